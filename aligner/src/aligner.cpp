@@ -0,0 +1,513 @@
+/*
+  _____ _ _ _                    _             _
+ |  ___(_) | |_ ___ _ __   _ __ | |_   _  __ _(_)_ __
+ | |_  | | | __/ _ \ '__| | '_ \| | | | |/ _` | | '_ \
+ |  _| | | | ||  __/ |    | |_) | | |_| | (_| | | | | |
+ |_|   |_|_|\__\___|_|    | .__/|_|\__,_|\__, |_|_| |_|
+                          |_|            |___/
+# A Template for AlignerPlugin, a Filter Plugin
+# Generated by the command: C:\Program Files\MADS\usr\local\bin\mads-plugin.exe -t filter -d C:\mirrorworld\instrumented_crutches_mads\aligner aligner
+# Hostname: unknown
+# Current working directory: C:\mirrorworld\instrumented_crutches_mads
+# Creation date: 2026-10-14T17:52:11.305+0200
+# NOTICE: MADS Version 2.0.0
+*/
+// Mandatory included headers
+#include <filter.hpp>
+#include <nlohmann/json.hpp>
+#include <pugg/Kernel.h>
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <limits>
+#include <clock_offset.hpp>
+#include <command.hpp>
+#include <heartbeat.hpp>
+#include <sample_aligner.hpp>
+#include <sample_reader.hpp>
+
+// other includes as needed here
+
+// Define the name of the plugin
+#ifndef PLUGIN_NAME
+#define PLUGIN_NAME "aligner"
+#endif
+
+// Load the namespaces
+using namespace std;
+using json = nlohmann::json;
+using sample_aligner::Sample;
+using sample_aligner::max_channels;
+static_assert(max_channels == sample_reader::max_channels, "a handle message must fit in an aligned sample");
+
+
+// Plugin class. This shall be the only part that needs to be modified,
+// implementing the actual functionality
+class AlignerPlugin : public Filter<json, json> {
+
+public:
+
+  // Typically, no need to change this
+  string kind() override { return PLUGIN_NAME; }
+
+  // Implement the actual functionality here
+  // Return types:
+  // return_type::success: processing is valid, go to process
+  // return_type::retry: skip processing go to next loop
+  // return_type::warning: content of _error is tracked with register_event
+  // return_type::error: _error is traced, skip process
+  // return_type::critical: execution stops
+  return_type load_data(json const &input, string topic = "", vector<unsigned char> const *blob = nullptr) override {
+
+    // if topic contains the "command" field, process commands here
+    if (input.contains("command")) {
+
+      const command::Code action = command::decode(input); // the code, or the name, see command.hpp
+      if (action == command::Code::start) {
+        restart();
+        _recording = true;
+      } else if (action == command::Code::stop && _recording) {
+        // release everything, the jitter buffers included, and the partial messages
+        advance(numeric_limits<int64_t>::max());
+        for (size_t side = 0; side < 2; ++side) {
+          for (size_t sensor = 0; sensor < 2; ++sensor) {
+            emit_stream(side, sensor);
+          }
+        }
+        emit_matrix();
+        _recording = false;
+      }
+      return return_type::success;
+    }
+
+    const int side = side_index(input.value("side", ""));
+    if (side < 0) {
+      return return_type::success;
+    }
+
+    // clock offset of each crutch from the master, estimated by its sync_handler
+    if (topic == "sync_handler") {
+      if (input.contains("info") && input["info"].contains("offset_ms")) {
+        _offset_us[side] = static_cast<int64_t>(input["info"]["offset_ms"].get<double>() * 1000.0);
+      }
+      return return_type::success;
+    }
+
+    const int sensor = topic == "tip_loadcell" ? tip : (topic == "handle_loadcell" ? handle : -1);
+    if (!_recording || sensor < 0 ||
+        (!input.contains("force") && !(input.contains("frame") && blob != nullptr))) {
+      return return_type::success;
+    }
+
+    // publishing time of the message, on the system clock of the crutch
+    int64_t published_ms = 0;
+    const json &timestamp = input.contains("timestamp") ? input["timestamp"] : json();
+    const auto date = timestamp.is_object() ? timestamp.find("$date") : timestamp.end();
+    if (date == timestamp.end() || !date->is_string() ||
+        !clock_offset::parse_iso8601_ms(date->get_ref<const string &>().data(),
+                                        date->get_ref<const string &>().size(), published_ms)) {
+      _error = topic + " message without a valid timestamp, ignored";
+      return return_type::warning;
+    }
+    const int64_t published_us = published_ms * 1000;
+
+    // readings with their monotonic time, otherwise stamped at publishing
+    const sample_reader::Status status = _reader.read(input, blob, uint64_t(published_us));
+    if (status == sample_reader::Status::raw) {
+      return return_type::success; // raw ADC counts are not aligned
+    }
+    if (status != sample_reader::Status::ok || !set_labels(side, sensor)) {
+      _error = topic + " of " + side_names[side] + " " +
+               (status == sample_reader::Status::ok ? string("channels not in handle_labels") : _reader.error()) +
+               ", message ignored";
+      return return_type::warning;
+    }
+    Channel &channel = _channels[side][sensor];
+    const bool stamped = _reader.stamped();
+    _scratch.clear();
+    for (size_t i = 0; i < _reader.count(); ++i) {
+      Sample sample;
+      sample.t_us = static_cast<int64_t>(_reader.t_us(i));
+      for (size_t c = 0; c < _reader.channels(); ++c) {
+        sample.values[channel.column[c]] = static_cast<float>(_reader.value(i, c));
+      }
+      _scratch.push_back(sample);
+    }
+
+    if (_scratch.empty()) {
+      return return_type::success;
+    }
+
+    // monotonic time of the crutch -> its system time -> system time of the master
+    if (stamped) {
+      channel.clock.add(published_us, _scratch.back().t_us);
+    }
+    for (Sample &sample : _scratch) {
+      if (stamped) {
+        sample.t_us = channel.clock.to_system(sample.t_us);
+      }
+      sample.t_us -= _offset_us[side];
+      channel.stream.insert(sample);
+    }
+
+    advance(system_clock_us() - _delay_us);
+    return return_type::success;
+  }
+
+  // One message per batch of aligned samples, plus the periodic agent_status
+  // Return types:
+  // return_type::success: result is published
+  // return_type::retry: don't publish, go to next loop
+  // return_type::warning: content of _error is added to result befor publishing
+  // return_type::error: _error is traced via register_event, don't publish
+  // return_type::critical: execution stops
+  return_type process(json &out, vector<unsigned char> *blob = nullptr) override {
+    out.clear();
+
+    // Send agent_status if no batch to send and the heartbeat is due
+    if (!_pending.empty()) {
+
+      out = std::move(_pending.front());
+      _pending.pop();
+
+    } else if (_heartbeat.due(_recording)) {
+
+      out["agent_status"] = _recording ? "recording" : "idle";
+      unsigned long late = 0, overflow = 0;
+      for (size_t side = 0; side < 2; ++side) {
+        out["info"]["offset_ms"][side_names[side]] = _offset_us[side] / 1000.0;
+        for (size_t sensor = 0; sensor < 2; ++sensor) {
+          late += _channels[side][sensor].stream.late();
+          overflow += _channels[side][sensor].stream.overflow();
+        }
+      }
+      out["info"]["late"] = late;
+      if (overflow > 0) {
+        out["info"]["overflow"] = overflow;
+      }
+      if (_pending.dropped() > 0) {
+        out["info"]["dropped"] = _pending.dropped();
+      }
+      _heartbeat.sent(_recording);
+
+    } else {
+      // if there is no batch to send and not enough time has passed, don't send anything
+      return return_type::retry;
+    }
+
+    // This sets the agent_id field in the output json object, only when it is
+    // not empty
+    if (!_agent_id.empty()) out["agent_id"] = _agent_id;
+    return return_type::success;
+  }
+
+  void set_params(const json &params) override {
+    // Call the parent class method to set the common parameters
+    // (e.g. agent_id, etc.)
+    Filter::set_params(params);
+
+    // then merge the defaults with the actually provided parameters
+    // params needs to be cast to json
+    _params.merge_patch(params);
+
+    _heartbeat.configure(_params); // health_status_period, default to 500 ms, and health_status_mode
+    const double rate = _params.value("rate", 100.0); // rows per second of the aligned matrix
+    if (rate <= 0.0) {
+      _error = "rate must be greater than zero.";
+      throw std::runtime_error(_error);
+    }
+    _period_us = static_cast<int64_t>(1e6 / rate);
+    _delay_us = static_cast<int64_t>(_params.value("delay", 200.0) * 1000.0); // ms, jitter buffer
+    _hold_us = static_cast<int64_t>(_params.value("hold", 100.0) * 1000.0); // ms, last value kept on a gap
+    _samples_per_message = max(1, _params.value("samples_per_message", 50));
+    // columns of the handle channels in the messages and the matrix, on both sides
+    _handle_labels = _params.value("handle_labels", default_handle_labels);
+    if (_handle_labels.size() > max_channels) {
+      _error = "handle_labels must have at most " + to_string(max_channels) + " labels.";
+      throw std::runtime_error(_error);
+    }
+    restart();
+  }
+
+  // Implement this method if you want to provide additional information
+  map<string, string> info() override {
+    // return a map of strings with additional information about the plugin
+    // it is used to print the information about the plugin when it is loaded
+    // by the agent
+
+    return {
+      {"Rate", json(_params.value("rate", 100.0)).dump() + " Hz"},
+      {"Delay", json(_params.value("delay", 200.0)).dump() + " ms"},
+      {"Samples per message", to_string(_samples_per_message)}
+    };
+
+  };
+
+private:
+
+  enum { tip = 0, handle = 1 };
+  static constexpr const char *side_names[2] = {"left", "right"};
+  static constexpr const char *sensor_names[2] = {"tip", "handle"};
+  static constexpr size_t max_pending = 64;
+  static constexpr size_t stream_capacity = 4096; // samples in a jitter buffer
+  static constexpr size_t matrix_width = 2 * (1 + max_channels); // tip and handle of each side
+  // the labels of the standard input_map of the handles, alphabetical
+  inline static const vector<string> default_handle_labels = {
+    "down_back", "down_front", "ext_back", "ext_front", "int_back", "int_front", "up_back", "up_front"};
+
+  // One load cell of one crutch
+  struct Channel {
+    bool configured = false;
+    vector<string> labels; // in the order of the messages, empty for the unlabelled channel of the tip load cell
+    array<size_t, max_channels> column{}; // position in handle_labels of each channel of the messages
+    sample_aligner::ClockMap<64> clock;
+    sample_aligner::Stream stream;
+    vector<int64_t> t_us; // released samples not yet published
+    vector<vector<float>> force;
+  };
+
+  static int side_index(const string &side) {
+    return side == "left" ? 0 : (side == "right" ? 1 : -1);
+  }
+
+  static int64_t system_clock_us() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::system_clock::now().time_since_epoch()).count();
+  }
+
+  void restart() {
+    for (auto &side : _channels) {
+      for (auto &channel : side) {
+        channel.configured = false;
+        channel.clock.reset();
+        channel.stream.reset(1, stream_capacity);
+        channel.t_us.clear();
+        channel.force.clear();
+      }
+    }
+    _next_row_us = 0;
+    _rows_t_us.clear();
+    _rows.clear();
+    _pending.reset();
+  }
+
+  // Check the channel labels of the message read against the stream, a change restarts the stream.
+  // Handle channels are stored at the position of their label in handle_labels, the same on both
+  // sides whatever their order in the messages, and those not connected stay at 0.
+  bool set_labels(size_t side, size_t sensor) {
+    Channel &channel = _channels[side][sensor];
+    if (channel.configured && channel.labels == _reader.labels()) {
+      return true;
+    }
+    if (sensor == tip) {
+      if (_reader.channels() != 1) {
+        return false;
+      }
+      channel.column[0] = 0;
+    } else {
+      if (_reader.labels().empty()) {
+        return false;
+      }
+      for (size_t c = 0; c < _reader.labels().size(); ++c) {
+        const auto label = std::find(_handle_labels.begin(), _handle_labels.end(), _reader.labels()[c]);
+        if (label == _handle_labels.end()) {
+          return false;
+        }
+        channel.column[c] = label - _handle_labels.begin();
+      }
+    }
+    emit_stream(side, sensor);
+    channel.labels = _reader.labels();
+    channel.stream.reset(sensor == tip ? 1 : max_channels, stream_capacity);
+    channel.clock.reset();
+    channel.configured = true;
+    return true;
+  }
+
+  // Release the samples older than the watermark and resample them on the common grid
+  void advance(int64_t watermark_us) {
+    int64_t first_us = numeric_limits<int64_t>::max();
+    int64_t last_us = numeric_limits<int64_t>::min();
+    int64_t end_us = watermark_us;
+    for (size_t side = 0; side < 2; ++side) {
+      for (size_t sensor = 0; sensor < 2; ++sensor) {
+        Channel &channel = _channels[side][sensor];
+        if (channel.stream.empty()) {
+          continue;
+        }
+        first_us = min(first_us, channel.stream.first_us());
+        last_us = max(last_us, channel.stream.last_us());
+        // a stream behind the watermark is waited for, up to the hold time
+        end_us = min(end_us, max(channel.stream.last_us(), watermark_us - _hold_us));
+        channel.stream.release(watermark_us, [&](const Sample &sample) {
+          channel.t_us.push_back(sample.t_us);
+          channel.force.emplace_back(sample.values.begin(), sample.values.begin() + channel.stream.channels());
+          if (channel.t_us.size() >= size_t(_samples_per_message)) {
+            emit_stream(side, sensor);
+          }
+        });
+      }
+    }
+    if (first_us == numeric_limits<int64_t>::max()) {
+      return; // no sample yet
+    }
+
+    // the grid starts at the first multiple of the period after the first released sample
+    end_us = min(end_us, last_us);
+    if (_next_row_us == 0 && first_us <= end_us) {
+      _next_row_us = (first_us / _period_us + 1) * _period_us;
+    } else if (_next_row_us == 0) {
+      return;
+    }
+    array<float, max_channels> values;
+    while (_next_row_us <= end_us) {
+      _rows_t_us.push_back(_next_row_us);
+      for (size_t side = 0; side < 2; ++side) {
+        for (size_t sensor = 0; sensor < 2; ++sensor) {
+          _channels[side][sensor].stream.value_at(_next_row_us, _hold_us, values.data());
+          _rows.insert(_rows.end(), values.begin(), values.begin() + (sensor == tip ? 1 : max_channels));
+        }
+      }
+      _next_row_us += _period_us;
+      if (_rows_t_us.size() >= size_t(_samples_per_message)) {
+        emit_matrix();
+      }
+    }
+  }
+
+  // Queue the released samples of one load cell, on the common timebase
+  void emit_stream(size_t side, size_t sensor) {
+    Channel &channel = _channels[side][sensor];
+    if (channel.t_us.empty()) {
+      return;
+    }
+    json out;
+    out["side"] = side_names[side];
+    out["samples"] = channel.t_us.size();
+    out[sensor_names[sensor]]["t_us"] = channel.t_us;
+    if (sensor == tip) {
+      json &force = out[sensor_names[sensor]]["force"] = json::array();
+      for (const auto &row : channel.force) {
+        force.push_back(row[0]);
+      }
+    } else {
+      out[sensor_names[sensor]]["force"] = channel.force;
+    }
+    queue(std::move(out));
+    channel.t_us.clear();
+    channel.force.clear();
+  }
+
+  // Queue the rows of the aligned matrix
+  void emit_matrix() {
+    if (_rows_t_us.empty()) {
+      return;
+    }
+    json out;
+    out["samples"] = _rows_t_us.size();
+    out["t_us"] = _rows_t_us;
+    json &matrix = out["matrix"] = json::array();
+    for (size_t r = 0; r < _rows_t_us.size(); ++r) {
+      matrix.push_back(vector<float>(_rows.begin() + r * matrix_width, _rows.begin() + (r + 1) * matrix_width));
+    }
+    queue(std::move(out));
+    _rows_t_us.clear();
+    _rows.clear();
+  }
+
+  void queue(json &&out) {
+    _pending.push(std::move(out));
+  }
+
+  Heartbeat _heartbeat; // schedules the agent_status messages
+
+  // Define the fields that are used to store internal resources
+  bool _recording = false;
+  int64_t _period_us = 10000;
+  int64_t _delay_us = 200000;
+  int64_t _hold_us = 100000;
+  int _samples_per_message = 50;
+  vector<string> _handle_labels = default_handle_labels;
+  array<array<Channel, 2>, 2> _channels; // by side and load cell
+  array<int64_t, 2> _offset_us{}; // system clock of each crutch minus the one of the master
+  sample_reader::Reader _reader; // samples of the message being loaded
+  vector<Sample> _scratch; // the same, on the clock of the crutch
+  int64_t _next_row_us = 0; // time of the next row of the matrix, 0 before the first sample
+  vector<int64_t> _rows_t_us;
+  vector<float> _rows; // matrix_width values per row
+  sample_reader::Pending<json> _pending{max_pending}; // batches not yet published
+
+};
+
+
+/*
+  ____  _             _             _      _
+ |  _ \| |_   _  __ _(_)_ __     __| |_ __(_)_   _____ _ __
+ | |_) | | | | |/ _` | | '_ \   / _` | '__| \ \ / / _ \ '__|
+ |  __/| | |_| | (_| | | | | | | (_| | |  | |\ V /  __/ |
+ |_|   |_|_|\__,_|\__, |_|_| |_|  \__,_|_|  |_| \_/ \___|_|
+                |___/
+Enable the class as plugin
+*/
+INSTALL_FILTER_DRIVER(AlignerPlugin, json, json);
+
+
+/*
+                  _
+  _ __ ___   __ _(_)_ __
+ | '_ ` _ \ / _` | | '_ \
+ | | | | | | (_| | | | | |
+ |_| |_| |_|\__,_|\__, |_|
+
+*/
+
+int main(int argc, char const *argv[])
+{
+  AlignerPlugin plugin;
+  json params;
+  json input, output;
+
+  // Set example values to params
+  params["rate"] = 100.0;
+  params["samples_per_message"] = 10;
+
+  // Set the parameters
+  plugin.set_params(params);
+
+  input["command"] = "start";
+  plugin.load_data(input, "coordinator");
+
+  // The sync_handler of the right crutch finds its clock 3 ms ahead of the master
+  input.clear();
+  input["side"] = "right";
+  input["info"]["offset_ms"] = 3.0;
+  plugin.load_data(input, "sync_handler");
+
+  // Emulate 100 ms of the same force on the two tip load cells at 80 Hz, the right published 3 ms later
+  const int64_t start_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+    std::chrono::system_clock::now().time_since_epoch()).count();
+  for (int i = 0; i < 8; ++i) {
+    for (const string side : {"left", "right"}) {
+      const int64_t published_ms = start_ms + i * 13 + (side == "right" ? 3 : 0);
+      const time_t seconds = published_ms / 1000;
+      char date[32];
+      strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S", gmtime(&seconds));
+      input.clear();
+      input["timestamp"]["$date"] = string(date) + "." + to_string(1000 + published_ms % 1000).substr(1) + "Z";
+      input["side"] = side;
+      input["force"] = 10.0 * i;
+      input["t_us"] = uint64_t(i) * 12500;
+      plugin.load_data(input, "tip_loadcell");
+    }
+  }
+
+  input.clear();
+  input["command"] = "stop";
+  plugin.load_data(input, "coordinator");
+  while (plugin.process(output) == return_type::success && !output.contains("agent_status")) {
+    cout << "Output: " << output.dump() << endl;
+  }
+
+  return 0;
+}
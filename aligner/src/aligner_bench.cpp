@@ -0,0 +1,49 @@
+/*
+  ____                  _
+ | __ )  ___ _ __   ___| |__
+ |  _ \ / _ \ '_ \ / __| '_ \
+ | |_) |  __/ | | | (__| | | |
+ |____/ \___|_| |_|\___|_| |_|
+
+Per-message cost of the aligner: the tips at 2x200 Hz and the 8-channel
+handles at 2x100 Hz during a recording, with the offsets of the two
+sync_handlers, see common/bench.hpp
+*/
+#define main aligner_main
+#include "aligner.cpp"
+#undef main
+
+#include <bench.hpp>
+
+int main(int argc, char const *argv[]) {
+  bench::Bench bench("aligner", argc, argv, {
+    {"health_status_period", 500},
+    {"rate", 100.0},
+    {"delay", 200.0},
+    {"hold", 100.0},
+    {"samples_per_message", 50}
+  });
+
+  AlignerPlugin plugin;
+  plugin.set_params(bench.params());
+  bench.once("start", [&] { plugin.load_data({{"command", "start"}, {"id", 1}}, "coordinator"); });
+
+  bench::crutch_streams(bench);
+  for (const string side : {"left", "right"}) {
+    bench.stream("sync_" + side, "sync_handler", 1.0, [side](uint64_t, bench::Message &m) {
+      bench::heartbeat(m, "sync_handler", "synchronized", side);
+      m.payload["info"]["offset_ms"] = side == "left" ? 1.5 : -2.0;
+    }, side == "left" ? 0.1 : 0.6);
+  }
+  bench.stream("coordinator", 2.0, [](uint64_t, bench::Message &m) {
+    bench::heartbeat(m, "coordinator", "recording");
+  });
+  bench.run(plugin);
+
+  bench.once("stop", [&] {
+    json out;
+    plugin.load_data({{"command", "stop"}}, "coordinator");
+    plugin.process(out);
+  });
+  return 0;
+}
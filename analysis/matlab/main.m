@@ -122,8 +122,7 @@ end
 
 
 function plot_group(filename, groupPath, groupName, idx, outputDir, csvOutputDir, coordinatorLabels, coordinatorTimestamps, config)
-datasets = h5info(filename, groupPath).Datasets;
-datasetNames = string({datasets.Name});
+datasetNames = signal_dataset_names(filename, groupPath);
 
 timestampName = find_first(datasetNames, ["timestamp", "timsestamp"]);
 sideName = find_first(datasetNames, "side");
@@ -251,8 +250,7 @@ tipTimestampName = find_first(tipDatasetNames, ["timestamp", "timsestamp"]);
 tipSideName = find_first(tipDatasetNames, "side");
 tipForceName = find_first(tipDatasetNames, "force");
 
-handleDatasets = h5info(filename, handleGroupPath).Datasets;
-handleDatasetNames = string({handleDatasets.Name});
+handleDatasetNames = signal_dataset_names(filename, handleGroupPath);
 handleTimestampName = find_first(handleDatasetNames, ["timestamp", "timsestamp"]);
 handleSideName = find_first(handleDatasetNames, "side");
 handleForceName = find_first(handleDatasetNames, "force.up_back");
@@ -359,8 +357,7 @@ end
 
 
 function plot_handle_loadcell_pairs(filename, groupPath, idx, outputDir, csvOutputDir, timestampsRaw, timeSeconds, sides, leftColor, rightColor, coordinatorLabels, coordinatorTimestamps, tsAll, timingInfo)
-datasets = h5info(filename, groupPath).Datasets;
-datasetNames = string({datasets.Name});
+datasetNames = signal_dataset_names(filename, groupPath);
 
 pairs = [
     "up", "force.up_front", "force.up_back";
@@ -457,8 +454,47 @@ end
 end
 
 
+function names = signal_dataset_names(filename, groupPath)
+% Dataset names of a group, a multi-channel dataset with a "columns"
+% attribute (e.g. handle_loadcell/force) is listed as name.column
+datasets = h5info(filename, groupPath).Datasets;
+names = strings(0, 1);
+for i = 1:numel(datasets)
+    columns = dataset_columns(datasets(i));
+    if isempty(columns)
+        names(end + 1, 1) = string(datasets(i).Name); %#ok<AGROW>
+    else
+        names = [names; string(datasets(i).Name) + "." + columns(:)]; %#ok<AGROW>
+    end
+end
+end
+
+
+function columns = dataset_columns(dataset)
+columns = strings(0, 1);
+if isempty(dataset.Attributes)
+    return
+end
+idx = find(string({dataset.Attributes.Name}) == "columns", 1, 'first');
+if ~isempty(idx)
+    columns = string(dataset.Attributes(idx).Value);
+end
+end
+
+
 function values = read_dataset_1d(filename, path)
-raw = h5read(filename, path);
+% A path name.column that is not a dataset is a column of the dataset name
+try
+    raw = h5read(filename, path);
+catch
+    full = char(path);
+    dot = find(full == '.', 1, 'last');
+    datasetPath = string(full(1:dot - 1));
+    columns = string(h5readatt(filename, datasetPath, "columns"));
+    raw = h5read(filename, datasetPath);
+    % MATLAB reverses the dimensions: the N x C dataset is read as C x N
+    raw = raw(columns == string(full(dot + 1:end)), :);
+end
 values = raw(:);
 end
 
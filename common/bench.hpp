@@ -0,0 +1,549 @@
+/*
+  ____                  _
+ | __ )  ___ _ __   ___| |__
+ |  _ \ / _ \ '_ \ / __| '_ \
+ | |_) |  __/ | | | (__| | | |
+ |____/ \___|_| |_|\___|_| |_|
+
+Replay of message streams through a filter plugin, with latency and
+allocation statistics, header only
+*/
+
+#ifndef BENCH_HPP
+#define BENCH_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <limits>
+#include <new>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <filter.hpp>
+#include <nlohmann/json.hpp>
+
+// The global operator new is replaced to count the allocations, so this
+// header must be included by a single source file of the bench executable.
+// The counters include the allocations of all the threads of the plugin.
+namespace bench {
+inline std::atomic<uint64_t> allocations{0};
+inline std::atomic<uint64_t> allocated_bytes{0};
+} // namespace bench
+
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete" // malloc and free behind new and delete
+#endif
+void *operator new(std::size_t size) {
+  bench::allocations.fetch_add(1, std::memory_order_relaxed);
+  bench::allocated_bytes.fetch_add(size, std::memory_order_relaxed);
+  if (void *p = std::malloc(size ? size : 1)) {
+    return p;
+  }
+  throw std::bad_alloc();
+}
+void *operator new[](std::size_t size) { return ::operator new(size); }
+void operator delete(void *p) noexcept { std::free(p); }
+void operator delete[](void *p) noexcept { std::free(p); }
+void operator delete(void *p, std::size_t) noexcept { std::free(p); }
+void operator delete[](void *p, std::size_t) noexcept { std::free(p); }
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+
+namespace bench {
+
+using json = nlohmann::json;
+using clock = std::chrono::steady_clock;
+
+// A message delivered to load_data(). A message without topic is a call of
+// process() alone, as the periodic loop of a source agent.
+struct Message {
+  std::string topic;
+  json payload;
+  std::vector<unsigned char> blob;
+};
+
+// Clocks of the synthetic messages: the time of the event being sent, in
+// seconds of the run, on the steady and system clocks of its start. The
+// messages are stamped with it instead of the current time, so that a run
+// back to back carries the same readings as a paced one.
+struct VirtualClock {
+  clock::time_point steady = clock::now();
+  std::chrono::system_clock::time_point system = std::chrono::system_clock::now();
+  double t = 0.0;
+};
+
+inline VirtualClock &virtual_clock() {
+  static VirtualClock instance;
+  return instance;
+}
+
+// Latencies and allocations of the events of one stream
+struct Stats {
+  std::vector<int64_t> latency_ns;
+  uint64_t allocations = 0;
+  uint64_t max_allocations = 0;
+  uint64_t bytes = 0;
+  uint64_t published = 0;
+  uint64_t retries = 0;
+  uint64_t errors = 0;
+
+  size_t events() const { return latency_ns.size(); }
+
+  void add(int64_t ns, uint64_t allocs, uint64_t b, return_type loaded, bool published_now) {
+    latency_ns.push_back(ns);
+    allocations += allocs;
+    max_allocations = std::max(max_allocations, allocs);
+    bytes += b;
+    published += published_now;
+    retries += loaded == return_type::retry;
+    errors += loaded == return_type::error || loaded == return_type::critical;
+  }
+
+  // Nearest-rank percentile of the sorted latencies, in µs
+  double percentile_us(double p) const {
+    if (latency_ns.empty()) {
+      return NAN;
+    }
+    const size_t rank = static_cast<size_t>(std::ceil(p / 100.0 * double(latency_ns.size())));
+    return latency_ns[std::min(std::max<size_t>(rank, 1), latency_ns.size()) - 1] / 1000.0;
+  }
+};
+
+// Swallows the console output of the plugins while they are measured
+class Quiet {
+public:
+  explicit Quiet(bool enabled) : _saved(enabled ? std::cout.rdbuf(&_null) : nullptr) {}
+  ~Quiet() {
+    if (_saved) {
+      std::cout.rdbuf(_saved);
+    }
+  }
+
+private:
+  struct NullBuffer : std::streambuf {
+    std::streamsize xsputn(const char *, std::streamsize n) override { return n; }
+    int overflow(int c) override { return traits_type::not_eof(c); }
+  };
+  NullBuffer _null;
+  std::streambuf *_saved;
+};
+
+// Drives a Filter<json, json> plugin with periodic synthetic streams, or with
+// a recording, and reports the throughput, the latency percentiles and the
+// allocations of each event. An event is a load_data() followed, when the
+// message is accepted, by a process(), as the MADS filter agent does, or a
+// process() alone for the periodic streams without topic.
+//
+// Command line, common to all the benches:
+//   -d, --duration <s>   length of the run, default 10 s
+//   -f, --fast           no pacing: events back to back, for the capacity. The
+//                        messages keep their times, shifted to end at the
+//                        start of the run, as if they came already delayed
+//   -r, --replay <file>  JSON lines {"t": s, "topic": ..., "payload": {...}},
+//                        replacing the synthetic streams with a topic
+//   -o <key>=<value>     plugin parameter, the value is parsed as json
+//   -v, --verbose        keep the console output of the plugin
+class Bench {
+public:
+  Bench(const std::string &name, int argc, char const *argv[], json params = json::object())
+      : _name(name), _params(std::move(params)) {
+    for (int i = 1; i < argc; ++i) {
+      const std::string arg = argv[i];
+      const bool has_value = i + 1 < argc;
+      if ((arg == "-d" || arg == "--duration") && has_value) {
+        _duration = std::atof(argv[++i]);
+        _duration_set = true;
+      } else if (arg == "-f" || arg == "--fast") {
+        _fast = true;
+      } else if ((arg == "-r" || arg == "--replay") && has_value) {
+        _replay_path = argv[++i];
+      } else if (arg == "-o" && has_value) {
+        const std::string option = argv[++i];
+        const size_t eq = option.find('=');
+        if (eq == std::string::npos) {
+          usage("invalid option " + option);
+        }
+        const std::string value = option.substr(eq + 1);
+        json parsed = json::parse(value, nullptr, false);
+        _params[option.substr(0, eq)] = parsed.is_discarded() ? json(value) : parsed;
+      } else if (arg == "-v" || arg == "--verbose") {
+        _verbose = true;
+      } else {
+        usage(arg == "-h" || arg == "--help" ? "" : "unknown argument " + arg);
+      }
+    }
+  }
+
+  // Plugin parameters: the defaults of the bench with the -o overrides
+  const json &params() const { return _params; }
+  bool fast() const { return _fast; }
+
+  // Add a periodic stream of messages on topic, make(n, message) fills the
+  // n-th one. The first message is sent at phase seconds.
+  void stream(const std::string &topic, double rate_hz,
+              std::function<void(uint64_t n, Message &message)> make, double phase = 0.0) {
+    stream(topic, topic, rate_hz, std::move(make), phase);
+  }
+
+  // Same, reported under its own name, for several streams on one topic
+  void stream(const std::string &name, const std::string &topic, double rate_hz,
+              std::function<void(uint64_t n, Message &message)> make, double phase = 0.0) {
+    _streams.push_back({name, topic, rate_hz, phase, std::move(make)});
+  }
+
+  // Add a periodic call of process() alone
+  void tick(const std::string &name, double rate_hz) {
+    _streams.push_back({name, "", rate_hz, 0.0, nullptr});
+  }
+
+  // Measure a single call, e.g. the start or stop of a recording
+  template <typename F> void once(const std::string &what, F &&call) {
+    uint64_t allocs;
+    int64_t ns;
+    {
+      Quiet quiet(!_verbose);
+      const uint64_t a0 = allocations.load(std::memory_order_relaxed);
+      const auto t0 = clock::now();
+      call();
+      ns = std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - t0).count();
+      allocs = allocations.load(std::memory_order_relaxed) - a0;
+    }
+    std::printf("%-22s %10.1f us, %llu allocations\n", what.c_str(), ns / 1000.0,
+                (unsigned long long)allocs);
+  }
+
+  // Run the streams through the plugin and print the report
+  void run(Filter<json, json> &plugin) {
+    std::ifstream replay;
+    if (!_replay_path.empty()) {
+      replay.open(_replay_path);
+      if (!replay) {
+        usage("cannot read " + _replay_path);
+      }
+    }
+    double end = _replay_path.empty() || _duration_set ? _duration
+                                                       : std::numeric_limits<double>::infinity();
+
+    // the streams with a topic are replaced by the recording
+    std::vector<Source> sources;
+    for (auto &s : _streams) {
+      if (!replay.is_open() || s.topic.empty()) {
+        sources.push_back({&s, 0, s.phase});
+      }
+    }
+    std::vector<Stats> stats(sources.size());
+    for (size_t i = 0; i < sources.size(); ++i) {
+      if (std::isfinite(end)) {
+        stats[i].latency_ns.reserve(size_t(sources[i].stream->rate_hz * end) + 16);
+      }
+    }
+    std::vector<std::string> replay_topics;
+    std::vector<Stats> replay_stats;
+    Message replayed;
+    double replay_t = next_replay(replay, replayed);
+
+    Message message;
+    json out;
+    std::vector<unsigned char> out_blob;
+    uint64_t events = 0;
+    int64_t busy_ns = 0;
+    std::printf("%s: %s%s, %s\n", _name.c_str(),
+                replay.is_open() ? ("replay of " + _replay_path).c_str() : "synthetic streams",
+                std::isfinite(end) ? (" for " + format("%.1f s", end)).c_str() : "",
+                _fast ? "back to back" : "paced at the stream rates");
+    std::fflush(stdout);
+
+    double elapsed;
+    {
+      Quiet quiet(!_verbose);
+      const auto start = clock::now();
+      const auto shift = std::chrono::duration_cast<clock::duration>(
+          std::chrono::duration<double>(_fast && std::isfinite(end) ? end : 0.0));
+      virtual_clock().steady = start - shift;
+      virtual_clock().system = std::chrono::system_clock::now() -
+                               std::chrono::duration_cast<std::chrono::system_clock::duration>(shift);
+      while (true) {
+        // the next event in time, from a stream or the recording
+        size_t next = sources.size();
+        double t = replay_t;
+        for (size_t i = 0; i < sources.size(); ++i) {
+          if (sources[i].t < t) {
+            t = sources[i].t;
+            next = i;
+          }
+        }
+        if (replay.is_open() && !std::isfinite(replay_t)) {
+          end = std::min(end, _replay_last); // end of the recording, the ticks stop too
+        }
+        if (!(t < end)) {
+          break;
+        }
+
+        Stats *s;
+        Message *m;
+        if (next < sources.size()) {
+          Source &source = sources[next];
+          m = &message;
+          m->topic = source.stream->topic;
+          m->payload = json();
+          m->blob.clear();
+          if (source.stream->make) {
+            virtual_clock().t = t;
+            source.stream->make(source.n, *m);
+          }
+          ++source.n;
+          source.t = source.stream->phase + double(source.n) / source.stream->rate_hz;
+          s = &stats[next];
+        } else {
+          m = &replayed;
+          const size_t index =
+              std::find(replay_topics.begin(), replay_topics.end(), m->topic) - replay_topics.begin();
+          if (index == replay_topics.size()) {
+            replay_topics.push_back(m->topic);
+            replay_stats.emplace_back();
+          }
+          s = &replay_stats[index];
+        }
+        if (!_fast) {
+          std::this_thread::sleep_until(start + std::chrono::duration_cast<clock::duration>(
+                                                    std::chrono::duration<double>(t)));
+        }
+
+        const uint64_t a0 = allocations.load(std::memory_order_relaxed);
+        const uint64_t b0 = allocated_bytes.load(std::memory_order_relaxed);
+        const auto t0 = clock::now();
+        return_type loaded = return_type::success;
+        bool published = false;
+        if (!m->topic.empty()) {
+          loaded = plugin.load_data(m->payload, m->topic, m->blob.empty() ? nullptr : &m->blob);
+        }
+        if (loaded == return_type::success || loaded == return_type::warning || m->topic.empty()) {
+          published = plugin.process(out, &out_blob) == return_type::success;
+        }
+        const int64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - t0).count();
+        s->add(ns, allocations.load(std::memory_order_relaxed) - a0,
+               allocated_bytes.load(std::memory_order_relaxed) - b0, loaded, published);
+        busy_ns += ns;
+        ++events;
+
+        if (next == sources.size()) {
+          replay_t = next_replay(replay, replayed);
+        }
+      }
+      elapsed = std::chrono::duration<double>(clock::now() - start).count();
+    }
+
+    std::printf("%-22s %8s %8s %8s %8s %9s %9s %9s %9s %8s %8s\n", "stream", "events",
+                "publish", "retry", "error", "p50 us", "p99 us", "p999 us", "max us", "alloc/ev",
+                "max");
+    Stats total;
+    for (size_t i = 0; i < sources.size(); ++i) {
+      print(sources[i].stream->name, stats[i], total);
+    }
+    for (size_t i = 0; i < replay_stats.size(); ++i) {
+      print(replay_topics[i], replay_stats[i], total);
+    }
+    if (stats.size() + replay_stats.size() > 1) {
+      print("total", total, total);
+    }
+    std::printf("%llu events in %.2f s: %.0f events/s, capacity %.0f events/s (%.1f%% busy), "
+                "%.0f bytes allocated per event\n",
+                (unsigned long long)events, elapsed, events / elapsed,
+                busy_ns > 0 ? events / (busy_ns * 1e-9) : 0.0, 100.0 * busy_ns * 1e-9 / elapsed,
+                events ? double(total.bytes) / events : 0.0);
+    std::fflush(stdout);
+  }
+
+private:
+  struct Stream {
+    std::string name;
+    std::string topic;
+    double rate_hz;
+    double phase;
+    std::function<void(uint64_t, Message &)> make;
+  };
+
+  struct Source {
+    const Stream *stream;
+    uint64_t n;
+    double t;
+  };
+
+  // Read the next message of the recording, returns its time or infinity
+  double next_replay(std::ifstream &replay, Message &message) {
+    std::string line;
+    while (replay.is_open() && std::getline(replay, line)) {
+      json record = json::parse(line, nullptr, false);
+      if (record.is_discarded() || !record.is_object() || !record.contains("topic") ||
+          !record.contains("payload")) {
+        continue;
+      }
+      message.topic = record["topic"].get<std::string>();
+      message.payload = std::move(record["payload"]);
+      message.blob.clear();
+      const double t = record.value("t", _replay_last);
+      _replay_last = std::max(_replay_last, t);
+      return _replay_last;
+    }
+    return std::numeric_limits<double>::infinity();
+  }
+
+  void print(const std::string &name, Stats &s, Stats &total) {
+    std::sort(s.latency_ns.begin(), s.latency_ns.end());
+    const double events = s.events() ? double(s.events()) : 1.0;
+    std::printf("%-22s %8zu %8llu %8llu %8llu %9.1f %9.1f %9.1f %9.1f %8.1f %8llu\n", name.c_str(),
+                s.events(), (unsigned long long)s.published, (unsigned long long)s.retries,
+                (unsigned long long)s.errors, s.percentile_us(50), s.percentile_us(99),
+                s.percentile_us(99.9), s.latency_ns.empty() ? NAN : s.latency_ns.back() / 1000.0,
+                s.allocations / events, (unsigned long long)s.max_allocations);
+    if (&s != &total) {
+      total.latency_ns.insert(total.latency_ns.end(), s.latency_ns.begin(), s.latency_ns.end());
+      total.allocations += s.allocations;
+      total.max_allocations = std::max(total.max_allocations, s.max_allocations);
+      total.bytes += s.bytes;
+      total.published += s.published;
+      total.retries += s.retries;
+      total.errors += s.errors;
+    }
+  }
+
+  static std::string format(const char *fmt, double value) {
+    char text[32];
+    std::snprintf(text, sizeof(text), fmt, value);
+    return text;
+  }
+
+  [[noreturn]] void usage(const std::string &error) {
+    if (!error.empty()) {
+      std::fprintf(stderr, "%s: %s\n", _name.c_str(), error.c_str());
+    }
+    std::fprintf(stderr,
+                 "Usage: %s_bench [-d seconds] [-f] [-r recording.jsonl] [-o key=value ...] [-v]\n",
+                 _name.c_str());
+    std::exit(error.empty() ? 0 : 1);
+  }
+
+  std::string _name;
+  json _params;
+  double _duration = 10.0;
+  bool _duration_set = false;
+  bool _fast = false;
+  bool _verbose = false;
+  std::string _replay_path;
+  double _replay_last = 0.0;
+  std::vector<Stream> _streams;
+};
+
+/*
+  __  __
+ |  \/  | ___  ___ ___  __ _  __ _  ___  ___
+ | |\/| |/ _ \/ __/ __|/ _` |/ _` |/ _ \/ __|
+ | |  | |  __/\__ \__ \ (_| | (_| |  __/\__ \
+ |_|  |_|\___||___/___/\__,_|\__, |\___||___/
+                             |___/
+Synthetic messages of the crutch agents
+*/
+
+// Labels of the handle channels, as in the input_map of templates/mads.ini
+inline const char *const handle_channels[8] = {"up_front",   "up_back",  "down_front",
+                                               "down_back",  "int_front", "int_back",
+                                               "ext_front",  "ext_back"};
+
+// Timestamp added by MADS to every message, the system time in ISO 8601, at
+// the virtual time of the message
+inline void stamp(json &message) {
+  const VirtualClock &vc = virtual_clock();
+  const auto now = vc.system + std::chrono::duration_cast<std::chrono::system_clock::duration>(
+                                   std::chrono::duration<double>(vc.t));
+  const std::time_t seconds = std::chrono::system_clock::to_time_t(now);
+  const long ms = long(std::chrono::duration_cast<std::chrono::milliseconds>(
+                           now.time_since_epoch()).count() % 1000);
+  std::tm utc;
+  gmtime_r(&seconds, &utc);
+  char date[40];
+  const size_t n = std::strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S", &utc);
+  std::snprintf(date + n, sizeof(date) - n, ".%03ld+0000", ms);
+  message["timestamp"]["$date"] = date;
+}
+
+// Tip force of a walk at one step per second: 600 ms of stance with a
+// half-sine of 300 N, then a swing with a few N of noise
+inline double gait_force(double t_s, double peak = 300.0) {
+  const double phase = t_s - std::floor(t_s);
+  const double noise = 2.0 * std::sin(t_s * 377.0) * std::cos(t_s * 91.0);
+  return phase < 0.6 ? peak * std::sin(3.14159265358979 * phase / 0.6) + noise : 2.0 + noise;
+}
+
+// Monotonic time of the crutch in us, at the virtual time of the message
+inline int64_t steady_us() {
+  const VirtualClock &vc = virtual_clock();
+  return std::chrono::duration_cast<std::chrono::microseconds>(vc.steady.time_since_epoch()).count() +
+         int64_t(std::llround(vc.t * 1e6));
+}
+
+// n-th reading of the tip load cell of a side, at rate_hz
+inline void tip_message(Message &m, const std::string &side, uint64_t n, double rate_hz) {
+  m.payload["force"] = gait_force(n / rate_hz);
+  m.payload["t_us"] = steady_us();
+  m.payload["side"] = side;
+  m.payload["agent_id"] = "tip_loadcell_" + side;
+  stamp(m.payload);
+}
+
+// n-th reading of the 8 channels of the handle of a side, at rate_hz
+inline void handle_message(Message &m, const std::string &side, uint64_t n, double rate_hz) {
+  const double force = gait_force(n / rate_hz, 200.0);
+  json &channels = m.payload["force"];
+  for (size_t c = 0; c < 8; ++c) {
+    channels[handle_channels[c]] = force * (0.05 + 0.1 * c);
+  }
+  m.payload["t_us"] = steady_us();
+  m.payload["side"] = side;
+  m.payload["agent_id"] = "handle_loadcell_" + side;
+  stamp(m.payload);
+}
+
+// Heartbeat of an agent, with the side when it has one
+inline void heartbeat(Message &m, const std::string &agent, const std::string &status,
+                      const std::string &side = "") {
+  m.payload["agent_status"] = status;
+  m.payload["agent_id"] = side.empty() ? agent : agent + "_" + side;
+  if (!side.empty()) {
+    m.payload["side"] = side;
+  }
+  stamp(m.payload);
+}
+
+// The load cells of the two crutches: the tips at 200 Hz and the 8-channel
+// handles at 100 Hz, interleaved as they arrive from the network
+inline void crutch_streams(Bench &bench, bool tips = true, bool handles = true) {
+  for (const std::string side : {"left", "right"}) {
+    const double phase = side == "left" ? 0.0 : 0.0025;
+    if (tips) {
+      bench.stream("tip_" + side, "tip_loadcell", 200.0, [side](uint64_t n, Message &m) {
+        tip_message(m, side, n, 200.0);
+      }, phase);
+    }
+    if (handles) {
+      bench.stream("handle_" + side, "handle_loadcell", 100.0, [side](uint64_t n, Message &m) {
+        handle_message(m, side, n, 100.0);
+      }, phase + 0.001);
+    }
+  }
+}
+
+} // namespace bench
+
+#endif // BENCH_HPP
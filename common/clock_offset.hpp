@@ -0,0 +1,156 @@
+/*
+   ____ _            _       ___   __  __          _
+  / ___| | ___   ___| | __  / _ \ / _|/ _|___  ___| |_
+ | |   | |/ _ \ / __| |/ / | | | | |_| |_/ __|/ _ \ __|
+ | |___| | (_) | (__|   <  | |_| |  _|  _\__ \  __/ |_
+  \____|_|\___/ \___|_|\_\  \___/|_| |_| |___/\___|\__|
+
+Timestamp parsing and clock offset estimation, header only
+*/
+
+#ifndef CLOCK_OFFSET_HPP
+#define CLOCK_OFFSET_HPP
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+
+namespace clock_offset {
+
+// Days from 1970-01-01 to the given date of the proleptic Gregorian calendar
+constexpr int64_t days_from_civil(int64_t y, unsigned m, unsigned d) {
+  y -= m <= 2;
+  const int64_t era = (y >= 0 ? y : y - 399) / 400;
+  const unsigned yoe = static_cast<unsigned>(y - era * 400);
+  const unsigned doy = (153 * (m > 2 ? m - 3 : m + 9) + 2) / 5 + d - 1;
+  const unsigned doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+  return era * 146097 + static_cast<int64_t>(doe) - 719468;
+}
+
+namespace detail {
+inline bool digits(const char *s, size_t n, int &value) {
+  value = 0;
+  for (size_t i = 0; i < n; ++i) {
+    if (s[i] < '0' || s[i] > '9') {
+      return false;
+    }
+    value = value * 10 + (s[i] - '0');
+  }
+  return true;
+}
+} // namespace detail
+
+// Parse a fixed-format ISO 8601 timestamp, as "2026-05-11T19:23:49.454+0100",
+// into ms since the Unix epoch. The fraction is optional and truncated to
+// ms, the zone is 'Z', ±HHMM or ±HH:MM. No allocation and no exception.
+inline bool parse_iso8601_ms(const char *s, size_t len, int64_t &epoch_ms) {
+  if (len < 20 || s[4] != '-' || s[7] != '-' || s[10] != 'T' || s[13] != ':' ||
+      s[16] != ':') {
+    return false;
+  }
+  int year, month, day, hour, minute, second;
+  if (!detail::digits(s, 4, year) || !detail::digits(s + 5, 2, month) ||
+      !detail::digits(s + 8, 2, day) || !detail::digits(s + 11, 2, hour) ||
+      !detail::digits(s + 14, 2, minute) || !detail::digits(s + 17, 2, second) ||
+      month < 1 || month > 12 || day < 1 || day > 31 || hour > 23 || minute > 59 ||
+      second > 60) {
+    return false;
+  }
+
+  size_t i = 19;
+  int ms = 0;
+  if (s[i] == '.') {
+    int scale = 100;
+    for (++i; i < len && s[i] >= '0' && s[i] <= '9'; ++i) {
+      ms += (s[i] - '0') * scale;
+      scale /= 10;
+    }
+  }
+
+  int zone_minutes = 0;
+  if (i < len && s[i] == 'Z') {
+    ++i;
+  } else if (i < len && (s[i] == '+' || s[i] == '-')) {
+    const int sign = s[i] == '-' ? -1 : 1;
+    int zh, zm;
+    const size_t mm = (i + 3 < len && s[i + 3] == ':') ? i + 4 : i + 3;
+    if (mm + 2 > len || !detail::digits(s + i + 1, 2, zh) || !detail::digits(s + mm, 2, zm)) {
+      return false;
+    }
+    zone_minutes = sign * (zh * 60 + zm);
+    i = mm + 2;
+  } else {
+    return false;
+  }
+  if (i != len) {
+    return false;
+  }
+
+  const int64_t seconds = days_from_civil(year, month, day) * 86400 + hour * 3600 +
+                          minute * 60 + second - zone_minutes * 60;
+  epoch_ms = seconds * 1000 + ms;
+  return true;
+}
+
+// Rolling median and median absolute deviation of the last `window` offsets,
+// at most N. The median rejects the occasional late message, the MAD is the
+// jitter. O(window) per sample on preallocated storage.
+template <size_t N> class OffsetEstimator {
+public:
+  void configure(size_t window) {
+    _window = std::min(std::max<size_t>(window, 1), N);
+    reset();
+  }
+
+  void reset() {
+    _count = 0;
+    _next = 0;
+    _median = 0.0;
+    _mad = 0.0;
+  }
+
+  void add(double offset_ms) {
+    _values[_next] = offset_ms;
+    _next = (_next + 1) % _window;
+    if (_count < _window) {
+      ++_count;
+    }
+    std::copy(_values.begin(), _values.begin() + _count, _scratch.begin());
+    _median = median_of(_count);
+    for (size_t i = 0; i < _count; ++i) {
+      _scratch[i] = std::fabs(_values[i] - _median);
+    }
+    _mad = median_of(_count);
+  }
+
+  size_t count() const { return _count; }
+  size_t window() const { return _window; }
+  double median() const { return _median; }
+  double mad() const { return _mad; }
+
+private:
+  // Median of the first n scratch values, reordering them
+  double median_of(size_t n) {
+    const auto begin = _scratch.begin();
+    const auto mid = begin + n / 2;
+    std::nth_element(begin, mid, begin + n);
+    if (n % 2 == 1) {
+      return *mid;
+    }
+    return 0.5 * (*mid + *std::max_element(begin, mid));
+  }
+
+  std::array<double, N> _values{};
+  std::array<double, N> _scratch{};
+  size_t _window = N;
+  size_t _count = 0;
+  size_t _next = 0;
+  double _median = 0.0;
+  double _mad = 0.0;
+};
+
+} // namespace clock_offset
+
+#endif // CLOCK_OFFSET_HPP
@@ -0,0 +1,152 @@
+/*
+   ____                                          _
+  / ___|___  _ __ ___  _ __ ___   __ _ _ __   __| |
+ | |   / _ \| '_ ` _ \| '_ ` _ \ / _` | '_ \ / _` |
+ | |__| (_) | | | | | | | | | | | (_| | | | | (_| |
+  \____\___/|_| |_| |_|_| |_| |_|\__,_|_| |_|\__,_|
+
+Command codes of the coordinator and their acknowledgement, header only
+*/
+
+#ifndef COMMAND_HPP
+#define COMMAND_HPP
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <nlohmann/json.hpp>
+#include <string>
+#include <string_view>
+
+// The commands of the coordinator carry both their name, for the web server
+// and the Python agents, and their code with a sequence number:
+// {"command": "start", "code": 1, "seq": 42, ...}. The C++ plugins dispatch
+// with a switch on command::decode(), an integer read instead of a chain of
+// string comparisons, and acknowledge the commands that change their state
+// with {"ack": {"seq", "code", "t_us"}} in their next message, where t_us is
+// the local wall clock when the command was applied. The status_handler
+// matches the acks of a seq to measure how much later each agent applied it.
+namespace command {
+
+enum class Code : uint8_t {
+  unknown,
+  start,
+  stop,
+  condition,
+  set_offset,
+  datetime_update,
+  get_agents_status,
+  pupil_neon_connect,
+  pupil_neon_disconnect
+};
+
+struct Entry {
+  std::string_view name;
+  Code code;
+};
+
+// In the order of the codes, checked at compile time below
+constexpr Entry table[] = {
+    {"", Code::unknown},
+    {"start", Code::start},
+    {"stop", Code::stop},
+    {"condition", Code::condition},
+    {"set_offset", Code::set_offset},
+    {"datetime_update", Code::datetime_update},
+    {"get_agents_status", Code::get_agents_status},
+    {"pupil_neon_connect", Code::pupil_neon_connect},
+    {"pupil_neon_disconnect", Code::pupil_neon_disconnect}};
+
+constexpr size_t count = sizeof(table) / sizeof(table[0]);
+
+constexpr bool table_in_order() {
+  for (size_t i = 0; i < count; ++i) {
+    if (static_cast<size_t>(table[i].code) != i) {
+      return false;
+    }
+  }
+  return true;
+}
+static_assert(table_in_order(), "command::table must list the codes in order");
+
+constexpr std::string_view name(Code code) {
+  return static_cast<size_t>(code) < count ? table[static_cast<size_t>(code)].name : std::string_view();
+}
+
+constexpr Code from_name(std::string_view name) {
+  for (size_t i = 1; i < count; ++i) {
+    if (table[i].name == name) {
+      return table[i].code;
+    }
+  }
+  return Code::unknown;
+}
+
+constexpr Code from_int(int64_t code) {
+  return code > 0 && code < int64_t(count) ? static_cast<Code>(code) : Code::unknown;
+}
+
+static_assert(from_name("set_offset") == Code::set_offset && name(Code::stop) == "stop",
+              "command::table lookups");
+
+// The command of a message: its code when present, else its name, else
+// Code::unknown (also for the messages without a command)
+inline Code decode(const nlohmann::json &input) {
+  auto code = input.find("code");
+  if (code != input.end() && code->is_number_integer()) {
+    return from_int(code->get<int64_t>());
+  }
+  auto command = input.find("command");
+  if (command != input.end() && command->is_string()) {
+    return from_name(command->get_ref<const std::string &>());
+  }
+  return Code::unknown;
+}
+
+// Microseconds since the Unix epoch, the clock of the acks
+inline int64_t wall_clock_us() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+             std::chrono::system_clock::now().time_since_epoch())
+      .count();
+}
+
+// The acknowledgement of the last command applied by a plugin, until it is
+// written in the next message
+class Ack {
+public:
+  // The command of input was applied now; a command without seq (e.g. sent by
+  // hand) is not acknowledged
+  void applied(const nlohmann::json &input, Code code) {
+    auto seq = input.find("seq");
+    if (seq == input.end() || !seq->is_number_unsigned()) {
+      return;
+    }
+    _seq = seq->get<uint64_t>();
+    _code = code;
+    _t_us = wall_clock_us();
+    _pending = true;
+  }
+
+  bool pending() const { return _pending; }
+
+  // Write {"seq", "code", "t_us"} in node, an object of the message
+  void write(nlohmann::json &node) {
+    if (!node.is_object()) {
+      node = nlohmann::json::object();
+    }
+    node["seq"] = _seq;
+    node["code"] = static_cast<int>(_code);
+    node["t_us"] = _t_us;
+    _pending = false;
+  }
+
+private:
+  bool _pending = false;
+  uint64_t _seq = 0;
+  Code _code = Code::unknown;
+  int64_t _t_us = 0;
+};
+
+} // namespace command
+
+#endif // COMMAND_HPP
@@ -0,0 +1,126 @@
+/*
+   ____       _ _     ____       _            _
+  / ___| __ _(_) |_  |  _ \  ___| |_ ___  ___| |_ ___  _ __
+ | |  _ / _` | | __| | | | |/ _ \ __/ _ \/ __| __/ _ \| '__|
+ | |_| | (_| | | |_  | |_| |  __/ ||  __/ (__| || (_) | |
+  \____|\__,_|_|\__| |____/ \___|\__\___|\___|\__\___/|_|
+
+Streaming step segmentation of the crutch tip force, header only
+*/
+
+#ifndef GAIT_DETECTOR_HPP
+#define GAIT_DETECTOR_HPP
+
+#include <cstdint>
+
+// Metrics of one completed step, i.e. one stance phase of the crutch. Times
+// are on the monotonic clock of the samples, in µs.
+struct GaitStep {
+  uint32_t count = 0;       // steps detected since the last reset, this one included
+  uint64_t heel_strike_us = 0;
+  uint64_t toe_off_us = 0;
+  double stance_s = 0.0;    // from heel strike to toe-off
+  double swing_s = 0.0;     // from the previous toe-off, 0 for the first step
+  double peak = 0.0;        // maximum force during the stance, N
+  double impulse = 0.0;     // integral of the force over the stance, N s
+  double cadence = 0.0;     // steps per minute from the previous heel strike, 0 for the first step
+};
+
+// Hysteresis detector, O(1) per sample: the stance starts when the force
+// rises above on_threshold and ends when it falls below off_threshold.
+// Stances shorter than min_stance_s are discarded as spikes, and a pause
+// longer than max_step_interval_s restarts the cadence and swing measures.
+class GaitDetector {
+public:
+  void configure(double on_threshold, double off_threshold, double min_stance_s,
+                 double max_step_interval_s) {
+    _on_threshold = on_threshold;
+    _off_threshold = off_threshold < on_threshold ? off_threshold : on_threshold;
+    _min_stance_us = static_cast<uint64_t>(min_stance_s * 1e6);
+    _max_interval_us = static_cast<uint64_t>(max_step_interval_s * 1e6);
+    reset();
+  }
+
+  void reset() {
+    _in_stance = false;
+    _has_previous = false;
+    _has_sample = false;
+    _count = 0;
+  }
+
+  bool in_stance() const { return _in_stance; }
+
+  // Add a sample, returns true when a step has just been completed: its
+  // metrics are then available from step() until the next completed step
+  bool add(uint64_t t_us, double force) {
+    if (_has_sample && t_us <= _last_t_us) {
+      return false; // out of order or repeated sample
+    }
+    bool completed = false;
+    if (!_in_stance) {
+      if (force > _on_threshold) {
+        _in_stance = true;
+        _stance_start_us = t_us;
+        _peak = force;
+        _impulse = 0.0;
+      }
+    } else {
+      // trapezoidal integration over the interval from the previous sample
+      _impulse += 0.5 * (force + _last_force) * (t_us - _last_t_us) * 1e-6;
+      if (force > _peak) {
+        _peak = force;
+      }
+      if (force < _off_threshold) {
+        _in_stance = false;
+        if (t_us - _stance_start_us >= _min_stance_us) {
+          complete(t_us);
+          completed = true;
+        }
+      }
+    }
+    _last_t_us = t_us;
+    _last_force = force;
+    _has_sample = true;
+    return completed;
+  }
+
+  const GaitStep &step() const { return _step; }
+
+private:
+  void complete(uint64_t toe_off_us) {
+    const bool continuous =
+        _has_previous && _stance_start_us - _previous_heel_strike_us <= _max_interval_us;
+    _step.count = ++_count;
+    _step.heel_strike_us = _stance_start_us;
+    _step.toe_off_us = toe_off_us;
+    _step.stance_s = (toe_off_us - _stance_start_us) * 1e-6;
+    _step.swing_s = continuous ? (_stance_start_us - _previous_toe_off_us) * 1e-6 : 0.0;
+    _step.peak = _peak;
+    _step.impulse = _impulse;
+    _step.cadence =
+        continuous ? 60e6 / static_cast<double>(_stance_start_us - _previous_heel_strike_us) : 0.0;
+    _previous_heel_strike_us = _stance_start_us;
+    _previous_toe_off_us = toe_off_us;
+    _has_previous = true;
+  }
+
+  double _on_threshold = 20.0;
+  double _off_threshold = 10.0;
+  uint64_t _min_stance_us = 150000;
+  uint64_t _max_interval_us = 5000000;
+
+  bool _in_stance = false;
+  bool _has_previous = false;
+  bool _has_sample = false;
+  uint32_t _count = 0;
+  uint64_t _stance_start_us = 0;
+  uint64_t _previous_heel_strike_us = 0;
+  uint64_t _previous_toe_off_us = 0;
+  uint64_t _last_t_us = 0;
+  double _last_force = 0.0;
+  double _peak = 0.0;
+  double _impulse = 0.0;
+  GaitStep _step;
+};
+
+#endif // GAIT_DETECTOR_HPP
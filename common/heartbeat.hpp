@@ -0,0 +1,75 @@
+/*
+  _   _                 _   _                _
+ | | | | ___  __ _ _ __| |_| |__   ___  __ _| |_
+ | |_| |/ _ \/ _` | '__| __| '_ \ / _ \/ _` | __|
+ |  _  |  __/ (_| | |  | |_| |_) |  __/ (_| | |_
+ |_| |_|\___|\__,_|_|   \__|_.__/ \___|\__,_|\__|
+
+Scheduling of the agent_status messages, header only
+*/
+
+#ifndef HEARTBEAT_HPP
+#define HEARTBEAT_HPP
+
+#include <chrono>
+#include <cstdint>
+#include <nlohmann/json.hpp>
+#include <string>
+
+// Decides when an agent publishes its agent_status, from the settings:
+//
+//   health_status_period = 500       # ms
+//   health_status_mode = "periodic"  # or "delta"
+//   health_status_keepalive = 2000   # ms, delta mode only
+//
+// In periodic mode the status goes out every health_status_period. In delta
+// mode it goes out as soon as the state of the agent changes, otherwise only
+// every health_status_keepalive, which must stay below the
+// unreachable_agent_timeout of status_handler. The state is a small code
+// chosen by the agent, e.g. 1 while recording and 0 when idle.
+class Heartbeat {
+public:
+  using clock = std::chrono::steady_clock;
+
+  void configure(const nlohmann::json &params) {
+    _period = std::chrono::milliseconds(params.value("health_status_period", 500));
+    _delta = params.value("health_status_mode", std::string("periodic")) == "delta";
+    _keepalive = std::chrono::milliseconds(params.value("health_status_keepalive", 2000));
+  }
+
+  // True if the agent_status should be published now
+  bool due(uint32_t state, clock::time_point now = clock::now()) const {
+    if (_delta) {
+      return !_sent || state != _state || now - _last >= _keepalive;
+    }
+    return now - _last >= _period;
+  }
+
+  // Record that the agent_status has been published
+  void sent(uint32_t state, clock::time_point now = clock::now()) {
+    _last = now;
+    _state = state;
+    _sent = true;
+  }
+
+  // When the next agent_status is due, in the past if it already is
+  clock::time_point next_due(uint32_t state) const {
+    if (_delta) {
+      return (!_sent || state != _state) ? _last : _last + _keepalive;
+    }
+    return _last + _period;
+  }
+
+  int period_ms() const { return static_cast<int>(_period.count()); }
+  bool delta() const { return _delta; }
+
+private:
+  std::chrono::milliseconds _period{500};
+  std::chrono::milliseconds _keepalive{2000};
+  bool _delta = false;
+  bool _sent = false;
+  uint32_t _state = 0;
+  clock::time_point _last = clock::now();
+};
+
+#endif // HEARTBEAT_HPP
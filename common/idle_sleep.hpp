@@ -0,0 +1,54 @@
+/*
+  ___     _ _        ____  _
+ |_ _| __| | | ___  / ___|| | ___  ___ _ __
+  | | / _` | |/ _ \ \___ \| |/ _ \/ _ \ '_ \
+  | || (_| | |  __/  ___) | |  __/  __/ |_) |
+ |___|\__,_|_|\___| |____/|_|\___|\___| .__/
+                                      |_|
+Low-power scheduling of the non-blocking agents while idle, header only
+*/
+
+#ifndef IDLE_SLEEP_HPP
+#define IDLE_SLEEP_HPP
+
+#include <algorithm>
+#include <chrono>
+#include <nlohmann/json.hpp>
+#include <thread>
+
+// An agent run with --dont-block calls process() every period, also between
+// acquisitions, when all it has to do is an agent_status now and then. With
+//
+//   idle_sleep = true     # default false
+//   idle_max_sleep = 200  # ms
+//
+// process() sleeps instead until its next deadline (e.g. Heartbeat::next_due),
+// but at most idle_max_sleep: a command that arrives meanwhile waits in the
+// socket until process() returns, so this is the worst-case latency of start
+// and set_offset. The agent only sleeps while idle, start brings back the
+// tight acquisition loop at the next cycle.
+class IdleSleep {
+public:
+  using clock = std::chrono::steady_clock;
+
+  void configure(const nlohmann::json &params) {
+    _enabled = params.value("idle_sleep", false);
+    _max_sleep = std::chrono::milliseconds(std::max(0, params.value("idle_max_sleep", 200)));
+  }
+
+  // Sleep until the deadline, at most idle_max_sleep, if enabled
+  void until(clock::time_point deadline) const {
+    if (_enabled) {
+      std::this_thread::sleep_until(std::min(deadline, clock::now() + _max_sleep));
+    }
+  }
+
+  bool enabled() const { return _enabled; }
+  int max_sleep_ms() const { return static_cast<int>(_max_sleep.count()); }
+
+private:
+  bool _enabled = false;
+  std::chrono::milliseconds _max_sleep{200};
+};
+
+#endif // IDLE_SLEEP_HPP
@@ -0,0 +1,186 @@
+/*
+  __  __                                   _____                    _       _
+ |  \/  | ___  ___ ___  __ _  __ _  ___  |_   _|__ _ __ ___  _ __ | | __ _| |_ ___
+ | |\/| |/ _ \/ __/ __|/ _` |/ _` |/ _ \   | |/ _ \ '_ ` _ \| '_ \| |/ _` | __/ _ \
+ | |  | |  __/\__ \__ \ (_| | (_| |  __/   | |  __/ | | | | | |_) | | (_| | ||  __/
+ |_|  |_|\___||___/___/\__,_|\__, |\___|   |_|\___|_| |_| |_| .__/|_|\__,_|\__\___|
+                             |___/                          |_|
+Output messages of process() built in place, header only
+*/
+
+#ifndef MESSAGE_TEMPLATE_HPP
+#define MESSAGE_TEMPLATE_HPP
+
+#include <nlohmann/json.hpp>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// Writing a json in place. Unlike operator[] and operator=, these functions
+// reuse the existing node of a key and the buffer of a string, so that they
+// do not allocate when the value is written again.
+namespace message_template {
+
+// The node of key in object, created the first time
+inline nlohmann::json &field(nlohmann::json &object, const char *key) {
+  if (!object.is_object()) {
+    object = nlohmann::json::object();
+  }
+  auto it = object.find(key);
+  return it != object.end() ? *it : object[key];
+}
+
+template <typename T>
+inline std::enable_if_t<std::is_arithmetic<T>::value> assign(nlohmann::json &node, T value) {
+  node = value;
+}
+
+inline void assign(nlohmann::json &node, const char *value) {
+  if (node.is_string()) {
+    node.get_ref<std::string &>().assign(value);
+  } else {
+    node = value;
+  }
+}
+
+inline void assign(nlohmann::json &node, const std::string &value) { assign(node, value.c_str()); }
+
+// Any other value, copied only when it differs, e.g. a constant descriptor
+inline void assign(nlohmann::json &node, const nlohmann::json &value) {
+  if (node != value) {
+    node = value;
+  }
+}
+
+// An array of numbers, resized in place
+template <typename T> inline void assign(nlohmann::json &node, const std::vector<T> &values) {
+  if (!node.is_array()) {
+    node = nlohmann::json::array();
+  }
+  auto &array = node.get_ref<nlohmann::json::array_t &>();
+  array.resize(values.size());
+  for (size_t i = 0; i < values.size(); ++i) {
+    assign(array[i], values[i]);
+  }
+}
+
+} // namespace message_template
+
+// The messages of a plugin, built in the out json of process(), which the
+// agent passes again at every cycle. begin() replaces out.clear(): the fields
+// that the template wrote in the previous message are kept, so that writing
+// them again reuses their nodes, and finish() removes those that were not
+// written again. The constant fields (e.g. side and agent_id) are set once,
+// by set_params(), and added by finish(). A stream of messages with the same
+// fields then does not allocate. The nested objects are written in place
+// with message_template::field(), or emptied by object() when their keys
+// change from a message to the next.
+class MessageTemplate {
+public:
+  // A field of every message, a null value removes it
+  void set_constant(const char *key, nlohmann::json value) {
+    for (auto &constant : _constants) {
+      if (constant.first == key) {
+        constant.second = std::move(value);
+        return;
+      }
+    }
+    _constants.emplace_back(key, std::move(value));
+  }
+
+  // Forget the fields of the previous messages, e.g. when the parameters
+  // change their keys: begin() removes them from out. The constants are kept.
+  void reset() { _fields.clear(); }
+
+  // Start a new message in out. The keys not written by the template (e.g.
+  // added by the agent after process()) are removed, as by out.clear().
+  void begin(nlohmann::json &out) {
+    _out = &out;
+    if (!out.is_object()) {
+      out = nlohmann::json::object();
+    }
+    for (auto it = out.begin(); it != out.end();) {
+      if (known(it.key())) {
+        ++it;
+      } else {
+        it = out.erase(it);
+      }
+    }
+    for (auto &f : _fields) {
+      f.written = false;
+    }
+  }
+
+  // The node of a top-level field of the current message
+  nlohmann::json &operator[](const char *key) { return write(key).first; }
+
+  // An object field of the current message, emptied when it is first written
+  // in the message
+  nlohmann::json &object(const char *key) {
+    auto node = write(key);
+    if (!node.second || !node.first.is_object()) {
+      node.first = nlohmann::json::object();
+    }
+    return node.first;
+  }
+
+  // Complete the message
+  void finish() {
+    for (const auto &f : _fields) {
+      if (!f.written) {
+        _out->erase(f.key);
+      }
+    }
+    for (const auto &constant : _constants) {
+      if (constant.second.is_null()) {
+        _out->erase(constant.first);
+      } else {
+        message_template::assign(message_template::field(*_out, constant.first.c_str()), constant.second);
+      }
+    }
+  }
+
+private:
+  struct Field {
+    std::string key;
+    bool written = false;
+  };
+
+  // The node of a field and whether it was already written in this message
+  std::pair<nlohmann::json &, bool> write(const char *key) {
+    bool written = false;
+    bool found = false;
+    for (auto &f : _fields) {
+      if (f.key == key) {
+        written = f.written;
+        f.written = found = true;
+        break;
+      }
+    }
+    if (!found) {
+      _fields.push_back({key, true});
+    }
+    return {message_template::field(*_out, key), written};
+  }
+
+  bool known(const std::string &key) const {
+    for (const auto &f : _fields) {
+      if (f.key == key) {
+        return true;
+      }
+    }
+    for (const auto &constant : _constants) {
+      if (constant.first == key) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  std::vector<Field> _fields; // written at least once, in order of appearance
+  std::vector<std::pair<std::string, nlohmann::json>> _constants;
+  nlohmann::json *_out = nullptr;
+};
+
+#endif // MESSAGE_TEMPLATE_HPP
@@ -0,0 +1,214 @@
+/*
+  ____            __
+ |  _ \ ___ _ __ / _|
+ | |_) / _ \ '__| |_
+ |  __/  __/ |  |  _|
+ |_|   \___|_|  |_|
+
+Latency histograms of the hot paths and their periodic summary, header only
+*/
+
+#ifndef PERF_HPP
+#define PERF_HPP
+
+#include <chrono>
+#include <cstdint>
+#include <initializer_list>
+#include <nlohmann/json.hpp>
+#include <utility>
+
+#ifdef PERF_INSTRUMENTATION
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cmath>
+#include <vector>
+#endif
+
+// The instrumentation is compiled in with -DPERF_INSTRUMENTATION (CMake
+// option of the same name). Without it the classes below are empty and every
+// call is a no-op that the compiler removes, so the hot paths can be
+// instrumented unconditionally.
+namespace perf {
+
+#ifdef PERF_INSTRUMENTATION
+
+constexpr bool enabled = true;
+
+inline uint64_t now_ns() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+// Log-linear histogram of durations in ns, as HdrHistogram with 4 bits of
+// precision: 16 buckets per power of two, so any value is within 6.25% of its
+// bucket. record() is a few relaxed atomic increments, safe from any thread,
+// drain() reads and resets the buckets from the reporting thread.
+class Histogram {
+public:
+  static constexpr unsigned sub_bits = 4;
+  static constexpr unsigned sub_count = 1u << sub_bits;
+  static constexpr size_t bucket_count = (64 - sub_bits + 1) * sub_count;
+
+  struct Summary {
+    uint64_t count = 0;
+    double mean_us = 0, p50_us = 0, p99_us = 0, p999_us = 0, max_us = 0;
+  };
+
+  void record(uint64_t ns) {
+    _buckets[index(ns)].fetch_add(1, std::memory_order_relaxed);
+    _sum.fetch_add(ns, std::memory_order_relaxed);
+    uint64_t max = _max.load(std::memory_order_relaxed);
+    while (ns > max && !_max.compare_exchange_weak(max, ns, std::memory_order_relaxed)) {
+    }
+  }
+
+  // Summary of the values recorded since the previous drain()
+  Summary drain() {
+    Summary s;
+    std::array<uint32_t, bucket_count> counts;
+    for (size_t i = 0; i < bucket_count; ++i) {
+      counts[i] = _buckets[i].exchange(0, std::memory_order_relaxed);
+      s.count += counts[i];
+    }
+    const uint64_t sum = _sum.exchange(0, std::memory_order_relaxed);
+    s.max_us = _max.exchange(0, std::memory_order_relaxed) / 1000.0;
+    if (s.count == 0) {
+      return s;
+    }
+    s.mean_us = sum / 1000.0 / s.count;
+    const std::pair<double, double *> quantiles[] = {
+        {0.5, &s.p50_us}, {0.99, &s.p99_us}, {0.999, &s.p999_us}};
+    uint64_t seen = 0;
+    size_t q = 0;
+    for (size_t i = 0; i < bucket_count && q < 3; ++i) {
+      seen += counts[i];
+      while (q < 3 && seen >= std::ceil(quantiles[q].first * s.count)) {
+        // the middle of the bucket, never above the maximum
+        *quantiles[q].second = std::min(midpoint(i) / 1000.0, s.max_us);
+        ++q;
+      }
+    }
+    return s;
+  }
+
+private:
+  static size_t index(uint64_t v) {
+    if (v < sub_count) {
+      return size_t(v);
+    }
+#if defined(__GNUC__) || defined(__clang__)
+    const unsigned e = 63u - unsigned(__builtin_clzll(v)); // >= sub_bits
+#else
+    unsigned e = 0;
+    for (uint64_t x = v; x >>= 1;) {
+      ++e;
+    }
+#endif
+    return size_t(e - sub_bits + 1) * sub_count + size_t((v >> (e - sub_bits)) & (sub_count - 1));
+  }
+
+  static double midpoint(size_t i) {
+    if (i < sub_count) {
+      return double(i);
+    }
+    const unsigned e = unsigned(i / sub_count) + sub_bits - 1;
+    const double width = std::ldexp(1.0, int(e - sub_bits));
+    return (sub_count + i % sub_count) * width + width / 2;
+  }
+
+  std::array<std::atomic<uint32_t>, bucket_count> _buckets{};
+  std::atomic<uint64_t> _sum{0};
+  std::atomic<uint64_t> _max{0};
+};
+
+// Records the duration of its scope
+class Timer {
+public:
+  explicit Timer(Histogram &histogram) : _histogram(histogram), _start(now_ns()) {}
+  ~Timer() {
+    if (_start > 0) {
+      _histogram.record(now_ns() - _start);
+    }
+  }
+  // Do not record this scope, e.g. when it has been idle
+  void discard() { _start = 0; }
+  Timer(const Timer &) = delete;
+  Timer &operator=(const Timer &) = delete;
+
+private:
+  Histogram &_histogram;
+  uint64_t _start;
+};
+
+// Named histograms of a plugin and the schedule of their summary, which is
+// added as the "perf" field of the next message published after perf_period
+// ms: {"<name>": {"n", "mean", "p50", "p99", "p999", "max"}}, times in µs.
+class Report {
+public:
+  Report(std::initializer_list<std::pair<const char *, Histogram *>> histograms)
+      : _histograms(histograms) {}
+
+  // perf_period in ms, default 5000, 0 disables the summary
+  void configure(const nlohmann::json &params) {
+    _period = std::chrono::milliseconds(params.value("perf_period", 5000));
+    _last = std::chrono::steady_clock::now();
+  }
+
+  // Add the summary to out when the period has elapsed
+  void publish_if_due(nlohmann::json &out) {
+    const auto now = std::chrono::steady_clock::now();
+    if (_period.count() <= 0 || now - _last < _period) {
+      return;
+    }
+    _last = now;
+    nlohmann::json &perf = out["perf"];
+    for (auto &entry : _histograms) {
+      const Histogram::Summary s = entry.second->drain();
+      perf[entry.first] = {{"n", s.count},
+                           {"mean", round(s.mean_us)},
+                           {"p50", round(s.p50_us)},
+                           {"p99", round(s.p99_us)},
+                           {"p999", round(s.p999_us)},
+                           {"max", round(s.max_us)}};
+    }
+  }
+
+private:
+  static double round(double us) { return std::round(us * 10.0) / 10.0; }
+
+  std::vector<std::pair<const char *, Histogram *>> _histograms;
+  std::chrono::milliseconds _period{5000};
+  std::chrono::steady_clock::time_point _last = std::chrono::steady_clock::now();
+};
+
+#else // PERF_INSTRUMENTATION
+
+constexpr bool enabled = false; // to skip the computation of the recorded values
+
+inline uint64_t now_ns() { return 0; }
+
+class Histogram {
+public:
+  void record(uint64_t) {}
+};
+
+class Timer {
+public:
+  explicit Timer(Histogram &) {}
+  void discard() {}
+};
+
+class Report {
+public:
+  Report(std::initializer_list<std::pair<const char *, Histogram *>>) {}
+  void configure(const nlohmann::json &) {}
+  void publish_if_due(nlohmann::json &) {}
+};
+
+#endif // PERF_INSTRUMENTATION
+
+} // namespace perf
+
+#endif // PERF_HPP
@@ -0,0 +1,70 @@
+/*
+  ____            _ _   _                  _   _                        _
+ |  _ \ ___  __ _| | |_(_)_ __ ___   ___  | |_| |__  _ __ ___  __ _  __| |
+ | |_) / _ \/ _` | | __| | '_ ` _ \ / _ \ | __| '_ \| '__/ _ \/ _` |/ _` |
+ |  _ <  __/ (_| | | |_| | | | | | |  __/ | |_| | | | | |  __/ (_| | (_| |
+ |_| \_\___|\__,_|_|\__|_|_| |_| |_|\___|  \__|_| |_|_|  \___|\__,_|\__,_|
+
+Scheduling helpers for the acquisition threads, header only
+*/
+
+#ifndef REALTIME_THREAD_HPP
+#define REALTIME_THREAD_HPP
+
+#include <cstring>
+#include <ctime>
+#include <iostream>
+#include <thread>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+// Give a running thread SCHED_FIFO priority (1-99, 0 keeps the default
+// scheduling) and pin it to a core (-1 for no pinning). Failures, e.g. a
+// missing CAP_SYS_NICE, are reported with prefix and are not fatal.
+inline void configure_realtime_thread(std::thread &t, int priority, int cpu,
+                                      const char *prefix = "") {
+#ifdef __linux__
+  if (priority > 0) {
+    sched_param param{};
+    param.sched_priority = priority;
+    const int rc = pthread_setschedparam(t.native_handle(), SCHED_FIFO, &param);
+    if (rc != 0) {
+      std::cout << prefix << "Cannot set SCHED_FIFO priority " << priority
+                << ": " << std::strerror(rc) << std::endl;
+    }
+  }
+  if (cpu >= 0) {
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(cpu, &cpus);
+    const int rc = pthread_setaffinity_np(t.native_handle(), sizeof(cpus), &cpus);
+    if (rc != 0) {
+      std::cout << prefix << "Cannot pin the thread to cpu " << cpu << ": "
+                << std::strerror(rc) << std::endl;
+    }
+  }
+#else
+  (void)t;
+  if (priority > 0 || cpu >= 0) {
+    std::cout << prefix
+              << "Thread priority and cpu pinning are only supported on Linux"
+              << std::endl;
+  }
+#endif
+}
+
+// CPU time consumed by the calling thread, in seconds (0 where unsupported)
+inline double thread_cpu_seconds() {
+#if defined(CLOCK_THREAD_CPUTIME_ID)
+  timespec ts{};
+  if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) == 0) {
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+  }
+#endif
+  return 0.0;
+}
+
+#endif // REALTIME_THREAD_HPP
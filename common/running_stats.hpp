@@ -0,0 +1,121 @@
+/*
+  ____                    _               ____  _        _
+ |  _ \ _   _ _ __  _ __ (_)_ __   __ _  / ___|| |_ __ _| |_ ___
+ | |_) | | | | '_ \| '_ \| | '_ \ / _` | \___ \| __/ _` | __/ __|
+ |  _ <| |_| | | | | | | | | | | | (_| |  ___) | || (_| | |_\__ \
+ |_| \_\\__,_|_| |_|_| |_|_|_| |_|\__, | |____/ \__\__,_|\__|___/
+                                  |___/
+On-line statistics and incremental offset calibration, header only
+*/
+
+#ifndef RUNNING_STATS_HPP
+#define RUNNING_STATS_HPP
+
+#include <array>
+#include <cmath>
+#include <cstddef>
+
+// Welford running mean and variance: numerically stable, O(1) per sample
+class RunningStats {
+public:
+  void reset() {
+    _count = 0;
+    _mean = 0.0;
+    _m2 = 0.0;
+  }
+
+  void add(double x) {
+    ++_count;
+    const double delta = x - _mean;
+    _mean += delta / static_cast<double>(_count);
+    _m2 += delta * (x - _mean);
+  }
+
+  size_t count() const { return _count; }
+  double mean() const { return _mean; }
+
+  // Sample variance, 0 with less than two samples
+  double variance() const {
+    return _count > 1 ? _m2 / static_cast<double>(_count - 1) : 0.0;
+  }
+
+  double stddev() const { return std::sqrt(variance()); }
+
+private:
+  size_t _count = 0;
+  double _mean = 0.0;
+  double _m2 = 0.0;
+};
+
+// Offset calibration of N channels, fed one reading per call so that it can
+// be spread over several process() cycles. The offset of each channel is the
+// mean of the first `samples` readings; the following `test_samples`
+// readings, with the new offset subtracted, give the residual test value.
+template <size_t N> class OffsetCalibration {
+public:
+  void start(size_t samples, size_t test_samples) {
+    _samples = samples > 0 ? samples : 1;
+    _test_samples = test_samples;
+    for (auto &s : _stats) {
+      s.reset();
+    }
+    for (auto &s : _test) {
+      s.reset();
+    }
+    _running = true;
+  }
+
+  // Restart with the same settings, discarding the readings collected so far
+  void restart() {
+    if (_running) {
+      start(_samples, _test_samples);
+    }
+  }
+
+  bool running() const { return _running; }
+
+  // Add a reading without offset, one value per channel. Returns true when
+  // the calibration has just completed.
+  bool add(const double *values) {
+    if (!_running) {
+      return false;
+    }
+    if (_stats[0].count() < _samples) {
+      for (size_t i = 0; i < N; ++i) {
+        _stats[i].add(values[i]);
+      }
+      if (_stats[0].count() == _samples) {
+        for (size_t i = 0; i < N; ++i) {
+          _offset[i] = _stats[i].mean();
+          _stddev[i] = _stats[i].stddev();
+        }
+      }
+    } else {
+      for (size_t i = 0; i < N; ++i) {
+        _test[i].add(values[i] - _offset[i]);
+      }
+    }
+    if (_stats[0].count() < _samples || _test[0].count() < _test_samples) {
+      return false;
+    }
+    _running = false;
+    return true;
+  }
+
+  // Results, valid after add() returned true
+  const std::array<double, N> &offset() const { return _offset; }
+  const std::array<double, N> &stddev() const { return _stddev; } // noise of a single reading
+  double test(size_t i) const { return _test[i].mean(); }
+  size_t samples() const { return _samples; }
+
+private:
+  std::array<RunningStats, N> _stats;
+  std::array<RunningStats, N> _test;
+  std::array<double, N> _offset{};
+  std::array<double, N> _stddev{};
+  size_t _samples = 1;
+  size_t _test_samples = 0;
+  bool _running = false;
+};
+
+#endif // RUNNING_STATS_HPP
@@ -0,0 +1,161 @@
+/*
+  ____                        _         _    _ _
+ / ___|  __ _ _ __ ___  _ __ | | ___   / \  | (_) __ _ _ __   ___ _ __
+ \___ \ / _` | '_ ` _ \| '_ \| |/ _ \ / _ \ | | |/ _` | '_ \ / _ \ '__|
+  ___) | (_| | | | | | | |_) | |  __// ___ \| | | (_| | | | |  __/ |
+ |____/ \__,_|_| |_| |_| .__/|_|\___/_/   \_\_|_|\__, |_| |_|\___|_|
+                       |_|                       |___/
+Clock mapping, jitter buffer and resampling of the crutch streams, header only
+*/
+
+#ifndef SAMPLE_ALIGNER_HPP
+#define SAMPLE_ALIGNER_HPP
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <limits>
+
+namespace sample_aligner {
+
+constexpr size_t max_channels = 8;
+
+// One reading of a load cell, on the common timebase (µs since the epoch)
+struct Sample {
+  int64_t t_us = 0;
+  std::array<float, max_channels> values{};
+};
+
+// Maps the monotonic clock of the samples of a crutch to its system clock.
+// Each message gives the difference between its publishing time (system
+// clock, the MADS timestamp) and the reading time of its last sample
+// (monotonic clock): the difference is the offset between the two clocks
+// plus the delay before publishing, so the minimum over the last N messages
+// is the best estimate of the offset.
+template <size_t N = 64> class ClockMap {
+public:
+  void reset() {
+    _count = 0;
+    _next = 0;
+  }
+
+  void add(int64_t system_us, int64_t steady_us) {
+    _deltas[_next] = system_us - steady_us;
+    _next = (_next + 1) % N;
+    if (_count < N) {
+      ++_count;
+    }
+    _base_us = *std::min_element(_deltas.begin(), _deltas.begin() + _count);
+  }
+
+  bool valid() const { return _count > 0; }
+
+  // System time of a monotonic timestamp
+  int64_t to_system(int64_t steady_us) const { return steady_us + _base_us; }
+
+private:
+  std::array<int64_t, N> _deltas{};
+  size_t _count = 0;
+  size_t _next = 0;
+  int64_t _base_us = 0;
+};
+
+// Jitter buffer of one stream: samples are kept sorted by time and released
+// in order once they are older than the watermark, so that a late sample
+// can still take its place. A sample older than the last released one is
+// too late and discarded. Released samples stay in the buffer until the
+// resampling has moved past them.
+class Stream {
+public:
+  void reset(size_t channels, size_t capacity) {
+    _channels = std::min(channels, max_channels);
+    _capacity = std::max<size_t>(capacity, 2);
+    _buffer.clear();
+    _released = 0;
+    _released_us = std::numeric_limits<int64_t>::min();
+    _late = 0;
+    _overflow = 0;
+  }
+
+  size_t channels() const { return _channels; }
+  bool empty() const { return _buffer.empty(); }
+  size_t size() const { return _buffer.size(); }
+  unsigned long late() const { return _late; }
+  unsigned long overflow() const { return _overflow; }
+  int64_t first_us() const { return _buffer.front().t_us; }
+  int64_t last_us() const { return _buffer.back().t_us; }
+
+  // Insert a sample in time order, O(1) when it is not late
+  void insert(const Sample &sample) {
+    if (sample.t_us <= _released_us) {
+      ++_late;
+      return;
+    }
+    if (_buffer.size() >= _capacity) {
+      // the watermark is not moving, e.g. a wrong clock offset: drop the oldest
+      if (_released == 0) {
+        _released_us = _buffer.front().t_us;
+        ++_overflow;
+      } else {
+        --_released;
+      }
+      _buffer.pop_front();
+    }
+    auto it = _buffer.end();
+    while (it != _buffer.begin() + _released && (it - 1)->t_us > sample.t_us) {
+      --it;
+    }
+    _buffer.insert(it, sample);
+  }
+
+  // Release, in time order, the samples not later than the watermark
+  template <typename F> void release(int64_t watermark_us, F &&emit) {
+    while (_released < _buffer.size() && _buffer[_released].t_us <= watermark_us) {
+      _released_us = _buffer[_released].t_us;
+      emit(_buffer[_released]);
+      ++_released;
+    }
+  }
+
+  // Value of the stream at time t, linearly interpolated between the
+  // surrounding samples. After the last sample the value is held for
+  // hold_us, before the first sample and after the hold it is 0. The times
+  // must be increasing between calls: the samples before t are dropped.
+  void value_at(int64_t t_us, int64_t hold_us, float *out) {
+    while (_released >= 2 && _buffer[1].t_us <= t_us) {
+      _buffer.pop_front();
+      --_released;
+    }
+    std::fill(out, out + max_channels, 0.0f);
+    if (_buffer.empty() || _buffer.front().t_us > t_us) {
+      return;
+    }
+    const Sample &a = _buffer.front();
+    if (_buffer.size() < 2 || _buffer[1].t_us <= a.t_us) {
+      if (t_us - a.t_us <= hold_us) {
+        std::copy(a.values.begin(), a.values.begin() + _channels, out);
+      }
+      return;
+    }
+    const Sample &b = _buffer[1];
+    const float k = float(t_us - a.t_us) / float(b.t_us - a.t_us);
+    for (size_t c = 0; c < _channels; ++c) {
+      out[c] = a.values[c] + k * (b.values[c] - a.values[c]);
+    }
+  }
+
+private:
+  std::deque<Sample> _buffer;
+  size_t _channels = 1;
+  size_t _capacity = 4096;
+  size_t _released = 0; // samples at the front of the buffer already released
+  int64_t _released_us = std::numeric_limits<int64_t>::min();
+  unsigned long _late = 0;
+  unsigned long _overflow = 0;
+};
+
+} // namespace sample_aligner
+
+#endif // SAMPLE_ALIGNER_HPP
@@ -0,0 +1,211 @@
+/*
+  ____                        _        _____
+ / ___|  __ _ _ __ ___  _ __ | | ___  |  ___| __ __ _ _ __ ___   ___
+ \___ \ / _` | '_ ` _ \| '_ \| |/ _ \ | |_ | '__/ _` | '_ ` _ \ / _ \
+  ___) | (_| | | | | | | |_) | |  __/ |  _|| | | (_| | | | | | |  __/
+ |____/ \__,_|_| |_| |_| .__/|_|\___| |_|  |_|  \__,_|_| |_| |_|\___|
+                       |_|
+Binary frame of load cell samples, carried in the MADS message blob
+*/
+
+#ifndef SAMPLE_FRAME_HPP
+#define SAMPLE_FRAME_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+// Frame layout, all fields little-endian:
+//
+//   offset  size  field
+//   0       2     magic, "IC" (0x49, 0x43)
+//   2       1     version
+//   3       1     side (see Side)
+//   4       1     kind of the values (see Kind)
+//   5       1     channels per sample
+//   6       2     number of samples
+//   8       4     sequence number of the first sample
+//   12      ...   samples: timestamp_us (uint64, steady clock) followed by
+//                 one 4 byte value per channel
+//
+// The JSON part of the message carries a small descriptor in the "frame"
+// field, with the kind, the JSON key and the channel labels, so that the
+// receiver can map each channel to the same dataset used in JSON mode.
+namespace sample_frame {
+
+constexpr uint8_t magic_0 = 0x49;
+constexpr uint8_t magic_1 = 0x43;
+constexpr uint8_t version = 1;
+constexpr size_t header_size = 12;
+
+enum class Side : uint8_t { unknown = 0, left = 1, right = 2 };
+
+enum class Kind : uint8_t {
+  force_f32 = 0, // calibrated forces, float32 in N
+  raw_i32 = 1    // raw ADC counts, two's complement int32
+};
+
+inline Side side_from_string(const std::string &side) {
+  if (side == "left") {
+    return Side::left;
+  } else if (side == "right") {
+    return Side::right;
+  }
+  return Side::unknown;
+}
+
+inline const char *kind_name(Kind kind) {
+  return kind == Kind::raw_i32 ? "raw_i32" : "force_f32";
+}
+
+inline bool kind_from_string(const std::string &name, Kind &kind) {
+  if (name == "force_f32") {
+    kind = Kind::force_f32;
+  } else if (name == "raw_i32") {
+    kind = Kind::raw_i32;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+inline size_t sample_size(uint8_t channels) { return 8 + 4 * size_t(channels); }
+
+inline void put_u16(uint8_t *p, uint16_t v) {
+  p[0] = uint8_t(v);
+  p[1] = uint8_t(v >> 8);
+}
+
+inline void put_u32(uint8_t *p, uint32_t v) {
+  for (int i = 0; i < 4; ++i) {
+    p[i] = uint8_t(v >> (8 * i));
+  }
+}
+
+inline void put_u64(uint8_t *p, uint64_t v) {
+  for (int i = 0; i < 8; ++i) {
+    p[i] = uint8_t(v >> (8 * i));
+  }
+}
+
+inline uint16_t get_u16(const uint8_t *p) {
+  return uint16_t(p[0] | (uint16_t(p[1]) << 8));
+}
+
+inline uint32_t get_u32(const uint8_t *p) {
+  uint32_t v = 0;
+  for (int i = 3; i >= 0; --i) {
+    v = (v << 8) | p[i];
+  }
+  return v;
+}
+
+inline uint64_t get_u64(const uint8_t *p) {
+  uint64_t v = 0;
+  for (int i = 7; i >= 0; --i) {
+    v = (v << 8) | p[i];
+  }
+  return v;
+}
+
+// Build a frame into a byte buffer. The buffer is cleared by begin() but
+// keeps its capacity, so a reused buffer does not allocate. A frame can be
+// filled across several Writer instances on the same buffer, e.g. one
+// sample per process() call.
+class Writer {
+public:
+  explicit Writer(std::vector<unsigned char> &buffer) : _buffer(buffer) {}
+
+  void begin(Side side, Kind kind, uint8_t channels, uint32_t sequence) {
+    _buffer.resize(header_size);
+    uint8_t *p = _buffer.data();
+    p[0] = magic_0;
+    p[1] = magic_1;
+    p[2] = version;
+    p[3] = uint8_t(side);
+    p[4] = uint8_t(kind);
+    p[5] = channels;
+    put_u16(p + 6, 0);
+    put_u32(p + 8, sequence);
+  }
+
+  // Append one sample, values holds one element per channel
+  void add_sample(uint64_t timestamp_us, const float *values) {
+    uint8_t *p = grow();
+    put_u64(p, timestamp_us);
+    for (uint8_t c = 0; c < channels(); ++c) {
+      uint32_t bits;
+      std::memcpy(&bits, &values[c], sizeof(bits));
+      put_u32(p + 8 + 4 * c, bits);
+    }
+  }
+
+  void add_sample(uint64_t timestamp_us, const int32_t *values) {
+    uint8_t *p = grow();
+    put_u64(p, timestamp_us);
+    for (uint8_t c = 0; c < channels(); ++c) {
+      put_u32(p + 8 + 4 * c, uint32_t(values[c]));
+    }
+  }
+
+  uint8_t channels() const { return _buffer[5]; }
+  uint16_t count() const { return get_u16(_buffer.data() + 6); }
+
+private:
+  uint8_t *grow() {
+    const size_t offset = _buffer.size();
+    _buffer.resize(offset + sample_size(channels()));
+    put_u16(_buffer.data() + 6, uint16_t(count() + 1));
+    return _buffer.data() + offset;
+  }
+
+  std::vector<unsigned char> &_buffer;
+};
+
+// Read-only view over a received frame, no copies
+class Reader {
+public:
+  // Validate the frame, false if it is malformed or truncated
+  bool parse(const unsigned char *data, size_t size) {
+    _data = data;
+    if (size < header_size || data[0] != magic_0 || data[1] != magic_1 ||
+        data[2] != version || data[4] > uint8_t(Kind::raw_i32)) {
+      return false;
+    }
+    return size == header_size + size_t(count()) * sample_size(channels());
+  }
+
+  Side side() const { return Side(_data[3]); }
+  Kind kind() const { return Kind(_data[4]); }
+  uint8_t channels() const { return _data[5]; }
+  uint16_t count() const { return get_u16(_data + 6); }
+  uint32_t sequence() const { return get_u32(_data + 8); }
+
+  uint64_t timestamp_us(size_t sample) const {
+    return get_u64(sample_ptr(sample));
+  }
+
+  float value_f32(size_t sample, size_t channel) const {
+    const uint32_t bits = get_u32(sample_ptr(sample) + 8 + 4 * channel);
+    float value;
+    std::memcpy(&value, &bits, sizeof(value));
+    return value;
+  }
+
+  int32_t value_i32(size_t sample, size_t channel) const {
+    return int32_t(get_u32(sample_ptr(sample) + 8 + 4 * channel));
+  }
+
+private:
+  const uint8_t *sample_ptr(size_t sample) const {
+    return _data + header_size + sample * sample_size(channels());
+  }
+
+  const unsigned char *_data = nullptr;
+};
+
+} // namespace sample_frame
+
+#endif // SAMPLE_FRAME_HPP
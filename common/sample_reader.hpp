@@ -0,0 +1,230 @@
+/*
+  ____                        _        ____                _
+ / ___|  __ _ _ __ ___  _ __ | | ___  |  _ \ ___  __ _  __| | ___ _ __
+ \___ \ / _` | '_ ` _ \| '_ \| |/ _ \ | |_) / _ \/ _` |/ _` |/ _ \ '__|
+  ___) | (_| | | | | | | |_) | |  __/ |  _ <  __/ (_| | (_| |  __/ |
+ |____/ \__,_|_| |_| |_| .__/|_|\___| |_| \_\___|\__,_|\__,_|\___|_|
+                       |_|
+Samples of the load cell messages, in any of their formats, header only
+*/
+
+#ifndef SAMPLE_READER_HPP
+#define SAMPLE_READER_HPP
+
+#include "sample_frame.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <nlohmann/json.hpp>
+#include <string>
+#include <vector>
+
+// The load cell agents publish their readings in three formats:
+//
+//   single reading   {"force": 12.5, "t_us": 1000}, "t_us" optional
+//   batch            {"force": [...], "t_us": [...], "samples": n}
+//   binary frame     {"frame": {"channels": [...], ...}} + the blob, see
+//                    sample_frame.hpp
+//
+// where "force" is a number for the unlabelled channel of the tip, or an
+// object of labelled channels for the handle, with one array per label in a
+// batch. Reader::read() turns any of them into count() samples of
+// channels() values, in the order of labels(), into buffers reused between
+// messages. A malformed message is reported as invalid with its error(),
+// never by an exception.
+namespace sample_reader {
+
+constexpr size_t max_channels = 8;
+
+enum class Status {
+  ok,      // count() samples were read
+  none,    // no force in the message, e.g. an agent_status
+  raw,     // binary frame of raw ADC counts, not read
+  invalid  // malformed message, see error()
+};
+
+class Reader {
+public:
+  // Read the samples of a message. A single reading without "t_us" is
+  // stamped with default_t_us and stamped() is false.
+  Status read(const nlohmann::json &input, const std::vector<unsigned char> *blob,
+              uint64_t default_t_us) {
+    _count = 0;
+    _channels = 0;
+    _stamped = true;
+    _labels.clear();
+    _t_us.clear();
+    _values.clear();
+    _error.clear();
+    auto frame = input.find("frame");
+    if (frame != input.end() && blob != nullptr) {
+      return read_frame(*frame, *blob);
+    }
+    auto force = input.find("force");
+    if (force == input.end()) {
+      return Status::none;
+    }
+    auto t_us = input.find("t_us");
+    try {
+      return read_json(*force, t_us != input.end() && !t_us->is_null() ? &*t_us : nullptr, default_t_us);
+    } catch (const nlohmann::json::exception &e) {
+      return invalid(std::string("malformed forces: ") + e.what());
+    }
+  }
+
+  size_t count() const { return _count; }
+  size_t channels() const { return _channels; }
+  // Channel labels in message order, empty for a single unlabelled channel
+  const std::vector<std::string> &labels() const { return _labels; }
+  // False if the samples were stamped with default_t_us
+  bool stamped() const { return _stamped; }
+  uint64_t t_us(size_t sample) const { return _t_us[sample]; }
+  double value(size_t sample, size_t channel) const { return _values[sample * _channels + channel]; }
+  const std::string &error() const { return _error; }
+
+private:
+  Status read_frame(const nlohmann::json &descriptor, const std::vector<unsigned char> &blob) {
+    sample_frame::Reader frame;
+    if (!frame.parse(blob.data(), blob.size())) {
+      return invalid("invalid frame");
+    }
+    if (frame.kind() != sample_frame::Kind::force_f32) {
+      return Status::raw;
+    }
+    auto labels = descriptor.is_object() ? descriptor.find("channels") : descriptor.end();
+    if (labels != descriptor.end()) {
+      if (!labels->is_array()) {
+        return invalid("invalid frame channels");
+      }
+      for (const auto &label : *labels) {
+        if (!label.is_string()) {
+          return invalid("invalid frame channels");
+        }
+        _labels.push_back(label.get<std::string>());
+      }
+    }
+    if (!set_channels(frame.channels())) {
+      return Status::invalid;
+    }
+    _count = frame.count();
+    for (size_t i = 0; i < _count; ++i) {
+      _t_us.push_back(frame.timestamp_us(i));
+      for (size_t c = 0; c < _channels; ++c) {
+        _values.push_back(frame.value_f32(i, c));
+      }
+    }
+    return Status::ok;
+  }
+
+  Status read_json(const nlohmann::json &force, const nlohmann::json *t_us, uint64_t default_t_us) {
+    if (force.is_object()) {
+      for (auto it = force.begin(); it != force.end(); ++it) {
+        _labels.push_back(it.key());
+      }
+    }
+    if (!set_channels(force.is_object() ? force.size() : 1)) {
+      return Status::invalid;
+    }
+    const nlohmann::json &first = force.is_object() ? force.begin().value() : force;
+    if (!first.is_array()) {
+      // single reading
+      _count = 1;
+      _stamped = t_us != nullptr;
+      _t_us.push_back(_stamped ? t_us->get<uint64_t>() : default_t_us);
+      if (force.is_object()) {
+        for (auto it = force.begin(); it != force.end(); ++it) {
+          _values.push_back(it.value().get<double>());
+        }
+      } else {
+        _values.push_back(force.get<double>());
+      }
+      return Status::ok;
+    }
+
+    // batch, one array per channel
+    _count = first.size();
+    if (t_us == nullptr || !t_us->is_array() || t_us->size() != _count) {
+      return invalid("force and t_us arrays do not match");
+    }
+    if (force.is_object()) {
+      for (auto it = force.begin(); it != force.end(); ++it) {
+        if (!it.value().is_array() || it.value().size() != _count) {
+          return invalid("force arrays of different sizes");
+        }
+      }
+    }
+    for (size_t i = 0; i < _count; ++i) {
+      _t_us.push_back((*t_us)[i].get<uint64_t>());
+      if (force.is_object()) {
+        for (auto it = force.begin(); it != force.end(); ++it) {
+          _values.push_back(it.value()[i].get<double>());
+        }
+      } else {
+        _values.push_back(force[i].get<double>());
+      }
+    }
+    return Status::ok;
+  }
+
+  bool set_channels(size_t channels) {
+    if (channels == 0 || channels > max_channels || (!_labels.empty() && _labels.size() != channels)) {
+      invalid("unsupported channels");
+      return false;
+    }
+    _channels = channels;
+    return true;
+  }
+
+  Status invalid(std::string error) {
+    _count = 0;
+    _error = std::move(error);
+    return Status::invalid;
+  }
+
+  size_t _count = 0;
+  size_t _channels = 0;
+  bool _stamped = true;
+  std::vector<std::string> _labels;
+  std::vector<uint64_t> _t_us;
+  std::vector<double> _values; // channels() per sample
+  std::string _error;
+};
+
+// Results computed from the samples and waiting for process(), bounded: when
+// it is full the oldest one is dropped and counted, the subscribers are too
+// slow to keep up
+template <typename T> class Pending {
+public:
+  explicit Pending(size_t capacity) : _capacity(capacity) {}
+
+  void push(T &&item) {
+    if (_items.size() >= _capacity) {
+      _items.pop_front();
+      ++_dropped;
+    }
+    _items.push_back(std::move(item));
+  }
+
+  bool empty() const { return _items.empty(); }
+  size_t size() const { return _items.size(); }
+  T &front() { return _items.front(); }
+  void pop() { _items.pop_front(); }
+  unsigned long dropped() const { return _dropped; }
+
+  // Empty the queue, keeping the count of the dropped items
+  void clear() { _items.clear(); }
+
+  void reset() {
+    _items.clear();
+    _dropped = 0;
+  }
+
+private:
+  size_t _capacity;
+  std::deque<T> _items;
+  unsigned long _dropped = 0;
+};
+
+} // namespace sample_reader
+
+#endif // SAMPLE_READER_HPP
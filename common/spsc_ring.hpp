@@ -0,0 +1,111 @@
+/*
+  ____  ____  ____   ____   ____  _
+ / ___||  _ \/ ___| / ___| |  _ \(_)_ __   __ _
+ \___ \| |_) \___ \| |     | |_) | | '_ \ / _` |
+  ___) |  __/ ___) | |___  |  _ <| | | | | (_| |
+ |____/|_|   |____/ \____| |_| \_\_|_| |_|\__, |
+                                          |___/
+Bounded single-producer/single-consumer ring buffer, header only
+*/
+
+#ifndef SPSC_RING_HPP
+#define SPSC_RING_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <vector>
+
+// Lock-free ring with preallocated slots: the producer fills a slot in place
+// (acquire + commit) and the consumer reads it in place (front + pop), so
+// that slots keep their capacity and steady-state operation does not
+// allocate. Exactly one thread may produce and one thread may consume.
+template <typename T> class SpscRing {
+public:
+  explicit SpscRing(size_t capacity = 1) { reset(capacity); }
+
+  SpscRing(const SpscRing &) = delete;
+  SpscRing &operator=(const SpscRing &) = delete;
+
+  // Resize and empty the ring, not thread safe: call it only while neither
+  // the producer nor the consumer is running
+  void reset(size_t capacity) {
+    if (capacity == 0) {
+      throw std::invalid_argument("Ring capacity must be greater than zero.");
+    }
+    _slots.clear();
+    _slots.resize(capacity);
+    _head.store(0, std::memory_order_relaxed);
+    _tail.store(0, std::memory_order_relaxed);
+    _high_water.store(0, std::memory_order_relaxed);
+  }
+
+  // Producer: get the next free slot, nullptr if the ring is full
+  T *acquire() {
+    const uint64_t head = _head.load(std::memory_order_relaxed);
+    if (head - _tail.load(std::memory_order_acquire) >= _slots.size()) {
+      return nullptr;
+    }
+    return &_slots[head % _slots.size()];
+  }
+
+  // Producer: publish the slot returned by acquire()
+  void commit() {
+    const uint64_t head = _head.load(std::memory_order_relaxed) + 1;
+    _head.store(head, std::memory_order_release);
+    const size_t used =
+        static_cast<size_t>(head - _tail.load(std::memory_order_relaxed));
+    if (used > _high_water.load(std::memory_order_relaxed)) {
+      _high_water.store(used, std::memory_order_relaxed);
+    }
+  }
+
+  // Producer: copy an item into the ring, false if it is full
+  bool push(const T &item) {
+    T *slot = acquire();
+    if (slot == nullptr) {
+      return false;
+    }
+    *slot = item;
+    commit();
+    return true;
+  }
+
+  // Consumer: get the oldest published slot, nullptr if the ring is empty
+  T *front() {
+    const uint64_t tail = _tail.load(std::memory_order_relaxed);
+    if (tail == _head.load(std::memory_order_acquire)) {
+      return nullptr;
+    }
+    return &_slots[tail % _slots.size()];
+  }
+
+  // Consumer: release the slot returned by front()
+  void pop() {
+    _tail.store(_tail.load(std::memory_order_relaxed) + 1,
+                std::memory_order_release);
+  }
+
+  size_t size() const {
+    return static_cast<size_t>(_head.load(std::memory_order_acquire) -
+                               _tail.load(std::memory_order_acquire));
+  }
+
+  bool empty() const { return size() == 0; }
+
+  size_t capacity() const { return _slots.size(); }
+
+  // Maximum number of slots in use since the last reset
+  size_t high_water() const {
+    return _high_water.load(std::memory_order_relaxed);
+  }
+
+private:
+  std::vector<T> _slots;
+  alignas(64) std::atomic<uint64_t> _head{0}; // next slot to write
+  alignas(64) std::atomic<uint64_t> _tail{0}; // next slot to read
+  std::atomic<size_t> _high_water{0};
+};
+
+#endif // SPSC_RING_HPP
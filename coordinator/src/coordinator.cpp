@@ -16,6 +16,10 @@
 #include <filter.hpp>
 #include <nlohmann/json.hpp>
 #include <pugg/Kernel.h>
+#include <command.hpp>
+#include <heartbeat.hpp>
+#include <idle_sleep.hpp>
+#include <message_template.hpp>
 
 // other includes as needed here
 #include <chrono>
@@ -35,6 +39,7 @@
 // Load the namespaces
 using namespace std;
 using json = nlohmann::json;
+using message_template::assign;
 
 
 // Plugin class. This shall be the only part that needs to be modified,
@@ -49,12 +54,11 @@ public:
   // Implement the actual functionality here
   return_type load_data(json const &input, string topic = "", vector<unsigned char> const *blob = nullptr) override {
     
-    // if topic contains "command", process commands here
-    if (input.contains("command")) {
-    
-      string action = input.value("command", ""); // Get the command, default to empty string if not found
+    // if topic contains "command", process commands here (dispatched on their code, see command.hpp)
+    const command::Code action = command::decode(input);
+    switch (action) {
 
-      if (action == "start") {
+      case command::Code::start:
         if (_recording) {
           _error = "recording: start requested while already acquiring";
           return return_type::error;
@@ -77,8 +81,10 @@ public:
         _send_command = true;
         _command_to_send = action;
 
-        std::cout << "Sending command " << action << " with id " << _id_to_send << std::endl;
-      } else if (action == "stop") {
+        std::cout << "Sending command start with id " << _id_to_send << std::endl;
+        break;
+
+      case command::Code::stop:
         if (_recording == false) {
           _error = "idle: stop requested while not acquiring";
           return return_type::error;
@@ -88,8 +94,10 @@ public:
         _send_command = true;
         _command_to_send = action;
 
-        std::cout << "Sending command " << action << std::endl;
-      } else if (action == "condition") {
+        std::cout << "Sending command stop" << std::endl;
+        break;
+
+      case command::Code::condition:
         if (input.contains("label")) {
           
           // send with additional field "label" if it is provided in the input json, if not, use "NA" as default value
@@ -98,9 +106,11 @@ public:
           _send_command = true;
           _command_to_send = action;
 
-          std::cout << "Sending command " << action << " with label " << _label_to_send << std::endl;
+          std::cout << "Sending command condition with label " << _label_to_send << std::endl;
         }
-      } else if (action == "datetime_update") {
+        break;
+
+      case command::Code::datetime_update:
         #ifdef RASPBERRYPI_PLATFORM
           if (input.contains("datetime_to_set")) {
             
@@ -118,10 +128,10 @@ public:
             }
 
             // Construct and execute the system command
-            string command = "sudo date -s \"" + datetime_to_set + "\"";
-            std::cout << "Executing: " << command << std::endl;
+            string date_command = "sudo date -s \"" + datetime_to_set + "\"";
+            std::cout << "Executing: " << date_command << std::endl;
             
-            int result = std::system(command.c_str());
+            int result = std::system(date_command.c_str());
             
             if (result == 0) {
               std::cout << "Successfully updated system datetime to " << datetime_to_set << std::endl;
@@ -138,17 +148,20 @@ public:
           std::cout << "datetime_update command received, but datetime update is only supported on Raspberry Pi. Command ignored." << std::endl;
           return return_type::retry;
         #endif
-        
-      } else if (action == "get_agents_status" || action == "set_offset" || action == "pupil_neon_connect" || action == "pupil_neon_disconnect") {
+        break;
+
+      case command::Code::get_agents_status:
+      case command::Code::set_offset:
+      case command::Code::pupil_neon_connect:
+      case command::Code::pupil_neon_disconnect:
         // add here other commands that doesn't require additional fields or check for them as needed
         _send_command = true;
         _command_to_send = action;
-        std::cout << "Sending command " << action << std::endl;
-      } else {
+        std::cout << "Sending command " << command::name(action) << std::endl;
+        break;
+
+      default:
         return return_type::retry;
-      }
-    } else {
-      return return_type::retry;
     }
 
     return return_type::success;
@@ -157,62 +170,75 @@ public:
   // We calculate the average of the last N values for each key and store it
   // into the output json object
   return_type process(json &out, vector<unsigned char> *blob = nullptr) override {
-    out.clear();
+    _message.begin(out); // the fields of the previous message are updated in place
 
-    // Send periodic agent_status if no command to send and 500ms have passed
-    auto now = std::chrono::steady_clock::now();
-    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(now - _last_health_status_time).count();
+    // Send agent_status if no command to send and the heartbeat is due
+    const bool health_status_due = _heartbeat.due(_recording);
     
     // load the data as necessary and set the fields of the json out variable
-    if (_send_command || elapsed >= _health_status_period) {
+    if (_send_command || health_status_due) {
 
-      if (elapsed >= _health_status_period) {
-        out["agent_status"] = _recording ? "recording" : "idle";
-        _last_health_status_time = now;
+      bool status_sent = health_status_due;
+      if (health_status_due) {
+        assign(_message["agent_status"], _recording ? "recording" : "idle");
       } 
 
       if (_send_command){
-        out["command"] = _command_to_send;
+        // the name for the web server and the Python agents, the code and the sequence number for the C++ plugins
+        assign(_message["command"], command::name(_command_to_send).data());
+        assign(_message["code"], static_cast<int>(_command_to_send));
+        assign(_message["seq"], ++_seq);
+        assign(_message["t_us"], command::wall_clock_us()); // the reference of the latency of the acks
 
-        if (_command_to_send == "start") {
+        if (_command_to_send == command::Code::start) {
 
-          out["id"] = _id_to_send; // include id only for start command
+          assign(_message["id"], _id_to_send); // include id only for start command
           if (_subject_id_to_send != -1) {
-            out["subject_id"] = _subject_id_to_send;
+            assign(_message["subject_id"], _subject_id_to_send);
           }
           if (_session_id_to_send != -1) {
-            out["session_id"] = _session_id_to_send;
+            assign(_message["session_id"], _session_id_to_send);
           }
           _recording = true;
           
           // update health status immediately when starting acquisition, so that the agent can react to it without waiting for the next periodic update
-          out["agent_status"] = "recording";
+          assign(_message["agent_status"], "recording");
+          status_sent = true;
 
-        } else if (_command_to_send == "stop") {
+        } else if (_command_to_send == command::Code::stop) {
 
           _recording = false;
-          out["agent_status"] = "idle";
+          assign(_message["agent_status"], "idle");
+          status_sent = true;
 
-        } else if (_command_to_send == "condition") {
+        } else if (_command_to_send == command::Code::condition) {
 
-          out["label"] = _label_to_send;
+          assign(_message["label"], _label_to_send);
         
         }
         // do nothing special for other commands for now, just send the command
       }
 
+      // commands to start and stop also carry the new agent_status
+      if (status_sent) {
+        _heartbeat.sent(_recording);
+      }
+
       // always reset the command to send after sending it, so that we don't send it again in the next iteration
       _send_command = false; // reset the flag
-      _command_to_send = ""; // reset the command
+      _command_to_send = command::Code::unknown; // reset the command
 
     } else {
       // if there is no command to send and not enough time has passed, don't send anything
+      // (idle: sleep until the next agent_status, if enabled)
+      if (!_recording) {
+        _idle.until(_heartbeat.next_due(_recording));
+      }
       return return_type::retry;
     }
     
-    // This sets the agent_id field in the output json object, only when it is
-    // not empty
-    if (!_agent_id.empty()) out["agent_id"] = _agent_id;
+    // agent_id, when it is not empty, is a constant of _message
+    _message.finish();
     return return_type::success;
   }
   
@@ -225,7 +251,9 @@ public:
     // params needs to be cast to json
     _params.merge_patch(params);
 
-    _health_status_period = _params.value("health_status_period", 500); // default to 500 ms
+    _heartbeat.configure(_params); // health_status_period, default to 500 ms, and health_status_mode
+    _idle.configure(_params); // idle_sleep, default to false, and idle_max_sleep, default to 200 ms
+    _message.set_constant("agent_id", _agent_id.empty() ? json() : json(_agent_id));
       
   }
 
@@ -244,10 +272,12 @@ private:
   bool _recording = false;
   bool _send_command = false;
 
-  string _command_to_send = "";
+  command::Code _command_to_send = command::Code::unknown;
+  uint64_t _seq = 0; // of the last command sent, acknowledged by the plugins
 
-  int _health_status_period = 500; // in milliseconds, default to 500 ms
-  std::chrono::steady_clock::time_point _last_health_status_time = std::chrono::steady_clock::now();
+  Heartbeat _heartbeat; // schedules the agent_status messages
+  IdleSleep _idle; // sleep in process() while idle
+  MessageTemplate _message; // output messages, updated in place in out
 
   int _id_to_send = -1;
   int _subject_id_to_send = -1;
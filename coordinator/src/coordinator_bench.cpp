@@ -0,0 +1,49 @@
+/*
+  ____                  _
+ | __ )  ___ _ __   ___| |__
+ |  _ \ / _ \ '_ \ / __| '_ \
+ | |_) |  __/ | | | (__| | | |
+ |____/ \___|_| |_|\___|_| |_|
+
+Per-message cost of the coordinator: process() every 10 ms during a
+recording, with labels and status requests from the web server, see
+common/bench.hpp
+*/
+#define main coordinator_main
+#include "coordinator.cpp"
+#undef main
+
+#include <bench.hpp>
+
+int main(int argc, char const *argv[]) {
+  bench::Bench bench("coordinator", argc, argv, {
+    {"health_status_period", 500}
+  });
+
+  CoordinatorPlugin plugin;
+  plugin.set_params(bench.params());
+  bench.once("start", [&] {
+    json out;
+    plugin.load_data({{"command", "start"}, {"id", 1}, {"subject_id", 1}, {"session_id", 1}}, "ws_command");
+    plugin.process(out);
+  });
+
+  bench.tick("process", 100.0);
+  bench.stream("condition", "ws_command", 1.0, [](uint64_t n, bench::Message &m) {
+    m.payload["command"] = "condition";
+    m.payload["label"] = n % 2 ? "walking" : "standing";
+    bench::stamp(m.payload);
+  });
+  bench.stream("get_status", "ws_command", 0.2, [](uint64_t, bench::Message &m) {
+    m.payload["command"] = "get_agents_status";
+    bench::stamp(m.payload);
+  }, 0.5);
+  bench.run(plugin);
+
+  bench.once("stop", [&] {
+    json out;
+    plugin.load_data({{"command", "stop"}}, "ws_command");
+    plugin.process(out);
+  });
+  return 0;
+}
@@ -0,0 +1,310 @@
+/*
+  _____ _ _ _                    _             _
+ |  ___(_) | |_ ___ _ __   _ __ | |_   _  __ _(_)_ __
+ | |_  | | | __/ _ \ '__| | '_ \| | | | |/ _` | | '_ \
+ |  _| | | | ||  __/ |    | |_) | | |_| | (_| | | | | |
+ |_|   |_|_|\__\___|_|    | .__/|_|\__,_|\__, |_|_| |_|
+                          |_|            |___/
+# A Template for Force_previewPlugin, a Filter Plugin
+# Generated by the command: C:\Program Files\MADS\usr\local\bin\mads-plugin.exe -t filter -d C:\mirrorworld\instrumented_crutches_mads\force_preview force_preview
+# Hostname: unknown
+# Current working directory: C:\mirrorworld\instrumented_crutches_mads
+# Creation date: 2026-10-14T15:03:52.940+0200
+# NOTICE: MADS Version 2.0.0
+*/
+// Mandatory included headers
+#include <filter.hpp>
+#include <nlohmann/json.hpp>
+#include <pugg/Kernel.h>
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <command.hpp>
+#include <heartbeat.hpp>
+#include <map>
+#include <sample_reader.hpp>
+
+// other includes as needed here
+
+// Define the name of the plugin
+#ifndef PLUGIN_NAME
+#define PLUGIN_NAME "force_preview"
+#endif
+
+// Load the namespaces
+using namespace std;
+using json = nlohmann::json;
+
+
+// Plugin class. This shall be the only part that needs to be modified,
+// implementing the actual functionality
+class Force_previewPlugin : public Filter<json, json> {
+
+public:
+
+  // Typically, no need to change this
+  string kind() override { return PLUGIN_NAME; }
+
+  // Implement the actual functionality here
+  // Return types:
+  // return_type::success: processing is valid, go to process
+  // return_type::retry: skip processing go to next loop
+  // return_type::warning: content of _error is tracked with register_event
+  // return_type::error: _error is traced, skip process
+  // return_type::critical: execution stops
+  return_type load_data(json const &input, string topic = "", vector<unsigned char> const *blob = nullptr) override {
+
+    // if topic contains the "command" field, process commands here
+    if (input.contains("command")) {
+
+      const command::Code action = command::decode(input); // the code, or the name, see command.hpp
+      if (action == command::Code::start) {
+        _recording = true;
+      } else if (action == command::Code::stop) {
+        _recording = false;
+        // the last, partial, buckets are sent as they are
+        for (auto &stream : _streams) {
+          emit(stream.first, stream.second);
+        }
+      }
+      return return_type::success;
+    }
+
+    // only the messages carrying forces are decimated, agent_status and info messages are dropped
+    const sample_reader::Status status = _reader.read(input, blob, steady_clock_us());
+    if (status == sample_reader::Status::none || status == sample_reader::Status::raw) {
+      return return_type::success; // raw ADC counts are not previewed
+    }
+    const string key = topic + "/" + input.value("side", "unknown");
+    if (status == sample_reader::Status::invalid) {
+      _error = key + " " + _reader.error() + ", message ignored";
+      return return_type::warning;
+    }
+
+    Stream &stream = _streams[key];
+    set_labels(key, stream);
+    array<float, max_channels> values{};
+    for (size_t i = 0; i < _reader.count(); ++i) {
+      for (size_t c = 0; c < stream.channels; ++c) {
+        values[c] = static_cast<float>(_reader.value(i, c));
+      }
+      add_sample(key, stream, _reader.t_us(i), values.data());
+    }
+
+    return return_type::success;
+  }
+
+  // One message per bucket, plus the periodic agent_status
+  // Return types:
+  // return_type::success: result is published
+  // return_type::retry: don't publish, go to next loop
+  // return_type::warning: content of _error is added to result befor publishing
+  // return_type::error: _error is traced via register_event, don't publish
+  // return_type::critical: execution stops
+  return_type process(json &out, vector<unsigned char> *blob = nullptr) override {
+    out.clear();
+
+    // Send agent_status if no bucket to send and the heartbeat is due
+    if (!_pending.empty()) {
+
+      out = std::move(_pending.front());
+      _pending.pop();
+
+    } else if (_heartbeat.due(_recording)) {
+
+      out["agent_status"] = _recording ? "recording" : "idle";
+      out["info"]["streams"] = _streams.size();
+      if (_pending.dropped() > 0) {
+        out["info"]["dropped"] = _pending.dropped();
+      }
+      _heartbeat.sent(_recording);
+
+    } else {
+      // if there is no bucket to send and not enough time has passed, don't send anything
+      return return_type::retry;
+    }
+
+    // This sets the agent_id field in the output json object, only when it is
+    // not empty
+    if (!_agent_id.empty()) out["agent_id"] = _agent_id;
+    return return_type::success;
+  }
+
+  void set_params(const json &params) override {
+    // Call the parent class method to set the common parameters
+    // (e.g. agent_id, etc.)
+    Filter::set_params(params);
+
+    // then merge the defaults with the actually provided parameters
+    // params needs to be cast to json
+    _params.merge_patch(params);
+
+    _heartbeat.configure(_params); // health_status_period, default to 500 ms, and health_status_mode
+    const double rate = _params.value("rate", 20.0); // buckets per second, for each stream
+    if (rate <= 0.0) {
+      _error = "rate must be greater than zero.";
+      throw std::runtime_error(_error);
+    }
+    _bucket_us = static_cast<uint64_t>(1e6 / rate);
+    _streams.clear();
+    _pending.clear();
+  }
+
+  // Implement this method if you want to provide additional information
+  map<string, string> info() override {
+    // return a map of strings with additional information about the plugin
+    // it is used to print the information about the plugin when it is loaded
+    // by the agent
+
+    return {
+      {"Rate", json(_params.value("rate", 20.0)).dump() + " Hz"}
+    };
+
+  };
+
+private:
+
+  static constexpr size_t max_channels = sample_reader::max_channels;
+  static constexpr size_t max_pending = 64;
+
+  // Bucket being filled for one topic and side
+  struct Stream {
+    bool configured = false;
+    size_t channels = 0;
+    vector<string> labels; // empty for the unlabelled channel of the tip load cell
+    bool started = false;
+    uint64_t start_us = 0; // first timestamp covered by the bucket
+    uint32_t samples = 0;
+    array<float, max_channels> min{};
+    array<float, max_channels> max{};
+    array<double, max_channels> sum{};
+  };
+
+  static uint64_t steady_clock_us() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+  }
+
+  // Check the channel labels of the message read against the stream, a change restarts the stream
+  void set_labels(const string &key, Stream &stream) {
+    if (stream.configured && stream.channels == _reader.channels() && stream.labels == _reader.labels()) {
+      return;
+    }
+    emit(key, stream);
+    stream.labels = _reader.labels();
+    stream.channels = _reader.channels();
+    stream.configured = true;
+    stream.started = false;
+  }
+
+  // O(1) per sample per channel: the bucket keeps the extremes and the sum
+  void add_sample(const string &key, Stream &stream, uint64_t t_us, const float *values) {
+    const size_t channels = stream.channels;
+    if (!stream.started) {
+      stream.start_us = t_us;
+      stream.started = true;
+    } else if (t_us >= stream.start_us + _bucket_us) {
+      const uint64_t start_us = stream.start_us + (t_us - stream.start_us) / _bucket_us * _bucket_us;
+      emit(key, stream);
+      stream.start_us = start_us; // buckets stay aligned, gaps produce no empty buckets
+    }
+    if (stream.samples == 0) {
+      std::copy(values, values + channels, stream.min.begin());
+      std::copy(values, values + channels, stream.max.begin());
+      stream.sum.fill(0.0);
+    }
+    for (size_t c = 0; c < channels; ++c) {
+      stream.min[c] = std::min(stream.min[c], values[c]);
+      stream.max[c] = std::max(stream.max[c], values[c]);
+      stream.sum[c] += values[c];
+    }
+    ++stream.samples;
+  }
+
+  // Queue the message of the current bucket, if not empty, and empty it
+  void emit(const string &key, Stream &stream) {
+    if (stream.samples == 0) {
+      return;
+    }
+    json out;
+    const size_t slash = key.find('/');
+    out["source"] = key.substr(0, slash);
+    out["side"] = key.substr(slash + 1);
+    out["t_us"] = stream.start_us;
+    out["samples"] = stream.samples;
+    if (stream.labels.empty()) {
+      out["force"] = stream.sum[0] / stream.samples;
+      out["force_min"] = stream.min[0];
+      out["force_max"] = stream.max[0];
+    } else {
+      for (size_t c = 0; c < stream.labels.size(); ++c) {
+        out["force"][stream.labels[c]] = stream.sum[c] / stream.samples;
+        out["force_min"][stream.labels[c]] = stream.min[c];
+        out["force_max"][stream.labels[c]] = stream.max[c];
+      }
+    }
+    _pending.push(std::move(out));
+    stream.samples = 0;
+  }
+
+  Heartbeat _heartbeat; // schedules the agent_status messages
+
+  // Define the fields that are used to store internal resources
+  bool _recording = false;
+  uint64_t _bucket_us = 50000;
+  map<string, Stream> _streams; // by "<topic>/<side>"
+  sample_reader::Reader _reader; // samples of the message being loaded
+  sample_reader::Pending<json> _pending{max_pending}; // completed buckets not yet published
+
+};
+
+
+/*
+  ____  _             _             _      _
+ |  _ \| |_   _  __ _(_)_ __     __| |_ __(_)_   _____ _ __
+ | |_) | | | | |/ _` | | '_ \   / _` | '__| \ \ / / _ \ '__|
+ |  __/| | |_| | (_| | | | | | | (_| | |  | |\ V /  __/ |
+ |_|   |_|_|\__,_|\__, |_|_| |_|  \__,_|_|  |_| \_/ \___|_|
+                |___/
+Enable the class as plugin
+*/
+INSTALL_FILTER_DRIVER(Force_previewPlugin, json, json);
+
+
+/*
+                  _
+  _ __ ___   __ _(_)_ __
+ | '_ ` _ \ / _` | | '_ \
+ | | | | | | (_| | | | | |
+ |_| |_| |_|\__,_|_|_| |_|
+
+*/
+
+int main(int argc, char const *argv[])
+{
+  Force_previewPlugin plugin;
+  json params;
+  json input, output;
+
+  // Set example values to params
+  params["rate"] = 20.0;
+
+  // Set the parameters
+  plugin.set_params(params);
+
+  // Feed 200 ms of an emulated tip load cell at 80 Hz
+  for (int i = 0; i < 16; ++i) {
+    input.clear();
+    input["side"] = "left";
+    input["force"] = 10.0 * i;
+    input["t_us"] = uint64_t(i) * 12500;
+    plugin.load_data(input, "tip_loadcell");
+    output.clear();
+    if (plugin.process(output) == return_type::success && output.contains("force")) {
+      cout << "Output: " << output.dump() << endl;
+    }
+  }
+
+  return 0;
+}
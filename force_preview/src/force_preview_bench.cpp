@@ -0,0 +1,39 @@
+/*
+  ____                  _
+ | __ )  ___ _ __   ___| |__
+ |  _ \ / _ \ '_ \ / __| '_ \
+ | |_) |  __/ | | | (__| | | |
+ |____/ \___|_| |_|\___|_| |_|
+
+Per-message cost of force_preview: the tips at 2x200 Hz and the 8-channel
+handles at 2x100 Hz during a recording, see common/bench.hpp
+*/
+#define main force_preview_main
+#include "force_preview.cpp"
+#undef main
+
+#include <bench.hpp>
+
+int main(int argc, char const *argv[]) {
+  bench::Bench bench("force_preview", argc, argv, {
+    {"health_status_period", 500},
+    {"rate", 20.0}
+  });
+
+  Force_previewPlugin plugin;
+  plugin.set_params(bench.params());
+  bench.once("start", [&] { plugin.load_data({{"command", "start"}, {"id", 1}}, "coordinator"); });
+
+  bench::crutch_streams(bench);
+  bench.stream("coordinator", 2.0, [](uint64_t, bench::Message &m) {
+    bench::heartbeat(m, "coordinator", "recording");
+  });
+  bench.run(plugin);
+
+  bench.once("stop", [&] {
+    json out;
+    plugin.load_data({{"command", "stop"}}, "coordinator");
+    plugin.process(out);
+  });
+  return 0;
+}
@@ -0,0 +1,267 @@
+/*
+  _____ _ _ _                    _             _
+ |  ___(_) | |_ ___ _ __   _ __ | |_   _  __ _(_)_ __
+ | |_  | | | __/ _ \ '__| | '_ \| | | | |/ _` | | '_ \
+ |  _| | | | ||  __/ |    | |_) | | |_| | (_| | | | | |
+ |_|   |_|_|\__\___|_|    | .__/|_|\__,_|\__, |_|_| |_|
+                          |_|            |___/
+# A Template for Gait_eventsPlugin, a Filter Plugin
+# Generated by the command: C:\Program Files\MADS\usr\local\bin\mads-plugin.exe -t filter -d C:\mirrorworld\instrumented_crutches_mads\gait_events gait_events
+# Hostname: unknown
+# Current working directory: C:\mirrorworld\instrumented_crutches_mads
+# Creation date: 2026-10-14T10:12:37.201+0200
+# NOTICE: MADS Version 2.0.0
+*/
+// Mandatory included headers
+#include <filter.hpp>
+#include <nlohmann/json.hpp>
+#include <pugg/Kernel.h>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <gait_detector.hpp>
+#include <command.hpp>
+#include <heartbeat.hpp>
+#include <sample_reader.hpp>
+
+// other includes as needed here
+
+// Define the name of the plugin
+#ifndef PLUGIN_NAME
+#define PLUGIN_NAME "gait_events"
+#endif
+
+// Load the namespaces
+using namespace std;
+using json = nlohmann::json;
+
+
+// Plugin class. This shall be the only part that needs to be modified,
+// implementing the actual functionality
+class Gait_eventsPlugin : public Filter<json, json> {
+
+public:
+
+  // Typically, no need to change this
+  string kind() override { return PLUGIN_NAME; }
+
+  // Implement the actual functionality here
+  // Return types:
+  // return_type::success: processing is valid, go to process
+  // return_type::retry: skip processing go to next loop
+  // return_type::warning: content of _error is tracked with register_event
+  // return_type::error: _error is traced, skip process
+  // return_type::critical: execution stops
+  return_type load_data(json const &input, string topic = "", vector<unsigned char> const *blob = nullptr) override {
+
+    // if topic contains the "command" field, process commands here
+    if (input.contains("command")) {
+
+      const command::Code action = command::decode(input); // the code, or the name, see command.hpp
+      if (action == command::Code::start) {
+        _recording = true;
+        _detector.reset(); // steps are counted per acquisition
+        _steps.clear();
+      } else if (action == command::Code::stop) {
+        _recording = false;
+      }
+      return return_type::success;
+    }
+
+    // only the tip load cell of this crutch is segmented
+    if (topic != "tip_loadcell" || input.value("side", "") != _side) {
+      return return_type::success;
+    }
+
+    // the force of the first channel, whatever the format of the message
+    const sample_reader::Status status = _reader.read(input, blob, steady_clock_us());
+    if (status == sample_reader::Status::none) {
+      return return_type::success;
+    }
+    if (status != sample_reader::Status::ok) {
+      _error = "tip_loadcell " + (status == sample_reader::Status::raw ? string("raw frame") : _reader.error()) +
+               ", message ignored";
+      return return_type::warning;
+    }
+    for (size_t i = 0; i < _reader.count(); ++i) {
+      add_sample(_reader.t_us(i), _reader.value(i, 0));
+    }
+
+    return return_type::success;
+  }
+
+  // One message per completed step, plus the periodic agent_status
+  // Return types:
+  // return_type::success: result is published
+  // return_type::retry: don't publish, go to next loop
+  // return_type::warning: content of _error is added to result befor publishing
+  // return_type::error: _error is traced via register_event, don't publish
+  // return_type::critical: execution stops
+  return_type process(json &out, vector<unsigned char> *blob = nullptr) override {
+    out.clear();
+
+    // Send agent_status if no step to send and the heartbeat is due
+    if (!_steps.empty()) {
+
+      const GaitStep &step = _steps.front();
+      out["event"] = "step";
+      out["step"]["count"] = step.count;
+      out["step"]["heel_strike_us"] = step.heel_strike_us;
+      out["step"]["toe_off_us"] = step.toe_off_us;
+      out["step"]["stance"] = step.stance_s;
+      out["step"]["swing"] = step.swing_s;
+      out["step"]["peak"] = step.peak;
+      out["step"]["impulse"] = step.impulse;
+      out["step"]["cadence"] = step.cadence;
+      _steps.pop();
+
+    } else if (_heartbeat.due(_recording)) {
+
+      out["agent_status"] = _recording ? "recording" : "idle";
+      out["info"]["steps"] = _detector.step().count;
+      out["info"]["in_stance"] = _detector.in_stance();
+      if (_steps.dropped() > 0) {
+        out["info"]["dropped_steps"] = _steps.dropped();
+      }
+      _heartbeat.sent(_recording);
+
+    } else {
+      // if there is no step to send and not enough time has passed, don't send anything
+      return return_type::retry;
+    }
+
+    // If there is a message to send, we must send the crutch side
+    out["side"] = _side;
+
+    // This sets the agent_id field in the output json object, only when it is
+    // not empty
+    if (!_agent_id.empty()) out["agent_id"] = _agent_id;
+    return return_type::success;
+  }
+
+  void set_params(const json &params) override {
+    // Call the parent class method to set the common parameters
+    // (e.g. agent_id, etc.)
+    Filter::set_params(params);
+
+    // provide sensible defaults for the parameters by setting e.g.
+    _params["side"] = "unknown";
+
+    // then merge the defaults with the actually provided parameters
+    // params needs to be cast to json
+    _params.merge_patch(params);
+
+    _heartbeat.configure(_params); // health_status_period, default to 500 ms, and health_status_mode
+
+    // Hysteresis thresholds in N, stance durations in s
+    _detector.configure(
+      _params.value("on_threshold", 20.0), // heel strike when the force rises above
+      _params.value("off_threshold", 10.0), // toe-off when the force falls below
+      _params.value("min_stance", 0.15), // shorter stances are discarded as spikes
+      _params.value("max_step_interval", 5.0) // longer pauses restart cadence and swing
+    );
+
+    if (_params.contains("side") && (_params["side"] == "left" || _params["side"] == "right")) {
+      _side = _params["side"].get<string>();
+      _agent_id = "gait_events_" + _side; // this is useful when the side field is not reachable
+      std::cout << "Side set to " << _side << std::endl;
+    } else {
+      _error = "Side parameter not set or invalid (only 'left' or 'right' allowed).";
+      std::cout << _error << std::endl;
+      throw std::runtime_error(_error);
+    }
+
+  }
+
+  // Implement this method if you want to provide additional information
+  map<string, string> info() override {
+    // return a map of strings with additional information about the plugin
+    // it is used to print the information about the plugin when it is loaded
+    // by the agent
+
+    return {
+      {"Side", _side},
+      {"On threshold", json(_params.value("on_threshold", 20.0)).dump() + " N"},
+      {"Off threshold", json(_params.value("off_threshold", 10.0)).dump() + " N"},
+      {"Min stance", json(_params.value("min_stance", 0.15)).dump() + " s"}
+    };
+
+  };
+
+private:
+
+  static uint64_t steady_clock_us() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+  }
+
+  void add_sample(uint64_t t_us, double force) {
+    if (!_detector.add(t_us, force)) {
+      return;
+    }
+    _steps.push(GaitStep(_detector.step()));
+  }
+
+  static constexpr size_t max_pending_steps = 16;
+
+  Heartbeat _heartbeat; // schedules the agent_status messages
+
+  string _side = "unknown";
+  // Define the fields that are used to store internal resources
+  bool _recording = false;
+  GaitDetector _detector;
+  sample_reader::Reader _reader; // samples of the message being loaded
+  sample_reader::Pending<GaitStep> _steps{max_pending_steps}; // completed steps not yet published
+
+};
+
+
+/*
+  ____  _             _             _      _
+ |  _ \| |_   _  __ _(_)_ __     __| |_ __(_)_   _____ _ __
+ | |_) | | | | |/ _` | | '_ \   / _` | '__| \ \ / / _ \ '__|
+ |  __/| | |_| | (_| | | | | | | (_| | |  | |\ V /  __/ |
+ |_|   |_|\__,_|\__, |_|_| |_|  \__,_|_|  |_| \_/ \___|_|
+                |___/
+Enable the class as plugin
+*/
+INSTALL_FILTER_DRIVER(Gait_eventsPlugin, json, json);
+
+
+/*
+                  _
+  _ __ ___   __ _(_)_ __
+ | '_ ` _ \ / _` | | '_ \
+ | | | | | | (_| | | | | |
+ |_| |_| |_|\__,_|_|_| |_|
+
+*/
+
+int main(int argc, char const *argv[])
+{
+  Gait_eventsPlugin plugin;
+  json params;
+  json input, output;
+
+  // Set example values to params
+  params["side"] = "left";
+
+  // Set the parameters
+  plugin.set_params(params);
+
+  // Feed two emulated steps of the left tip load cell at 80 Hz
+  for (int i = 0; i < 160; ++i) {
+    const double phase = (i % 80) / 80.0;
+    input.clear();
+    input["side"] = "left";
+    input["force"] = phase < 0.6 ? 300.0 * sin(3.14159265 * phase / 0.6) : 0.0;
+    input["t_us"] = uint64_t(i) * 12500;
+    plugin.load_data(input, "tip_loadcell");
+    output.clear();
+    if (plugin.process(output) == return_type::success && output.contains("step")) {
+      cout << "Output: " << output.dump(2) << endl;
+    }
+  }
+
+  return 0;
+}
@@ -0,0 +1,39 @@
+/*
+  ____                  _
+ | __ )  ___ _ __   ___| |__
+ |  _ \ / _ \ '_ \ / __| '_ \
+ | |_) |  __/ | | | (__| | | |
+ |____/ \___|_| |_|\___|_| |_|
+
+Per-message cost of gait_events: the tips of both crutches at 200 Hz during a
+recording, a step per second, see common/bench.hpp
+*/
+#define main gait_events_main
+#include "gait_events.cpp"
+#undef main
+
+#include <bench.hpp>
+
+int main(int argc, char const *argv[]) {
+  bench::Bench bench("gait_events", argc, argv, {
+    {"side", "left"},
+    {"health_status_period", 500},
+    {"on_threshold", 20.0},
+    {"off_threshold", 10.0},
+    {"min_stance", 0.15},
+    {"max_step_interval", 5.0}
+  });
+
+  Gait_eventsPlugin plugin;
+  plugin.set_params(bench.params());
+  bench.once("start", [&] { plugin.load_data({{"command", "start"}, {"id", 1}}, "coordinator"); });
+
+  bench::crutch_streams(bench, true, false);
+  bench.stream("coordinator", 2.0, [](uint64_t, bench::Message &m) {
+    bench::heartbeat(m, "coordinator", "recording");
+  });
+  bench.run(plugin);
+
+  bench.once("stop", [&] { plugin.load_data({{"command", "stop"}}, "coordinator"); });
+  return 0;
+}
@@ -29,6 +29,9 @@
 ******************************************************************************/
 #include "DEV_Config.h"
 #include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <time.h>
 
 /**
  * GPIO
@@ -118,6 +121,96 @@ UBYTE DEV_SPI_ReadByte(void)
 	return DEV_SPI_WriteByte(0x00);
 }
 
+/******************************************************************************
+function:	Full-duplex transfer of several bytes with a single driver call
+parameter:
+	Tx  : bytes to send, NULL sends zeros
+	Rx  : received bytes, NULL discards them (can be equal to Tx)
+	Len : number of bytes, at most DEV_SPI_MAX_BYTES
+Info:
+	Return 0 on success
+******************************************************************************/
+UBYTE DEV_SPI_Transfer(const UBYTE *Tx, UBYTE *Rx, UDOUBLE Len)
+{
+	UBYTE buf[DEV_SPI_MAX_BYTES];
+	if(Len > DEV_SPI_MAX_BYTES)
+		return 1;
+	if(Tx)
+		memcpy(buf, Tx, Len);
+	else
+		memset(buf, 0, Len);
+#ifdef RPI
+#ifdef USE_BCM2835_LIB
+	bcm2835_spi_transfern((char *)buf, Len);
+#elif USE_WIRINGPI_LIB
+	if(wiringPiSPIDataRW(0, buf, Len) < 0)
+		return 1;
+#elif USE_DEV_LIB
+	if(DEV_HARDWARE_SPI_Transfer(buf, Len) < 0)
+		return 1;
+#endif
+#endif
+
+#ifdef JETSON
+	UDOUBLE i;
+	for(i = 0; i < Len; i++)
+		buf[i] = DEV_SPI_WriteByte(buf[i]);
+#endif
+	if(Rx)
+		memcpy(Rx, buf, Len);
+	return 0;
+}
+
+/******************************************************************************
+function:	Several transfers in a row, e.g. a register write and a data read,
+			with a single driver call
+parameter:
+	Seg   : tx/rx buffers of each transfer, in order
+	Count : number of segments
+Info:
+	With the spidev backend this is one SPI_IOC_MESSAGE with one
+	spi_ioc_transfer per segment, otherwise the segments are merged into a
+	single transfer of at most DEV_SPI_MAX_BYTES bytes.
+	Return 0 on success
+******************************************************************************/
+UBYTE DEV_SPI_TransferSegments(const DEV_SPI_Segment *Seg, int Count)
+{
+#if defined(RPI) && defined(USE_DEV_LIB)
+	SPI_Segment segments[SPI_MAX_SEGMENTS];
+	int i;
+	if(Count <= 0 || Count > SPI_MAX_SEGMENTS)
+		return 1;
+	for(i = 0; i < Count; i++) {
+		segments[i].tx = Seg[i].Tx;
+		segments[i].rx = Seg[i].Rx;
+		segments[i].len = Seg[i].Len;
+	}
+	return DEV_HARDWARE_SPI_TransferSegments(segments, Count) < 0 ? 1 : 0;
+#else
+	UBYTE buf[DEV_SPI_MAX_BYTES];
+	UDOUBLE len = 0;
+	int i;
+	for(i = 0; i < Count; i++) {
+		if(len + Seg[i].Len > DEV_SPI_MAX_BYTES)
+			return 1;
+		if(Seg[i].Tx)
+			memcpy(buf + len, Seg[i].Tx, Seg[i].Len);
+		else
+			memset(buf + len, 0, Seg[i].Len);
+		len += Seg[i].Len;
+	}
+	if(DEV_SPI_Transfer(buf, buf, len) != 0)
+		return 1;
+	len = 0;
+	for(i = 0; i < Count; i++) {
+		if(Seg[i].Rx)
+			memcpy(Seg[i].Rx, buf + len, Seg[i].Len);
+		len += Seg[i].Len;
+	}
+	return 0;
+#endif
+}
+
 /**
  * GPIO Mode
 **/
@@ -186,6 +279,130 @@ void DEV_Delay_ms(UDOUBLE xms)
 #endif
 }
 
+/**
+ * DRDY falling edge, without busy waiting
+**/
+#if defined(RPI) && defined(USE_WIRINGPI_LIB)
+static pthread_mutex_t DRDY_Mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t DRDY_Cond = PTHREAD_COND_INITIALIZER;
+static UDOUBLE DRDY_Edges = 0;
+static UBYTE DRDY_Interrupt = 0;
+
+static void DEV_DRDY_ISR(void)
+{
+	pthread_mutex_lock(&DRDY_Mutex);
+	DRDY_Edges++;
+	pthread_cond_signal(&DRDY_Cond);
+	pthread_mutex_unlock(&DRDY_Mutex);
+}
+#elif defined(USE_DEV_LIB)
+static int DRDY_Fd = -1;
+#endif
+
+/******************************************************************************
+function:	Enable the falling edge interrupt of the DRDY pin
+parameter:
+Info:
+	Return 0 on success, 1 if interrupts are not available (DEV_DRDY_Wait
+	can not be used, poll DEV_DRDY_PIN instead)
+******************************************************************************/
+UBYTE DEV_DRDY_Interrupt_Init(void)
+{
+#if defined(RPI) && defined(USE_WIRINGPI_LIB)
+	if(!DRDY_Interrupt) {
+		if(wiringPiISR(DEV_DRDY_PIN, INT_EDGE_FALLING, &DEV_DRDY_ISR) < 0) {
+			printf("DRDY interrupt setup failed !!! \r\n");
+			return 1;
+		}
+		DRDY_Interrupt = 1;
+	}
+	pthread_mutex_lock(&DRDY_Mutex);
+	DRDY_Edges = 0;
+	pthread_mutex_unlock(&DRDY_Mutex);
+	return 0;
+#elif defined(USE_DEV_LIB)
+	char path[DIR_MAXSIZ];
+	int fd;
+	char value_str[3];
+
+	if(DRDY_Fd < 0) {
+		snprintf(path, DIR_MAXSIZ, "/sys/class/gpio/gpio%d/edge", DEV_DRDY_PIN);
+		fd = open(path, O_WRONLY);
+		if(fd < 0 || write(fd, "falling", 7) < 0) {
+			if(fd >= 0)
+				close(fd);
+			printf("DRDY edge setup failed !!! \r\n");
+			return 1;
+		}
+		close(fd);
+		snprintf(path, DIR_MAXSIZ, "/sys/class/gpio/gpio%d/value", DEV_DRDY_PIN);
+		DRDY_Fd = open(path, O_RDONLY);
+		if(DRDY_Fd < 0) {
+			printf("DRDY value open failed !!! \r\n");
+			return 1;
+		}
+	}
+	// a read clears the pending edge
+	lseek(DRDY_Fd, 0, SEEK_SET);
+	if(read(DRDY_Fd, value_str, sizeof(value_str)) < 0)
+		return 1;
+	return 0;
+#else
+	return 1;
+#endif
+}
+
+/******************************************************************************
+function:	Sleep until the next falling edge of the DRDY pin
+parameter:
+	timeout_ms : maximum waiting time
+Info:
+	Edges that arrived since the last call are consumed immediately.
+	Return 0 on edge, 1 on timeout or if interrupts are not available
+******************************************************************************/
+UBYTE DEV_DRDY_Wait(UDOUBLE timeout_ms)
+{
+#if defined(RPI) && defined(USE_WIRINGPI_LIB)
+	struct timespec deadline;
+	int rc = 0;
+	if(!DRDY_Interrupt)
+		return 1;
+	clock_gettime(CLOCK_REALTIME, &deadline);
+	deadline.tv_sec += timeout_ms / 1000;
+	deadline.tv_nsec += (long)(timeout_ms % 1000) * 1000000L;
+	if(deadline.tv_nsec >= 1000000000L) {
+		deadline.tv_sec++;
+		deadline.tv_nsec -= 1000000000L;
+	}
+	pthread_mutex_lock(&DRDY_Mutex);
+	while(DRDY_Edges == 0 && rc == 0)
+		rc = pthread_cond_timedwait(&DRDY_Cond, &DRDY_Mutex, &deadline);
+	if(DRDY_Edges == 0) {
+		pthread_mutex_unlock(&DRDY_Mutex);
+		return 1;
+	}
+	DRDY_Edges = 0;
+	pthread_mutex_unlock(&DRDY_Mutex);
+	return 0;
+#elif defined(USE_DEV_LIB)
+	struct pollfd pfd;
+	char value_str[3];
+	if(DRDY_Fd < 0)
+		return 1;
+	pfd.fd = DRDY_Fd;
+	pfd.events = POLLPRI | POLLERR;
+	if(poll(&pfd, 1, (int)timeout_ms) <= 0)
+		return 1;
+	lseek(DRDY_Fd, 0, SEEK_SET);
+	if(read(DRDY_Fd, value_str, sizeof(value_str)) < 0)
+		return 1;
+	return 0;
+#else
+	(void)timeout_ms;
+	return 1;
+#endif
+}
+
 static int DEV_Equipment_Testing(void)
 {
 	int i;
@@ -349,6 +566,10 @@ void DEV_Module_Exit(void)
 	DEV_HARDWARE_SPI_end();
 	DEV_Digital_Write(DEV_RST_PIN, 0);
 	DEV_Digital_Write(DEV_CS_PIN, 0);
+	if(DRDY_Fd >= 0) {
+		close(DRDY_Fd);
+		DRDY_Fd = -1;
+	}
 #endif
 
 #elif JETSON
@@ -83,8 +83,25 @@ UBYTE DEV_Digital_Read(UWORD Pin);
 UBYTE DEV_SPI_WriteByte(UBYTE Value);
 UBYTE DEV_SPI_ReadByte(void);
 
+/**
+ * Multi-byte transfers, chip select is handled by the caller
+**/
+typedef struct {
+    const UBYTE *Tx;    // NULL sends zeros
+    UBYTE *Rx;          // NULL discards the received bytes
+    UDOUBLE Len;
+} DEV_SPI_Segment;
+
+#define DEV_SPI_MAX_BYTES 32
+
+UBYTE DEV_SPI_Transfer(const UBYTE *Tx, UBYTE *Rx, UDOUBLE Len);
+UBYTE DEV_SPI_TransferSegments(const DEV_SPI_Segment *Seg, int Count);
+
 UBYTE DEV_Module_Init(void);
 void DEV_Module_Exit(void);
 
+UBYTE DEV_DRDY_Interrupt_Init(void);
+UBYTE DEV_DRDY_Wait(UDOUBLE timeout_ms);
+
 void DEV_Delay_ms(UDOUBLE xms);
 #endif
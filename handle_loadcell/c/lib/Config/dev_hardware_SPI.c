@@ -35,6 +35,7 @@
 #include <stdio.h>
 
 #include <stdint.h> 
+#include <string.h> 
 #include <unistd.h> 
 #include <stdio.h> 
 #include <stdlib.h> 
@@ -360,3 +361,35 @@ int DEV_HARDWARE_SPI_Transfer(uint8_t *buf, uint32_t len)
     return 1;
 }
 
+/******************************************************************************
+function: Several transfers in a single SPI_IOC_MESSAGE
+parameter:
+    segments : tx/rx buffers of each transfer, in order
+    count :    number of segments, at most SPI_MAX_SEGMENTS
+Info: One ioctl for all the segments
+      Return 1 success
+      Return -1 failed
+******************************************************************************/
+int DEV_HARDWARE_SPI_TransferSegments(const SPI_Segment *segments, int count)
+{
+    struct spi_ioc_transfer xfer[SPI_MAX_SEGMENTS];
+    int i;
+    if(count <= 0 || count > SPI_MAX_SEGMENTS)
+        return -1;
+    memset(xfer, 0, sizeof(xfer));
+    for(i = 0; i < count; i++) {
+        xfer[i].len = segments[i].len;
+        xfer[i].tx_buf = (unsigned long)segments[i].tx;
+        xfer[i].rx_buf = (unsigned long)segments[i].rx;
+        xfer[i].speed_hz = tr.speed_hz;
+        xfer[i].delay_usecs = tr.delay_usecs;
+        xfer[i].bits_per_word = tr.bits_per_word;
+    }
+
+    //ioctl Operation, transmission of data
+    if (ioctl(hardware_SPI.fd, SPI_IOC_MESSAGE(count), xfer) < 1) {
+        DEV_HARDWARE_SPI_Debug("can't send spi message\r\n");
+        return -1;
+    }
+    return 1;
+}
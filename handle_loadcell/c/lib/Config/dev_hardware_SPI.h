@@ -77,6 +77,17 @@ typedef enum
     SPI_4WIRE_Mode = 1
 }BusMode;
 
+/**
+ * One segment of a multi-segment transfer
+**/
+typedef struct {
+    const uint8_t *tx;  // NULL sends zeros
+    uint8_t *rx;        // NULL discards the received bytes
+    uint32_t len;
+} SPI_Segment;
+
+#define SPI_MAX_SEGMENTS 8
+
 
 /**
  * Define SPI attribute
@@ -108,6 +119,7 @@ int DEV_HARDWARE_SPI_setSpeed(uint32_t speed);
 
 uint8_t DEV_HARDWARE_SPI_TransferByte(uint8_t buf);
 int DEV_HARDWARE_SPI_Transfer(uint8_t *buf, uint32_t len);
+int DEV_HARDWARE_SPI_TransferSegments(const SPI_Segment *segments, int count);
 
 void DEV_HARDWARE_SPI_SetDataInterval(uint16_t us);
 int DEV_HARDWARE_SPI_SetBusMode(BusMode mode);
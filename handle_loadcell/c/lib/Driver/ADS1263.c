@@ -31,6 +31,14 @@
 
 UBYTE ScanMode = 0;
 
+#define RDATA_LEN 7     // RDATA command, status, 4 data bytes (ADC2: 3 + pad), CRC
+#define RDATA_RETRIES 100   // RDATA reads without new data before giving up
+
+// Continuous scan state, see ADS1263_ScanStart
+static UBYTE Scan_List[10];
+static int Scan_Number = 0;
+static UBYTE Scan_Interrupt = 0;
+
 /******************************************************************************
 function:   Module reset
 parameter:
@@ -68,10 +76,9 @@ Info:
 ******************************************************************************/
 static void ADS1263_WriteReg(UBYTE Reg, UBYTE data)
 {
+    UBYTE tx[3] = {CMD_WREG | Reg, 0x00, data};
     DEV_Digital_Write(DEV_CS_PIN, 0);
-    DEV_SPI_WriteByte(CMD_WREG | Reg);
-    DEV_SPI_WriteByte(0x00);
-    DEV_SPI_WriteByte(data);
+    DEV_SPI_Transfer(tx, NULL, sizeof(tx));
     DEV_Digital_Write(DEV_CS_PIN, 1);
 }
 
@@ -84,14 +91,11 @@ Info:
 ******************************************************************************/
 static UBYTE ADS1263_Read_data(UBYTE Reg)
 {
-    UBYTE temp = 0;
+    UBYTE buf[3] = {CMD_RREG | Reg, 0x00, 0x00};
     DEV_Digital_Write(DEV_CS_PIN, 0);
-    DEV_SPI_WriteByte(CMD_RREG | Reg);
-    DEV_SPI_WriteByte(0x00);
-    // DEV_Delay_ms(1);
-    temp = DEV_SPI_ReadByte();
+    DEV_SPI_Transfer(buf, buf, sizeof(buf));
     DEV_Digital_Write(DEV_CS_PIN, 1);
-    return temp;
+    return buf[2];
 }
 
 /******************************************************************************
@@ -128,7 +132,7 @@ static void ADS1263_WaitDRDY(void)
     while(1) {
         if(DEV_Digital_Read(DEV_DRDY_PIN) == 0)
             break;
-        if(i >= 4000000) {
+        if(++i >= 4000000) {
             printf("Time Out ...\r\n"); 
             break;
         }
@@ -370,65 +374,100 @@ function:  Read ADC data
 parameter: 
 Info:
 ******************************************************************************/
-static UDOUBLE ADS1263_Read_ADC1_Data(void)
+/******************************************************************************
+function:  Decode the answer to RDATA1
+parameter: 
+    buf : the RDATA_LEN bytes received
+Info:
+    Return the 32 bit conversion
+******************************************************************************/
+static UDOUBLE ADS1263_Decode_ADC1_Data(const UBYTE *buf)
 {
     UDOUBLE read = 0;
-    UBYTE buf[4] = {0, 0, 0, 0};
-    UBYTE Status, CRC;
-    DEV_Digital_Write(DEV_CS_PIN, 0);
-    do {
-        DEV_SPI_WriteByte(CMD_RDATA1);
-        // DEV_Delay_ms(10);
-        Status = DEV_SPI_ReadByte();
-    }while((Status & 0x40) == 0);
-    
-    buf[0] = DEV_SPI_ReadByte();
-    buf[1] = DEV_SPI_ReadByte();
-    buf[2] = DEV_SPI_ReadByte();
-    buf[3] = DEV_SPI_ReadByte();
-    CRC = DEV_SPI_ReadByte();
-    DEV_Digital_Write(DEV_CS_PIN, 1);
-    read |= ((UDOUBLE)buf[0] << 24);
-    read |= ((UDOUBLE)buf[1] << 16);
-    read |= ((UDOUBLE)buf[2] << 8);
-    read |= (UDOUBLE)buf[3];
-    // printf("%x %x %x %x %x %x\r\n", Status, buf[0], buf[1], buf[2], buf[3], CRC);
-    if(ADS1263_Checksum(read, CRC) != 0)
+    read |= ((UDOUBLE)buf[2] << 24);
+    read |= ((UDOUBLE)buf[3] << 16);
+    read |= ((UDOUBLE)buf[4] << 8);
+    read |= (UDOUBLE)buf[5];
+    // printf("%x %x %x %x %x %x\r\n", buf[1], buf[2], buf[3], buf[4], buf[5], buf[6]);
+    if(ADS1263_Checksum(read, buf[6]) != 0)
         printf("ADC1 Data read error! \r\n");
     return read;
 }
 
+/******************************************************************************
+function:  Read RDATA until the status reports new data
+parameter: 
+    tx     : the RDATA command and its padding
+    buf    : the RDATA_LEN bytes received
+    status : new data bit of the status byte
+Info:
+    The reads already in buf count as the first retry.
+    Return 0 on success, 1 on SPI error or no new data after RDATA_RETRIES reads
+******************************************************************************/
+static UBYTE ADS1263_Retry_RDATA(const UBYTE *tx, UBYTE *buf, UBYTE status)
+{
+    int retries = 1;
+    while((buf[1] & status) == 0) {
+        if(retries++ >= RDATA_RETRIES || DEV_SPI_Transfer(tx, buf, RDATA_LEN) != 0)
+            return 1;
+    }
+    return 0;
+}
+
+/******************************************************************************
+function:  Read ADC data
+parameter: 
+    Value : the conversion, unchanged on error
+Info:
+    Command, status, data and CRC in a single transfer, repeated until the
+    status reports new data
+    Return 0 on success, 1 on SPI error or no new data
+******************************************************************************/
+static UBYTE ADS1263_Read_ADC1_Data(UDOUBLE *Value)
+{
+    const UBYTE tx[RDATA_LEN] = {CMD_RDATA1, 0, 0, 0, 0, 0, 0};
+    UBYTE buf[RDATA_LEN] = {0};
+    UBYTE ret;
+    DEV_Digital_Write(DEV_CS_PIN, 0);
+    ret = DEV_SPI_Transfer(tx, buf, RDATA_LEN) != 0 || ADS1263_Retry_RDATA(tx, buf, 0x40) != 0;
+    DEV_Digital_Write(DEV_CS_PIN, 1);
+    if(ret != 0) {
+        printf("ADC1 no data! \r\n");
+        return 1;
+    }
+    *Value = ADS1263_Decode_ADC1_Data(buf);
+    return 0;
+}
+
 /******************************************************************************
 function:  Read ADC data
 parameter: 
+    Value : the conversion, unchanged on error
 Info:
+    Return 0 on success, 1 on SPI error or no new data
 ******************************************************************************/
-static UDOUBLE ADS1263_Read_ADC2_Data(void)
+static UBYTE ADS1263_Read_ADC2_Data(UDOUBLE *Value)
 {
     UDOUBLE read = 0;
-    UBYTE buf[4] = {0, 0, 0, 0};
-    UBYTE Status, CRC;
+    const UBYTE tx[RDATA_LEN] = {CMD_RDATA2, 0, 0, 0, 0, 0, 0};
+    UBYTE buf[RDATA_LEN] = {0};
+    UBYTE ret;
     
     DEV_Digital_Write(DEV_CS_PIN, 0);
-    do {
-        DEV_SPI_WriteByte(CMD_RDATA2);
-        // DEV_Delay_ms(10);
-        Status = DEV_SPI_ReadByte();
-    }while((Status & 0x80) == 0);
-    
-    buf[0] = DEV_SPI_ReadByte();
-    buf[1] = DEV_SPI_ReadByte();
-    buf[2] = DEV_SPI_ReadByte();
-    buf[3] = DEV_SPI_ReadByte();
-    CRC = DEV_SPI_ReadByte();
+    ret = DEV_SPI_Transfer(tx, buf, RDATA_LEN) != 0 || ADS1263_Retry_RDATA(tx, buf, 0x80) != 0;
     DEV_Digital_Write(DEV_CS_PIN, 1);
-    read |= ((UDOUBLE)buf[0] << 16);
-    read |= ((UDOUBLE)buf[1] << 8);
-    read |= (UDOUBLE)buf[2];
-    // printf("%x %x %x %x %x\r\n", Status, buf[0], buf[1], buf[2], CRC);
-    if(ADS1263_Checksum(read, CRC) != 0)
+    if(ret != 0) {
+        printf("ADC2 no data! \r\n");
+        return 1;
+    }
+    read |= ((UDOUBLE)buf[2] << 16);
+    read |= ((UDOUBLE)buf[3] << 8);
+    read |= (UDOUBLE)buf[4];
+    // printf("%x %x %x %x %x\r\n", buf[1], buf[2], buf[3], buf[4], buf[6]);
+    if(ADS1263_Checksum(read, buf[6]) != 0)
         printf("ADC2 Data read error! \r\n");
-    return read;
+    *Value = read;
+    return 0;
 }
 
 /******************************************************************************
@@ -449,7 +488,7 @@ UDOUBLE ADS1263_GetChannalValue(UBYTE Channel)
         // ADS1263_WriteCmd(CMD_START1);
         // DEV_Delay_ms(2);
         ADS1263_WaitDRDY();
-        Value = ADS1263_Read_ADC1_Data();
+        ADS1263_Read_ADC1_Data(&Value);
     } else {
         if(Channel>4) {
             return 0;
@@ -459,7 +498,7 @@ UDOUBLE ADS1263_GetChannalValue(UBYTE Channel)
         // ADS1263_WriteCmd(CMD_START1);
         // DEV_Delay_ms(2);
         ADS1263_WaitDRDY();
-        Value = ADS1263_Read_ADC1_Data();
+        ADS1263_Read_ADC1_Data(&Value);
     }
     // printf("Get IN%d value success \r\n", Channel);
     return Value;
@@ -482,7 +521,7 @@ UDOUBLE ADS1263_GetChannalValue_ADC2(UBYTE Channel)
         // DEV_Delay_ms(2);
         ADS1263_WriteCmd(CMD_START2);
         // DEV_Delay_ms(2);
-        Value = ADS1263_Read_ADC2_Data();
+        ADS1263_Read_ADC2_Data(&Value);
     } else {
         if(Channel>4) {
             return 0;
@@ -491,7 +530,7 @@ UDOUBLE ADS1263_GetChannalValue_ADC2(UBYTE Channel)
         // DEV_Delay_ms(2);
         ADS1263_WriteCmd(CMD_START2);
         // DEV_Delay_ms(2);
-        Value = ADS1263_Read_ADC2_Data();
+        ADS1263_Read_ADC2_Data(&Value);
     }
     // printf("Get IN%d value success \r\n", Channel);
     return Value;
@@ -530,6 +569,132 @@ void ADS1263_GetAll_ADC2(UDOUBLE *ADC_Value)
     // printf("----------Read ADC2 value success----------\r\n");
 }
 
+/******************************************************************************
+function:  ADC1 input mux of a channel
+parameter: 
+    Channel : channel number, single-ended or differential (see ScanMode)
+Info:
+******************************************************************************/
+static UBYTE ADS1263_Mux(UBYTE Channel)
+{
+    if(ScanMode == 0) {
+        return (Channel << 4) | 0x0a;       //0x0a:VCOM as Negative Input
+    }
+    return ((2 * Channel) << 4) | (2 * Channel + 1);    //DiffChannal AIN2n-AIN2n+1
+}
+
+/******************************************************************************
+function:  Switch the ADC1 input mux and read the last conversion
+parameter: 
+    Channel : next channel to convert
+Info:
+    Writing INPMUX restarts the conversion, the result of the previous one
+    stays in the data register: WREG and RDATA1 go in one SPI message.
+    Value : the conversion of the previous channel, unchanged on error
+    Return 0 on success, 1 on SPI error or no new data
+******************************************************************************/
+static UBYTE ADS1263_SwitchMux_Read_ADC1_Data(UBYTE Channel, UDOUBLE *Value)
+{
+    const UBYTE wreg[3] = {CMD_WREG | REG_INPMUX, 0x00, ADS1263_Mux(Channel)};
+    const UBYTE rdata[RDATA_LEN] = {CMD_RDATA1, 0, 0, 0, 0, 0, 0};
+    UBYTE buf[RDATA_LEN] = {0};
+    UBYTE ret;
+    DEV_SPI_Segment seg[2] = {
+        {wreg, NULL, sizeof(wreg)},
+        {rdata, buf, RDATA_LEN},
+    };
+    DEV_Digital_Write(DEV_CS_PIN, 0);
+    // no new data yet (e.g. the edge was missed): read again
+    ret = DEV_SPI_TransferSegments(seg, 2) != 0 || ADS1263_Retry_RDATA(rdata, buf, 0x40) != 0;
+    DEV_Digital_Write(DEV_CS_PIN, 1);
+    if(ret != 0) {
+        printf("ADC1 no data! \r\n");
+        return 1;
+    }
+    *Value = ADS1263_Decode_ADC1_Data(buf);
+    return 0;
+}
+
+/******************************************************************************
+function:  Start the continuous scan of a list of channels
+parameter: 
+    List   : channels to convert, in order
+    Number : number of channels, at most 10
+Info:
+    ADC1 keeps converting: each conversion is read on its DRDY falling edge,
+    right after switching the mux to the next channel, so that the settling
+    of the next conversion overlaps the read of the current one.
+    Return 0 when DRDY is waited for by interrupt, 1 when the scan falls
+    back to polling the pin
+******************************************************************************/
+UBYTE ADS1263_ScanStart(UBYTE *List, int Number)
+{
+    int i;
+    if(Number > 10) {
+        Number = 10;
+    }
+    for(i = 0; i < Number; i++) {
+        Scan_List[i] = List[i];
+    }
+    Scan_Number = Number;
+    if(Number <= 0) {
+        return 1;
+    }
+    if(ScanMode == 0) {
+        ADS1263_SetChannal(Scan_List[0]);
+    } else {
+        ADS1263_SetDiffChannal(Scan_List[0]);
+    }
+    // enabled after the mux switch, so that no edge of the old channel is pending
+    Scan_Interrupt = DEV_DRDY_Interrupt_Init() == 0;
+    if(!Scan_Interrupt) {
+        printf("DRDY interrupt not available, scanning by polling \r\n");
+    }
+    return !Scan_Interrupt;
+}
+
+/******************************************************************************
+function:  Read one conversion of every scanned channel
+parameter: 
+    Value      : one value per channel, in the order of the scan list
+    timeout_ms : maximum wait for each conversion
+Info:
+    Return 0 on success, 1 on DRDY timeout, 2 on SPI error or no new data
+******************************************************************************/
+UBYTE ADS1263_ScanFrame(UDOUBLE *Value, UDOUBLE timeout_ms)
+{
+    int i;
+    for(i = 0; i < Scan_Number; i++) {
+        if(Scan_Interrupt) {
+            if(DEV_DRDY_Wait(timeout_ms) != 0) {
+                return 1;
+            }
+        } else {
+            ADS1263_WaitDRDY();
+        }
+        // start the next channel's conversion first, the result of this one stays in the data register
+        if(Scan_Number > 1) {
+            if(ADS1263_SwitchMux_Read_ADC1_Data(Scan_List[(i + 1) % Scan_Number], &Value[i]) != 0) {
+                return 2;
+            }
+        } else if(ADS1263_Read_ADC1_Data(&Value[i]) != 0) {
+            return 2;
+        }
+    }
+    return 0;
+}
+
+/******************************************************************************
+function:  Stop the continuous scan
+parameter: 
+Info:
+    ADC1 keeps converting, ADS1263_GetAll can be used again
+******************************************************************************/
+void ADS1263_ScanStop(void)
+{
+    Scan_Number = 0;
+}
+
 /******************************************************************************
 function:  RTD Test function
 parameter: 
@@ -575,7 +740,8 @@ UDOUBLE ADS1263_RTD(ADS1263_DELAY delay, ADS1263_GAIN gain, ADS1263_DRATE drate)
     ADS1263_WriteCmd(CMD_START1);
     DEV_Delay_ms(10);
     ADS1263_WaitDRDY();
-    Value = ADS1263_Read_ADC1_Data();
+    Value = 0;
+    ADS1263_Read_ADC1_Data(&Value);
     ADS1263_WriteCmd(CMD_STOP1);
 
     return Value;
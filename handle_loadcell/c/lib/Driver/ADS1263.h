@@ -188,6 +188,9 @@ void ADS1263_SetMode(UBYTE Mode);
 UDOUBLE ADS1263_GetChannalValue(UBYTE Channel);
 void ADS1263_GetAll(UBYTE *List, UDOUBLE *Value, int Number);
 void ADS1263_GetAll_ADC2(UDOUBLE *ADC_Value);
+UBYTE ADS1263_ScanStart(UBYTE *List, int Number);
+UBYTE ADS1263_ScanFrame(UDOUBLE *Value, UDOUBLE timeout_ms);
+void ADS1263_ScanStop(void);
 UDOUBLE ADS1263_RTD(ADS1263_DELAY delay, ADS1263_GAIN gain, ADS1263_DRATE drate);
 void ADS1263_DAC(ADS1263_DAC_VOLT volt, UBYTE isPositive, UBYTE isClose);
 #endif
\ No newline at end of file
@@ -16,10 +16,23 @@
 #include <filter.hpp>
 #include <nlohmann/json.hpp>
 #include <pugg/Kernel.h>
+#include <algorithm>
 #include <array>
+#include <atomic>
 #include <chrono>
 #include <cstdint>
 #include <map>
+#include <mutex>
+#include <thread>
+#include <command.hpp>
+#include <heartbeat.hpp>
+#include <idle_sleep.hpp>
+#include <message_template.hpp>
+#include <perf.hpp>
+#include <realtime_thread.hpp>
+#include <running_stats.hpp>
+#include <sample_frame.hpp>
+#include <spsc_ring.hpp>
 
 #ifdef RASPBERRYPI_PLATFORM
   extern "C" {
@@ -41,6 +54,8 @@
 // Load the namespaces
 using namespace std;
 using json = nlohmann::json;
+using message_template::assign;
+using message_template::field;
 
 
 // Plugin class. This shall be the only part that needs to be modified,
@@ -50,6 +65,7 @@ class Handle_loadcellPlugin : public Filter<json, json> {
 public:
 
   ~Handle_loadcellPlugin() override {
+    stop_scan(); // the scan thread must not outlive the ADC
 #ifdef RASPBERRYPI_PLATFORM
     if (_adc_initialized) {
       DEV_Module_Exit();
@@ -69,22 +85,30 @@ public:
   // return_type::critical: execution stops
   return_type load_data(json const &input, string topic = "", vector<unsigned char> const *blob = nullptr) override {
     
-    // if topic contains the "command" field, process commands here
-    if (input.contains("command")) {
-
-      string action = input.value("command", ""); // Get the command, default to empty string if not found
-      if (action == "start") {
+    // if topic contains the "command" field, process commands here (dispatched on their code, see command.hpp)
+    const command::Code action = command::decode(input);
+    switch (action) {
 
+      case command::Code::start:
         _recording = true;
+        _calibration.restart(); // a pending calibration starts over after the acquisition
+        _sequence = 0;
+        clear_frame();
+        if (_scan_mode) {
+          start_scan();
+        }
+        _ack.applied(input, action); // as soon as the acquisition is started, for the start skew of the crutches
         std::cout << std::endl << "Starting acquisition" << std::endl;
+        break;
 
-      } else if (action == "stop") {
-
-        _recording = false;
+      case command::Code::stop:
+        _recording = false; // a partial frame, if any, is sent by the next process()
+        stop_scan(); // frames left in the ring are sent by the next process() calls
+        _ack.applied(input, action);
         std::cout << std::endl << "Stopping acquisition" << std::endl;
+        break;
 
-      } else if (action == "set_offset") {
-        
+      case command::Code::set_offset:
         // Setting offset is only allowed when not recording, if we are recording return an error
         // This is to avoid changing the offset while we are acquiring data, which could lead to inconsistent data and make it difficult to understand the actual forces being applied on the crutches.
         if (_recording) {
@@ -93,14 +117,14 @@ public:
         }
 
         _setting_offset = true;
+        _calibration.start(_offset_frames, _offset_test_frames);
+        _ack.applied(input, action);
         std::cout << std::endl << "Setting offset" << std::endl;
+        break;
 
-      } else {
+      default:
+        // if the message doesn't contain a command, we don't know how to handle it, so we retry
         return return_type::retry;
-      }
-    } else {
-      // if the message doesn't contain a command, we don't know how to handle it, so we retry
-      return return_type::retry;
     }
     
     return return_type::success;
@@ -115,16 +139,17 @@ public:
   // return_type::error: _error is traced via register_event, don't publish
   // return_type::critical: execution stops
   return_type process(json &out, vector<unsigned char> *blob = nullptr) override {
-    out.clear();
-    const auto process_start = std::chrono::steady_clock::now();
+    perf::Timer process_timer(_perf_process);
+    _message.begin(out); // the fields of the previous message are updated in place
+    if (_binary_mode && blob != nullptr) {
+      blob->clear(); // only messages with a sample carry a frame
+    }
 
     // Not valid states or transitions are handled in load_data, here we just process data
     // Here we should have only valid states and errors related to reading the sensor
 
-    // Send periodic agent_status if 500ms have passed
     auto now = std::chrono::steady_clock::now();
-    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(now - _last_health_status_time).count();
-    
+
     if (_process_cycles <= 1000000000) {
       ++_process_cycles;
     } else {
@@ -132,77 +157,104 @@ public:
     }
 
     // load the data as necessary and set the fields of the json out variable
-    if (_recording || _setting_offset || elapsed >= _health_status_period) {
+    const bool health_status_due = _heartbeat.due(_recording, now);
+    const bool must_send = health_status_due || _ack.pending(); // the ack of a command is not delayed to the next frame
+    if (_recording || _setting_offset || _frame_samples > 0 || !_scan_frames.empty() || must_send) {
       
-      if (elapsed >= _health_status_period) {
-        out["agent_status"] = _recording ? "recording" : "idle";
-        _last_health_status_time = now;
+      if (health_status_due) {
+        assign(_message["agent_status"], _recording ? "recording" : "idle");
+        if (_scan_mode) {
+          field(_message.object("info"), "scan") = scan_statistics(now);
+        }
+        _heartbeat.sent(_recording, now);
       } 
 
-      if (_recording){
-        #ifdef RASPBERRYPI_PLATFORM
-            if (!_adc_initialized) {
-              _error = "ADS1263 not initialized: call set_params() before process().";
-              return return_type::error;
-            }
+      if (_scan_mode && (_recording || !_scan_frames.empty())) {
+
+        {
+          std::lock_guard<std::mutex> lock(_scan_mutex);
+          if (!_scan_error.empty()) {
+            _error = "recording: " + _scan_error;
+            _scan_error.clear();
+            return return_type::error;
+          }
+        }
 
-            ADS1263_GetAll(_channel_list.data(), _raw_values.data(), static_cast<int>(_channel_list.size()));
+        // the channels are converted by the scan thread, here we only drain the ring
+        if (!drain_scan_frames(blob)) {
+          if (!_recording && _frame_samples > 0) {
+            // acquisition stopped and the ring is empty: send the partial frame
+            send_frame(blob);
+          } else if (!must_send) {
+            return return_type::retry;
+          }
+        }
 
-            out["force"] = build_channels_forces(true);
-        #else
+      } else if (_recording){
 
-          // If we are not on a Raspberry Pi, we emulate the load cell readings by generating random values, which can be useful for development and testing on non-Raspberry Pi machines
-          out["force"] = static_cast<float>(rand()) / static_cast<float>(RAND_MAX) * 100.0; // Random value between 0 and 100 N
+        if (!read_adc()) {
+          return return_type::error;
+        }
 
-        #endif
-      } else if (_setting_offset) {
-        #ifdef RASPBERRYPI_PLATFORM
-          if (!_adc_initialized) {
-            _error = "ADS1263 not initialized: call set_params() before process().";
-            return return_type::error;
-          }
+        // until the frame is complete there is nothing to send, unless the health status is due
+        if (!add_sample(steady_clock_us(), blob) && !must_send) {
+          return return_type::retry;
+        }
 
-          ADS1263_GetAll(_channel_list.data(), _raw_values.data(), static_cast<int>(_channel_list.size()));
-          calibrate_channel_offsets();
-          _setting_offset = false;
+      } else if (_frame_samples > 0) {
 
-          ADS1263_GetAll(_channel_list.data(), _raw_values.data(), static_cast<int>(_channel_list.size()));
-          out["info"]["offset"]["value"] = offsets_as_json();
-          out["info"]["offset"]["test"] = build_channels_forces(true);
-          out["agent_status"] = "idle";
+        // acquisition stopped with a partial frame: send it
+        send_frame(blob);
 
-        #else
-          // Emulated offset calibration path uses the same channel computation pipeline.
-          for (size_t i = 0; i < _raw_values.size(); ++i) {
-            _raw_values[i] = static_cast<uint32_t>(rand());
-          }
+      } else if (_setting_offset) {
 
-          calibrate_channel_offsets();
+        // one frame per cycle, so that calibrating does not stall the agent loop
+        if (!read_adc()) {
+          return return_type::error;
+        }
+        convert_raw(false);
+        if (_calibration.add(_forces.data())) {
+          _channel_offsets = _calibration.offset();
           _setting_offset = false;
 
-          for (size_t i = 0; i < _raw_values.size(); ++i) {
-            _raw_values[i] = static_cast<uint32_t>(rand());
+          // Store the offsets, the test read and the noise of each channel in the output json for user feedback
+          array<double, 8> test{};
+          for (size_t i = 0; i < test.size(); ++i) {
+            test[i] = _calibration.test(i);
           }
-
-          out["info"]["offset"]["value"] = offsets_as_json();
-          out["info"]["offset"]["test"] = build_channels_forces(true);
-          out["agent_status"] = "idle";
-
-        #endif
+          json &offset = field(_message.object("info"), "offset");
+          field(offset, "value") = channels_as_json(_channel_offsets);
+          field(offset, "test") = channels_as_json(test);
+          field(offset, "std") = channels_as_json(_calibration.stddev());
+          assign(field(offset, "samples"), _calibration.samples());
+          assign(_message["agent_status"], "idle");
+        } else if (!must_send) {
+          return return_type::retry;
+        }
 
       }
 
     } else {
       // if there is no command to send and not enough time has passed, don't send anything
+      // (idle: sleep until the next agent_status, if enabled)
+      process_timer.discard();
+      _idle.until(_heartbeat.next_due(_recording));
       return return_type::retry;
     }  
 
-    // If there is a message to send, we must send the crutch side
-    out["side"] = _side;
-
-    // This sets the agent_id field in the output json object, only when it is
-    // not empty
-    if (!_agent_id.empty()) out["agent_id"] = _agent_id;
+    if (perf::enabled) {
+      const uint64_t now_ns = perf::now_ns();
+      if (_last_publish_ns > 0) {
+        _perf_cycle.record(now_ns - _last_publish_ns);
+      }
+      _last_publish_ns = now_ns;
+    }
+    if (_ack.pending()) {
+      _ack.write(_message.object("ack"));
+    }
+    // If there is a message to send, we must send the crutch side and the agent_id (constants of _message)
+    _message.finish();
+    _perf.publish_if_due(out);
     return return_type::success;
   }
   
@@ -219,12 +271,33 @@ public:
     }
 
     _params["ref_voltage"] = _params.value("ref_voltage", 4.12);
-    _health_status_period = _params.value("health_status_period", 500); // default to 500 ms
+    _heartbeat.configure(_params); // health_status_period, default to 500 ms, and health_status_mode
+    _perf.configure(_params); // perf_period, default to 5000 ms
+    _idle.configure(_params); // idle_sleep, default to false, and idle_max_sleep, default to 200 ms
     _adc1_rate = _params.value("adc1_rate", 7); // ADS1263_100SPS by default
+    _binary_mode = _params.value("binary_mode", false); // send samples as binary frames in the message blob
+    _samples_per_frame = max(1, _params.value("samples_per_frame", 1)); // readings sent in each message
+    for (auto &channel_forces : _frame_forces) {
+      channel_forces.reserve(_samples_per_frame);
+    }
+    _frame_t_us.reserve(_samples_per_frame);
+
+    // Continuous scan: a dedicated thread converts the channels on the DRDY interrupt, independently of the MADS loop
+    stop_scan();
+    _scan_mode = _params.value("scan_mode", false);
+    _thread_priority = _params.value("thread_priority", 0); // SCHED_FIFO priority (1-99), 0 keeps the default scheduling
+    _thread_cpu = _params.value("thread_cpu", -1); // core the thread is pinned to, -1 for no pinning
+    _scan_frames.reset(max(1, _params.value("ring_size", 256))); // frames buffered between the thread and process()
+    if (!sample_frame::kind_from_string(_params.value("binary_payload", "force_f32"), _frame_kind)) {
+      _error = "binary_payload parameter invalid (only 'force_f32' or 'raw_i32' allowed).";
+      std::cout << _error << std::endl;
+      throw std::runtime_error(_error);
+    }
 
     if (_params.contains("side") && (_params["side"] == "left" || _params["side"] == "right")) {
       _side = _params["side"].get<string>();
       _agent_id = "handle_loadcell_" + _side; // this is useful when the side field is not reachable
+      _frame_side = sample_frame::side_from_string(_side);
       std::cout << "Side set to " << _side << std::endl;
     } else {
       _error = "Side parameter not set or invalid (only 'left' or 'right' allowed).";
@@ -258,6 +331,33 @@ public:
       }
     }
 
+    _offset_frames = max(1, _params.value("offset_frames", 20)); // readings averaged by set_offset
+    _offset_test_frames = max(0, _params.value("offset_test_frames", 1)); // readings of the test after the offset
+
+    // Calibration tables in channel list order, so that the per-sample conversion does no lookups
+    for (size_t i = 0; i < _channel_list.size(); ++i) {
+      const int channel_idx = static_cast<int>(_channel_list[i]);
+      const auto label_it = _input_map.find(channel_idx);
+      _channel_labels[i] = (label_it != _input_map.end()) ? label_it->second : ("IN" + to_string(channel_idx));
+      const auto range_it = _range_map.find(channel_idx);
+      _channel_ranges[i] = (range_it != _range_map.end()) ? range_it->second : 1.0;
+    }
+
+    // Descriptor of the binary frames: one channel per label, in channel list order, stored in the "force.<label>" datasets
+    _frame_descriptor = {
+      {"kind", sample_frame::kind_name(_frame_kind)},
+      {"key", "force"},
+      {"channels", json::array()}
+    };
+    for (size_t i = 0; i < _channel_list.size(); ++i) {
+      _frame_descriptor["channels"].push_back(_channel_labels[i]);
+    }
+
+    // Fields of every message, the others may have new labels
+    _message.reset();
+    _message.set_constant("side", _side);
+    _message.set_constant("agent_id", _agent_id.empty() ? json() : json(_agent_id));
+
     #ifdef RASPBERRYPI_PLATFORM
       if (_adc_initialized) {
         DEV_Module_Exit();
@@ -285,6 +385,7 @@ public:
     #endif
     
     _setting_offset = true; // Set offset at the beginning
+    _calibration.start(_offset_frames, _offset_test_frames);
   }
 
   // Implement this method if you want to provide additional information
@@ -292,66 +393,265 @@ public:
     // return a map of strings with additional information about the plugin
     // it is used to print the information about the plugin when it is loaded
     // by the agent
-    
-    return {};
+    map<string, string> info_map;
+    if (_scan_mode) {
+      info_map["Continuous scan"] = json(adc1_sps()).dump() + " SPS, ring size " + to_string(_scan_frames.capacity()) +
+        ", priority " + (_thread_priority > 0 ? "SCHED_FIFO " + to_string(_thread_priority) : string("default")) +
+        ", cpu " + (_thread_cpu >= 0 ? to_string(_thread_cpu) : string("any"));
+    } else {
+      info_map["Continuous scan"] = "off";
+    }
+    return info_map;
     
   };
 
 private:
-  double raw_to_ratio(uint32_t raw) const {
-    const bool negative = (raw >> 31U) == 1U;
-    return negative ? -(2.0 - static_cast<double>(raw) / 2147483648.0) : (static_cast<double>(raw) / 2147483647.0);
+  // Monotonic timestamp of a reading, in microseconds
+  static uint64_t steady_clock_us() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+  }
+
+  // Nominal ADC1 data rate of the configured adc1_rate index (see ADS1263_DRATE)
+  double adc1_sps() const {
+    static constexpr array<double, 16> rates{
+      2.5, 5, 10, 16.6, 20, 50, 60, 100, 400, 1200, 2400, 4800, 7200, 14400, 19200, 38400
+    };
+    return rates[static_cast<size_t>(std::clamp(_adc1_rate, 0, 15))];
   }
 
-  string channel_label(int channel_idx) const {
-    const auto label_it = _input_map.find(channel_idx);
-    return (label_it != _input_map.end()) ? label_it->second : ("IN" + to_string(channel_idx));
+  // One conversion of every channel of the list, read by the scan thread
+  struct ScanFrame {
+    uint64_t t_us; // when the last channel has been read
+    array<uint32_t, 8> raw;
+  };
+
+  // Move the frames converted by the scan thread into the current message frame, stopping as soon as a
+  // message frame is sent (one message per process() call). Returns true if a frame has been sent.
+  bool drain_scan_frames(vector<unsigned char> *blob) {
+    while (const ScanFrame *frame = _scan_frames.front()) {
+      _raw_values = frame->raw;
+      const uint64_t t_us = frame->t_us;
+      _scan_frames.pop();
+      if (add_sample(t_us, blob)) {
+        return true;
+      }
+    }
+    return false;
   }
 
-  double channel_range(int channel_idx) const {
-    const auto range_it = _range_map.find(channel_idx);
-    return (range_it != _range_map.end()) ? range_it->second : 1.0;
+  void start_scan() {
+    stop_scan();
+    _scan_frames.reset(_scan_frames.capacity());
+    _scan_overruns = 0;
+    _scan_count = 0;
+    _scan_cpu_us = 0;
+    _last_scan_count = 0;
+    _last_scan_cpu_us = 0;
+    _last_scan_stats_time = std::chrono::steady_clock::now();
+    _scanning = true;
+    _scan_thread = thread(&Handle_loadcellPlugin::scan_loop, this);
+    configure_realtime_thread(_scan_thread, _thread_priority, _thread_cpu, "[handle_loadcell] ");
+  }
+
+  void stop_scan() {
+    if (!_scan_thread.joinable()) {
+      return;
+    }
+    _scanning = false;
+    _scan_thread.join();
   }
 
-  double channel_offset(int channel_idx) const {
-    const auto offset_it = _offset_map.find(channel_idx);
-    return (offset_it != _offset_map.end()) ? offset_it->second : 0.0;
+  // Body of the scan thread: the driver sleeps on the DRDY edge of each conversion and switches the
+  // mux to the next channel right after it, a complete frame is stamped and pushed into the ring
+  void scan_loop() {
+    const int channels = static_cast<int>(_channel_list.size());
+    ScanFrame frame{};
+  #ifdef RASPBERRYPI_PLATFORM
+    // a conversion should never take more than 4 sample periods
+    const UDOUBLE timeout_ms = static_cast<UDOUBLE>(max(100.0, 4000.0 / adc1_sps()));
+    UBYTE list[8];
+    for (int i = 0; i < channels; ++i) {
+      list[i] = _channel_list[i];
+    }
+    ADS1263_ScanStart(list, channels);
+  #else
+    // emulated conversions at the nominal data rate
+    const auto frame_period = std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+      std::chrono::duration<double>(channels / adc1_sps()));
+    auto next = std::chrono::steady_clock::now();
+  #endif
+    const double cpu_start = thread_cpu_seconds();
+    while (_scanning.load(std::memory_order_acquire)) {
+    #ifdef RASPBERRYPI_PLATFORM
+      UDOUBLE values[8];
+      if (UBYTE ret = ADS1263_ScanFrame(values, timeout_ms); ret != 0) {
+        std::lock_guard<std::mutex> lock(_scan_mutex);
+        _scan_error = ret == 1 ? "ADS1263 DRDY timeout in continuous scan"
+                               : "ADS1263 read error in continuous scan";
+        break;
+      }
+      for (int i = 0; i < channels; ++i) {
+        frame.raw[i] = values[i];
+      }
+    #else
+      next += frame_period;
+      std::this_thread::sleep_until(next);
+      for (int i = 0; i < channels; ++i) {
+        frame.raw[i] = static_cast<uint32_t>(rand());
+      }
+    #endif
+      frame.t_us = steady_clock_us();
+      if (!_scan_frames.push(frame)) {
+        _scan_overruns.fetch_add(1, std::memory_order_relaxed); // process() is not keeping up, the frame is lost
+      }
+      _scan_count.fetch_add(1, std::memory_order_relaxed);
+      _scan_cpu_us.store(static_cast<uint64_t>((thread_cpu_seconds() - cpu_start) * 1e6), std::memory_order_relaxed);
+    }
+  #ifdef RASPBERRYPI_PLATFORM
+    ADS1263_ScanStop();
+  #endif
   }
 
-  json build_channels_forces(bool apply_offset) const {
-    json channels = json::object();
+  // Frame rate and CPU usage of the scan thread since the last report
+  json scan_statistics(std::chrono::steady_clock::time_point now) {
+    const uint64_t count = _scan_count.load(std::memory_order_relaxed);
+    const uint64_t cpu_us = _scan_cpu_us.load(std::memory_order_relaxed);
+    const double wall_s = std::chrono::duration<double>(now - _last_scan_stats_time).count();
+    json stats;
+    stats["frame_rate"] = wall_s > 0 ? (count - _last_scan_count) / wall_s : 0.0; // Hz
+    stats["cpu_percent"] = wall_s > 0 ? (cpu_us - _last_scan_cpu_us) / (wall_s * 1e4) : 0.0;
+    stats["ring_size"] = _scan_frames.capacity();
+    stats["high_water"] = _scan_frames.high_water();
+    stats["overruns"] = _scan_overruns.load(std::memory_order_relaxed);
+    _last_scan_count = count;
+    _last_scan_cpu_us = cpu_us;
+    _last_scan_stats_time = now;
+    return stats;
+  }
 
-    for (size_t i = 0; i < _channel_list.size(); ++i) {
-      const int channel_idx = static_cast<int>(_channel_list[i]);
-      const double ratio = raw_to_ratio(_raw_values[i]);
-      const double range = channel_range(channel_idx);
-      const double offset = apply_offset ? channel_offset(channel_idx) : 0.0;
-      channels[channel_label(channel_idx)] = ratio * range - offset;
+  // Read one conversion of every channel into _raw_values, false (with _error set) if the ADC is not available
+  bool read_adc() {
+    perf::Timer timer(_perf_read);
+  #ifdef RASPBERRYPI_PLATFORM
+    if (!_adc_initialized) {
+      _error = "ADS1263 not initialized: call set_params() before process().";
+      return false;
+    }
+    ADS1263_GetAll(_channel_list.data(), _raw_values.data(), static_cast<int>(_channel_list.size()));
+  #else
+    // If we are not on a Raspberry Pi, we emulate the ADC conversions with random values, going through the same channel pipeline
+    for (size_t i = 0; i < _raw_values.size(); ++i) {
+      _raw_values[i] = static_cast<uint32_t>(rand());
     }
+  #endif
+    return true;
+  }
 
-    return channels;
+  // Convert the last raw reading into _forces: two's complement counts to a [-1, 1] ratio of the
+  // reference, times the range of the channel, minus its offset. No lookups and no branches, so that
+  // the compiler can vectorize the loop over the channels.
+  void convert_raw(bool apply_offset) {
+    const double offset_scale = apply_offset ? 1.0 : 0.0;
+    for (size_t i = 0; i < _forces.size(); ++i) {
+      const double counts = static_cast<int32_t>(_raw_values[i]);
+      const double ratio = counts / (counts < 0.0 ? 2147483648.0 : 2147483647.0);
+      _forces[i] = ratio * _channel_ranges[i] - offset_scale * _channel_offsets[i];
+    }
   }
 
-  void calibrate_channel_offsets() {
-    const json baseline = build_channels_forces(false);
+  // The last reading, keyed by the channel labels, written in place
+  void write_forces(json &node) const {
     for (size_t i = 0; i < _channel_list.size(); ++i) {
-      const int channel_idx = static_cast<int>(_channel_list[i]);
-      const string label = channel_label(channel_idx);
-      if (baseline.contains(label) && baseline[label].is_number()) {
-        _offset_map[channel_idx] = baseline[label].get<double>();
-      }
+      assign(field(node, _channel_labels[i].c_str()), _forces[i]);
     }
   }
 
-  json offsets_as_json() const {
+  // One value per channel, keyed by the channel labels
+  json channels_as_json(const array<double, 8> &values) const {
     json out = json::object();
     for (size_t i = 0; i < _channel_list.size(); ++i) {
-      const int channel_idx = static_cast<int>(_channel_list[i]);
-      out[channel_label(channel_idx)] = channel_offset(channel_idx);
+      out[_channel_labels[i]] = values[i];
     }
     return out;
   }
 
+  // Add the last reading to the current frame, returns true if the frame is complete and has been sent
+  // With one sample per frame the json carries the "force" object of scalars, as before
+  bool add_sample(uint64_t t_us, vector<unsigned char> *blob) {
+    perf::Timer timer(_perf_json);
+    if (!(_binary_mode && blob != nullptr && _frame_kind == sample_frame::Kind::raw_i32)) {
+      convert_raw(true);
+    }
+    if (_binary_mode && blob != nullptr) {
+      write_frame_sample(t_us);
+    } else if (_samples_per_frame > 1) {
+      for (size_t i = 0; i < _channel_list.size(); ++i) {
+        _frame_forces[i].push_back(_forces[i]);
+      }
+      _frame_t_us.push_back(t_us);
+    } else {
+      write_forces(_message["force"]);
+      if (_scan_mode) {
+        assign(_message["t_us"], t_us); // the conversion time is not the sending time
+      }
+      ++_sequence;
+      return true;
+    }
+    ++_sequence;
+    if (++_frame_samples < _samples_per_frame) {
+      return false;
+    }
+    send_frame(blob);
+    return true;
+  }
+
+  // Move the samples collected so far into the message: the frame goes in the blob (binary mode),
+  // or one array per label in "force" and the "t_us" array go in the json together with the number of "samples"
+  void send_frame(vector<unsigned char> *blob) {
+    if (_binary_mode && blob != nullptr) {
+      blob->swap(_frame_buffer); // no copy, the old blob buffer is reused for the next frame
+      assign(_message["frame"], _frame_descriptor);
+    } else {
+      json &force = _message["force"];
+      for (size_t i = 0; i < _channel_list.size(); ++i) {
+        assign(field(force, _channel_labels[i].c_str()), _frame_forces[i]);
+      }
+      assign(_message["t_us"], _frame_t_us);
+      assign(_message["samples"], _frame_t_us.size());
+    }
+    clear_frame();
+  }
+
+  void clear_frame() {
+    for (auto &channel_forces : _frame_forces) {
+      channel_forces.clear();
+    }
+    _frame_t_us.clear();
+    _frame_samples = 0;
+  }
+
+  // Pack the last reading into the binary frame (see sample_frame.hpp), as forces or raw ADC counts
+  void write_frame_sample(uint64_t timestamp_us) {
+    sample_frame::Writer frame(_frame_buffer);
+    if (_frame_samples == 0) {
+      frame.begin(_frame_side, _frame_kind, static_cast<uint8_t>(_channel_list.size()), _sequence);
+    }
+    if (_frame_kind == sample_frame::Kind::raw_i32) {
+      array<int32_t, 8> counts;
+      for (size_t i = 0; i < _channel_list.size(); ++i) {
+        counts[i] = static_cast<int32_t>(_raw_values[i]);
+      }
+      frame.add_sample(timestamp_us, counts.data());
+    } else {
+      array<float, 8> forces;
+      for (size_t i = 0; i < _channel_list.size(); ++i) {
+        forces[i] = static_cast<float>(_forces[i]);
+      }
+      frame.add_sample(timestamp_us, forces.data());
+    }
+  }
+
   // Define the fields that are used to store internal resources
 
   // Control flags
@@ -360,8 +660,10 @@ private:
 
   string _side = "unknown";
 
-  int _health_status_period = 500; // in milliseconds, default to 500 ms
-  std::chrono::steady_clock::time_point _last_health_status_time = std::chrono::steady_clock::now();
+  Heartbeat _heartbeat; // schedules the agent_status messages
+  command::Ack _ack; // of the last command, sent in the next message
+  IdleSleep _idle; // sleep in process() while idle
+  MessageTemplate _message; // output messages, updated in place in out
   unsigned long long _process_cycles = 0; // I dont know way, but without this counter the agent blocks after one process cycle
   int _adc1_rate = 7;
 
@@ -374,12 +676,57 @@ private:
     {0, 1.0}, {1, 1.0}, {2, 1.0}, {3, 1.0},
     {4, 1.0}, {5, 1.0}, {6, 1.0}, {7, 1.0}
   };
-  map<int, double> _offset_map{
-    {0, 0.0}, {1, 0.0}, {2, 0.0}, {3, 0.0},
-    {4, 0.0}, {5, 0.0}, {6, 0.0}, {7, 0.0}
-  };
+  int _offset_frames = 20;
+  int _offset_test_frames = 1;
+  OffsetCalibration<8> _calibration; // spread over several process() cycles
+
+  // Calibration resolved by set_params(), in channel list order
+  array<string, 8> _channel_labels;
+  array<double, 8> _channel_ranges{};
+  array<double, 8> _channel_offsets{};
+
   array<uint32_t, 8> _raw_values{};
+  array<double, 8> _forces{}; // last reading converted by convert_raw()
   bool _adc_initialized = false;
+
+  // Binary mode
+  bool _binary_mode = false;
+  sample_frame::Kind _frame_kind = sample_frame::Kind::force_f32;
+  sample_frame::Side _frame_side = sample_frame::Side::unknown;
+  uint32_t _sequence = 0; // sequence number of the next sample, reset at every start
+  json _frame_descriptor;
+
+  // Multi-sample frames
+  int _samples_per_frame = 1;
+  int _frame_samples = 0; // readings in the current, not yet sent, frame
+  vector<unsigned char> _frame_buffer; // binary frame being filled
+  array<vector<double>, 8> _frame_forces; // json frame being filled, one vector per channel
+  vector<uint64_t> _frame_t_us;
+
+  // Continuous scan
+  bool _scan_mode = false;
+  int _thread_priority = 0;
+  int _thread_cpu = -1;
+  SpscRing<ScanFrame> _scan_frames{256}; // producer: scan thread, consumer: process()
+  thread _scan_thread;
+  std::atomic<bool> _scanning{false};
+  std::atomic<uint64_t> _scan_overruns{0}; // frames lost because the ring was full
+  std::atomic<uint64_t> _scan_count{0}; // frames converted since start
+  std::atomic<uint64_t> _scan_cpu_us{0}; // CPU time of the scan thread since start
+  uint64_t _last_scan_count = 0;
+  uint64_t _last_scan_cpu_us = 0;
+  std::chrono::steady_clock::time_point _last_scan_stats_time;
+  std::mutex _scan_mutex;
+  string _scan_error; // guarded by _scan_mutex
+
+  // Latency histograms, compiled in with -DPERF_INSTRUMENTATION
+  perf::Histogram _perf_read;    // read_adc(), all the channels
+  perf::Histogram _perf_json;    // add_sample(), conversion, frame and json building
+  perf::Histogram _perf_process; // process()
+  perf::Histogram _perf_cycle;   // between two published messages
+  uint64_t _last_publish_ns = 0;
+  perf::Report _perf{{"adc_read", &_perf_read}, {"json", &_perf_json},
+                     {"process", &_perf_process}, {"cycle", &_perf_cycle}};
 };
 
 
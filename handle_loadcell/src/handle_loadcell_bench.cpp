@@ -0,0 +1,40 @@
+/*
+  ____                  _
+ | __ )  ___ _ __   ___| |__
+ |  _ \ / _ \ '_ \ / __| '_ \
+ | |_) |  __/ | | | (__| | | |
+ |____/ \___|_| |_|\___|_| |_|
+
+Per-message cost of handle_loadcell: process() at 100 Hz on 8 channels while
+recording, with the heartbeats of the coordinator, see common/bench.hpp
+*/
+#define main handle_loadcell_main
+#include "handle_loadcell.cpp"
+#undef main
+
+#include <bench.hpp>
+
+int main(int argc, char const *argv[]) {
+  bench::Bench bench("handle_loadcell", argc, argv, {
+    {"side", "left"},
+    {"health_status_period", 500},
+    {"samples_per_frame", 1},
+    {"input_map", json::object({{"left", {{0, "up_front"}, {1, "up_back"}, {2, "down_front"}, {3, "down_back"},
+                                          {4, "int_front"}, {5, "int_back"}, {6, "ext_front"}, {7, "ext_back"}}}})},
+    {"range_map", json::object({{"left", {{0, 500.0}, {1, 500.0}, {2, 50.0}, {3, 50.0},
+                                          {4, 50.0}, {5, 50.0}, {6, 50.0}, {7, 50.0}}}})}
+  });
+
+  Handle_loadcellPlugin plugin;
+  plugin.set_params(bench.params());
+  bench.once("start", [&] { plugin.load_data({{"command", "start"}, {"id", 1}}, "coordinator"); });
+
+  bench.tick("process", 100.0);
+  bench.stream("coordinator", 2.0, [](uint64_t, bench::Message &m) {
+    bench::heartbeat(m, "coordinator", "recording");
+  });
+  bench.run(plugin);
+
+  bench.once("stop", [&] { plugin.load_data({{"command", "stop"}}, "coordinator"); });
+  return 0;
+}
@@ -0,0 +1,449 @@
+/*
+  _     ____                             _
+ | |__| ___|  _____  ___ __   ___  _ __| |_
+ | '_ \|___ \ / _ \ \/ / '_ \ / _ \| '__| __|
+ | | | |___) |  __/>  <| |_) | (_) | |  | |_
+ |_| |_|____/ \___/_/\_\ .__/ \___/|_|   \__|
+                       |_|
+Export a dataset of an acquisition file written by hdf5_writer as CSV, with
+the left and right crutch merged on a common timebase
+*/
+
+#include <H5Cpp.h>
+#include <algorithm>
+#include <clock_offset.hpp>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <json2hdf5.hpp>
+#include <memory>
+#include <sample_frame.hpp>
+#include <string>
+#include <vector>
+
+using namespace std;
+using ValueType = JsonToHdf5Converter::ValueType;
+
+static const char *usage =
+    "Usage: h5export <file.h5> <group> <dataset> [options]\n"
+    "Write <dataset> of the left and right crutch as CSV: one row per\n"
+    "timestamp of either side, the other side linearly interpolated.\n"
+    "The group is split by side (/<group>/left, /<group>/right) or has a\n"
+    "side dataset.\n"
+    "Options:\n"
+    "  -t, --time <name>     time dataset: timestamp (ISO 8601) or t_us (µs),\n"
+    "                        default: the first one with a row per value\n"
+    "  -o, --output <file>   write to a file instead of stdout\n"
+    "  -H, --header <list>   CSV header, comma separated, instead of\n"
+    "                        timestamp_ns,<side>_<column><suffix>...\n"
+    "  -s, --suffix <text>   suffix of the column names, e.g. _N\n"
+    "  -p, --precision <n>   decimals of the values, default 2\n"
+    "  -b, --block <rows>    rows read at a time, default 65536\n";
+
+// Reads a dataset in blocks of rows, keeping a single block in memory.
+// Numbers and side codes are read as doubles, strings as strings.
+class BlockReader {
+public:
+  BlockReader(const H5::DataSet &dataset, hsize_t block_rows)
+      : _dataset(dataset), _block_rows(block_rows) {
+    hsize_t dims[2] = {0, 1};
+    _rank = _dataset.getSpace().getSimpleExtentDims(dims);
+    _rows = dims[0];
+    _width = _rank == 2 ? dims[1] : 1;
+    switch (_dataset.getTypeClass()) {
+    case H5T_FLOAT:
+    case H5T_INTEGER:
+      _type = ValueType::f64;
+      break;
+    case H5T_ENUM:
+      _type = ValueType::side;
+      break;
+    case H5T_STRING:
+      _type = ValueType::str;
+      break;
+    default:
+      throw runtime_error("unsupported type of dataset " + _dataset.getObjName());
+    }
+  }
+
+  hsize_t rows() const { return _rows; }
+  hsize_t width() const { return _width; }
+  ValueType type() const { return _type; }
+
+  // Value at (row, column), loading its block if needed
+  double number(hsize_t row, hsize_t column = 0) {
+    load(row);
+    return _numbers[(row - _first) * _width + column];
+  }
+
+  const string &text(hsize_t row) {
+    load(row);
+    return _texts[row - _first];
+  }
+
+private:
+  void load(hsize_t row) {
+    if (row >= _first && row < _first + _count) {
+      return;
+    }
+    _first = row - row % _block_rows;
+    _count = min(_block_rows, _rows - _first);
+    hsize_t offset[2] = {_first, 0};
+    hsize_t count[2] = {_count, _width};
+    H5::DataSpace file_space = _dataset.getSpace();
+    file_space.selectHyperslab(H5S_SELECT_SET, count, offset);
+    H5::DataSpace mem_space(_rank, count);
+
+    if (_type == ValueType::f64) {
+      _numbers.resize(_count * _width);
+      _dataset.read(_numbers.data(), H5::PredType::NATIVE_DOUBLE, mem_space, file_space);
+    } else if (_type == ValueType::side) {
+      // the side enum of hdf5_writer, 1-byte codes of sample_frame::Side
+      _codes.resize(_count);
+      _dataset.read(_codes.data(), _dataset.getEnumType(), mem_space, file_space);
+      _numbers.assign(_codes.begin(), _codes.end());
+    } else {
+      H5::StrType type = _dataset.getStrType();
+      _texts.resize(_count);
+      if (type.isVariableStr()) {
+        vector<char *> strings(_count);
+        _dataset.read(strings.data(), type, mem_space, file_space);
+        for (hsize_t i = 0; i < _count; ++i) {
+          _texts[i] = strings[i] ? strings[i] : "";
+        }
+        H5Dvlen_reclaim(type.getId(), mem_space.getId(), H5P_DEFAULT, strings.data());
+      } else {
+        const size_t size = type.getSize();
+        vector<char> block(_count * size);
+        _dataset.read(block.data(), type, mem_space, file_space);
+        for (hsize_t i = 0; i < _count; ++i) {
+          const char *s = block.data() + i * size;
+          _texts[i].assign(s, strnlen(s, size));
+        }
+      }
+    }
+  }
+
+  H5::DataSet _dataset;
+  hsize_t _block_rows;
+  int _rank = 1;
+  hsize_t _rows = 0;
+  hsize_t _width = 1;
+  ValueType _type = ValueType::none;
+  hsize_t _first = 0;
+  hsize_t _count = 0;
+  vector<double> _numbers;
+  vector<uint8_t> _codes;
+  vector<string> _texts;
+};
+
+// One reading of a crutch, time in ns
+struct Sample {
+  int64_t t_ns = 0;
+  vector<double> values;
+};
+
+// The rows of one side, in file order: all the rows of a side subgroup, or
+// the rows of a unified group whose side matches
+class SideStream {
+public:
+  SideStream(const H5::Group &group, const string &dataset, const string &time,
+             const H5::DataSet *side_dataset, sample_frame::Side side,
+             hsize_t block_rows)
+      : _values(group.openDataSet(dataset), block_rows), _side(side) {
+    if (_values.type() != ValueType::f64) {
+      throw runtime_error("dataset " + dataset + " is not numeric");
+    }
+    if (side_dataset) {
+      _sides = make_unique<BlockReader>(*side_dataset, block_rows);
+      if (_sides->rows() != _values.rows()) {
+        throw runtime_error("side and " + dataset + " have different lengths");
+      }
+    }
+    for (const string &name : time.empty() ? vector<string>{"timestamp", "t_us"}
+                                           : vector<string>{time}) {
+      if (group.nameExists(name)) {
+        auto reader = make_unique<BlockReader>(group.openDataSet(name), block_rows);
+        if (reader->rows() == _values.rows()) {
+          _time = std::move(reader);
+          _time_name = name;
+          break;
+        }
+      }
+    }
+    if (!_time) {
+      throw runtime_error("no time dataset with a row per value of " + dataset);
+    }
+    _columns = dataset_columns(group.openDataSet(dataset), dataset);
+    if (_columns.size() != _values.width()) {
+      throw runtime_error("the columns attribute of " + dataset + " does not match its width");
+    }
+  }
+
+  const vector<string> &columns() const { return _columns; }
+
+  // Next sample of the side, false at the end
+  bool next(Sample &sample) {
+    for (; _row < _values.rows(); ++_row) {
+      if (_sides && _sides->number(_row) != double(_side)) {
+        continue;
+      }
+      if (!time_ns(_row, sample.t_ns)) {
+        continue; // unparsable timestamp
+      }
+      sample.values.resize(_values.width());
+      for (hsize_t c = 0; c < _values.width(); ++c) {
+        sample.values[c] = _values.number(_row, c);
+      }
+      ++_row;
+      return true;
+    }
+    return false;
+  }
+
+private:
+  bool time_ns(hsize_t row, int64_t &t_ns) {
+    if (_time->type() == ValueType::str) {
+      const string &text = _time->text(row);
+      int64_t ms = 0;
+      if (!clock_offset::parse_iso8601_ms(text.data(), text.size(), ms)) {
+        return false;
+      }
+      t_ns = ms * 1000000;
+    } else {
+      const double t = _time->number(row);
+      t_ns = int64_t(_time_name == "t_us" ? t * 1000.0 : t * 1000000.0); // else ms
+    }
+    return true;
+  }
+
+  // Labels of the columns: the columns attribute of the datasets made from
+  // objects, the dataset name otherwise
+  static vector<string> dataset_columns(const H5::DataSet &dataset, const string &name) {
+    vector<string> columns;
+    if (dataset.attrExists("columns")) {
+      H5::Attribute attribute = dataset.openAttribute("columns");
+      hsize_t count = 0;
+      attribute.getSpace().getSimpleExtentDims(&count);
+      H5::StrType type(H5::PredType::C_S1, H5T_VARIABLE);
+      vector<char *> labels(count);
+      attribute.read(type, labels.data());
+      for (char *label : labels) {
+        columns.emplace_back(label);
+        free(label);
+      }
+      return columns;
+    }
+    hsize_t dims[2] = {0, 1};
+    const int rank = dataset.getSpace().getSimpleExtentDims(dims);
+    if (rank == 1) {
+      return {name};
+    }
+    for (hsize_t c = 0; c < dims[1]; ++c) {
+      columns.push_back(name + "_" + to_string(c));
+    }
+    return columns;
+  }
+
+  BlockReader _values;
+  unique_ptr<BlockReader> _sides;
+  unique_ptr<BlockReader> _time;
+  string _time_name;
+  sample_frame::Side _side;
+  vector<string> _columns;
+  hsize_t _row = 0;
+};
+
+// Value of a side at the merged times: linear between its two samples
+// around t, held before its first and after its last sample
+class SideCursor {
+public:
+  explicit SideCursor(unique_ptr<SideStream> stream) : _stream(std::move(stream)) {
+    _has_b = _stream && _stream->next(_b);
+  }
+
+  const vector<string> *columns() const { return _stream ? &_stream->columns() : nullptr; }
+
+  // Index of a column of the side, -1 if it has none of that name
+  int column(const string &name) const {
+    if (!_stream) {
+      return -1;
+    }
+    const vector<string> &columns = _stream->columns();
+    auto it = find(columns.begin(), columns.end(), name);
+    return it == columns.end() ? -1 : int(it - columns.begin());
+  }
+  bool pending() const { return _has_b; }
+  int64_t next_ns() const { return _b.t_ns; }
+
+  void advance(int64_t t_ns) {
+    while (_has_b && _b.t_ns <= t_ns) {
+      std::swap(_a, _b);
+      _has_a = true;
+      _has_b = _stream->next(_b);
+    }
+  }
+
+  double value(int64_t t_ns, size_t column) const {
+    if (!_has_a) {
+      return _has_b ? _b.values[column] : 0.0;
+    }
+    if (!_has_b || _a.t_ns == t_ns || _b.t_ns == _a.t_ns) {
+      return _a.values[column];
+    }
+    const double k = double(t_ns - _a.t_ns) / double(_b.t_ns - _a.t_ns);
+    return _a.values[column] + k * (_b.values[column] - _a.values[column]);
+  }
+
+private:
+  unique_ptr<SideStream> _stream;
+  Sample _a, _b;
+  bool _has_a = false;
+  bool _has_b = false;
+};
+
+// Stream of a side, or nullptr if the file has no data for it
+static unique_ptr<SideStream> open_side(H5::H5File &file, const string &group,
+                                        const string &dataset, const string &time,
+                                        sample_frame::Side side, hsize_t block_rows) {
+  const string name = side == sample_frame::Side::left ? "left" : "right";
+  const string split = group + "/" + name;
+  if (file.nameExists(group) && file.nameExists(split) &&
+      file.openGroup(split).nameExists(dataset)) {
+    return make_unique<SideStream>(file.openGroup(split), dataset, time, nullptr, side,
+                                   block_rows);
+  }
+  if (file.nameExists(group)) {
+    H5::Group unified = file.openGroup(group);
+    if (unified.nameExists(dataset) && unified.nameExists(JsonToHdf5Converter::side_key)) {
+      H5::DataSet sides = unified.openDataSet(JsonToHdf5Converter::side_key);
+      if (sides.getTypeClass() != H5T_ENUM) {
+        throw runtime_error("the side dataset is not the side enum of hdf5_writer");
+      }
+      return make_unique<SideStream>(unified, dataset, time, &sides, side, block_rows);
+    }
+  }
+  return nullptr;
+}
+
+int main(int argc, char const *argv[]) {
+  if (argc < 4) {
+    cerr << usage;
+    return 2;
+  }
+  const string filename = argv[1], group = argv[2], dataset = argv[3];
+  string time, output, header, suffix;
+  int precision = 2;
+  hsize_t block_rows = 65536;
+  for (int i = 4; i < argc; ++i) {
+    const string option = argv[i];
+    if (i + 1 >= argc) {
+      cerr << "Missing value of " << option << "\n" << usage;
+      return 2;
+    }
+    if (option == "-t" || option == "--time") {
+      time = argv[++i];
+    } else if (option == "-o" || option == "--output") {
+      output = argv[++i];
+    } else if (option == "-H" || option == "--header") {
+      header = argv[++i];
+    } else if (option == "-s" || option == "--suffix") {
+      suffix = argv[++i];
+    } else if (option == "-p" || option == "--precision") {
+      precision = max(0, atoi(argv[++i]));
+    } else if (option == "-b" || option == "--block") {
+      block_rows = max(1, atoi(argv[++i]));
+    } else {
+      cerr << "Unknown option " << option << "\n" << usage;
+      return 2;
+    }
+  }
+
+  H5Eset_auto2(H5E_DEFAULT, nullptr, nullptr); // errors are reported as exceptions
+  try {
+    // files being recorded are opened in SWMR mode, see hdf5_writer
+    H5::FileAccPropList access;
+    H5Pset_file_locking(access.getId(), false, true);
+    H5::H5File file;
+    try {
+      file = H5::H5File(filename, H5F_ACC_RDONLY | H5F_ACC_SWMR_READ,
+                        H5::FileCreatPropList::DEFAULT, access);
+    } catch (const H5::Exception &) {
+      file = H5::H5File(filename, H5F_ACC_RDONLY, H5::FileCreatPropList::DEFAULT, access);
+    }
+
+    SideCursor left(open_side(file, group, dataset, time, sample_frame::Side::left, block_rows));
+    SideCursor right(open_side(file, group, dataset, time, sample_frame::Side::right, block_rows));
+    if (!left.pending() && !right.pending()) {
+      cerr << "No " << group << "/" << dataset << " data in " << filename << "\n";
+      return 1;
+    }
+
+    FILE *out = output.empty() ? stdout : fopen(output.c_str(), "w");
+    if (!out) {
+      cerr << "Cannot write " << output << "\n";
+      return 1;
+    }
+    static char buffer[1 << 16];
+    setvbuf(out, buffer, _IOFBF, sizeof(buffer));
+
+    // the columns of both sides, matched by name: those of the left side, then
+    // those only the right side has. A column missing from a side, or a side
+    // without data, is filled with 0
+    vector<string> columns;
+    for (const SideCursor *cursor : {&left, &right}) {
+      if (cursor->columns()) {
+        for (const string &column : *cursor->columns()) {
+          if (find(columns.begin(), columns.end(), column) == columns.end()) {
+            columns.push_back(column);
+          }
+        }
+      }
+    }
+    const size_t width = columns.size();
+    vector<int> left_index(width, -1), right_index(width, -1);
+    for (size_t c = 0; c < width; ++c) {
+      left_index[c] = left.column(columns[c]);
+      right_index[c] = right.column(columns[c]);
+    }
+    if (header.empty()) {
+      header = "timestamp_ns";
+      for (const char *side : {"left", "right"}) {
+        for (const string &column : columns) {
+          header += string(",") + side + "_" + column + suffix;
+        }
+      }
+    }
+    fprintf(out, "%s\n", header.c_str());
+
+    // linear merge of the two time streams, in file order
+    while (left.pending() || right.pending()) {
+      int64_t t_ns = left.pending() ? left.next_ns() : right.next_ns();
+      if (right.pending()) {
+        t_ns = min(t_ns, right.next_ns());
+      }
+      left.advance(t_ns);
+      right.advance(t_ns);
+      fprintf(out, "%lld", (long long)t_ns);
+      for (const SideCursor *cursor : {&left, &right}) {
+        const vector<int> &index = cursor == &left ? left_index : right_index;
+        for (size_t c = 0; c < width; ++c) {
+          fprintf(out, ",%.*f", precision, index[c] >= 0 ? cursor->value(t_ns, index[c]) : 0.0);
+        }
+      }
+      fputc('\n', out);
+    }
+    if (out != stdout) {
+      fclose(out);
+    } else {
+      fflush(out);
+    }
+  } catch (const H5::Exception &e) {
+    cerr << "HDF5 error: " << e.getDetailMsg() << "\n";
+    return 1;
+  } catch (const exception &e) {
+    cerr << e.what() << "\n";
+    return 1;
+  }
+  return 0;
+}
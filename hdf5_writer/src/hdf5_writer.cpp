@@ -18,8 +18,22 @@
 
 // other includes as needed here
 #include <H5Cpp.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <fstream>
+#include <mutex>
 #include <sstream>
+#include <thread>
+#include <unordered_map>
+#include "clock_offset.hpp"
+#include "command.hpp"
+#include "heartbeat.hpp"
+#include "idle_sleep.hpp"
 #include "json2hdf5.hpp"
+#include "perf.hpp"
+#include "spsc_ring.hpp"
 
 // Define the name of the plugin
 #ifndef PLUGIN_NAME
@@ -39,6 +53,7 @@ public:
 
   ~Hdf5Plugin() {
     // Constructor implementation, if needed
+    stop_writer();
     try {
       _converter.close();
     } catch (const H5::Exception &e) {
@@ -57,13 +72,13 @@ public:
   // return_type::error: _error is traced, skip process
   // return_type::critical: execution stops
   return_type load_data(json const &input, string topic = "", vector<unsigned char> const *blob = nullptr) override {
+    perf::Timer load_timer(_perf_load);
     
-    // if su_topic contains "command" field, process commands here
-    if(input.contains("command")) {
+    // if su_topic contains "command" field, process commands here (dispatched on their code, see command.hpp)
+    const command::Code action = command::decode(input);
+    if (action != command::Code::unknown) {
 
-      string action = input.value("command",""); // get the command, default to empty string if not found
-
-      if (action == "start") {
+      if (action == command::Code::start) {
 
         // firstly check if we are already recording, if yes, return a warning and do not start a new recording, to avoid overwriting the existing file or creating multiple files at the same time, which can lead to data loss or corruption
         if (_recording) {
@@ -86,7 +101,9 @@ public:
         // Open a new file for recording
         string new_filename = "_acq_" + to_string(id) + ".h5";
 
-        if (new_filename == _filename) {
+        // after a rollover _filename is the last part: compare the ids, and look for the files of an earlier
+        // recording with the same id (e.g. before a restart), which the stop would overwrite
+        if (new_filename == _filename || id == _acquisition_id || recording_exists(id)) {
           _filename = "not_handled_filename.h5"; // reset filename to avoid overwriting in case of new recording without restart
           _error = "idle: filename collision detected for id: " + to_string(id);
           cout << _error << std::endl;
@@ -102,11 +119,18 @@ public:
           cout << _error << std::endl;
           return return_type::error;
         }
+        _acquisition_id = id;
+        _part = 0;
+        _parts = json::array();
+        start_part();
         _recording = true;
+        if (_async_write) {
+          start_writer();
+        }
         std::cout << "Starting recording id: " << id << std::endl;
 
         // other actions as needed
-      } else if (action == "stop") {
+      } else if (action == command::Code::stop) {
 
         // check if we are currently recording, if not, return a warning, to avoid potential issues with trying to close a file that is not open, which can lead to errors or crashes
         if (_recording == false) {
@@ -115,12 +139,21 @@ public:
           return return_type::error;
         }
 
+        // the writer thread drains the whole queue before exiting, so that no record is lost
+        stop_writer();
+
         try{
-          _converter.close(); // Close the current file
+          _converter.close(); // Flush the staged data and close the current file
         } catch (const H5::Exception &e) {
+          _recording = false;
           _error = "recording: closing HDF5 file: " + string(e.getDetailMsg());
           cout << _error << std::endl;
           return return_type::error;
+        } catch (const std::exception &e) {
+          _recording = false;
+          _error = "recording: closing HDF5 file: " + string(e.what());
+          cout << _error << std::endl;
+          return return_type::error;
         }
 
         // rename the file to indicate end of acquisition
@@ -132,52 +165,38 @@ public:
         }
 
         _recording = false;
+        if (rollover()) {
+          try {
+            add_part(new_filename, true); // the last part completes the manifest
+          } catch (const std::exception &e) {
+            _error = "idle: " + string(e.what());
+            cout << _error << std::endl;
+            return return_type::error;
+          }
+        }
         std::cout << "Stopping recording"<< std::endl;
         
       } 
         
     }
 
-    // If the topic is not in the keypaths, we need to retry
-    if (std::find(_converter.groups().begin(), _converter.groups().end(), topic) == _converter.groups().end()) {
+    // If the topic is not in the keypaths, we need to retry (a hash lookup in the table built in set_params)
+    auto recorded_topic = _fields_to_record.find(topic);
+    if (recorded_topic == _fields_to_record.end()) {
       return return_type::retry;
     }
 
     // if the input contains a field that must be recorded, we need to continue
     // Otherwise we need to retry to avoid saving the default field timestamp when there is no other field to record, which can lead to creating empty files or files with only default fields, which can be misleading and take up unnecessary space
-    auto contains_keypath = [this](const json &node, const string &keypath) {
-      const string separator = _converter.keypath_separator();
-      size_t start = 0;
-      size_t end = keypath.find(separator);
-      const json *current = &node;
-
-      while (end != string::npos) {
-        const string key = keypath.substr(start, end - start);
-        if (!current->is_object() || !current->contains(key)) {
-          return false;
-        }
-        current = &(*current)[key];
-        start = end + separator.length();
-        end = keypath.find(separator, start);
-      }
-
-      const string leaf_key = keypath.substr(start);
-      return current->is_object() && current->contains(leaf_key);
-    };
-
-    bool field_to_record_found = false;
-    for (const auto &keypath : _converter.keypaths(topic)) {
-      
-      // skip default fields
-      if (keypath == "timestamp" || keypath == "side") {
-        continue; 
-      }
-      
-      // check fields other than timestamp
-      if (contains_keypath(input, keypath)) {
-        field_to_record_found = true;
+    // Default fields (timestamp, side) are excluded once in set_params, here we only follow the precompiled keypaths
+    // Messages carrying a binary sample frame (see sample_frame.hpp) always have something to record
+    const bool has_frame = blob != nullptr && !blob->empty() && input.contains("frame");
+    bool field_to_record_found = has_frame;
+    for (const size_t index : recorded_topic->second) {
+      if (field_to_record_found) {
         break;
-      } 
+      }
+      field_to_record_found = (_converter.value_at_keypath(input, topic, index) != nullptr);
     }
 
     if (!field_to_record_found) {
@@ -189,7 +208,18 @@ public:
 
       // save the data to the file
       try {
-        _converter.save_to_group(input, topic);
+        if (_async_write) {
+          // extract the record here and leave the disk writes to the writer thread
+          return enqueue_record(input, topic, has_frame ? blob : nullptr);
+        }
+        perf::Timer append_timer(_perf_append);
+        const bool extracted = has_frame ? _converter.extract_frame(input, *blob, topic, _record)
+                                         : _converter.extract(input, topic, _record);
+        if (extracted) {
+          stamp_record(input, _record);
+          _converter.append(_record);
+          record_ages(_record);
+        }
       } catch (const std::exception &e) {
         _error = "recording: " + string(e.what());
         cout << _error << std::endl;
@@ -215,16 +245,48 @@ public:
   return_type process(json &out, vector<unsigned char> *blob = nullptr) override {
     out.clear();
 
-    // Send periodic agent_status if 500ms have passed
-    auto now = std::chrono::steady_clock::now();
-    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(now - _last_health_status_time).count();
-    
-    if (elapsed >= _health_status_period) {
+    // Report errors raised by the writer thread
+    if (_async_write) {
+      lock_guard<mutex> lock(_writer_mutex);
+      if (!_writer_error.empty()) {
+        _error = _writer_error;
+        _writer_error.clear();
+        cout << _error << std::endl;
+        return return_type::error;
+      }
+    }
+
+    // Write staged data to the file when the flush period expires, also when no new messages arrive,
+    // and continue in a new part when the current one is complete (in async mode the writer thread does it)
+    if (_recording && !_async_write) {
+      try {
+        _converter.flush_if_due();
+        roll_over_if_due();
+      } catch (const std::exception &e) {
+        _error = "recording: " + string(e.what());
+        cout << _error << std::endl;
+        return return_type::error;
+      }
+    }
+
+    // Send agent_status when the heartbeat is due
+    if (_heartbeat.due(_recording)) {
       out["agent_status"] = _recording ? "recording" : "idle";
-      _last_health_status_time = now;
+      if (_async_write) {
+        out["info"]["queue"]["capacity"] = _queue.capacity();
+        out["info"]["queue"]["size"] = _queue.size();
+        out["info"]["queue"]["high_water"] = _queue.high_water();
+        out["info"]["queue"]["dropped"] = _dropped_records.load();
+      }
+      _heartbeat.sent(_recording);
     } else {
+      // idle: sleep until the next agent_status, if enabled
+      if (!_recording) {
+        _idle.until(_heartbeat.next_due(_recording));
+      }
       return return_type::retry;
     }
+    _perf.publish_if_due(out);
     
     
     // This sets the agent_id field in the output json object, only when it is
@@ -247,11 +309,41 @@ public:
     // params needs to be cast to json
     _params.merge_patch(params);
 
-    _health_status_period = _params.value("health_status_period", 500); // default to 500 ms
+    _heartbeat.configure(_params); // health_status_period, default to 500 ms, and health_status_mode
+    _perf.configure(_params); // perf_period, default to 5000 ms
+    _idle.configure(_params); // idle_sleep, default to false, and idle_max_sleep, default to 200 ms
     
+    try {
+      _converter.set_buffer_size(_params.value("buffer_size", 1024)); // rows staged in memory before writing, default to the chunk size
+      _converter.set_flush_period(_params.value("flush_period", 1000)); // default to 1000 ms
+      _converter.set_checkpoint_period(_params.value("checkpoint_period", 0)); // file flushed to disk at most this often, default to 0 (only on stop)
+      _converter.set_swmr(_params.value("swmr", false)); // readers can open the file while recording, default to false
+      _converter.set_summary(_params.value("summary", false)); // /summary group written on stop, default to false
+      _converter.set_float32(_params.value("float32", false)); // floating point datasets as float32, default to float64
+    } catch (const std::exception &e) {
+      _error = "Error setting buffering: " + string(e.what());
+      std::cerr << _error << std::endl;
+      return;
+    }
+
+    // Asynchronous writing: load_data only extracts the records, a dedicated thread writes them
+    _async_write = _params.value("async_write", false);
+    _block_when_full = (_params.value("queue_policy", "drop") == "block");
+    try {
+      _queue.reset(_params.value("queue_size", 4096)); // records, default to 4096
+    } catch (const std::exception &e) {
+      _error = "Error setting write queue: " + string(e.what());
+      std::cerr << _error << std::endl;
+      return;
+    }
+
     _folder_path = _params.value("folder_path", "./fallback_data/");
     _folder_path += (_folder_path.back() == '/') ? "" : "/"; // Ensure trailing slash
 
+    // Long acquisitions split into part files, 0 disables each limit
+    _rollover_period = max(0, _params.value("rollover_period", 0)); // s
+    _rollover_size = static_cast<hsize_t>(max(0.0, _params.value("rollover_size", 0.0)) * 1048576); // MiB
+
 
     try {
       _converter.set_keypath_separator(_params["keypath_sep"].get<string>());
@@ -260,11 +352,46 @@ public:
           _converter.append_keypath(keypath.get<string>(), group.key());
         }
       }
+
+      // Groups whose messages go to the /<group>/left and /<group>/right subgroups
+      for (const auto &group : _params.value("split_by_side", json::array())) {
+        _converter.set_split_by_side(group.get<string>());
+      }
+
+      // Index the keypaths that make a message worth recording, skipping the default fields
+      // Every group has an entry, also without such keypaths: the table is the set of the recorded topics
+      _fields_to_record.clear();
+      for (const auto &group : _converter.groups()) {
+        const auto &keypaths = _converter.keypaths(group);
+        auto &fields = _fields_to_record[group];
+        for (size_t i = 0; i < keypaths.size(); ++i) {
+          if (keypaths[i] != "timestamp" && keypaths[i] != "side") {
+            fields.push_back(i);
+          }
+        }
+      }
     } catch (const std::exception &e) {
       _error = "Error setting keypaths: " + string(e.what());
       std::cerr << _error << std::endl;
       return;
     }
+
+    // Storage of the new files, last so that an unavailable filter leaves the rest configured
+    try {
+      _converter.set_chunk_size(_params.value("chunk_size", 1024)); // rows per chunk, default to 1024
+      const json topic_chunk_size = _params.value("topic_chunk_size", json::object()); // items() must not outlive it
+      for (const auto &topic : topic_chunk_size.items()) {
+        _converter.set_chunk_size(topic.value().get<hsize_t>(), topic.key());
+      }
+      _converter.set_chunk_cache(_params.value("chunk_cache", 1048576)); // bytes per dataset, default to 1 MiB
+      _converter.set_string_size(_params.value("string_size", 0)); // bytes per string, default to variable length
+      _converter.set_file_format(_params.value("latest_format", false), _params.value("page_size", 0));
+      _converter.set_compression(_params.value("compression", "none"), _params.value("compression_level", 1), _params.value("shuffle", true));
+    } catch (const std::exception &e) {
+      _error = "Error setting storage: " + string(e.what());
+      std::cerr << _error << std::endl;
+      return;
+    }
   
   }
 
@@ -289,13 +416,230 @@ public:
     ss << " (total: " << total_keypaths << ")";
     info_map["Keypaths"] = ss.str();
     info_map["Keypath sep."] = _converter.keypath_separator();
+    info_map["Buffer size"] = to_string(_converter.buffer_size()) + " rows";
+    info_map["Flush period"] = to_string(_converter.flush_period()) + " ms";
+    info_map["Checkpoints"] = _converter.checkpoint_period() > 0 ? "every " + to_string(_converter.checkpoint_period()) + " ms" + (_converter.swmr() ? ", SWMR" : "") : "off";
+    info_map["Float type"] = _converter.float32() ? "float32" : "float64";
+    info_map["Chunks"] = to_string(_converter.chunk_size()) + " rows, cache " + to_string(_converter.chunk_cache() / 1024) + " KiB";
+    info_map["Compression"] = _converter.compression();
+    info_map["File format"] = string(_converter.latest_format() ? "1.10" : "earliest") + (_converter.page_size() > 0 ? ", pages of " + to_string(_converter.page_size()) + " bytes" : "");
+    info_map["Rollover"] = rollover() ? (_rollover_period > 0 ? "every " + to_string(_rollover_period) + " s" : string("")) +
+      (_rollover_period > 0 && _rollover_size > 0 ? " or " : "") +
+      (_rollover_size > 0 ? to_string(_rollover_size / 1048576) + " MiB" : string("")) : "off";
+    info_map["Async write"] = _async_write ? "queue of " + to_string(_queue.capacity()) + " records, " + (_block_when_full ? "block" : "drop") + " when full" : "off";
     return info_map;
     
   };
 
 private:
+  // Producer side of the asynchronous mode: extract the record into a free queue slot
+  return_type enqueue_record(json const &input, const string &topic, vector<unsigned char> const *frame) {
+    JsonToHdf5Converter::Record *slot = _queue.acquire();
+    while (slot == nullptr && _block_when_full) {
+      // backpressure: wait for the writer thread to free a slot
+      _writer_cv.notify_one();
+      this_thread::sleep_for(chrono::milliseconds(1));
+      slot = _queue.acquire();
+    }
+    if (slot == nullptr) {
+      // warn only on the first dropped record of the acquisition, the counter is in the agent_status
+      if (_dropped_records++ == 0) {
+        _error = "recording: write queue full, dropping records";
+        cout << _error << std::endl;
+        return return_type::warning;
+      }
+      return return_type::retry;
+    }
+    const bool extracted = (frame != nullptr) ? _converter.extract_frame(input, *frame, topic, *slot)
+                                              : _converter.extract(input, topic, *slot);
+    if (!extracted) {
+      return return_type::retry;
+    }
+    stamp_record(input, *slot);
+    _queue.commit();
+    _writer_cv.notify_one();
+
+    counter++;
+    return return_type::success;
+  }
+
+  // Consumer side of the asynchronous mode: drain the queue into the file
+  void writer_loop() {
+    while (true) {
+      JsonToHdf5Converter::Record *record = _queue.front();
+      if (record != nullptr) {
+        try {
+          perf::Timer append_timer(_perf_append);
+          _converter.append(*record);
+          record_ages(*record);
+          roll_over_if_due(); // between two records, so that each one is in a single part
+        } catch (const std::exception &e) {
+          lock_guard<mutex> lock(_writer_mutex);
+          _writer_error = "recording: " + string(e.what());
+        }
+        _queue.pop();
+        continue;
+      }
+
+      // queue empty: exit only now, so that stop always drains everything
+      if (_writer_stop.load()) {
+        break;
+      }
+
+      try {
+        _converter.flush_if_due();
+        roll_over_if_due();
+      } catch (const std::exception &e) {
+        lock_guard<mutex> lock(_writer_mutex);
+        _writer_error = "recording: " + string(e.what());
+      }
+
+      // a missed notification only delays the wake up by the wait timeout
+      unique_lock<mutex> lock(_writer_mutex);
+      _writer_cv.wait_for(lock, chrono::milliseconds(10), [this] {
+        return !_queue.empty() || _writer_stop.load();
+      });
+    }
+  }
+
+  // The file or the manifest of a recording with this id is already in folder_path
+  bool recording_exists(int id) const {
+    const string base = _folder_path + "acq_" + to_string(id);
+    for (const string &name : {base + ".h5", base + ".json", _folder_path + "_acq_" + to_string(id) + ".h5"}) {
+      if (std::ifstream(name).good()) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  bool rollover() const { return _rollover_period > 0 || _rollover_size > 0; }
+
+  // A new part was opened
+  void start_part() {
+    _part_start = chrono::steady_clock::now();
+    _part_start_ms = chrono::duration_cast<chrono::milliseconds>(
+      chrono::system_clock::now().time_since_epoch()).count();
+    _last_size_check = _part_start;
+  }
+
+  // Close the current part and continue in the next one when the part has reached rollover_period or
+  // rollover_size. The size is checked once per second, so a part can exceed it by about a second of data,
+  // plus the staged rows and the summary written on close. Runs on the thread that writes the file.
+  void roll_over_if_due() {
+    if (!rollover()) {
+      return;
+    }
+    const auto now = chrono::steady_clock::now();
+    bool due = _rollover_period > 0 && now - _part_start >= chrono::seconds(_rollover_period);
+    if (!due && _rollover_size > 0 && now - _last_size_check >= chrono::seconds(1)) {
+      _last_size_check = now;
+      due = _converter.file_size() >= _rollover_size;
+    }
+    if (!due) {
+      return;
+    }
+
+    // the staged rows and the summary of the part are written by close(), which also releases the buffers
+    // and the summaries: the memory used does not grow with the length of the acquisition
+    _converter.close();
+    const string closed_filename = _filename.substr(1); // remove leading underscore
+    if (std::rename((_folder_path + _filename).c_str(), (_folder_path + closed_filename).c_str()) != 0) {
+      throw runtime_error("error renaming file " + _filename + " to " + closed_filename);
+    }
+    add_part(closed_filename, false);
+
+    ++_part;
+    _filename = "_acq_" + to_string(_acquisition_id) + "_part" + to_string(_part) + ".h5";
+    _converter.open(_folder_path + _filename);
+    start_part();
+    std::cout << "Recording id " << _acquisition_id << " continues in " << _filename << std::endl;
+  }
+
+  // Add a closed part to the manifest acq_<id>.json, rewritten as a whole, so that after a power cut it
+  // still lists the parts completed so far. The last part of the acquisition sets complete.
+  void add_part(const string &filename, bool last) {
+    std::ifstream part(_folder_path + filename, std::ios::binary | std::ios::ate);
+    const int64_t end_ms = chrono::duration_cast<chrono::milliseconds>(
+      chrono::system_clock::now().time_since_epoch()).count();
+    _parts.push_back({
+      {"file", filename},
+      {"start_ms", _part_start_ms},
+      {"end_ms", end_ms},
+      {"bytes", part ? static_cast<int64_t>(part.tellg()) : int64_t(-1)}
+    });
+    const json manifest = {{"id", _acquisition_id}, {"parts", _parts}, {"complete", last}};
+
+    const string manifest_file = _folder_path + "acq_" + to_string(_acquisition_id) + ".json";
+    {
+      std::ofstream out(manifest_file + ".tmp");
+      out << manifest.dump(2) << std::endl;
+      if (!out) {
+        throw runtime_error("error writing " + manifest_file + ".tmp");
+      }
+    }
+    std::remove(manifest_file.c_str()); // rename does not replace an existing file on Windows
+    if (std::rename((manifest_file + ".tmp").c_str(), manifest_file.c_str()) != 0) {
+      throw runtime_error("error renaming " + manifest_file + ".tmp");
+    }
+  }
+
+  // Stamp a record extracted from input with its reception and the timestamp of the message, set by the
+  // publishing agent, for record_ages()
+  void stamp_record(const json &input, JsonToHdf5Converter::Record &record) {
+    if (!perf::enabled) {
+      return;
+    }
+    record.received_us = command::wall_clock_us();
+    record.sent_us = 0;
+    auto it = input.find("timestamp");
+    if (it == input.end() || !it->is_object() || !it->contains("$date") || !(*it)["$date"].is_string()) {
+      return;
+    }
+    const string &date = (*it)["$date"].get_ref<const string &>();
+    int64_t sent_ms = 0;
+    if (clock_offset::parse_iso8601_ms(date.data(), date.size(), sent_ms)) {
+      record.sent_us = sent_ms * 1000;
+    }
+  }
+
+  // Once a record is staged into the file, on the thread that writes it: the time it waited since its
+  // reception, in the queue with async_write, and the age of its oldest sample. The message timestamp is
+  // taken when the newest sample is published, so the age adds the span of the t_us of the samples to the
+  // time since that timestamp. It has the ms resolution of the timestamp and includes the clock offset
+  // between the two hosts, see the sync_handler.
+  void record_ages(const JsonToHdf5Converter::Record &record) {
+    if (!perf::enabled || record.received_us == 0) {
+      return;
+    }
+    const int64_t now_us = command::wall_clock_us();
+    _perf_queued.record(uint64_t(std::max<int64_t>(0, now_us - record.received_us)) * 1000);
+    if (record.sent_us > 0) {
+      _perf_sample_age.record(uint64_t(std::max<int64_t>(0, now_us - record.sent_us + record.span_us)) * 1000);
+    }
+  }
+
+  void start_writer() {
+    stop_writer();
+    _dropped_records = 0;
+    _queue.reset(_queue.capacity());
+    _writer_stop = false;
+    _writer = thread(&Hdf5Plugin::writer_loop, this);
+  }
+
+  void stop_writer() {
+    if (!_writer.joinable()) {
+      return;
+    }
+    _writer_stop = true;
+    _writer_cv.notify_one();
+    _writer.join();
+  }
+
   // Define the fields that are used to store internal resources
   JsonToHdf5Converter _converter; // Converter for JSON to HDF5
+  JsonToHdf5Converter::Record _record; // extracted in load_data() without async_write, reused between messages
+  unordered_map<string, vector<size_t>> _fields_to_record; // For each recorded topic, indexes of the keypaths other than the default ones
 
   uint32_t counter = 0; // A simple counter to keep track of the number of times load_data is called, used for demonstration purposes, can be removed if not needed
 
@@ -305,9 +649,40 @@ private:
 
   // control variables
   bool _recording = false;
+
+  // rollover of long acquisitions into part files, see roll_over_if_due()
+  int _rollover_period = 0; // s, 0 disables
+  hsize_t _rollover_size = 0; // bytes, 0 disables
+  int _acquisition_id = -1;
+  size_t _part = 0; // of the open file, 0 is _acq_<id>.h5 and the next ones _acq_<id>_part<n>.h5
+  json _parts = json::array(); // closed parts, for the manifest
+  chrono::steady_clock::time_point _part_start;
+  chrono::steady_clock::time_point _last_size_check;
+  int64_t _part_start_ms = 0; // wall clock, ms since the epoch
+
+  // asynchronous writing
+  bool _async_write = false;
+  bool _block_when_full = false; // queue policy: block load_data or drop the record when the queue is full
+  SpscRing<JsonToHdf5Converter::Record> _queue{4096};
+  thread _writer;
+  atomic<bool> _writer_stop{false};
+  atomic<uint64_t> _dropped_records{0};
+  mutex _writer_mutex; // protects _writer_error and the wait on _writer_cv
+  condition_variable _writer_cv;
+  string _writer_error = "";
   
-  int _health_status_period = 500;  // in milliseconds, default to 500 ms
-  std::chrono::steady_clock::time_point _last_health_status_time = std::chrono::steady_clock::now();
+  Heartbeat _heartbeat; // schedules the agent_status messages
+  IdleSleep _idle; // sleep in process() while idle
+
+  // Latency histograms, compiled in with -DPERF_INSTRUMENTATION
+  perf::Histogram _perf_load;       // load_data()
+  perf::Histogram _perf_append;     // staging of a record into the file, on the writer thread in async mode
+  perf::Histogram _perf_queued;     // reception of a record to its staging into the file
+  perf::Histogram _perf_sample_age; // oldest sample of a record to its staging into the file, ms resolution
+  perf::Report _perf{{"load_data", &_perf_load},
+                     {"append", &_perf_append},
+                     {"queued", &_perf_queued},
+                     {"sample_age", &_perf_sample_age}};
 };
 
 
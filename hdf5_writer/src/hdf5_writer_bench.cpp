@@ -0,0 +1,93 @@
+/*
+  ____                  _
+ | __ )  ___ _ __   ___| |__
+ |  _ \ / _ \ '_ \ / __| '_ \
+ | |_) |  __/ | | | (__| | | |
+ |____/ \___|_| |_|\___|_| |_|
+
+Per-message cost of hdf5_writer: a recording of the tips at 2x200 Hz and of
+the 8-channel handles at 2x100 Hz, with the labels and the heartbeats of the
+coordinator, see common/bench.hpp. The file is written in folder_path,
+default the temporary folder, and removed at the end unless -k is given.
+*/
+#define main hdf5_writer_main
+#include "hdf5_writer.cpp"
+#undef main
+
+#include <bench.hpp>
+#include <cstring>
+#include <filesystem>
+#include <unistd.h>
+
+int main(int argc, char const *argv[]) {
+  // -k keeps the file, the other arguments are for the bench
+  bool keep = false;
+  vector<char const *> args;
+  for (int i = 0; i < argc; ++i) {
+    if (strcmp(argv[i], "-k") == 0) {
+      keep = true;
+    } else {
+      args.push_back(argv[i]);
+    }
+  }
+
+  // the settings of templates/mads.ini
+  bench::Bench bench("hdf5_writer", int(args.size()), args.data(), {
+    {"folder_path", std::filesystem::temp_directory_path().string()},
+    {"buffer_size", 1024},
+    {"flush_period", 1000},
+    {"checkpoint_period", 2000},
+    {"swmr", true},
+    {"summary", true},
+    {"async_write", true},
+    {"queue_size", 4096},
+    {"queue_policy", "drop"},
+    {"float32", true},
+    {"chunk_size", 1024},
+    {"topic_chunk_size", json::object({{"coordinator", 64}})},
+    {"chunk_cache", 1048576},
+    {"compression", "deflate"},
+    {"compression_level", 1},
+    {"shuffle", true},
+    {"string_size", 64},
+    {"latest_format", true},
+    {"page_size", 65536},
+    {"keypaths", {
+      {"coordinator", {"label"}},
+      {"tip_loadcell", {"side", "force"}},
+      {"handle_loadcell", {"side", "force"}}
+    }}
+  });
+
+  Hdf5Plugin plugin;
+  plugin.set_params(bench.params());
+  const int id = static_cast<int>(getpid());
+  bench.once("start", [&] { plugin.load_data({{"command", "start"}, {"id", id}}, "coordinator"); });
+
+  bench::crutch_streams(bench);
+  bench.stream("heartbeat", "coordinator", 2.0, [](uint64_t, bench::Message &m) {
+    bench::heartbeat(m, "coordinator", "recording");
+  });
+  bench.stream("condition", "coordinator", 0.2, [](uint64_t n, bench::Message &m) {
+    m.payload["command"] = "condition";
+    m.payload["label"] = n % 2 ? "walking" : "standing";
+    m.payload["agent_id"] = "coordinator";
+    bench::stamp(m.payload);
+  }, 0.25);
+  bench.tick("process", 100.0);
+  bench.run(plugin);
+
+  bench.once("stop", [&] { plugin.load_data({{"command", "stop"}}, "coordinator"); });
+
+  const std::filesystem::path file = std::filesystem::path(bench.params()["folder_path"].get<string>()) /
+                                     ("acq_" + to_string(id) + ".h5");
+  std::error_code ec;
+  const auto size = std::filesystem::file_size(file, ec);
+  if (!ec) {
+    printf("%s: %.1f kB\n", file.string().c_str(), size / 1024.0);
+    if (!keep) {
+      std::filesystem::remove(file, ec);
+    }
+  }
+  return 0;
+}
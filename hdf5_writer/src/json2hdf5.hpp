@@ -11,14 +11,60 @@ Convert JSON files to HDF5 format using nlohmann and HDF5 library
 #define JSON2HDF5_HPP
 
 #include <H5Cpp.h>
+#include <algorithm>
+#include <chrono>
+#include <clock_offset.hpp>
 #include <map>
 #include <nlohmann/json.hpp>
+#include <sample_frame.hpp>
+#include <set>
 #include <stdexcept>
 #include <string>
+#include <summary.hpp>
 #include <vector>
 
 class JsonToHdf5Converter {
 public:
+  // Element type of a dataset, also used for extracted values
+  // The crutch side is stored as a 1-byte enum, see side_key
+  enum class ValueType { none, f64, i64, str, side };
+
+  // Top-level key with the number of samples batched in a message
+  static constexpr const char *batch_key = "samples";
+
+  // Keypath of the crutch side: the strings "left" and "right" are stored
+  // with the codes of sample_frame::Side instead of variable-length strings
+  static constexpr const char *side_key = "side";
+
+  // Typed value of a single keypath, extracted from a message
+  // Scalars have width 0, arrays are flattened with their width; a field can
+  // hold more than one row (e.g. the samples of a batch or a binary frame).
+  // Objects of numbers (e.g. the labelled channels of the handle) are rows
+  // with one column per key, in alphabetical order, named in columns.
+  struct RecordField {
+    bool present = false;
+    ValueType type = ValueType::none;
+    size_t width = 0;
+    size_t rows = 1;
+    std::vector<double> f64;
+    std::vector<int64_t> i64;
+    std::vector<std::string> str;
+    std::vector<std::string> columns;
+  };
+
+  // All the keypaths of a group extracted from a message, in keypath order
+  // Records can be reused: vectors keep their capacity between messages
+  // The times are not written: span_us is set by extract(), the other two
+  // are stamped by the caller for its latency measurements
+  struct Record {
+    std::string group;
+    std::string path; // HDF5 group written, <group>/<side> if split by side
+    std::vector<RecordField> fields;
+    int64_t span_us = 0;     // oldest to newest sample, from their t_us, 0 for a single sample
+    int64_t sent_us = 0;     // message timestamp set by its publisher, µs since the Unix epoch, 0 if unknown
+    int64_t received_us = 0; // reception of the message, same clock
+  };
+
   // Constructors
   JsonToHdf5Converter() {
     H5Eset_auto2(H5E_DEFAULT, nullptr, nullptr); // Disable error auto-printing
@@ -29,15 +75,26 @@ public:
     open(filename);
   }
 
-  ~JsonToHdf5Converter() { close(); }
+  ~JsonToHdf5Converter() {
+    try {
+      close();
+    } catch (...) {
+      // never throw from the destructor
+    }
+  }
 
   void open(const std::string &filename) {
-    // Open the HDF5 file
+    // Open the HDF5 file, the storage settings only apply to new files
+    _filename = filename;
+    _swmr_active = false;
+    _last_checkpoint_time = std::chrono::steady_clock::now();
     try {
-      _file = H5::H5File(filename, H5F_ACC_EXCL);
+      _file = H5::H5File(filename, H5F_ACC_EXCL, file_creation_properties(),
+                         file_access_properties(true));
     } catch (const H5::FileIException &e) {
       try {
-        _file = H5::H5File(filename, H5F_ACC_RDWR);
+        _file = H5::H5File(filename, H5F_ACC_RDWR, H5::FileCreatPropList::DEFAULT,
+                           file_access_properties(false));
       } catch (const H5::FileIException &e) {
         throw std::runtime_error("Cannot open file (is it open already?): " +
                                  e.getDetailMsg());
@@ -48,64 +105,271 @@ public:
   }
 
   // Method to convert JSON to HDF5
+  // Values are staged in memory and written to the file in blocks, when the
+  // buffer of the group is full, when the flush period expires or on close()
   void save_to_group(const nlohmann::json &json_data,
                      const std::string &group_name) {
     // Convert JSON data to HDF5 format
-    nlohmann::json j;
+    if (extract(json_data, group_name, _record)) {
+      append(_record);
+    }
+  }
+
+  // Extract the keypaths of a group from a message into a typed record,
+  // without touching the file. Returns false if no keypath is present.
+  // Only reads the configuration, so it can run alongside append() on
+  // another thread.
+  bool extract(const nlohmann::json &json_data, const std::string &group_name,
+               Record &record) const {
     if (group_name.empty()) {
       throw std::invalid_argument("Group name cannot be empty.");
     }
-    for (const auto &item : _keypaths[group_name]) {
-      j = json_from_keypath(json_data, item);
-      if (j != nullptr) {
-        write_to_dataset(j, item, group_name);
+    auto it = _compiled_keypaths.find(group_name);
+    if (it == _compiled_keypaths.end()) {
+      return false;
+    }
+    record.group = group_name;
+    record.path = group_path(json_data, group_name);
+    record.fields.resize(it->second.size());
+    const size_t samples = batch_samples(json_data);
+    bool found = false;
+    for (size_t i = 0; i < it->second.size(); ++i) {
+      const nlohmann::json *value = resolve_keypath(json_data, it->second[i]);
+      RecordField &field = record.fields[i];
+      field.present = value != nullptr;
+      if (field.present && it->second[i].name == side_key) {
+        // redundant in a side subgroup
+        field.present = record.path == group_name;
+        extract_side(*value, field);
+      } else if (field.present) {
+        extract_field(*value, it->second[i].name, field, samples);
       }
+      found = found || field.present;
+    }
+    if (samples > 1) {
+      repeat_single_rows(record, samples);
     }
+    record.span_us = batch_span_us(json_data);
+    return found;
   }
 
-  void write_to_dataset(const nlohmann::json &data,
-                        const std::string &dataset_name,
-                        const std::string &group_name) {
-    H5::Group group;
-    try {
-      try {
-        group = _file.openGroup(group_name);
-      } catch (const H5::FileIException &e) {
-        group = _file.createGroup(group_name);
+  // Time covered by the samples of a batch, from its "t_us" array
+  static int64_t batch_span_us(const nlohmann::json &json_data) {
+    auto it = json_data.find("t_us");
+    if (it == json_data.end() || !it->is_array() || it->size() < 2 ||
+        !it->front().is_number() || !it->back().is_number()) {
+      return 0;
+    }
+    return std::max<int64_t>(0, it->back().get<int64_t>() - it->front().get<int64_t>());
+  }
+
+  // Number of samples batched in a message (see the samples_per_frame
+  // setting of the load cell agents), 0 if the message is not a batch
+  static size_t batch_samples(const nlohmann::json &json_data) {
+    auto it = json_data.find(batch_key);
+    if (it == json_data.end() || !it->is_number_integer() ||
+        it->get<int64_t>() <= 0) {
+      return 0;
+    }
+    return it->get<size_t>();
+  }
+
+  // Write a message whose samples travel in a binary frame (see
+  // sample_frame.hpp), described by the "frame" field of the JSON part
+  void save_frame(const nlohmann::json &json_data,
+                  const std::vector<unsigned char> &blob,
+                  const std::string &group_name) {
+    if (extract_frame(json_data, blob, group_name, _record)) {
+      append(_record);
+    }
+  }
+
+  // Same as extract(), for binary frames: keypaths named <key><sep><label>
+  // (or <key> for a single unlabelled channel) get one row per sample from
+  // the matching channel, "t_us" and "seq" get the sample timestamps and
+  // sequence numbers, all the other keypaths are read from the JSON part
+  bool extract_frame(const nlohmann::json &json_data,
+                     const std::vector<unsigned char> &blob,
+                     const std::string &group_name, Record &record) const {
+    sample_frame::Reader frame;
+    if (!frame.parse(blob.data(), blob.size())) {
+      throw std::runtime_error("Malformed sample frame for group: " +
+                               group_name);
+    }
+    auto it = _compiled_keypaths.find(group_name);
+    if (it == _compiled_keypaths.end() || frame.count() == 0) {
+      return false;
+    }
+    const FrameLayout &frame_map =
+        frame_layout(json_data.at("frame"), group_name, frame.channels());
+    const std::vector<int> &layout = frame_map.sources;
+
+    record.group = group_name;
+    record.path = group_path(json_data, group_name);
+    record.fields.resize(it->second.size());
+    bool found = false;
+    for (size_t i = 0; i < it->second.size(); ++i) {
+      RecordField &field = record.fields[i];
+      if (layout[i] == frame_source_json) {
+        const nlohmann::json *value =
+            resolve_keypath(json_data, it->second[i]);
+        field.present = value != nullptr;
+        if (field.present && it->second[i].name == side_key) {
+          field.present = record.path == group_name;
+          extract_side(*value, field);
+        } else if (field.present) {
+          extract_field(*value, it->second[i].name, field);
+        }
+        continue;
       }
-      // Check if dataset exists
-      bool dataset_exists = false;
-      try {
-        H5::DataSet dataset = group.openDataSet(dataset_name);
-        dataset_exists = true;
-        dataset.close();
-      } catch (const H5::FileIException &) {
-        dataset_exists = false;
-      } catch (const H5::GroupIException &) {
-        dataset_exists = false;
-      }
-
-      if (!dataset_exists) {
-        // Create new dataset based on data type
-        create_dataset(dataset_name, group, data);
+
+      field.present = true;
+      field.width = 0;
+      field.rows = frame.count();
+      field.f64.clear();
+      field.i64.clear();
+      field.str.clear();
+      field.columns.clear();
+      found = true;
+      if (layout[i] == frame_source_channels) {
+        // all the channels in a single row, in the order of their labels
+        field.type = frame.kind() == sample_frame::Kind::force_f32
+                         ? ValueType::f64
+                         : ValueType::i64;
+        field.width = frame_map.order.size();
+        field.columns = frame_map.columns;
+        for (size_t n = 0; n < frame.count(); ++n) {
+          for (const size_t c : frame_map.order) {
+            if (field.type == ValueType::f64) {
+              field.f64.push_back(frame.value_f32(n, c));
+            } else {
+              field.i64.push_back(frame.value_i32(n, c));
+            }
+          }
+        }
+      } else if (layout[i] == frame_source_timestamp ||
+          layout[i] == frame_source_sequence) {
+        field.type = ValueType::i64;
+        for (size_t n = 0; n < frame.count(); ++n) {
+          field.i64.push_back(layout[i] == frame_source_timestamp
+                                  ? int64_t(frame.timestamp_us(n))
+                                  : int64_t(frame.sequence()) + int64_t(n));
+        }
+      } else if (frame.kind() == sample_frame::Kind::force_f32) {
+        field.type = ValueType::f64;
+        for (size_t n = 0; n < frame.count(); ++n) {
+          field.f64.push_back(frame.value_f32(n, size_t(layout[i])));
+        }
       } else {
-        // Append to existing dataset
-        append_to_dataset(dataset_name, group, data);
+        field.type = ValueType::i64;
+        for (size_t n = 0; n < frame.count(); ++n) {
+          field.i64.push_back(frame.value_i32(n, size_t(layout[i])));
+        }
       }
-    } catch (const H5::Exception &e) {
-      throw std::runtime_error("Error writing dataset '" + dataset_name +
-                               "': " + e.getDetailMsg());
+    }
+    record.span_us = std::max<int64_t>(
+        0, int64_t(frame.timestamp_us(frame.count() - 1)) -
+               int64_t(frame.timestamp_us(0)));
+    if (frame.count() > 1) {
+      repeat_single_rows(record, frame.count());
+    }
+    return found;
+  }
+
+  // Stage an extracted record, writing the group when a buffer is full
+  void append(const Record &record) {
+    auto it = _compiled_keypaths.find(record.group);
+    if (it == _compiled_keypaths.end()) {
+      return;
+    }
+    if (_summary) {
+      summarize(record, it->second);
+    }
+    bool buffer_full = false;
+    const size_t count = std::min(it->second.size(), record.fields.size());
+    for (size_t i = 0; i < count; ++i) {
+      if (record.fields[i].present &&
+          stage_value(record.fields[i], it->second[i].name, record.path) >=
+              _buffer_size) {
+        buffer_full = true;
+      }
+    }
+    if (buffer_full) {
+      flush_group(record.path);
+    }
+    flush_if_due();
+  }
+
+  // Write all the staged values of all the groups to the file
+  void flush() {
+    for (auto &pair : _buffers) {
+      flush_group(pair.first);
+    }
+    _last_flush_time = std::chrono::steady_clock::now();
+  }
+
+  // Write all the staged values if the flush period has expired
+  void flush_if_due() {
+    if (_flush_period <= 0) {
+      return;
+    }
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+                       std::chrono::steady_clock::now() - _last_flush_time)
+                       .count();
+    if (elapsed >= _flush_period) {
+      flush();
+      checkpoint_if_due();
+    }
+  }
+
+  // Make the file consistent on disk: everything written so far survives a
+  // power loss and is visible to the readers. In SWMR mode the first
+  // checkpoint switches the file to SWMR writing, the next ones flush it.
+  void checkpoint() {
+    if (_swmr && !_swmr_active) {
+      if (H5Fstart_swmr_write(_file.getId()) < 0) {
+        throw std::runtime_error("Cannot start SWMR writing on " + _filename);
+      }
+      _swmr_active = true;
+    } else {
+      _file.flush(H5F_SCOPE_GLOBAL);
+    }
+    _last_checkpoint_time = std::chrono::steady_clock::now();
+  }
+
+  // Checkpoint if the checkpoint period has expired, called after the
+  // timed flush, so that the staged rows are in the file
+  void checkpoint_if_due() {
+    if (_checkpoint_period <= 0) {
+      return;
+    }
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+                       std::chrono::steady_clock::now() - _last_checkpoint_time)
+                       .count();
+    if (elapsed >= _checkpoint_period) {
+      checkpoint();
     }
   }
 
   void close() {
-    // Close the HDF5 file
-    _file.close();
+    // Write pending data and the summary, then close the HDF5 file
+    // Buffers are always discarded, so that a failed flush does not leak
+    // stale samples into the next file
+    try {
+      flush();
+      write_summary();
+    } catch (...) {
+      release();
+      throw;
+    }
+    release();
   }
 
   void set_keypaths(const std::vector<std::string> &data_paths,
                     const std::string &group_name) {
     _keypaths[group_name] = data_paths;
+    compile_keypaths(group_name);
+    add_group_name(group_name);
   }
 
   void set_keypath_separator(const std::string &separator) {
@@ -114,26 +378,188 @@ public:
           "Keypath separator cannot be empty nor contain '/'.");
     }
     _keypath_sep = separator;
+    for (const auto &pair : _keypaths) {
+      compile_keypaths(pair.first);
+    }
+  }
+
+  // Get the value at the index-th keypath of the group, or nullptr if the
+  // message does not contain it. The value is not copied.
+  const nlohmann::json *value_at_keypath(const nlohmann::json &json_data,
+                                         const std::string &group_name,
+                                         size_t index) const {
+    auto it = _compiled_keypaths.find(group_name);
+    if (it == _compiled_keypaths.end() || index >= it->second.size()) {
+      return nullptr;
+    }
+    return resolve_keypath(json_data, it->second[index]);
   }
 
   std::string keypath_separator() const { return _keypath_sep; }
 
+  // Write the messages of a group into the /<group>/left and /<group>/right
+  // subgroups, according to their "side" field
+  void set_split_by_side(const std::string &group_name, bool split = true) {
+    if (split) {
+      _split_by_side.insert(group_name);
+    } else {
+      _split_by_side.erase(group_name);
+    }
+  }
+
+  bool split_by_side(const std::string &group_name) const {
+    return _split_by_side.count(group_name) > 0;
+  }
+
+  // Number of rows staged per dataset before writing a block to the file
+  void set_buffer_size(size_t rows) {
+    if (rows == 0) {
+      throw std::invalid_argument("Buffer size must be greater than zero.");
+    }
+    _buffer_size = rows;
+  }
+
+  size_t buffer_size() const { return _buffer_size; }
+
+  // Maximum time (ms) staged values are kept in memory, 0 to disable
+  void set_flush_period(int period_ms) { _flush_period = period_ms; }
+
+  int flush_period() const { return _flush_period; }
+
+  // Minimum time (ms) between two checkpoints, 0 to disable. A power loss
+  // loses at most the last checkpoint period plus the flush period.
+  void set_checkpoint_period(int period_ms) { _checkpoint_period = period_ms; }
+
+  int checkpoint_period() const { return _checkpoint_period; }
+
+  // Single-writer/multiple-reader mode of the new files, readers can open the
+  // file while it is written (h5py.File(path, "r", swmr=True)). It needs the
+  // HDF5 1.10 format, which it enables, and checkpoints, since SWMR writing
+  // starts at the first one. A SWMR writer cannot create objects: when a
+  // new group or dataset is needed, the file is reopened in normal mode and
+  // SWMR writing restarts at the next checkpoint.
+  void set_swmr(bool swmr) { _swmr = swmr; }
+
+  bool swmr() const { return _swmr; }
+
+  bool swmr_active() const { return _swmr_active; }
+
+  // Write the /summary group on close: for every numeric dataset its count,
+  // min, max and mean, and a min/max pyramid at 1:10, 1:100 and 1:1000, see
+  // summary.hpp. The datasets of the groups with a side field are
+  // summarized per side, in /summary/<group>/<side>.
+  void set_summary(bool summary) { _summary = summary; }
+
+  bool summary() const { return _summary; }
+
+  // Store the floating point datasets as float32 instead of float64, the
+  // values are converted on write. Only affects new datasets.
+  void set_float32(bool float32) { _float32 = float32; }
+
+  bool float32() const { return _float32; }
+
+  // Rows per HDF5 chunk of the new datasets, for all the groups or for the
+  // groups of a topic (including their side subgroups)
+  void set_chunk_size(hsize_t rows, const std::string &group_name = "") {
+    if (rows == 0) {
+      throw std::invalid_argument("Chunk size must be greater than zero.");
+    }
+    if (group_name.empty()) {
+      _chunk_size = rows;
+    } else {
+      _chunk_sizes[group_name] = rows;
+    }
+  }
+
+  hsize_t chunk_size(const std::string &group_name = "") const {
+    auto it = _chunk_sizes.find(group_name.substr(0, group_name.find('/')));
+    return it != _chunk_sizes.end() ? it->second : _chunk_size;
+  }
+
+  // Raw data chunk cache of each open dataset, in bytes. It should hold at
+  // least one chunk, otherwise a compressed chunk filled by several blocks
+  // is read back and decompressed at each block.
+  void set_chunk_cache(size_t bytes) { _chunk_cache = bytes; }
+
+  size_t chunk_cache() const { return _chunk_cache; }
+
+  // Compression of the new datasets: "none", "deflate" (level 1-9) or "lz4"
+  // (HDF5 filter plugin 32004, found through HDF5_PLUGIN_PATH), optionally
+  // preceded by the byte shuffle, which groups the bytes of the same
+  // significance and makes the samples compress much better
+  void set_compression(const std::string &filter, int level = 1,
+                       bool shuffle = true) {
+    H5Z_filter_t id = H5Z_FILTER_NONE;
+    if (filter == "deflate") {
+      if (level < 1 || level > 9) {
+        throw std::invalid_argument("Deflate level must be between 1 and 9.");
+      }
+      id = H5Z_FILTER_DEFLATE;
+    } else if (filter == "lz4") {
+      id = lz4_filter;
+    } else if (filter != "none") {
+      throw std::invalid_argument("Unknown compression filter: " + filter);
+    }
+    if (id != H5Z_FILTER_NONE && H5Zfilter_avail(id) <= 0) {
+      throw std::runtime_error("Compression filter not available: " + filter);
+    }
+    if (shuffle && id != H5Z_FILTER_NONE && H5Zfilter_avail(H5Z_FILTER_SHUFFLE) <= 0) {
+      throw std::runtime_error("Shuffle filter not available.");
+    }
+    _filter = id;
+    _compression = filter;
+    _compression_level = level;
+    _shuffle = shuffle;
+  }
+
+  const std::string &compression() const { return _compression; }
+
+  // Bytes per string of the new string datasets (e.g. timestamp), 0 for
+  // variable-length strings. Variable-length strings live on the global
+  // heap, which is not compressed; fixed-length strings are stored in the
+  // chunks and their padding compresses away. Longer values are truncated
+  // to string_size - 1 characters.
+  void set_string_size(size_t bytes) { _string_size = bytes; }
+
+  size_t string_size() const { return _string_size; }
+
+  // File format of the new files: with latest_format the library may use the
+  // structures introduced with HDF5 1.10 (e.g. the extensible array index of
+  // the appended datasets), readable by HDF5 1.10 and later only. A
+  // page_size > 0 selects the paged file space strategy: metadata and raw
+  // data are aggregated in pages of that size, written through a page
+  // buffer, so that the card sees fewer and larger writes.
+  void set_file_format(bool latest_format, hsize_t page_size = 0) {
+    _latest_format = latest_format;
+    _page_size = page_size;
+  }
+
+  bool latest_format() const { return _latest_format; }
+
+  hsize_t page_size() const { return _page_size; }
+
   const std::vector<std::string> &
   keypaths(std::string const &group_name) const {
     return _keypaths.at(group_name);
   }
 
-  std::vector<std::string> &groups() const {
+  // Names of the groups with keypaths, in alphabetical order, kept up to
+  // date when the keypaths are set
+  const std::vector<std::string> &groups() const {
     if (_keypaths.empty()) {
       throw std::runtime_error("No groups defined in keypaths.");
     }
-    // return a vector of group names
-    static std::vector<std::string> group_names;
-    group_names.clear();
-    for (const auto &pair : _keypaths) {
-      group_names.push_back(pair.first);
+    return _group_names;
+  }
+
+  // Bytes of the open file, including the space allocated to the chunks
+  // not written yet
+  hsize_t file_size() const {
+    hsize_t size = 0;
+    if (H5Fget_filesize(_file.getId(), &size) < 0) {
+      throw std::runtime_error("Cannot get the size of " + _filename);
     }
-    return group_names;
+    return size;
   }
 
   auto &append_keypath(std::string const &dataset_name,
@@ -143,297 +569,965 @@ public:
     }
     // Add dataset name to the list of data paths
     _keypaths[group_name].push_back(dataset_name);
+    compile_keypaths(group_name);
+    add_group_name(group_name);
     return *this;
   }
 
 private:
+  // In-memory staging buffer for a single dataset
+  // Values are stored row-major: scalars give a 1D dataset (width 0), arrays
+  // give a 2D dataset with one row per message
+  struct StagingBuffer {
+    ValueType type = ValueType::none;
+    size_t width = 0;
+    size_t rows = 0;
+    std::vector<double> f64;
+    std::vector<int64_t> i64;
+    std::vector<std::string> str;
+    std::vector<std::string> columns; // labels of the columns, for objects
+
+    void clear() {
+      // keep the capacity, it will be filled again by the next block
+      f64.clear();
+      i64.clear();
+      str.clear();
+      rows = 0;
+    }
+  };
+
+  // Resolved dataset handle, opened once on the first write and kept until
+  // close(), so that appending needs no HDF5 lookup
+  struct DatasetHandle {
+    H5::DataSet dataset;
+    ValueType type = ValueType::none;
+    int rank = 1;
+    hsize_t width = 0;
+    hsize_t rows = 0;
+    size_t string_size = 0; // 0 for variable-length strings
+  };
+
+  // Keypath split into its keys once, when it is set
+  struct CompiledKeypath {
+    std::string name;              // dataset name, i.e. the full keypath
+    std::vector<std::string> keys; // keys to follow, from the root
+  };
+
   H5::H5File _file; // HDF5 file object
   std::map<std::string, std::vector<std::string>>
       _keypaths; // Store dataset names
+  std::vector<std::string> _group_names; // Keys of _keypaths, sorted
+  std::map<std::string, std::vector<CompiledKeypath>>
+      _compiled_keypaths; // Same keypaths, split by separator
+  std::map<std::string, std::map<std::string, StagingBuffer>>
+      _buffers; // Staged values, by group and dataset name
+  std::map<std::string, H5::Group> _groups; // Open groups, by path
+  std::set<std::string> _split_by_side; // Groups written per side
+  std::map<std::string, std::map<std::string, DatasetHandle>>
+      _handles; // Open datasets, by group and dataset name
+  // Mapping from frame channels to keypaths, for the last descriptor seen
+  struct FrameLayout {
+    nlohmann::json descriptor;
+    std::vector<int> sources;
+    std::vector<std::string> columns; // channel labels, sorted
+    std::vector<size_t> order;        // channel of each sorted label
+  };
+
+  Record _record; // Scratch record reused by save_to_group()
+  mutable std::map<std::string, FrameLayout>
+      _frame_layouts; // Only used by the extracting thread
   std::string _keypath_sep = ".";
+  hsize_t _chunk_size = 1024; // Rows per HDF5 chunk
+  std::map<std::string, hsize_t> _chunk_sizes; // Rows per chunk, by topic
+  size_t _chunk_cache = 1 << 20; // Bytes of chunk cache per dataset
+  H5Z_filter_t _filter = H5Z_FILTER_NONE; // Compression filter
+  std::string _compression = "none";
+  int _compression_level = 1;
+  bool _shuffle = true;
+  size_t _string_size = 0; // Fixed-length strings, 0 for variable length
+  bool _latest_format = false; // HDF5 1.10 file format
+  hsize_t _page_size = 0;      // Paged file space, 0 to disable
+  size_t _buffer_size = 1024; // Rows staged before writing, per dataset
+  int _flush_period = 1000;   // in milliseconds, 0 to disable
+  bool _float32 = false;      // floating point datasets stored as float32
+  std::vector<uint8_t> _side_codes; // Scratch for writing side datasets
+  std::vector<char> _string_block;  // Scratch for fixed-length strings
+  std::chrono::steady_clock::time_point _last_flush_time =
+      std::chrono::steady_clock::now();
+  // Summary of the datasets of a group (and side), computed while recording
+  struct GroupSummary {
+    int64_t first_ms = 0; // first and last timestamp, ms since the epoch
+    int64_t last_ms = 0;
+    bool timed = false;
+    std::map<std::string, DatasetSummary> datasets;
+    std::map<std::string, std::vector<std::string>> columns;
+  };
 
-  nlohmann::json json_from_keypath(const nlohmann::json &j,
-                                   const std::string &keypath) {
-    nlohmann::json result = j;
-    size_t start = 0;
-    size_t end = keypath.find(_keypath_sep);
-    while (end != std::string::npos) {
-      std::string key = keypath.substr(start, end - start);
-      if (result.contains(key)) {
-        result = result[key];
-      } else {
+  bool _summary = false;
+  std::map<std::string, GroupSummary> _summaries; // by summary path
+  std::string _filename;       // Open file, to reopen it out of SWMR mode
+  int _checkpoint_period = 0;  // in milliseconds, 0 to disable
+  bool _swmr = false;          // SWMR mode requested for the new files
+  bool _swmr_active = false;   // SWMR writing started on the open file
+  std::chrono::steady_clock::time_point _last_checkpoint_time =
+      std::chrono::steady_clock::now();
+
+  void add_group_name(const std::string &group_name) {
+    auto it = std::lower_bound(_group_names.begin(), _group_names.end(),
+                               group_name);
+    if (it == _group_names.end() || *it != group_name) {
+      _group_names.insert(it, group_name);
+    }
+  }
+
+  // Split the keypaths of a group into their keys
+  void compile_keypaths(const std::string &group_name) {
+    std::vector<CompiledKeypath> compiled;
+    for (const auto &keypath : _keypaths[group_name]) {
+      CompiledKeypath item{keypath, {}};
+      size_t start = 0;
+      size_t end = keypath.find(_keypath_sep);
+      while (end != std::string::npos) {
+        item.keys.push_back(keypath.substr(start, end - start));
+        start = end + _keypath_sep.length();
+        end = keypath.find(_keypath_sep, start);
+      }
+      item.keys.push_back(keypath.substr(start));
+      compiled.push_back(std::move(item));
+    }
+    _compiled_keypaths[group_name] = std::move(compiled);
+  }
+
+  // HDF5 group of a message: the group itself, or its side subgroup
+  std::string group_path(const nlohmann::json &json_data,
+                         const std::string &group_name) const {
+    if (_split_by_side.empty() || !split_by_side(group_name)) {
+      return group_name;
+    }
+    auto it = json_data.find("side");
+    if (it == json_data.end() || !it->is_string() ||
+        (*it != "left" && *it != "right")) {
+      return group_name;
+    }
+    return group_name + "/" + it->get<std::string>();
+  }
+
+  // Follow the keys of a compiled keypath, by reference
+  static const nlohmann::json *resolve_keypath(const nlohmann::json &j,
+                                               const CompiledKeypath &keypath) {
+    const nlohmann::json *node = &j;
+    for (const auto &key : keypath.keys) {
+      if (!node->is_object()) {
+        return nullptr;
+      }
+      auto it = node->find(key);
+      if (it == node->end()) {
         return nullptr;
       }
-      start = end + _keypath_sep.length();
-      end = keypath.find(_keypath_sep, start);
+      node = &(*it);
     }
-    result = result.contains(keypath.substr(start))
-                 ? result[keypath.substr(start)]
-                 : nullptr;
-    if (result.contains("$date")) {
+    if (node->is_object()) {
       // Handle timestamp with $date
-      result = result["$date"];
-    }
-    return result;
-  }
-
-  // Helper method to create a new dataset based on JSON data type
-  void create_dataset(const std::string &dataset_name, const H5::Group &group,
-                      const nlohmann::json &data) {
-    if (data.is_number_float()) {
-      create_scalar_dataset<double>(dataset_name, group, data.get<double>());
-    } else if (data.is_number_integer()) {
-      create_scalar_dataset<int64_t>(dataset_name, group, data.get<int64_t>());
-    } else if (data.is_string()) {
-      create_string_dataset(dataset_name, group, data.get<std::string>());
-    } else if (data.is_array()) {
-      create_array_dataset(dataset_name, group, data);
+      auto it = node->find("$date");
+      if (it != node->end()) {
+        node = &(*it);
+      }
+    }
+    return node->is_null() ? nullptr : node;
+  }
+
+  // Helper method to get the value type of a JSON value
+  static ValueType value_type(const nlohmann::json &value) {
+    if (value.is_number_float()) {
+      return ValueType::f64;
+    } else if (value.is_number_integer()) {
+      return ValueType::i64;
+    } else if (value.is_string()) {
+      return ValueType::str;
+    }
+    return ValueType::none;
+  }
+
+  // Convert a JSON value (scalar or array) into a typed field, all the
+  // elements having the type of the first one. In a batch of N samples an
+  // array of N elements holds one row per sample (scalars or arrays of the
+  // same size), any other value is a single row.
+  static void extract_field(const nlohmann::json &value,
+                            const std::string &dataset_name,
+                            RecordField &field, size_t samples = 0) {
+    field.f64.clear();
+    field.i64.clear();
+    field.str.clear();
+    field.columns.clear();
+    if (value.is_object()) {
+      extract_object(value, dataset_name, field, samples);
+      return;
+    }
+    const bool batch =
+        samples > 0 && value.is_array() && value.size() == samples;
+    const nlohmann::json &first =
+        value.is_array() && !value.empty() ? value[0] : value;
+    if (batch) {
+      field.rows = samples;
+      field.width = first.is_array() ? first.size() : 0;
     } else {
+      field.rows = 1;
+      field.width = value.is_array() ? value.size() : 0;
+    }
+    if (value.is_array() && (value.empty() || (batch && first.is_array() &&
+                                               first.empty()))) {
+      throw std::runtime_error("Cannot create dataset from empty array");
+    }
+    field.type = value_type(batch && first.is_array() ? first[0] : first);
+    if (field.type == ValueType::none) {
       throw std::runtime_error("Unsupported JSON data type for dataset: " +
                                dataset_name);
     }
+
+    try {
+      if (batch && field.width > 0) {
+        for (const auto &row : value) {
+          if (!row.is_array() || row.size() != field.width) {
+            throw std::runtime_error(
+                "Array size mismatch in batch for dataset: " + dataset_name);
+          }
+          for (const auto &element : row) {
+            extract_element(element, field);
+          }
+        }
+      } else if (value.is_array()) {
+        for (const auto &element : value) {
+          extract_element(element, field);
+        }
+      } else {
+        extract_element(value, field);
+      }
+    } catch (const nlohmann::json::exception &e) {
+      throw std::runtime_error("Type mismatch for dataset '" + dataset_name +
+                               "': " + e.what());
+    }
   }
 
-  // Helper method to append data to existing dataset
-  void append_to_dataset(const std::string &dataset_name,
-                         const H5::Group &group, const nlohmann::json &data) {
-    H5::DataSet dataset = group.openDataSet(dataset_name);
-    H5::DataSpace current_space = dataset.getSpace();
+  // An object of numbers is one row with a column per key, an object of
+  // arrays of N elements in a batch of N samples gives one row per sample
+  static void extract_object(const nlohmann::json &value,
+                             const std::string &dataset_name,
+                             RecordField &field, size_t samples) {
+    if (value.empty()) {
+      throw std::runtime_error("Cannot create dataset from empty object");
+    }
+    const nlohmann::json &first = value.begin().value();
+    const bool batch =
+        samples > 0 && first.is_array() && first.size() == samples;
+    field.rows = batch ? samples : 1;
+    field.width = value.size();
+    field.type = value_type(batch ? first[0] : first);
+    if (field.type != ValueType::f64 && field.type != ValueType::i64) {
+      throw std::runtime_error("Unsupported JSON data type for dataset: " +
+                               dataset_name);
+    }
+    field.columns.resize(value.size());
+    size_t c = 0;
+    for (auto it = value.begin(); it != value.end(); ++it, ++c) {
+      field.columns[c] = it.key(); // short labels, no allocation on reuse
+    }
+    try {
+      for (size_t r = 0; r < field.rows; ++r) {
+        for (const auto &column : value) {
+          extract_element(batch ? column.at(r) : column, field);
+        }
+      }
+    } catch (const nlohmann::json::exception &e) {
+      throw std::runtime_error("Type or size mismatch for dataset '" +
+                               dataset_name + "': " + e.what());
+    }
+  }
 
-    // Get current dimensions
-    int rank = current_space.getSimpleExtentNdims();
-    std::vector<hsize_t> current_dims(rank);
-    current_space.getSimpleExtentDims(current_dims.data());
+  // The fields with one row per message (e.g. timestamp and side) of a
+  // batch or frame of several samples are repeated on every sample, so that
+  // all the datasets of the group keep a row per sample
+  static void repeat_single_rows(Record &record, size_t rows) {
+    for (RecordField &field : record.fields) {
+      if (!field.present || field.rows != 1) {
+        continue;
+      }
+      const size_t f64 = field.f64.size();
+      const size_t i64 = field.i64.size();
+      const size_t str = field.str.size();
+      field.f64.reserve(f64 * rows); // no reallocation while copying
+      field.i64.reserve(i64 * rows);
+      field.str.reserve(str * rows);
+      for (size_t r = 1; r < rows; ++r) {
+        for (size_t k = 0; k < f64; ++k) {
+          field.f64.push_back(field.f64[k]);
+        }
+        for (size_t k = 0; k < i64; ++k) {
+          field.i64.push_back(field.i64[k]);
+        }
+        for (size_t k = 0; k < str; ++k) {
+          field.str.push_back(field.str[k]);
+        }
+      }
+      field.rows = rows;
+    }
+  }
 
-    if (data.is_array()) {
-      // Append array as new row to matrix
-      append_array_to_matrix(dataset, data, group, current_dims);
-    } else {
-      // Append scalar to vector
-      append_scalar_to_vector(dataset, data, group, current_dims);
+  // Code of the crutch side, 0 (unknown) for anything but "left" and "right"
+  static void extract_side(const nlohmann::json &value, RecordField &field) {
+    field.type = ValueType::side;
+    field.width = 0;
+    field.rows = 1;
+    field.f64.clear();
+    field.str.clear();
+    field.columns.clear();
+    field.i64.assign(1, int64_t(sample_frame::Side::unknown));
+    if (value == "left") {
+      field.i64[0] = int64_t(sample_frame::Side::left);
+    } else if (value == "right") {
+      field.i64[0] = int64_t(sample_frame::Side::right);
     }
+  }
 
-    dataset.close();
+  static void extract_element(const nlohmann::json &element,
+                              RecordField &field) {
+    switch (field.type) {
+    case ValueType::f64:
+      field.f64.push_back(element.get<double>());
+      break;
+    case ValueType::i64:
+      field.i64.push_back(element.get<int64_t>());
+      break;
+    case ValueType::str:
+      field.str.push_back(element.get<std::string>());
+      break;
+    default:
+      break;
+    }
   }
 
-  // Create scalar dataset (for initial single values)
-  template <typename T>
-  void create_scalar_dataset(const std::string &dataset_name,
-                             const H5::Group &group, T value) {
-    // Create 1D dataset with initial size 1, unlimited max size
-    hsize_t dims[1] = {1};
-    hsize_t max_dims[1] = {H5S_UNLIMITED};
-    H5::DataSpace space(1, dims, max_dims);
+  // Append a field (scalar or array row) to the staging buffer of the
+  // dataset, converting numbers to the type selected by the first value.
+  // Returns the number of rows currently staged.
+  size_t stage_value(const RecordField &field, const std::string &dataset_name,
+                     const std::string &group_name) {
+    StagingBuffer &buffer = _buffers[group_name][dataset_name];
 
-    // Create dataset with chunking for extensibility
-    H5::DSetCreatPropList prop;
-    hsize_t chunk_dims[1] = {1024}; // Chunk size
-    prop.setChunk(1, chunk_dims);
+    if (buffer.type == ValueType::none) {
+      // First value: determine data type and shape
+      buffer.type = field.type;
+      buffer.width = field.width;
+      buffer.columns = field.columns;
+    }
 
-    H5::DataType data_type;
-    if constexpr (std::is_same_v<T, double>) {
-      data_type = H5::PredType::NATIVE_DOUBLE;
-    } else if constexpr (std::is_same_v<T, int64_t>) {
-      data_type = H5::PredType::NATIVE_LLONG;
+    if (field.width != buffer.width) {
+      throw std::runtime_error(
+          "Array size mismatch: expected " + std::to_string(buffer.width) +
+          ", got " + std::to_string(field.width));
+    }
+    if ((field.type == ValueType::str) != (buffer.type == ValueType::str) ||
+        (field.type == ValueType::side) != (buffer.type == ValueType::side)) {
+      throw std::runtime_error("Type mismatch for dataset: " + dataset_name);
+    }
+    if (field.columns != buffer.columns) {
+      throw std::runtime_error("Column labels changed for dataset: " +
+                               dataset_name);
     }
 
-    H5::DataSet dataset =
-        group.createDataSet(dataset_name, data_type, space, prop);
+    switch (buffer.type) {
+    case ValueType::f64:
+      if (field.type == ValueType::f64) {
+        buffer.f64.insert(buffer.f64.end(), field.f64.begin(), field.f64.end());
+      } else {
+        buffer.f64.insert(buffer.f64.end(), field.i64.begin(), field.i64.end());
+      }
+      break;
+    case ValueType::side:
+      buffer.i64.insert(buffer.i64.end(), field.i64.begin(), field.i64.end());
+      break;
+    case ValueType::i64:
+      if (field.type == ValueType::i64) {
+        buffer.i64.insert(buffer.i64.end(), field.i64.begin(), field.i64.end());
+      } else {
+        for (const double value : field.f64) {
+          buffer.i64.push_back(static_cast<int64_t>(value));
+        }
+      }
+      break;
+    case ValueType::str:
+      buffer.str.insert(buffer.str.end(), field.str.begin(), field.str.end());
+      break;
+    default:
+      break;
+    }
 
-    // Write initial value
-    dataset.write(&value, data_type);
-    dataset.close();
+    buffer.rows += field.rows;
+    return buffer.rows;
   }
 
-  // Create string dataset
-  void create_string_dataset(const std::string &dataset_name,
-                             const H5::Group &group, const std::string &value) {
-    // Create variable-length string type
-    H5::StrType string_type(H5::PredType::C_S1, H5T_VARIABLE);
+  // Source of each keypath of a group when decoding a binary frame: a
+  // channel index or one of the values below. Built on the first frame and
+  // rebuilt only if the descriptor changes.
+  static constexpr int frame_source_json = -1;
+  static constexpr int frame_source_timestamp = -2;
+  static constexpr int frame_source_sequence = -3;
+  static constexpr int frame_source_channels = -4; // <key>: all the channels
 
-    hsize_t dims[1] = {1};
-    hsize_t max_dims[1] = {H5S_UNLIMITED};
-    H5::DataSpace space(1, dims, max_dims);
+  const FrameLayout &frame_layout(const nlohmann::json &descriptor,
+                                  const std::string &group_name,
+                                  size_t channels) const {
+    FrameLayout &layout = _frame_layouts[group_name];
+    if (!layout.sources.empty() && layout.descriptor == descriptor) {
+      return layout;
+    }
 
-    H5::DSetCreatPropList prop;
-    hsize_t chunk_dims[1] = {1024};
-    prop.setChunk(1, chunk_dims);
+    const std::string key = descriptor.value("key", "");
+    const nlohmann::json labels =
+        descriptor.value("channels", nlohmann::json::array());
+    if (key.empty() || !labels.is_array() ||
+        std::max<size_t>(labels.size(), 1) != channels) {
+      throw std::runtime_error("Frame descriptor does not match the frame for "
+                               "group: " + group_name);
+    }
 
-    H5::DataSet dataset =
-        group.createDataSet(dataset_name, string_type, space, prop);
+    layout.descriptor = descriptor;
+    layout.sources.clear();
+    layout.columns.clear();
+    layout.order.clear();
+    for (const auto &label : labels) {
+      layout.columns.push_back(label.get<std::string>());
+    }
+    std::sort(layout.columns.begin(), layout.columns.end());
+    for (const auto &column : layout.columns) {
+      for (size_t c = 0; c < labels.size(); ++c) {
+        if (labels[c] == column) {
+          layout.order.push_back(c);
+          break;
+        }
+      }
+    }
+    for (const auto &keypath : _compiled_keypaths.at(group_name)) {
+      int source = frame_source_json;
+      if (keypath.name == "t_us") {
+        source = frame_source_timestamp;
+      } else if (keypath.name == "seq") {
+        source = frame_source_sequence;
+      } else if (labels.empty() && keypath.name == key) {
+        source = 0;
+      } else if (keypath.name == key) {
+        source = frame_source_channels;
+      } else {
+        for (size_t c = 0; c < labels.size(); ++c) {
+          if (keypath.name == key + _keypath_sep + labels[c].get<std::string>()) {
+            source = int(c);
+          }
+        }
+      }
+      layout.sources.push_back(source);
+    }
+    return layout;
+  }
 
-    const char *str_data = value.c_str();
-    dataset.write(&str_data, string_type);
-    dataset.close();
+  // Drop staged values and cached handles, then close the file
+  // Handles must be released first, otherwise the file stays open
+  void release() {
+    _buffers.clear();
+    _summaries.clear();
+    _handles.clear();
+    _groups.clear();
+    _file.close();
+    _swmr_active = false;
   }
 
-  // Create array dataset (2D matrix)
-  void create_array_dataset(const std::string &dataset_name,
-                            const H5::Group &group,
-                            const nlohmann::json &array) {
-    if (array.empty()) {
-      throw std::runtime_error("Cannot create dataset from empty array");
+  // Update the summary of the group of a record with its numeric fields.
+  // The timestamp gives the duration, the side the summary path.
+  void summarize(const Record &record,
+                 const std::vector<CompiledKeypath> &keypaths) {
+    const size_t count = std::min(keypaths.size(), record.fields.size());
+    std::string path = record.path;
+    for (size_t i = 0; i < count; ++i) {
+      const RecordField &field = record.fields[i];
+      if (field.present && field.type == ValueType::side && !field.i64.empty()) {
+        if (field.i64[0] == int64_t(sample_frame::Side::left)) {
+          path += "/left";
+        } else if (field.i64[0] == int64_t(sample_frame::Side::right)) {
+          path += "/right";
+        }
+      }
+    }
+    GroupSummary &summary = _summaries[path];
+    for (size_t i = 0; i < count; ++i) {
+      const RecordField &field = record.fields[i];
+      if (!field.present) {
+        continue;
+      }
+      if (field.type == ValueType::str && keypaths[i].name == "timestamp" &&
+          !field.str.empty()) {
+        int64_t ms = 0;
+        const std::string &text = field.str.back();
+        if (clock_offset::parse_iso8601_ms(text.data(), text.size(), ms)) {
+          summary.first_ms = summary.timed ? summary.first_ms : ms;
+          summary.last_ms = ms;
+          summary.timed = true;
+        }
+        continue;
+      }
+      if (field.type != ValueType::f64 && field.type != ValueType::i64) {
+        continue;
+      }
+      const size_t width = std::max<size_t>(field.width, 1);
+      auto it = summary.datasets.find(keypaths[i].name);
+      if (it == summary.datasets.end()) {
+        it = summary.datasets.emplace(keypaths[i].name, DatasetSummary(width))
+                 .first;
+        summary.columns[keypaths[i].name] = field.columns;
+      }
+      if (it->second.width() != width) {
+        continue; // the dataset write reports the mismatch
+      }
+      for (size_t r = 0; r < field.rows; ++r) {
+        if (field.type == ValueType::f64) {
+          it->second.add(field.f64.data() + r * width);
+        } else {
+          it->second.add(field.i64.data() + r * width);
+        }
+      }
     }
+  }
 
-    size_t array_size = array.size();
+  // Write the summaries to /summary, replacing a previous one (on reopen)
+  void write_summary() {
+    if (!_summary || _summaries.empty()) {
+      return;
+    }
+    if (_swmr_active) {
+      leave_swmr();
+    }
+    if (_file.nameExists("summary")) {
+      _file.unlink("summary");
+    }
+    H5::Group root = _file.createGroup("summary");
+    std::vector<int64_t> decimation(DatasetSummary::decimation.begin(),
+                                    DatasetSummary::decimation.end());
+    write_attribute(root, "decimation", decimation);
 
-    // Determine data type from first element
-    if (array[0].is_number_float()) {
-      create_array_dataset_typed<double>(dataset_name, group, array);
-    } else if (array[0].is_number_integer()) {
-      create_array_dataset_typed<int64_t>(dataset_name, group, array);
-    } else if (array[0].is_string()) {
-      create_string_array_dataset(dataset_name, group, array);
-    } else {
-      throw std::runtime_error("Unsupported array element type for dataset: " +
-                               dataset_name);
+    for (auto &pair : _summaries) {
+      H5::Group group = make_groups(root, pair.first);
+      GroupSummary &summary = pair.second;
+      if (summary.timed) {
+        write_attribute(group, "first_timestamp_ms",
+                        std::vector<int64_t>{summary.first_ms});
+        write_attribute(group, "last_timestamp_ms",
+                        std::vector<int64_t>{summary.last_ms});
+        write_attribute(group, "duration",
+                        std::vector<double>{
+                            double(summary.last_ms - summary.first_ms) / 1000.0});
+      }
+      for (auto &dataset : summary.datasets) {
+        DatasetSummary &values = dataset.second;
+        values.finish();
+        const size_t width = values.width();
+        H5::Group node = group.createGroup(dataset.first);
+        std::vector<double> min(width), max(width), mean(width);
+        std::vector<int64_t> count(width);
+        for (size_t c = 0; c < width; ++c) {
+          count[c] = int64_t(values.count(c));
+          min[c] = values.min(c);
+          max[c] = values.max(c);
+          mean[c] = values.mean(c);
+        }
+        write_attribute(node, "rows", std::vector<int64_t>{int64_t(values.rows())});
+        write_attribute(node, "count", count);
+        write_attribute(node, "min", min);
+        write_attribute(node, "max", max);
+        write_attribute(node, "mean", mean);
+        const auto &columns = summary.columns[dataset.first];
+        if (!columns.empty()) {
+          write_string_attribute(node, "columns", columns);
+        }
+        for (size_t l = 0; l < DatasetSummary::level_count; ++l) {
+          const std::string suffix = std::to_string(DatasetSummary::decimation[l]);
+          const DatasetSummary::Level &level = values.level(l);
+          write_float_dataset(node, "min_" + suffix, level.min, level.rows, width);
+          write_float_dataset(node, "max_" + suffix, level.max, level.rows, width);
+        }
+      }
     }
   }
 
-  template <typename T>
-  void create_array_dataset_typed(const std::string &dataset_name,
-                                  const H5::Group &group,
-                                  const nlohmann::json &array) {
-    size_t array_size = array.size();
+  // Open or create the groups of a relative path under a parent
+  static H5::Group make_groups(H5::Group parent, const std::string &path) {
+    size_t start = 0;
+    while (start < path.size()) {
+      const size_t slash = path.find('/', start);
+      const std::string name = path.substr(start, slash - start);
+      parent = parent.nameExists(name) ? parent.openGroup(name)
+                                       : parent.createGroup(name);
+      start = slash == std::string::npos ? path.size() : slash + 1;
+    }
+    return parent;
+  }
 
-    // Create 2D dataset: rows x columns (1 x array_size initially)
-    hsize_t dims[2] = {1, array_size};
-    hsize_t max_dims[2] = {H5S_UNLIMITED, array_size};
-    H5::DataSpace space(2, dims, max_dims);
+  static void write_attribute(H5::H5Object &object, const std::string &name,
+                              const std::vector<double> &values) {
+    hsize_t count = values.size();
+    object.createAttribute(name, H5::PredType::NATIVE_DOUBLE, H5::DataSpace(1, &count))
+        .write(H5::PredType::NATIVE_DOUBLE, values.data());
+  }
 
-    H5::DSetCreatPropList prop;
-    hsize_t chunk_dims[2] = {1024, array_size};
-    prop.setChunk(2, chunk_dims);
+  static void write_attribute(H5::H5Object &object, const std::string &name,
+                              const std::vector<int64_t> &values) {
+    hsize_t count = values.size();
+    object.createAttribute(name, H5::PredType::NATIVE_LLONG, H5::DataSpace(1, &count))
+        .write(H5::PredType::NATIVE_LLONG, values.data());
+  }
 
-    H5::DataType data_type;
-    if constexpr (std::is_same_v<T, double>) {
-      data_type = H5::PredType::NATIVE_DOUBLE;
-    } else if constexpr (std::is_same_v<T, int64_t>) {
-      data_type = H5::PredType::NATIVE_LLONG;
+  static void write_string_attribute(H5::H5Object &object, const std::string &name,
+                                     const std::vector<std::string> &values) {
+    std::vector<const char *> labels;
+    for (const auto &value : values) {
+      labels.push_back(value.c_str());
     }
+    hsize_t count = labels.size();
+    H5::StrType string_type(H5::PredType::C_S1, H5T_VARIABLE);
+    object.createAttribute(name, string_type, H5::DataSpace(1, &count))
+        .write(string_type, labels.data());
+  }
 
-    H5::DataSet dataset =
-        group.createDataSet(dataset_name, data_type, space, prop);
+  // Small contiguous float32 dataset, 1D for one column
+  static void write_float_dataset(H5::Group &group, const std::string &name,
+                                  const std::vector<float> &values, size_t rows,
+                                  size_t width) {
+    hsize_t dims[2] = {rows, width};
+    H5::DataSpace space(width > 1 ? 2 : 1, dims);
+    group.createDataSet(name, H5::PredType::NATIVE_FLOAT, space)
+        .write(values.data(), H5::PredType::NATIVE_FLOAT);
+  }
 
-    // Convert JSON array to C++ vector
-    std::vector<T> data;
-    for (const auto &element : array) {
-      data.push_back(element.get<T>());
+  // Leave the SWMR mode before creating an object, keeping the staged values
+  // The SWMR readers hold a lock on the file: the reopen ignores it, and
+  // they may get a failed read until the next checkpoint
+  void leave_swmr() {
+    _handles.clear();
+    _groups.clear();
+    _file.close();
+    _swmr_active = false;
+    try {
+      H5::FileAccPropList access = file_access_properties(false);
+      H5Pset_file_locking(access.getId(), false, true);
+      _file = H5::H5File(_filename, H5F_ACC_RDWR,
+                         H5::FileCreatPropList::DEFAULT, access);
+    } catch (const H5::Exception &e) {
+      throw std::runtime_error("Cannot reopen " + _filename + ": " +
+                               e.getDetailMsg());
     }
+  }
 
-    dataset.write(data.data(), data_type);
-    dataset.close();
+  // Whether an object exists, also when its parent groups do not
+  bool path_exists(const std::string &path) const {
+    for (size_t slash = path.find('/', 1);; slash = path.find('/', slash + 1)) {
+      if (!_file.nameExists(path.substr(0, slash))) {
+        return false;
+      }
+      if (slash == std::string::npos) {
+        return true;
+      }
+    }
   }
 
-  void create_string_array_dataset(const std::string &dataset_name,
-                                   const H5::Group &group,
-                                   const nlohmann::json &array) {
-    size_t array_size = array.size();
+  // Write the staged values of all the datasets of a group to the file
+  void flush_group(const std::string &group_name) {
+    auto it = _buffers.find(group_name);
+    if (it == _buffers.end() ||
+        std::none_of(it->second.begin(), it->second.end(),
+                     [](const auto &pair) { return pair.second.rows > 0; })) {
+      return;
+    }
 
-    H5::StrType string_type(H5::PredType::C_S1, H5T_VARIABLE);
+    for (auto &pair : it->second) {
+      if (pair.second.rows == 0) {
+        continue;
+      }
+      try {
+        DatasetHandle &handle =
+            resolve_dataset(pair.first, group_name, pair.second);
+        write_to_dataset(pair.second, handle);
+      } catch (const H5::Exception &e) {
+        pair.second.clear();
+        throw std::runtime_error("Error writing dataset '" + pair.first +
+                                 "': " + e.getDetailMsg());
+      } catch (...) {
+        pair.second.clear();
+        throw;
+      }
+      pair.second.clear();
+    }
+  }
 
-    hsize_t dims[2] = {1, array_size};
-    hsize_t max_dims[2] = {H5S_UNLIMITED, array_size};
-    H5::DataSpace space(2, dims, max_dims);
+  // Get the cached group, opening or creating it on first use, together
+  // with its parents
+  H5::Group &resolve_group(const std::string &group_name) {
+    auto it = _groups.find(group_name);
+    if (it != _groups.end()) {
+      return it->second;
+    }
+    const size_t slash = group_name.rfind('/');
+    if (slash != std::string::npos && slash > 0) {
+      resolve_group(group_name.substr(0, slash));
+    }
+    H5::Group group = _file.nameExists(group_name)
+                          ? _file.openGroup(group_name)
+                          : _file.createGroup(group_name);
+    return _groups.emplace(group_name, group).first->second;
+  }
 
-    H5::DSetCreatPropList prop;
-    hsize_t chunk_dims[2] = {1024, array_size};
-    prop.setChunk(2, chunk_dims);
+  // Get the cached dataset handle, opening or creating the dataset on first
+  // use. Existing datasets (file reopened for append) are checked for shape.
+  DatasetHandle &resolve_dataset(const std::string &dataset_name,
+                                 const std::string &group_name,
+                                 const StagingBuffer &buffer) {
+    auto it = _handles[group_name].find(dataset_name);
+    if (it != _handles[group_name].end()) {
+      return it->second;
+    }
+    if (_swmr_active && !path_exists(group_name + "/" + dataset_name)) {
+      leave_swmr(); // drops all the cached handles
+    }
+    auto &group_handles = _handles[group_name];
 
-    H5::DataSet dataset =
-        group.createDataSet(dataset_name, string_type, space, prop);
+    H5::Group &group = resolve_group(group_name);
+    DatasetHandle handle;
+    handle.rank = buffer.width > 0 ? 2 : 1;
+    handle.width = buffer.width;
 
-    // Convert to array of C strings
-    std::vector<const char *> string_data;
-    std::vector<std::string> strings; // Keep strings alive
-    for (const auto &element : array) {
-      strings.push_back(element.get<std::string>());
-      string_data.push_back(strings.back().c_str());
+    if (!group.nameExists(dataset_name)) {
+      // Create new empty dataset based on data type
+      handle.dataset =
+          create_dataset(dataset_name, group, buffer, chunk_size(group_name));
+      handle.type = buffer.type;
+      handle.string_size = buffer.type == ValueType::str ? _string_size : 0;
+    } else {
+      handle.dataset =
+          group.openDataSet(dataset_name, dataset_access_properties());
+      H5::DataSpace space = handle.dataset.getSpace();
+      if (space.getSimpleExtentNdims() != handle.rank) {
+        throw std::runtime_error("Rank mismatch for dataset: " + dataset_name);
+      }
+      hsize_t dims[2] = {0, 0};
+      space.getSimpleExtentDims(dims);
+      if (handle.rank == 2 && dims[1] != buffer.width) {
+        throw std::runtime_error("Array size mismatch: expected " +
+                                 std::to_string(dims[1]) + ", got " +
+                                 std::to_string(buffer.width));
+      }
+      handle.rows = dims[0];
+      switch (handle.dataset.getTypeClass()) {
+      case H5T_FLOAT:
+        handle.type = ValueType::f64;
+        break;
+      case H5T_INTEGER:
+        handle.type = ValueType::i64;
+        break;
+      case H5T_STRING: {
+        handle.type = ValueType::str;
+        H5::StrType string_type = handle.dataset.getStrType();
+        handle.string_size =
+            string_type.isVariableStr() ? 0 : string_type.getSize();
+        break;
+      }
+      case H5T_ENUM:
+        handle.type = ValueType::side;
+        break;
+      default:
+        throw std::runtime_error("Unsupported data type for dataset: " +
+                                 dataset_name);
+      }
     }
 
-    dataset.write(string_data.data(), string_type);
-    dataset.close();
+    if ((handle.type == ValueType::str) != (buffer.type == ValueType::str) ||
+        (handle.type == ValueType::side) != (buffer.type == ValueType::side)) {
+      throw std::runtime_error("Type mismatch for dataset: " + dataset_name);
+    }
+    return group_handles.emplace(dataset_name, handle).first->second;
   }
 
-  // Append scalar to vector (1D dataset)
-  void append_scalar_to_vector(H5::DataSet &dataset, const nlohmann::json &data,
-                               const H5::Group &group,
-                               std::vector<hsize_t> &current_dims) {
-    // Extend dataset by 1 element
-    hsize_t new_dims[1] = {current_dims[0] + 1};
-    dataset.extend(new_dims);
+  // Registered id of the LZ4 filter plugin
+  static constexpr H5Z_filter_t lz4_filter = 32004;
 
-    // Get memory and file space for the new element
-    H5::DataSpace file_space = dataset.getSpace();
-    hsize_t offset[1] = {current_dims[0]};
-    hsize_t count[1] = {1};
-    file_space.selectHyperslab(H5S_SELECT_SET, count, offset);
+  // Pages held by the page buffer of a paged file
+  static constexpr hsize_t page_buffer_pages = 16;
 
-    H5::DataSpace mem_space(1, count);
-
-    // Write the new data
-    if (data.is_number_float()) {
-      double value = data.get<double>();
-      dataset.write(&value, H5::PredType::NATIVE_DOUBLE, mem_space, file_space);
-    } else if (data.is_number_integer()) {
-      int64_t value = data.get<int64_t>();
-      dataset.write(&value, H5::PredType::NATIVE_LLONG, mem_space, file_space);
-    } else if (data.is_string()) {
-      H5::StrType string_type(H5::PredType::C_S1, H5T_VARIABLE);
-      dataset.write(data.get<std::string>(), string_type, mem_space,
-                    file_space);
+  H5::FileCreatPropList file_creation_properties() const {
+    H5::FileCreatPropList prop;
+    if (_page_size > 0) {
+      prop.setFileSpaceStrategy(H5F_FSPACE_STRATEGY_PAGE, false, 1);
+      prop.setFileSpacePagesize(_page_size);
     }
+    return prop;
   }
 
-  // Append array as new row to matrix (2D dataset)
-  void append_array_to_matrix(H5::DataSet &dataset, const nlohmann::json &array,
-                              const H5::Group &group,
-                              std::vector<hsize_t> &current_dims) {
-    if (array.size() != current_dims[1]) {
-      throw std::runtime_error("Array size mismatch: expected " +
-                               std::to_string(current_dims[1]) + ", got " +
-                               std::to_string(array.size()));
+  // The page buffer can only be enabled on files created paged
+  H5::FileAccPropList file_access_properties(bool create) const {
+    H5::FileAccPropList prop;
+    if (_latest_format || _swmr) {
+      prop.setLibverBounds(H5F_LIBVER_V110, H5F_LIBVER_LATEST);
+    }
+    if (create && _page_size > 0) {
+      if (H5Pset_page_buffer_size(prop.getId(), _page_size * page_buffer_pages,
+                                  0, 0) < 0) {
+        throw H5::PropListIException("file_access_properties",
+                                     "H5Pset_page_buffer_size failed");
+      }
     }
+    return prop;
+  }
+
+  // Chunk cache of a dataset: 521 slots (a prime, as advised by the HDF5
+  // documentation) and w0 = 1, since appended chunks are never read again
+  H5::DSetAccPropList dataset_access_properties() const {
+    H5::DSetAccPropList prop;
+    prop.setChunkCache(521, _chunk_cache, 1.0);
+    return prop;
+  }
+
+  // 1-byte enum of the crutch side, with the codes of sample_frame::Side
+  static H5::EnumType side_type() {
+    H5::EnumType type(H5::PredType::NATIVE_UINT8);
+    uint8_t codes[] = {uint8_t(sample_frame::Side::unknown),
+                       uint8_t(sample_frame::Side::left),
+                       uint8_t(sample_frame::Side::right)};
+    type.insert("unknown", &codes[0]);
+    type.insert("left", &codes[1]);
+    type.insert("right", &codes[2]);
+    return type;
+  }
 
-    // Extend dataset by 1 row
-    hsize_t new_dims[2] = {current_dims[0] + 1, current_dims[1]};
-    dataset.extend(new_dims);
+  // Append the staged block to the dataset with a single extend and write
+  void write_to_dataset(const StagingBuffer &buffer, DatasetHandle &handle) {
+    // Extend dataset by the number of staged rows
+    hsize_t new_dims[2] = {handle.rows + buffer.rows, handle.width};
+    handle.dataset.extend(new_dims);
 
-    // Select the new row in file space
-    H5::DataSpace file_space = dataset.getSpace();
-    hsize_t offset[2] = {current_dims[0], 0};
-    hsize_t count[2] = {1, current_dims[1]};
+    // Select the new rows in file space, built from the cached extent
+    hsize_t max_dims[2] = {H5S_UNLIMITED, handle.width};
+    H5::DataSpace file_space(handle.rank, new_dims, max_dims);
+    hsize_t offset[2] = {handle.rows, 0};
+    hsize_t count[2] = {buffer.rows, handle.width};
     file_space.selectHyperslab(H5S_SELECT_SET, count, offset);
 
-    H5::DataSpace mem_space(2, count);
+    H5::DataSpace mem_space(handle.rank, count);
 
-    // Write the new row
-    if (!array.empty()) {
-      if (array[0].is_number_float()) {
-        std::vector<double> row_data;
-        for (const auto &element : array) {
-          row_data.push_back(element.get<double>());
+    // Write the whole block
+    switch (buffer.type) {
+    case ValueType::f64:
+      handle.dataset.write(buffer.f64.data(), H5::PredType::NATIVE_DOUBLE,
+                           mem_space, file_space);
+      break;
+    case ValueType::i64:
+      handle.dataset.write(buffer.i64.data(), H5::PredType::NATIVE_LLONG,
+                           mem_space, file_space);
+      break;
+    case ValueType::side:
+      _side_codes.assign(buffer.i64.begin(), buffer.i64.end());
+      handle.dataset.write(_side_codes.data(), side_type(), mem_space,
+                           file_space);
+      break;
+    case ValueType::str: {
+      if (handle.string_size > 0) {
+        // one block of null-terminated strings, truncated to the size
+        const size_t size = handle.string_size;
+        _string_block.assign(buffer.str.size() * size, '\0');
+        for (size_t i = 0; i < buffer.str.size(); ++i) {
+          buffer.str[i].copy(_string_block.data() + i * size, size - 1);
         }
-        dataset.write(row_data.data(), H5::PredType::NATIVE_DOUBLE, mem_space,
-                      file_space);
-      } else if (array[0].is_number_integer()) {
-        std::vector<int64_t> row_data;
-        for (const auto &element : array) {
-          row_data.push_back(element.get<int64_t>());
-        }
-        dataset.write(row_data.data(), H5::PredType::NATIVE_LLONG, mem_space,
-                      file_space);
-      } else if (array[0].is_string()) {
-        H5::StrType string_type(H5::PredType::C_S1, H5T_VARIABLE);
-        std::vector<const char *> string_data;
-        std::vector<std::string> strings;
-        for (const auto &element : array) {
-          strings.push_back(element.get<std::string>());
-          string_data.push_back(strings.back().c_str());
-        }
-        dataset.write(string_data.data(), string_type, mem_space, file_space);
+        handle.dataset.write(_string_block.data(),
+                             H5::StrType(H5::PredType::C_S1, size), mem_space,
+                             file_space);
+        break;
+      }
+      H5::StrType string_type(H5::PredType::C_S1, H5T_VARIABLE);
+      std::vector<const char *> string_data;
+      string_data.reserve(buffer.str.size());
+      for (const auto &element : buffer.str) {
+        string_data.push_back(element.c_str());
       }
+      handle.dataset.write(string_data.data(), string_type, mem_space,
+                           file_space);
+      break;
+    }
+    default:
+      break;
+    }
+    handle.rows += buffer.rows;
+  }
+
+  // Helper method to create a new, empty dataset based on the staged type
+  // Scalars give a 1D vector, arrays a 2D matrix with fixed row width
+  H5::DataSet create_dataset(const std::string &dataset_name,
+                             const H5::Group &group,
+                             const StagingBuffer &buffer, hsize_t chunk_rows) {
+    const int rank = buffer.width > 0 ? 2 : 1;
+    hsize_t dims[2] = {0, buffer.width};
+    hsize_t max_dims[2] = {H5S_UNLIMITED, buffer.width};
+    H5::DataSpace space(rank, dims, max_dims);
+
+    // Create dataset with chunking for extensibility, and compression
+    H5::DSetCreatPropList prop;
+    hsize_t chunk_dims[2] = {chunk_rows, buffer.width};
+    prop.setChunk(rank, chunk_dims);
+    if (_filter != H5Z_FILTER_NONE) {
+      if (_shuffle) {
+        prop.setShuffle();
+      }
+      if (_filter == H5Z_FILTER_DEFLATE) {
+        prop.setDeflate(_compression_level);
+      } else {
+        prop.setFilter(_filter, H5Z_FLAG_MANDATORY, 0, nullptr);
+      }
+    }
+    const H5::DSetAccPropList access = dataset_access_properties();
+
+    H5::DataSet dataset;
+    switch (buffer.type) {
+    case ValueType::f64:
+      dataset = group.createDataSet(dataset_name,
+                                    _float32 ? H5::PredType::NATIVE_FLOAT
+                                             : H5::PredType::NATIVE_DOUBLE,
+                                    space, prop, access);
+      break;
+    case ValueType::i64:
+      dataset = group.createDataSet(dataset_name, H5::PredType::NATIVE_LLONG,
+                                    space, prop, access);
+      break;
+    case ValueType::side:
+      dataset = group.createDataSet(dataset_name, side_type(), space, prop,
+                                    access);
+      break;
+    case ValueType::str: {
+      // Create fixed or variable-length string type
+      H5::StrType string_type(H5::PredType::C_S1,
+                              _string_size > 0 ? _string_size : H5T_VARIABLE);
+      dataset = group.createDataSet(dataset_name, string_type, space, prop,
+                                    access);
+      break;
+    }
+    default:
+      throw std::runtime_error("Unsupported JSON data type for dataset: " +
+                               dataset_name);
+    }
+
+    // Name the columns of the datasets made from objects, once
+    if (!buffer.columns.empty()) {
+      std::vector<const char *> labels;
+      for (const auto &column : buffer.columns) {
+        labels.push_back(column.c_str());
+      }
+      hsize_t count = labels.size();
+      H5::StrType string_type(H5::PredType::C_S1, H5T_VARIABLE);
+      H5::Attribute attribute = dataset.createAttribute(
+          "columns", string_type, H5::DataSpace(1, &count));
+      attribute.write(string_type, labels.data());
     }
+    return dataset;
   }
 };
 
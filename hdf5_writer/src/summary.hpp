@@ -0,0 +1,143 @@
+/*
+  ____
+ / ___| _   _ _ __ ___  _ __ ___   __ _ _ __ _   _
+ \___ \| | | | '_ ` _ \| '_ ` _ \ / _` | '__| | | |
+  ___) | |_| | | | | | | | | | | | (_| | |  | |_| |
+ |____/ \__,_|_| |_| |_|_| |_| |_|\__,_|_|   \__, |
+                                             |___/
+Statistics and min/max pyramid of a dataset, computed while recording
+*/
+
+#ifndef SUMMARY_HPP
+#define SUMMARY_HPP
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+// Running summary of the rows of a numeric dataset, one set of values per
+// column: count, min, max and mean over the whole acquisition, plus the
+// min and max of every window of 10, 100 and 1000 rows, so that a plot of
+// any length can be drawn from a few kilobytes. NaNs are skipped. Each row
+// only updates the finest level, the coarser ones are fed by the completed
+// windows of the level below: O(columns) per row.
+class DatasetSummary {
+public:
+  static constexpr size_t level_count = 3;
+  static constexpr std::array<size_t, level_count> decimation = {10, 100, 1000};
+
+  // Min and max of the completed windows of one level, row-major
+  struct Level {
+    size_t rows = 0;
+    std::vector<float> min;
+    std::vector<float> max;
+  };
+
+  explicit DatasetSummary(size_t width = 1) { reset(width); }
+
+  void reset(size_t width) {
+    _width = width > 0 ? width : 1;
+    _rows = 0;
+    _count.assign(_width, 0);
+    _min.assign(_width, inf());
+    _max.assign(_width, -inf());
+    _sum.assign(_width, 0.0);
+    for (size_t l = 0; l < level_count; ++l) {
+      _levels[l] = Level();
+      _window[l].rows = 0;
+      _window[l].min.assign(_width, inf());
+      _window[l].max.assign(_width, -inf());
+    }
+  }
+
+  size_t width() const { return _width; }
+  size_t rows() const { return _rows; }
+
+  // Add a row of width values
+  template <typename T> void add(const T *values) {
+    Window &window = _window[0];
+    for (size_t c = 0; c < _width; ++c) {
+      const double value = static_cast<double>(values[c]);
+      if (std::isnan(value)) {
+        continue;
+      }
+      ++_count[c];
+      _sum[c] += value;
+      _min[c] = std::fmin(_min[c], value);
+      _max[c] = std::fmax(_max[c], value);
+      window.min[c] = std::fmin(window.min[c], value);
+      window.max[c] = std::fmax(window.max[c], value);
+    }
+    ++_rows;
+    if (++window.rows == decimation[0]) {
+      complete(0);
+    }
+  }
+
+  // Close the partial windows, so that the last rows are in the pyramid.
+  // No row can be added afterwards.
+  void finish() {
+    for (size_t l = 0; l < level_count; ++l) {
+      if (_window[l].rows > 0) {
+        complete(l);
+      }
+    }
+  }
+
+  // Totals of a column, NaN when it has no values
+  uint64_t count(size_t column) const { return _count[column]; }
+  double min(size_t column) const { return _count[column] ? _min[column] : NAN; }
+  double max(size_t column) const { return _count[column] ? _max[column] : NAN; }
+  double mean(size_t column) const {
+    return _count[column] ? _sum[column] / double(_count[column]) : NAN;
+  }
+
+  const Level &level(size_t l) const { return _levels[l]; }
+
+private:
+  struct Window {
+    size_t rows = 0; // rows of the finest level, or windows of the level below
+    std::vector<double> min;
+    std::vector<double> max;
+  };
+
+  static double inf() { return std::numeric_limits<double>::infinity(); }
+
+  // Store the window of level l and feed it to the next level
+  void complete(size_t l) {
+    Window &window = _window[l];
+    Level &level = _levels[l];
+    for (size_t c = 0; c < _width; ++c) {
+      const bool empty = window.min[c] > window.max[c]; // only NaNs
+      level.min.push_back(empty ? NAN : float(window.min[c]));
+      level.max.push_back(empty ? NAN : float(window.max[c]));
+    }
+    ++level.rows;
+    if (l + 1 < level_count) {
+      Window &next = _window[l + 1];
+      for (size_t c = 0; c < _width; ++c) {
+        next.min[c] = std::fmin(next.min[c], window.min[c]);
+        next.max[c] = std::fmax(next.max[c], window.max[c]);
+      }
+      if (++next.rows == decimation[l + 1] / decimation[l]) {
+        complete(l + 1);
+      }
+    }
+    window.rows = 0;
+    std::fill(window.min.begin(), window.min.end(), inf());
+    std::fill(window.max.begin(), window.max.end(), -inf());
+  }
+
+  size_t _width = 1;
+  size_t _rows = 0;
+  std::vector<uint64_t> _count;
+  std::vector<double> _min, _max, _sum;
+  std::array<Window, level_count> _window;
+  std::array<Level, level_count> _levels;
+};
+
+#endif // SUMMARY_HPP
@@ -18,12 +18,20 @@
 #include <pugg/Kernel.h>
 
 // other includes as needed here
-#include <deque>
 #include <chrono>
 #include <iomanip>
 #include <sstream>
 #include <algorithm>
+#include <array>
 #include <cctype>
+#include <cmath>
+#include <functional>
+#include <unordered_map>
+#include <vector>
+#include <command.hpp>
+#include <message_template.hpp>
+#include <perf.hpp>
+#include <spsc_ring.hpp>
 
 // Define the name of the plugin
 #ifndef PLUGIN_NAME
@@ -33,14 +41,59 @@
 // Load the namespaces
 using namespace std;
 using json = nlohmann::json;
+using message_template::assign;
+using message_template::field;
+
+// Level of a status, compared as an enum instead of a string
+enum class Level : uint8_t { none, info, warning, error, critical };
+
+inline const char *level_name(Level level) {
+  switch (level) {
+    case Level::info: return "info";
+    case Level::warning: return "warning";
+    case Level::error: return "error";
+    case Level::critical: return "critical";
+    default: return "";
+  }
+}
+
+constexpr size_t no_index = static_cast<size_t>(-1);
 
 // Structure to store the last status of an agent
 struct AgentStatus {
+  string source; // e.g. tip_loadcell_left
   string status;
-  string level;
+  Level level = Level::none;
   string message;
   string side;
+  size_t status_hash = 0; // hashes of status and message, for a cheap change detection
+  size_t message_hash = 0;
+  bool reported = false; // the first status of an agent is always relevant
   chrono::steady_clock::time_point last_update;
+  // links of the deadline queue, see Status_handlerPlugin::touch()
+  size_t prev = no_index;
+  size_t next = no_index;
+  bool queued = false;
+};
+
+// A status waiting to be published, serialized only by process(). The slots of the queue are reused,
+// so that the strings keep their capacity.
+struct PendingStatus {
+  size_t agent = no_index; // index in the table of the agents, for the source and the side, no_index for the command latency
+  Level level = Level::none;
+  string status;
+  string message;
+};
+
+// The acknowledgements of the last command of the coordinator (see command.hpp), collected until
+// command_ack_timeout and then reported in a single status
+struct CommandAcks {
+  uint64_t seq = 0;
+  command::Code code = command::Code::unknown;
+  int64_t sent_us = 0; // wall clock of the coordinator
+  bool open = false;
+  chrono::steady_clock::time_point deadline;
+  vector<pair<size_t, int64_t>> acks; // index of the agent and its wall clock when it applied the command
 };
 
 // Plugin class. This shall be the only part that needs to be modified,
@@ -54,29 +107,38 @@ public:
 
   // Add an agent to monitor
   void add_agent(const string& source_id) {
-    if (_agents.find(source_id) == _agents.end()) {
-      // If the agent is not already monitored, add it with an initial status of "unknown"
-      _agents[source_id] = AgentStatus{"unknown", "", "", "", chrono::steady_clock::now()};
-      if (_debug) {
-        cout << "Added agent '" << source_id << "' to monitoring list" << endl;
-      }
-    }
+    source_index(source_id);
   }
 
   // Remove an agent from monitoring
   void remove_agent(const string& source_id) {
-    if (_agents.erase(source_id) > 0) {
-      if (_debug) {
-        cout << "Removed agent '" << source_id << "' from monitoring list" << endl;
-      }
+    auto it = _source_ids.find(source_id);
+    if (it == _source_ids.end()) {
+      return;
+    }
+    // rare: rebuild the indices instead of keeping holes in the flat table
+    const size_t removed = it->second;
+    remap_pending(removed);
+    _agents.erase(_agents.begin() + removed);
+    _source_ids.clear();
+    for (size_t i = 0; i < _agents.size(); ++i) {
+      _source_ids[_agents[i].source] = i;
+    }
+    rebuild_deadlines();
+    _command_acks.acks.clear(); // their indices are not valid anymore
+    for (auto &topic : _topics) {
+      topic.second.sources.fill(no_index);
+    }
+    if (_debug) {
+      cout << "Removed agent '" << source_id << "' from monitoring list" << endl;
     }
   }
 
   // Get the last status of an agent
   bool get_agent_status(const string& source_id, AgentStatus& status) const {
-    auto it = _agents.find(source_id);
-    if (it != _agents.end()) {
-      status = it->second;
+    auto it = _source_ids.find(source_id);
+    if (it != _source_ids.end()) {
+      status = _agents[it->second];
       return true;
     }
     return false;
@@ -85,14 +147,15 @@ public:
   // Get all monitored agents
   vector<string> get_monitored_agents() const {
     vector<string> agents;
-    for (const auto& pair : _agents) {
-      agents.push_back(pair.first);
+    for (const auto& agent : _agents) {
+      agents.push_back(agent.source);
     }
     return agents;
   }
 
   // Implement the actual functionality here
   return_type load_data(json const &input, string topic = "", vector<unsigned char> const *blob = nullptr) override {
+    perf::Timer load_timer(_perf_load);
     
     // If the topic is agent_event, we want to set the source as the name of the agent if available, otherwise we keep the topic as source
     // if the topic is empty, we cannot determine the source of the message, so we retry 
@@ -101,284 +164,159 @@ public:
     }
 
     // initialize variables to build the message and determine the level
-    string source = topic; // default 
-    string level = "";
-    string status = "";
-    string message = "";
-    string side = "";
-    bool has_status = false;
-
+    Level level = Level::none;
+    const string *status = nullptr; // points into the input or to a constant, no copies
+    string message;
+    const string *side = &no_side;
 
     if (topic == "agent_event") {
 
       // Since agent_event topic listens to all the agents in the mads network, we need to filter on the sub_topic of this agent (list of names in _params[sub_topic])
-      if (!_params["sub_topic"].contains(topic)) {
-        // If the agent name is not in the list of sub_topics, we don't process the message
+      auto name = input.find("name");
+      if (name == input.end() || !name->is_string()) {
         return return_type::retry;
       }
-
-      // For agent events, we want to set the source as the name of the agent if available, otherwise we keep the topic as source
-      if (input.contains("name")) {
-        source = input["name"].get<string>();
+      auto entry = _topics.find(name->get_ref<const string &>());
+      if (entry == _topics.end()) {
+        // If the agent name is not in the list of sub_topics, we don't process the message
+        return return_type::retry;
       }
 
       // if present we retrive the side from modified_settings or settings, to add it to the message and have more context about the event
-      // if side value is "unknown", we havo to decide how to handle it
-      if (input.contains("modified_settings") || input.contains("settings")){
-        json settings = input.contains("modified_settings") ? input["modified_settings"] : input["settings"];
-        if (settings.contains("side")) {
-          side = settings["side"].get<string>();
-          if (side == "unknown") {
-            // if the side is unknown, we can either set it to an empty string or keep it as "unknown", depending on how we want to handle it in the rest of the code, for now we set it to empty string to avoid having "unknown" as a value in the messages
-            side = "";
-          }
+      // if the side is "unknown", it is handled as not specified
+      auto settings = input.find("modified_settings");
+      if (settings == input.end()) {
+        settings = input.find("settings");
+      }
+      if (settings != input.end() && settings->is_object()) {
+        auto s = settings->find("side");
+        if (s != settings->end() && s->is_string() && s->get_ref<const string &>() != "unknown") {
+          side = &s->get_ref<const string &>();
         }
       }
-      // add side only when needed to distinguish the topic
-      source += side.empty() ? "" : "_" + side;; // e.g. tip_loadcell_left, tip_loadcell_right, coordinator (if no side specified)
 
       // Handle agent events (e.g. startup, shutdown, etc.)
-      if (input.contains("event")) {
-        string event = input["event"].get<string>();
-        if (event == "startup") {
-          level = "info";
-          status = "startup";
-          message = "Agent startup";
-          has_status = true;
-        } else if (event == "shutdown") {
-          level = "critical";
-          status = "shutdown";
-          message = "Agent shutdown";
-          has_status = true;
-        } else if (event == "message") {
-          if (input.contains("info")){
-            json info = input["info"];
-            if (info.contains("warning")) {
-              level = "warning";
-            } else if (info.contains("error")) {
-              level = "error";
-            } else if (info.contains("critical")) {
-              level = "critical";
-            } 
-
-            // first field is the level, the second field is the message
-            string received_message =  info[level][1].get<string>();
-            
-            // the first word (until the first :) is the status, the rest is the message
-            size_t colon_pos = received_message.find(':');
-            if (colon_pos != string::npos) {
-              status = received_message.substr(0, colon_pos);
-              message = received_message.substr(colon_pos + 1);
-            } else {
-              status = "unknown";
-              message = received_message;
-            }
-            has_status = true;
-          }
-        } 
-      } else {
+      auto event = input.find("event");
+      if (event == input.end() || !event->is_string()) {
         // if there is no event field, we don't know how to handle it, so we retry
         return return_type::retry;
       }
-
-    } else { // All the topics different from agent_event if it contains status
-      
-      // Handle health info messages 
-      if (input.contains("agent_status")) {
-        
-        if (input["agent_status"].is_string()) {
-          status = input["agent_status"].get<string>();
-          level = "info";
-
-          // Check if is info, warning, error or critical based on the status value, to set the level accordingly
-          if (input.contains("info")) {
-
-            //cout << "Received info message: " << input["info"].dump() << endl;
-            
-            // Handle offset messages from tip loadcell topic
-            if (input["info"].contains("offset") && source == "tip_loadcell") {
-              if (input["info"]["offset"].contains("value") && input["info"]["offset"].contains("test")) {
-                // Format message like: "offset value = 50.0 N, offset test = 5.0 N"
-                float offset_value = input["info"]["offset"]["value"].get<float>();
-                float offset_test = input["info"]["offset"]["test"].get<float>();
-                std::ostringstream val_str, test_str;
-                val_str << std::fixed << std::setprecision(1) << offset_value;
-                test_str << std::fixed << std::setprecision(1) << offset_test;
-                message = "offset value: " + val_str.str() + " N, offset test: " + test_str.str() + " N";
-              }
-            }
-
-            // Handle offset messages from handle loadcell topic
-            if (input["info"].contains("offset") && source == "handle_loadcell") {
-              if (input["info"]["offset"].contains("value") && input["info"]["offset"].contains("test")) {
-                // Format message like: "offset value = [50.0, 50.0, 50.0, 50.0, 50.0, 50.0, 50.0, 50.0] N, offset test = [5.0, 5.0, 5.0, 5.0, 5.0, 5.0, 5.0, 5.0] N"
-                // always send the status in this order:
-                // "up_front", "up_back", "int_front", "int_back", "ext_front", "ext_back", "down_front", "down_back"
-                std::ostringstream val_str, test_str;
-                for (const auto& label : {"up_front", "up_back", "int_front", "int_back", "ext_front", "ext_back", "down_front", "down_back"}) {
-                  float offset_value = input["info"]["offset"]["value"][label].get<float>();
-                  float offset_test = input["info"]["offset"]["test"][label].get<float>();
-                  val_str << std::fixed << std::setprecision(1) << offset_value << ", ";
-                  test_str << std::fixed << std::setprecision(1) << offset_test << ", ";
-                }
-                message = "offset value: [" + val_str.str().substr(0, val_str.str().length() - 2) + "] N, offset test: [" + test_str.str().substr(0, test_str.str().length() - 2) + "] N";
-              }
-            }
-
-            // handle battery status messages from ups topic
-            if (input["info"].contains("current") && input["info"].contains("percent") && source == "ups") {
-              
-              if (input["info"]["current"].is_number() && input["info"]["percent"].is_number()) {
-                float current = input["info"]["current"].get<float>();
-                float battery_percent = input["info"]["percent"].get<float>();
-
-                // if current is negative, it means that the battery is feeding the raspberry
-                // if current is positive, it means that the battery is charging
-                if (current < 0) {
-                  std::ostringstream percent_str;
-                  percent_str << std::fixed << std::setprecision(1) << battery_percent;
-                  message = "battery percent: " + percent_str.str() + "%";
-
-                  if (input["info"].contains("remaining_battery_time")) {
-                    if (input["info"]["remaining_battery_time"].is_string()) {
-                      string battery_remaining_time = input["info"]["remaining_battery_time"].get<string>();
-                      message += ", remaining time: " + battery_remaining_time;
-                    }
-                  }
-                } else {
-                  message = "Battery is charging";
-                }
-
-              } else {
-                // just ignore it if the format is not ok
-                return return_type::retry;
-              }
-              
-            }
-
-            // handle synchronization status messages from sync_handler topic
-            if (input["info"].contains("synchronized") && input["info"].contains("synchronizing") && source == "sync_handler") {
-              
-              if (input["info"]["synchronized"].is_boolean() && input["info"]["synchronizing"].is_boolean()) {
-                bool synchronized = input["info"]["synchronized"].get<bool>();
-                bool synchronizing = input["info"]["synchronizing"].get<bool>();
-
-                if (!synchronizing) {
-                  message = string("Device is synchronized: ") + (synchronized ? "true" : "false");
-                } else {
-                  message = "Device is synchronizing";
-                }
-
-              } else {
-                // just ignore it if the format is not ok
-                return return_type::retry;
-              }
-              
-            }
-
-            // Add here any other info to handle
-          }
-
-          if (input.contains("warning")) {
-            level = "warning";
-            message = input["warning"].get<string>();
-          }
-
-          if (input.contains("error")) {
-            level = "error";
-            message = input["error"].get<string>();
-          }
-
-          if (input.contains("critical")) {
-            level = "critical";
-            message = input["critical"].get<string>();
-          }
-
-          // Get side from the side field if present
-          // If the side is not specified, it will be set to void and the message will be considered as not related to a specific side
-          if (input.contains("side")) {
-            if(input["side"].is_string()) {
-              side = input["side"].get<string>();
-            }
-          } 
-          // add side only when needed to distinguish the topic
-          source += side.empty() ? "" : "_" + side;; // e.g. tip_loadcell_left, tip_loadcell_right, coordinator (if no side specified)
-
-          has_status = true;
+      const string &event_name = event->get_ref<const string &>();
+      string event_status;
+      if (event_name == "startup") {
+        level = Level::info;
+        status = &status_startup;
+        message = "Agent startup";
+      } else if (event_name == "shutdown") {
+        level = Level::critical;
+        status = &status_shutdown;
+        message = "Agent shutdown";
+      } else if (event_name == "message") {
+        auto info = input.find("info");
+        if (info == input.end()) {
+          return return_type::success;
         }
-
-      } else if (input.contains("command")) {
-        // Handle the request of sending an update of the current agents status
-        if (input["command"].is_string()) {
-          if (input["command"].get<string>() == "get_agents_status") {
-            _send_agents_status = true;
-            return return_type::success;
-          }
+        const char *level_key = nullptr;
+        if (info->contains("warning")) {
+          level = Level::warning;
+        } else if (info->contains("error")) {
+          level = Level::error;
+        } else if (info->contains("critical")) {
+          level = Level::critical;
+        } else {
+          return return_type::retry;
         }
+        level_key = level_name(level);
 
+        // first field is the level, the second field is the message
+        auto field = info->find(level_key);
+        if (!field->is_array() || field->size() < 2 || !field->at(1).is_string()) {
+          return return_type::retry;
+        }
+        const string &received_message = field->at(1).get_ref<const string &>();
+
+        // the first word (until the first :) is the status, the rest is the message
+        size_t colon_pos = received_message.find(':');
+        if (colon_pos != string::npos) {
+          event_status = received_message.substr(0, colon_pos);
+          message = received_message.substr(colon_pos + 1);
+        } else {
+          event_status = "unknown";
+          message = received_message;
+        }
+        status = &event_status;
       } else {
-        // if the message doesn't contain status, we don't know how to handle it, so we retry
-        return return_type::retry;
+        return return_type::success;
       }
+
+      update_agent(agent_index(entry->second, name->get_ref<const string &>(), *side), *status, level, std::move(message), *side);
+      return return_type::success;
+
     }
 
+    // All the topics different from agent_event: dispatch on the topic, the table is built from sub_topic in set_params
+    auto entry = _topics.find(topic);
+    if (entry == _topics.end()) {
+      entry = _topics.emplace(topic, TopicHandler{}).first; // not subscribed explicitly, no info handler
+    }
 
-    /* Controlliamo se il messaggio è rilevante per noi in base al livello e allo status, ad esempio:
-      1   - Agente in attesa di avvio registrazione/connessione (ready): se ricevo un messaggio di idle e stavo registrando, se ricevo un messaggio di startup ed ero morto, oppure se ricevo un idle e prima non avevo ricevuto il messaggio di startup
-      1.2 - Agente in attesa di connessione con sensore (not connected): se l'agente è attivo, ma richiede di essere connesso al sensore (neon). Continuo a riceve idle
-      1.3 - Agente connesso e in attesa di registrazione (connected and ready): se ricevo connected 
-      2   - Agente in registrazione (recording): se ricevo un messaggio di recording e non stavo registrando
-      4   - Agente morto (dead): se ricevo un messaggio di shutdown
-      5   - Aggiornamento info agente: se ricevo un messaggio di offset
-    */
-    bool is_relevant = false; 
+    // The commands of the coordinator and their acks, for the latency of each agent
+    auto ack = input.find("ack");
+    if (ack != input.end()) {
+      add_ack(*ack, entry->second, topic, input);
+    } else if (input.contains("seq")) {
+      open_command(input);
+    }
 
-    // Check if the agent status has changed (excluding last_update timestamp)
-    if (has_status) {
-      auto it = _agents.find(source);
-      if (it == _agents.end()) {
-        // New agent - always relevant
-        is_relevant = true;
-      } else {
-        // Existing agent - check if any field has changed
-        const AgentStatus& old_status = it->second;
-        if (old_status.status != status || 
-            old_status.level != level || 
-            old_status.message != message || 
-            old_status.side != side) {
-          is_relevant = true;
+    // Handle health info messages 
+    auto agent_status = input.find("agent_status");
+    if (agent_status != input.end()) {
+
+      if (!agent_status->is_string()) {
+        return return_type::success;
+      }
+      status = &agent_status->get_ref<const string &>();
+      level = Level::info;
+
+      // topic specific info, e.g. offsets, battery, synchronization
+      auto info = input.find("info");
+      if (info != input.end() && entry->second.info != nullptr) {
+        if (!(this->*(entry->second.info))(*info, message)) {
+          // just ignore it if the format is not ok
+          return return_type::retry;
         }
       }
-    }
 
-    // ALWAYS update the status of the agent in the internal tracking map, even if the message is not relevant, to have an updated status of the agent and be able to trigger the relevant messages based on the status changes
-    if (has_status) {
-      // Update the agent status in the internal tracking map
-      if (_agents.find(source) == _agents.end()) {
-        // If agent doesn't exist, add it
-        add_agent(source);
+      // Check if is info, warning, error or critical based on the status value, to set the level accordingly
+      static const pair<const char *, Level> levels[] = {
+        {"warning", Level::warning}, {"error", Level::error}, {"critical", Level::critical}
+      };
+      for (const auto &l : levels) {
+        auto field = input.find(l.first);
+        if (field != input.end()) {
+          level = l.second;
+          message = field->get<string>();
+        }
       }
 
-      // Update the existing agent status with current timestamp
-      _agents[source] = AgentStatus{status, level, message, side, chrono::steady_clock::now()};
-    }
-
-    // proceed only if the message is relevant based on the level, otherwise ignore it
-    if (is_relevant) {
+      // Get side from the side field if present
+      // If the side is not specified, it will be set to void and the message will be considered as not related to a specific side
+      auto s = input.find("side");
+      if (s != input.end() && s->is_string()) {
+        side = &s->get_ref<const string &>();
+      }
 
-      // Build the output json object with the relevant information about the status, and push it to the pending queue
-      // note: timestamp and timecode are added by the agent, so no need to add them here (they are the timestamps of the device running this plugin)
-      json out_msg;
-      out_msg["source"] = source;
-      out_msg["level"] = level;
-      out_msg["status"] = status;
-      out_msg["message"] = message;
-      if (!side.empty()) out_msg["side"] = side;
+      update_agent(agent_index(entry->second, topic, *side), *status, level, std::move(message), *side);
 
-      _pending.push_back(out_msg);
-      if (_pending.size() > _max_pending) {
-        _pending.pop_front();
+    } else if (input.contains("command")) {
+      // Handle the request of sending an update of the current agents status
+      if (command::decode(input) == command::Code::get_agents_status) {
+        _send_agents_status = true;
       }
+
+    } else {
+      // if the message doesn't contain status, we don't know how to handle it, so we retry
+      return return_type::retry;
     }
 
     return return_type::success;
@@ -387,57 +325,38 @@ public:
   // We calculate the average of the last N values for each key and store it
   // into the output json object
   return_type process(json &out, vector<unsigned char> *blob = nullptr) override {
-    out.clear();
+    perf::Timer process_timer(_perf_process);
+    _message.begin(out); // the fields of the previous message are updated in place
 
     if (_send_agents_status) {
-      for (const auto& pair : _agents) {
-        const string& source_id = pair.first;
-        const AgentStatus& agent_status = pair.second;
-
-        json out_msg;
-        out_msg["source"] = source_id;
-        out_msg["level"] = agent_status.level;
-        out_msg["status"] = agent_status.status;
-        out_msg["message"] = agent_status.message;
-        if (!agent_status.side.empty()) out_msg["side"] = agent_status.side;
-
-        _pending.push_back(out_msg);
-        if (_pending.size() > _max_pending) {
-          _pending.pop_front();
-        }
+      for (const auto& agent : _agents) {
+        push_pending(agent);
       }
-
       _send_agents_status = false;
     }
 
-    // Send "unreachable" status if no update received for more than 3 seconds for each agent, and update the status to "unreachable" in the internal tracking map
     auto now = std::chrono::steady_clock::now();
-    
-    for (auto& pair : _agents) {
-      string source_id = pair.first;
-      AgentStatus& agent_status = pair.second;
-
-      // Calculate elapsed time for this specific agent
-      auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(now - agent_status.last_update).count();
+    if (_command_acks.open && now >= _command_acks.deadline) {
+      report_command_latency();
+    }
 
-      if (agent_status.status != "unreachable" && elapsed >= _unreachable_agent_timeout) {
-        agent_status.status = "unreachable";
-        agent_status.level = "critical";
+    // Send "unreachable" status if no update received for more than 3 seconds for each agent, and update the status to "unreachable" in the internal tracking map
+    // The agents are queued by last update and the timeout is the same for all, so only the expired ones at
+    // the head of the queue are visited
+    const auto timeout = std::chrono::milliseconds(_unreachable_agent_timeout);
+
+    while (_deadlines_head != no_index && now - _agents[_deadlines_head].last_update >= timeout) {
+      AgentStatus &agent_status = _agents[_deadlines_head];
+      unlink(_deadlines_head); // queued again by its next update
+
+      if (agent_status.status_hash != _unreachable_hash) {
+        agent_status.status = status_unreachable;
+        agent_status.status_hash = _unreachable_hash;
+        agent_status.level = Level::critical;
         agent_status.message = "No update received for more than " + to_string(_unreachable_agent_timeout) + " ms";
+        agent_status.message_hash = hash<string>{}(agent_status.message);
         agent_status.last_update = now;
-
-        // Build the output json object with the relevant information about the status, and push it to the pending queue
-        json out_msg;
-        out_msg["source"] = source_id;
-        out_msg["level"] = agent_status.level;
-        out_msg["status"] = agent_status.status;
-        out_msg["message"] = agent_status.message;
-        if (!agent_status.side.empty()) out_msg["side"] = agent_status.side;
-
-        _pending.push_back(out_msg);
-        if (_pending.size() > _max_pending) {
-          _pending.pop_front();
-        }
+        push_pending(agent_status);
       }
     }
 
@@ -449,16 +368,30 @@ public:
       return return_type::retry;
     }
 
-    out["status"] = _pending.front();
-    _pending.pop_front();
+    if (_batch_status) {
+      // the whole queue in one message, e.g. the snapshot after get_agents_status
+      json &statuses = _message["status"];
+      if (!statuses.is_array()) {
+        statuses = json::array();
+      }
+      auto &array = statuses.get_ref<json::array_t &>();
+      array.resize(_pending.size());
+      for (json &status : array) {
+        write_status(status, *_pending.front());
+        _pending.pop();
+      }
+    } else {
+      write_status(_message["status"], *_pending.front());
+      _pending.pop();
+    }
+
+    // agent_id, when it is not empty, is a constant of _message
+    _message.finish();
+    _perf.publish_if_due(out);
 
     if (_debug) {
       std::cout << std::endl << out.dump(4) << std::endl;
     }
-
-    // This sets the agent_id field in the output json object, only when it is
-    // not empty
-    if (!_agent_id.empty()) out["agent_id"] = _agent_id;
     return return_type::success;
   }
   
@@ -473,9 +406,39 @@ public:
 
     // Read the parameters for the plugin, set as defaults if not specified
     _max_pending = _params.value("max_pending", 100);
+    _pending.reset(max<size_t>(1, _max_pending));
+    _message.set_constant("agent_id", _agent_id.empty() ? json() : json(_agent_id));
     _debug = _params.value("debug", false);
+    _batch_status = _params.value("batch_status", false); // publish all the pending statuses as one array
 
     _unreachable_agent_timeout = _params.value("unreachable_agent_timeout", 3000); // default to 3000 ms
+    _command_ack_timeout = _params.value("command_ack_timeout", 1000); // ms, acks of a command collected before its report
+    _max_command_skew = _params.value("max_command_skew", 20.0); // ms between the sides, above it the report is a warning
+    _perf.configure(_params); // perf_period, default to 5000 ms
+
+    // Dispatch table, built once: one entry per subscribed topic, with the handler of its info field
+    static const pair<const char *, InfoHandler> info_handlers[] = {
+      {"tip_loadcell", &Status_handlerPlugin::tip_loadcell_info},
+      {"handle_loadcell", &Status_handlerPlugin::handle_loadcell_info},
+      {"ups", &Status_handlerPlugin::ups_info},
+      {"sync_handler", &Status_handlerPlugin::sync_handler_info}
+      // Add here any other info to handle
+    };
+    _topics.clear();
+    if (_params.contains("sub_topic") && _params["sub_topic"].is_array()) {
+      for (const auto &t : _params["sub_topic"]) {
+        if (!t.is_string() || t.get_ref<const string &>() == "agent_event") {
+          continue;
+        }
+        TopicHandler handler;
+        for (const auto &h : info_handlers) {
+          if (t.get_ref<const string &>() == h.first) {
+            handler.info = h.second;
+          }
+        }
+        _topics[t.get<string>()] = handler;
+      }
+    }
 
     cout << "Params:" << _params.dump(4) << endl;
 
@@ -492,23 +455,396 @@ public:
   };
 
 private:
+
+  // Parses the info field of a heartbeat into the status message, returns false if the format is not valid
+  using InfoHandler = bool (Status_handlerPlugin::*)(const json &info, string &message);
+
+  // Entry of the dispatch table: the info handler and the index of the agent of each side
+  struct TopicHandler {
+    InfoHandler info = nullptr;
+    array<size_t, 3> sources{no_index, no_index, no_index}; // no side, left, right
+  };
+
+  // Handle offset messages from tip loadcell topic
+  bool tip_loadcell_info(const json &info, string &message) {
+    auto offset = info.find("offset");
+    if (offset != info.end() && offset->contains("value") && offset->contains("test")) {
+      // Format message like: "offset value = 50.0 N, offset test = 5.0 N"
+      std::ostringstream str;
+      str << std::fixed << std::setprecision(1) << "offset value: " << (*offset)["value"].get<float>()
+          << " N, offset test: " << (*offset)["test"].get<float>() << " N";
+      message = str.str();
+    }
+    return true;
+  }
+
+  // Handle offset messages from handle loadcell topic
+  bool handle_loadcell_info(const json &info, string &message) {
+    auto offset = info.find("offset");
+    if (offset != info.end() && offset->contains("value") && offset->contains("test")) {
+      // Format message like: "offset value = [50.0, 50.0, 50.0, 50.0, 50.0, 50.0, 50.0, 50.0] N, offset test = [5.0, 5.0, 5.0, 5.0, 5.0, 5.0, 5.0, 5.0] N"
+      // always send the status in this order:
+      // "up_front", "up_back", "int_front", "int_back", "ext_front", "ext_back", "down_front", "down_back"
+      const json &value = (*offset)["value"];
+      const json &test = (*offset)["test"];
+      std::ostringstream val_str, test_str;
+      val_str << std::fixed << std::setprecision(1);
+      test_str << std::fixed << std::setprecision(1);
+      const char *separator = "";
+      for (const char *label : {"up_front", "up_back", "int_front", "int_back", "ext_front", "ext_back", "down_front", "down_back"}) {
+        auto v = value.find(label);
+        auto t = test.find(label);
+        if (v == value.end() || t == test.end()) {
+          continue; // channel not mapped on this handle
+        }
+        val_str << separator << v->get<float>();
+        test_str << separator << t->get<float>();
+        separator = ", ";
+      }
+      message = "offset value: [" + val_str.str() + "] N, offset test: [" + test_str.str() + "] N";
+    }
+    return true;
+  }
+
+  // handle battery status messages from ups topic
+  bool ups_info(const json &info, string &message) {
+    auto current = info.find("current");
+    auto percent = info.find("percent");
+    if (current == info.end() || percent == info.end()) {
+      return true;
+    }
+    if (!current->is_number() || !percent->is_number()) {
+      return false;
+    }
+
+    // if current is negative, it means that the battery is feeding the raspberry
+    // if current is positive, it means that the battery is charging
+    if (current->get<float>() < 0) {
+      std::ostringstream percent_str;
+      percent_str << std::fixed << std::setprecision(1) << percent->get<float>();
+      message = "battery percent: " + percent_str.str() + "%";
+
+      auto remaining = info.find("remaining_battery_time");
+      if (remaining != info.end() && remaining->is_string()) {
+        message += ", remaining time: " + remaining->get_ref<const string &>();
+      }
+    } else {
+      message = "Battery is charging";
+    }
+    return true;
+  }
+
+  // handle synchronization status messages from sync_handler topic
+  bool sync_handler_info(const json &info, string &message) {
+    auto synchronized = info.find("synchronized");
+    auto synchronizing = info.find("synchronizing");
+    if (synchronized == info.end() || synchronizing == info.end()) {
+      return true;
+    }
+    if (!synchronized->is_boolean() || !synchronizing->is_boolean()) {
+      return false;
+    }
+    if (!synchronizing->get<bool>()) {
+      message = string("Device is synchronized: ") + (synchronized->get<bool>() ? "true" : "false");
+    } else {
+      message = "Device is synchronizing";
+    }
+    return true;
+  }
+
+  // Index of the agent with the given source name, added with the "unknown" status if not monitored yet
+  size_t source_index(const string &source) {
+    auto it = _source_ids.find(source);
+    if (it != _source_ids.end()) {
+      return it->second;
+    }
+    AgentStatus agent;
+    agent.source = source;
+    agent.status = "unknown";
+    agent.status_hash = hash<string>{}(agent.status);
+    agent.last_update = chrono::steady_clock::now();
+    _agents.push_back(std::move(agent));
+    _source_ids[source] = _agents.size() - 1;
+    touch(_agents.size() - 1);
+    if (_debug) {
+      cout << "Added agent '" << source << "' to monitoring list" << endl;
+    }
+    return _agents.size() - 1;
+  }
+
+  // Index of the agent of a topic and side, cached in the dispatch table for the usual sides
+  size_t agent_index(TopicHandler &topic, const string &name, const string &side) {
+    const int slot = side.empty() ? 0 : side == "left" ? 1 : side == "right" ? 2 : -1;
+    if (slot >= 0 && topic.sources[slot] != no_index) {
+      return topic.sources[slot];
+    }
+    // add side only when needed to distinguish the topic, e.g. tip_loadcell_left, tip_loadcell_right, coordinator (if no side specified)
+    const size_t index = source_index(side.empty() ? name : name + "_" + side);
+    if (slot >= 0) {
+      topic.sources[slot] = index;
+    }
+    return index;
+  }
+
+  /* Controlliamo se il messaggio è rilevante per noi in base al livello e allo status, ad esempio:
+    1   - Agente in attesa di avvio registrazione/connessione (ready): se ricevo un messaggio di idle e stavo registrando, se ricevo un messaggio di startup ed ero morto, oppure se ricevo un idle e prima non avevo ricevuto il messaggio di startup
+    1.2 - Agente in attesa di connessione con sensore (not connected): se l'agente è attivo, ma richiede di essere connesso al sensore (neon). Continuo a riceve idle
+    1.3 - Agente connesso e in attesa di registrazione (connected and ready): se ricevo connected 
+    2   - Agente in registrazione (recording): se ricevo un messaggio di recording e non stavo registrando
+    4   - Agente morto (dead): se ricevo un messaggio di shutdown
+    5   - Aggiornamento info agente: se ricevo un messaggio di offset
+  */
+  void update_agent(size_t index, const string &status, Level level, string &&message, const string &side) {
+    AgentStatus &agent = _agents[index];
+
+    // ALWAYS update the timestamp of the agent, even if the message is not relevant, to detect the unreachable agents
+    agent.last_update = chrono::steady_clock::now();
+    touch(index);
+
+    // Check if the agent status has changed, comparing the hashes and the level instead of the strings
+    // (the side is part of the source, so it cannot change)
+    const size_t status_hash = hash<string>{}(status);
+    const size_t message_hash = hash<string>{}(message);
+    if (agent.reported && agent.status_hash == status_hash && agent.level == level &&
+        agent.message_hash == message_hash) {
+      return;
+    }
+    agent.status = status;
+    agent.status_hash = status_hash;
+    agent.level = level;
+    agent.message = std::move(message);
+    agent.message_hash = message_hash;
+    agent.side = side;
+    agent.reported = true;
+
+    // proceed only if the message is relevant, push it to the pending queue
+    push_pending(agent);
+  }
+
+  // Move an agent just updated to the tail of the deadline queue: since the timeout is the same for all the
+  // agents, the queue stays sorted by deadline and the next agent to expire is always at its head
+  void touch(size_t index) {
+    unlink(index);
+    AgentStatus &agent = _agents[index];
+    agent.prev = _deadlines_tail;
+    agent.next = no_index;
+    agent.queued = true;
+    if (_deadlines_tail != no_index) {
+      _agents[_deadlines_tail].next = index;
+    } else {
+      _deadlines_head = index;
+    }
+    _deadlines_tail = index;
+  }
+
+  void unlink(size_t index) {
+    AgentStatus &agent = _agents[index];
+    if (!agent.queued) {
+      return;
+    }
+    (agent.prev != no_index ? _agents[agent.prev].next : _deadlines_head) = agent.next;
+    (agent.next != no_index ? _agents[agent.next].prev : _deadlines_tail) = agent.prev;
+    agent.prev = agent.next = no_index;
+    agent.queued = false;
+  }
+
+  // Relink the queued agents after the indices have changed
+  void rebuild_deadlines() {
+    vector<size_t> queued;
+    for (size_t i = 0; i < _agents.size(); ++i) {
+      if (_agents[i].queued) {
+        queued.push_back(i);
+      }
+      _agents[i].queued = false;
+    }
+    sort(queued.begin(), queued.end(), [this](size_t a, size_t b) {
+      return _agents[a].last_update < _agents[b].last_update;
+    });
+    _deadlines_head = _deadlines_tail = no_index;
+    for (size_t i : queued) {
+      touch(i);
+    }
+  }
+
+  // Push the current status of an agent to the pending queue, dropping the oldest one when it is full
+  void push_pending(const AgentStatus &agent) {
+    push_pending(static_cast<size_t>(&agent - _agents.data()), agent.level, agent.status, agent.message);
+  }
+
+  void push_pending(size_t agent, Level level, const string &status, const string &message) {
+    PendingStatus *slot = _pending.acquire();
+    if (slot == nullptr) {
+      _pending.pop();
+      slot = _pending.acquire();
+    }
+    slot->agent = agent;
+    slot->level = level;
+    slot->status = status;
+    slot->message = message;
+    _pending.commit();
+  }
+
+  // Before erasing the agent at index removed from the table: drop its pending statuses and shift the
+  // indices of the following agents, rotating the queue once to keep the order
+  void remap_pending(size_t removed) {
+    for (size_t n = _pending.size(); n > 0; --n) {
+      PendingStatus *pending = _pending.front();
+      _pending.pop();
+      if (pending->agent == removed) {
+        continue;
+      }
+      if (pending->agent != no_index && pending->agent > removed) {
+        --pending->agent;
+      }
+      PendingStatus *slot = _pending.acquire(); // never nullptr, a slot was just freed
+      if (slot != pending) {
+        std::swap(*slot, *pending);
+      }
+      _pending.commit();
+    }
+  }
+
+  // A command of the coordinator with its sequence number: the acks of the previous one are reported,
+  // those of this one are collected until command_ack_timeout
+  void open_command(const json &input) {
+    auto seq = input.find("seq");
+    auto t_us = input.find("t_us");
+    if (!seq->is_number_unsigned() || t_us == input.end() || !t_us->is_number_integer()) {
+      return;
+    }
+    if (_command_acks.open) {
+      report_command_latency();
+    }
+    _command_acks.seq = seq->get<uint64_t>();
+    _command_acks.code = command::decode(input);
+    _command_acks.sent_us = t_us->get<int64_t>();
+    _command_acks.deadline = chrono::steady_clock::now() + chrono::milliseconds(_command_ack_timeout);
+    _command_acks.acks.clear();
+    _command_acks.open = true;
+  }
+
+  // The ack of an agent, kept if it is for the command being collected
+  void add_ack(const json &ack, TopicHandler &handler, const string &topic, const json &input) {
+    auto seq = ack.find("seq");
+    auto t_us = ack.find("t_us");
+    if (!_command_acks.open || seq == ack.end() || !seq->is_number_unsigned() ||
+        seq->get<uint64_t>() != _command_acks.seq || t_us == ack.end() || !t_us->is_number_integer()) {
+      return;
+    }
+    auto s = input.find("side");
+    const string &side = (s != input.end() && s->is_string()) ? s->get_ref<const string &>() : no_side;
+    _command_acks.acks.emplace_back(agent_index(handler, topic, side), t_us->get<int64_t>());
+  }
+
+  // One status with the latency of each agent after the coordinator, and with how much later the left
+  // side applied the command than the right one, for each topic acknowledged by both sides, e.g.:
+  // "start #12: tip_loadcell_left 14.2 ms, tip_loadcell_right 3.1 ms; left after right: tip_loadcell 11.1 ms"
+  // The times are wall clocks of different devices, as accurate as their synchronization.
+  void report_command_latency() {
+    _command_acks.open = false;
+    if (_command_acks.acks.empty()) {
+      return;
+    }
+    std::ostringstream latencies, skews;
+    latencies << std::fixed << std::setprecision(1);
+    skews << std::fixed << std::setprecision(1);
+    latencies << command::name(_command_acks.code) << " #" << _command_acks.seq << ": ";
+    Level level = Level::info;
+    const char *separator = "";
+    for (const auto &ack : _command_acks.acks) {
+      const AgentStatus &agent = _agents[ack.first];
+      latencies << separator << agent.source << " " << (ack.second - _command_acks.sent_us) / 1000.0 << " ms";
+      separator = ", ";
+
+      // for a left agent, the right agent of the same topic, if it acknowledged too
+      const string &source = agent.source;
+      if (source.size() <= 5 || source.compare(source.size() - 5, 5, "_left") != 0) {
+        continue;
+      }
+      const string topic = source.substr(0, source.size() - 5);
+      const string right = topic + "_right";
+      for (const auto &other : _command_acks.acks) {
+        if (_agents[other.first].source == right) {
+          const double skew_ms = (ack.second - other.second) / 1000.0;
+          skews << (skews.tellp() > 0 ? ", " : "") << topic << " " << skew_ms << " ms";
+          if (std::abs(skew_ms) > _max_command_skew) {
+            level = Level::warning;
+          }
+        }
+      }
+    }
+    string message = latencies.str();
+    if (skews.tellp() > 0) {
+      message += "; left after right: " + skews.str();
+    }
+    push_pending(no_index, level, string(command::name(_command_acks.code)), message);
+    if (_debug) {
+      cout << message << endl;
+    }
+  }
+
+  // Write a pending status in place in the output json object, with the relevant information about the status
+  // note: timestamp and timecode are added by the agent, so no need to add them here (they are the timestamps of the device running this plugin)
+  void write_status(json &node, const PendingStatus &pending) const {
+    const bool is_agent = pending.agent != no_index;
+    assign(field(node, "source"), is_agent ? _agents[pending.agent].source : status_command_latency);
+    assign(field(node, "level"), level_name(pending.level));
+    assign(field(node, "status"), pending.status);
+    assign(field(node, "message"), pending.message);
+    if (is_agent && !_agents[pending.agent].side.empty()) {
+      assign(field(node, "side"), _agents[pending.agent].side);
+    } else if (node.is_object()) {
+      node.erase("side");
+    }
+  }
+
+  static const string no_side;
+  static const string status_startup;
+  static const string status_shutdown;
+  static const string status_unreachable;
+  static const string status_command_latency;
+
   // Define the fields that are used to store internal resources
-  std::deque<json> _pending;
+  SpscRing<PendingStatus> _pending{100}; // single threaded, used for its preallocated slots
   size_t _max_pending = 100;
+  MessageTemplate _message; // output messages, updated in place in out
+
+  // Last status of each monitored agent with timestamp, in a flat table indexed by source id
+  // (e.g., "coordinator", "tip_loadcell_left", "tip_loadcell_right")
+  vector<AgentStatus> _agents;
+  unordered_map<string, size_t> _source_ids; // source name to index in _agents
+  size_t _deadlines_head = no_index; // least recently updated reachable agent
+  size_t _deadlines_tail = no_index;
+
+  // Dispatch table keyed by topic (and by agent name for agent_event)
+  unordered_map<string, TopicHandler> _topics;
 
-  // Map to store the last status of each monitored agent with timestamp
-  // Key: source_id (e.g., "coordinator", "tip_loadcell_left", "tip_loadcell_right")
-  // Value: AgentStatus containing status, level, message, side and timestamp
-  std::map<string, AgentStatus> _agents;
+  const size_t _unreachable_hash = hash<string>{}(status_unreachable);
 
   // Timeout in milliseconds before considering an agent as unreachable
   int _unreachable_agent_timeout = 3000;
 
+  // Acks of the last command, see report_command_latency()
+  CommandAcks _command_acks;
+  int _command_ack_timeout = 1000;
+  double _max_command_skew = 20.0;
+
   bool _send_agents_status = false;
+  bool _batch_status = false;
 
   bool _debug = false;
+
+  // Latency histograms, compiled in with -DPERF_INSTRUMENTATION
+  perf::Histogram _perf_load;    // load_data()
+  perf::Histogram _perf_process; // process()
+  perf::Report _perf{{"load_data", &_perf_load}, {"process", &_perf_process}};
 };
 
+const string Status_handlerPlugin::no_side = "";
+const string Status_handlerPlugin::status_startup = "startup";
+const string Status_handlerPlugin::status_shutdown = "shutdown";
+const string Status_handlerPlugin::status_unreachable = "unreachable";
+const string Status_handlerPlugin::status_command_latency = "command_latency";
 
 /*
   ____  _             _             _      _
@@ -0,0 +1,79 @@
+/*
+  ____                  _
+ | __ )  ___ _ __   ___| |__
+ |  _ \ / _ \ '_ \ / __| '_ \
+ | |_) |  __/ | | | (__| | | |
+ |____/ \___|_| |_|\___|_| |_|
+
+Per-message cost of status_handler: the heartbeats of the 15 agents of the
+two crutches and the base station, with their info fields, and the agent
+events, see common/bench.hpp
+*/
+#define main status_handler_main
+#include "status_handler.cpp"
+#undef main
+
+#include <bench.hpp>
+
+int main(int argc, char const *argv[]) {
+  bench::Bench bench("status_handler", argc, argv, {
+    {"sub_topic", {"agent_event", "coordinator", "ups", "sync_handler", "hdf5_writer",
+                   "tip_loadcell", "handle_loadcell", "ppg", "pupil_neon", "gait_events"}},
+    {"unreachable_agent_timeout", 6000},
+    {"batch_status", false},
+    {"debug", false}
+  });
+
+  Status_handlerPlugin plugin;
+  plugin.set_params(bench.params());
+
+  // topic, side and heartbeat rate of each agent
+  struct Agent {
+    const char *topic;
+    const char *side;
+    double rate_hz;
+  };
+  static const Agent agents[] = {
+    {"tip_loadcell", "left", 2.0}, {"tip_loadcell", "right", 2.0},
+    {"handle_loadcell", "left", 2.0}, {"handle_loadcell", "right", 2.0},
+    {"sync_handler", "left", 1.0}, {"sync_handler", "right", 1.0},
+    {"ups", "left", 0.2}, {"ups", "right", 0.2},
+    {"ppg", "left", 2.0}, {"ppg", "right", 2.0},
+    {"gait_events", "left", 2.0}, {"gait_events", "right", 2.0},
+    {"coordinator", "", 2.0}, {"hdf5_writer", "", 2.0}, {"pupil_neon", "", 1.0}
+  };
+  for (size_t i = 0; i < sizeof(agents) / sizeof(agents[0]); ++i) {
+    const Agent agent = agents[i];
+    const string topic = agent.topic;
+    const string side = agent.side;
+    bench.stream(side.empty() ? topic : topic + "_" + side, topic, agent.rate_hz,
+                 [topic, side](uint64_t n, bench::Message &m) {
+      bench::heartbeat(m, topic, "recording", side);
+      json &info = m.payload["info"];
+      if (topic == "sync_handler") {
+        info["synchronized"] = true;
+        info["synchronizing"] = false;
+        info["offset_ms"] = 1.5;
+      } else if (topic == "ups") {
+        info["current"] = -250.0;
+        info["percent"] = 80.0 - n * 0.01;
+        info["voltage"] = 3.9;
+        info["remaining_battery_time"] = "02:10";
+      } else if (topic == "tip_loadcell" && n % 20 == 0) {
+        info["offset"] = {{"value", 12.5}, {"test", 0.1}, {"std", 0.05}, {"samples", 40}};
+      } else {
+        m.payload.erase("info");
+      }
+    }, 0.01 * i);
+  }
+  bench.stream("agent_event", 0.1, [](uint64_t n, bench::Message &m) {
+    m.payload["name"] = "tip_loadcell";
+    m.payload["event"] = "message";
+    m.payload["info"]["warning"] = {"tip_loadcell_left", "recording: frame " + to_string(n) + " late"};
+    m.payload["settings"]["side"] = "left";
+    bench::stamp(m.payload);
+  }, 0.5);
+  bench.tick("timeout", 10.0);
+  bench.run(plugin);
+  return 0;
+}
@@ -16,11 +16,13 @@
 #include <filter.hpp>
 #include <nlohmann/json.hpp>
 #include <pugg/Kernel.h>
+#include <clock_offset.hpp>
+#include <heartbeat.hpp>
+#include <message_template.hpp>
 #include <cstdlib>
-#include <ctime>
+#include <cmath>
 #include <chrono>
-#include <iomanip>
-#include <sstream>
+#include <ctime>
 
 // other includes as needed here
 
@@ -32,6 +34,8 @@
 // Load the namespaces
 using namespace std;
 using json = nlohmann::json;
+using message_template::assign;
+using message_template::field;
 
 
 // Plugin class. This shall be the only part that needs to be modified,
@@ -59,32 +63,44 @@ public:
     // Extract and parse the timestamp
     try {
       if (input.contains("timestamp") && input["timestamp"].is_object()) {
-        if (input["timestamp"].contains("$date")) {
-          string timestamp_str = input["timestamp"]["$date"].get<string>();
-          _synchronized = check_sync_status(timestamp_str);
-          //cout << "Timestamp: " << timestamp_str << ", Synchronized: " << (_synchronized ? "true" : "false") << endl;
+        const auto date = input["timestamp"].find("$date");
+        int64_t coordinator_ms = 0;
+        bool parsed = false;
+        if (date != input["timestamp"].end() && date->is_string()) {
+          const string &timestamp_str = date->get_ref<const string &>();
+          parsed = clock_offset::parse_iso8601_ms(timestamp_str.data(), timestamp_str.size(), coordinator_ms);
+        } else if (date != input["timestamp"].end() && date->is_number_integer()) {
+          coordinator_ms = date->get<int64_t>(); // already ms since the epoch
+          parsed = true;
+        }
+        if (!parsed) {
+          _error = "Invalid coordinator timestamp, message ignored";
+          return return_type::warning;
+        }
+
+        // offset of the local clock from the coordinator, latency of the message included
+        const int64_t now_ms = chrono::duration_cast<chrono::milliseconds>(
+          chrono::system_clock::now().time_since_epoch()).count();
+        _offset.add(static_cast<double>(now_ms - coordinator_ms));
+        _synchronized = fabs(_offset.median()) < _sync_threshold_ms;
 
-          const auto now = std::chrono::steady_clock::now();
+        const auto now = std::chrono::steady_clock::now();
 
-          if (_synchronized) {
-            _synchronizing = false;
+        if (_synchronized) {
+          _synchronizing = false;
+          _last_sync_attempt = now;
+        } else {
+          const bool cooldown_expired =
+              !_synchronizing ||
+              (now - _last_sync_attempt) >= _sync_cooldown;
+
+          if (cooldown_expired) {
+            _synchronizing = true;
             _last_sync_attempt = now;
-            //cout << "Device is synchronized. Next synchronization check will be performed after " << _health_status_period << " ms." << endl;
-          } else {
-            const bool cooldown_expired =
-                !_synchronizing ||
-                (now - _last_sync_attempt) >= std::chrono::seconds(8);
-
-            if (cooldown_expired) {
-              _synchronizing = true;
-              _last_sync_attempt = now;
-              const int restart_result = std::system("sudo systemctl restart chrony");
-              _last_sync_command_ok = (restart_result == 0);
-              //cout << "Attempted to restart chrony. Result: " << restart_result << endl;
-            }
+            const int restart_result = std::system("sudo systemctl restart chrony");
+            _last_sync_command_ok = (restart_result == 0);
+            _offset.reset(); // the clock is going to step, the older offsets are stale
           }
-
-          return return_type::success;
         }
       }
 
@@ -107,32 +123,33 @@ public:
   // return_type::error: _error is traced via register_event, don't publish
   // return_type::critical: execution stops
   return_type process(json &out, vector<unsigned char> *blob = nullptr) override {
-    out.clear();
+    _message.begin(out); // the fields of the previous message are updated in place
 
-    // Send periodic agent_status if no command to send and 500ms have passed
-    auto now = std::chrono::steady_clock::now();
-    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(now - _last_health_status_time).count();
+    // Send agent_status when the heartbeat is due, the state is the synchronization status
+    const uint32_t state = (_synchronized ? 1 : 0) | (_synchronizing ? 2 : 0);
     
     // load the data as necessary and set the fields of the json out variable
-    if (elapsed >= _health_status_period) {
+    if (_heartbeat.due(state)) {
 
       // Set the synchronized flag based on timestamp check
-      out["info"]["synchronized"] = _synchronized;
-      out["info"]["synchronizing"] = _synchronizing;
-      out["agent_status"] = "idle";
-      _last_health_status_time = now;
+      json &info = _message.object("info");
+      assign(field(info, "synchronized"), _synchronized);
+      assign(field(info, "synchronizing"), _synchronizing);
+      if (_offset.count() > 0) {
+        assign(field(info, "offset_ms"), _offset.median());
+        assign(field(info, "jitter_ms"), _offset.mad());
+        assign(field(info, "offset_samples"), _offset.count());
+      }
+      assign(_message["agent_status"], "idle");
+      _heartbeat.sent(state);
       
     } else {
       // if there is no command to send and not enough time has passed, don't send anything
       return return_type::retry;
     }
     
-    // If there is a message to send, we must send the crutch side
-    out["side"] = _side;
-
-    // This sets the agent_id field in the output json object, only when it is
-    // not empty
-    if (!_agent_id.empty()) out["agent_id"] = _agent_id;
+    // If there is a message to send, we must send the crutch side and the agent_id (constants of _message)
+    _message.finish();
     return return_type::success;
   }
   
@@ -148,7 +165,12 @@ public:
     // params needs to be cast to json
     _params.merge_patch(params);
 
-    _health_status_period = _params.value("health_status_period", 500); // default to 500 ms
+    _heartbeat.configure(_params); // health_status_period, default to 500 ms, and health_status_mode
+
+    // chrony is restarted when the median offset exceeds sync_threshold, at most once every sync_cooldown
+    _sync_threshold_ms = _params.value("sync_threshold", 5000.0);
+    _sync_cooldown = std::chrono::milliseconds(_params.value("sync_cooldown", 8000));
+    _offset.configure(_params.value("offset_window", 32)); // coordinator messages, at most 256
 
     if (_params.contains("side") && (_params["side"] == "left" || _params["side"] == "right")) {
       _side = _params["side"].get<string>();
@@ -159,6 +181,10 @@ public:
       std::cout << _error << std::endl;
       throw std::runtime_error(_error);
     }
+
+    // Fields of every message
+    _message.set_constant("side", _side);
+    _message.set_constant("agent_id", _agent_id.empty() ? json() : json(_agent_id));
       
   }
 
@@ -174,8 +200,8 @@ public:
 
 private:
   
-  int _health_status_period = 500; // in milliseconds, default to 500 ms
-  std::chrono::steady_clock::time_point _last_health_status_time = std::chrono::steady_clock::now();
+  Heartbeat _heartbeat; // schedules the agent_status messages
+  MessageTemplate _message; // output messages, updated in place in out
 
   string _side = "unknown";
   // Define the fields that are used to store internal resources
@@ -183,84 +209,10 @@ private:
   bool _synchronizing = false;
   bool _last_sync_command_ok = false;
   std::chrono::steady_clock::time_point _last_sync_attempt = std::chrono::steady_clock::time_point::min();
-  
-  // Helper function to parse ISO 8601 timestamp and get difference from now in seconds
-  bool check_sync_status(const string &timestamp_str) {
-    try {
-      // Parse ISO 8601 format: "2026-05-11T19:23:49.454+0100"
-      if (timestamp_str.size() < 24) {
-        return false;
-      }
-
-      const size_t timezone_start = timestamp_str.find_last_of("+-");
-      if (timezone_start == string::npos || timezone_start < 19) {
-        return false;
-      }
-
-      const size_t fraction_start = timestamp_str.find('.', 19);
-      const string seconds_part = timestamp_str.substr(0, 19);
-      struct tm tm_time = {};
-      istringstream time_stream(seconds_part);
-      time_stream >> get_time(&tm_time, "%Y-%m-%dT%H:%M:%S");
-      if (time_stream.fail()) {
-        return false;
-      }
-
-      int milliseconds = 0;
-      if (fraction_start != string::npos && fraction_start < timezone_start) {
-        const string fraction_part = timestamp_str.substr(fraction_start + 1, timezone_start - fraction_start - 1);
-        string milliseconds_str = fraction_part.substr(0, 3);
-        while (milliseconds_str.size() < 3) {
-          milliseconds_str.push_back('0');
-        }
-        milliseconds = stoi(milliseconds_str);
-      }
-
-      time_t parsed_seconds = 0;
-
-      if (timestamp_str.back() == 'Z') {
-#if defined(_WIN32)
-        parsed_seconds = _mkgmtime(&tm_time);
-#else
-        parsed_seconds = timegm(&tm_time);
-#endif
-      } else {
-        const string timezone_suffix = timestamp_str.substr(timezone_start);
-        if (timezone_suffix.size() != 5 && timezone_suffix.size() != 6) {
-          return false;
-        }
-
-        const int sign = (timezone_suffix[0] == '-') ? -1 : 1;
-        const int offset_hours = stoi(timezone_suffix.substr(1, 2));
-        const int offset_minutes = stoi(timezone_suffix.substr(3, 2));
-        const int offset_seconds = sign * ((offset_hours * 60) + offset_minutes) * 60;
-
-#if defined(_WIN32)
-        parsed_seconds = _mkgmtime(&tm_time) - offset_seconds;
-#else
-        parsed_seconds = timegm(&tm_time) - offset_seconds;
-#endif
-      }
-
-      auto now = chrono::system_clock::now();
+  double _sync_threshold_ms = 5000.0;
+  std::chrono::milliseconds _sync_cooldown{8000};
+  clock_offset::OffsetEstimator<256> _offset; // ms, local clock minus coordinator
 
-      auto parsed_time_point = chrono::system_clock::from_time_t(parsed_seconds) + chrono::milliseconds(milliseconds);
-      auto diff_ms = chrono::duration_cast<chrono::milliseconds>(now - parsed_time_point).count();
-      auto abs_diff_ms = (diff_ms < 0) ? -diff_ms : diff_ms;
-
-      auto current_time_ms = chrono::duration_cast<chrono::milliseconds>(now.time_since_epoch()).count();
-      auto parsed_time_ms = chrono::duration_cast<chrono::milliseconds>(parsed_time_point.time_since_epoch()).count();
-
-      //cout << "Current time: " << current_time_ms << ", Parsed time: " << parsed_time_ms << ", Difference: " << diff_ms << " ms" << endl;
-
-      // Return true if difference is less than 5 seconds
-      return abs_diff_ms < 5000;
-      
-    } catch (...) {
-      return false;
-    }
-  }
-  
 };
 
 
@@ -292,20 +244,20 @@ int main(int argc, char const *argv[])
   json input, output;
 
   // Set example values to params
-  params["test"] = "value";
+  params["side"] = "left";
+  params["health_status_period"] = 0; // publish at the first process()
 
   // Set the parameters
   plugin.set_params(params);
 
-  // Set input data
-  input["data"] = {
-    {"AX", 1},
-    {"AY", 2},
-    {"AZ", 3}
-  };
+  // Emulate a coordinator message stamped now, in UTC
+  const time_t now = time(nullptr);
+  char date[32];
+  strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S", gmtime(&now));
+  input["timestamp"]["$date"] = string(date) + ".000Z";
 
   // Set input data
-  plugin.load_data(input);
+  plugin.load_data(input, "coordinator");
   cout << "Input: " << input.dump(2) << endl;
 
   // Process data
@@ -315,4 +267,3 @@ int main(int argc, char const *argv[])
 
   return 0;
 }
-
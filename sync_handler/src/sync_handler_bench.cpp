@@ -0,0 +1,40 @@
+/*
+  ____                  _
+ | __ )  ___ _ __   ___| |__
+ |  _ \ / _ \ '_ \ / __| '_ \
+ | |_) |  __/ | | | (__| | | |
+ |____/ \___|_| |_|\___|_| |_|
+
+Per-message cost of sync_handler: the heartbeats and the labels of the
+coordinator, stamped with the local clock, see common/bench.hpp
+*/
+#define main sync_handler_main
+#include "sync_handler.cpp"
+#undef main
+
+#include <bench.hpp>
+
+int main(int argc, char const *argv[]) {
+  bench::Bench bench("sync_handler", argc, argv, {
+    {"side", "left"},
+    {"health_status_period", 1000},
+    {"sync_threshold", 5000},
+    {"sync_cooldown", 8000},
+    {"offset_window", 32}
+  });
+
+  Sync_handlerPlugin plugin;
+  plugin.set_params(bench.params());
+
+  bench.stream("heartbeat", "coordinator", 2.0, [](uint64_t, bench::Message &m) {
+    bench::heartbeat(m, "coordinator", "recording");
+  });
+  bench.stream("condition", "coordinator", 0.5, [](uint64_t n, bench::Message &m) {
+    m.payload["command"] = "condition";
+    m.payload["label"] = n % 2 ? "walking" : "standing";
+    m.payload["agent_id"] = "coordinator";
+    bench::stamp(m.payload);
+  }, 0.25);
+  bench.run(plugin);
+  return 0;
+}
@@ -0,0 +1,87 @@
+/*
+   ____                  _     _____ _ _ _
+  / ___|___  _   _ _ __ | |_  |  ___(_) | |_ ___ _ __
+ | |   / _ \| | | | '_ \| __| | |_  | | | __/ _ \ '__|
+ | |__| (_) | |_| | | | | |_  |  _| | | | ||  __/ |
+  \____\___/ \__,_|_| |_|\__| |_|   |_|_|\__\___|_|
+
+Integer despike, low-pass and scaling of the raw HX711 counts
+*/
+
+#ifndef COUNT_FILTER_HPP
+#define COUNT_FILTER_HPP
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+
+// Streaming filter of the signed 24-bit counts of a load cell converter:
+// a median of the last 3 or 5 readings removes the isolated spikes, then a
+// first-order IIR y += alpha * (x - y) smooths the result. The counts stay
+// integers, the IIR state has 8 fractional bits and alpha 16, and the output
+// is scaled to µN with a precomputed fixed-point factor: no floating point
+// and no allocation per reading.
+class CountFilter {
+public:
+  static constexpr size_t max_window = 5;
+
+  // median_window 3 or 5, anything else disables the median; iir_alpha in
+  // (0, 1], 1 disables the low-pass; newton_per_count is the force of one
+  // count, without offset
+  void configure(int median_window, double iir_alpha, double newton_per_count) {
+    _window = (median_window == 3 || median_window == 5) ? size_t(median_window) : 1;
+    _alpha_q16 = int64_t(std::lround(std::clamp(iir_alpha, 1.0 / 65536, 1.0) * 65536));
+    _scale_q16 = int64_t(std::llround(newton_per_count * 1e6 * 65536)); // µN per count
+    reset();
+  }
+
+  // Forget the previous readings, e.g. at the start of an acquisition
+  void reset() {
+    _primed = false;
+    _next = 0;
+  }
+
+  int median_window() const { return _window > 1 ? int(_window) : 0; }
+  double iir_alpha() const { return _alpha_q16 / 65536.0; }
+
+  // Add a reading, returns the filtered force in µN
+  int64_t add(int32_t counts) {
+    if (!_primed) {
+      _history.fill(counts); // the first reading fills the window and the IIR state
+      _y_q8 = int64_t(counts) * 256;
+      _primed = true;
+    }
+    _history[_next] = counts;
+    _next = (_next + 1) % _window;
+
+    const int64_t x_q8 = int64_t(median()) * 256;
+    _y_q8 += (_alpha_q16 * (x_q8 - _y_q8)) / 65536;
+    return (_y_q8 * _scale_q16) / (int64_t(1) << 24);
+  }
+
+private:
+  int32_t median() const {
+    if (_window == 3) {
+      const int32_t a = _history[0], b = _history[1], c = _history[2];
+      return std::max(std::min(a, b), std::min(std::max(a, b), c));
+    }
+    if (_window == 5) {
+      std::array<int32_t, max_window> v = _history;
+      std::nth_element(v.begin(), v.begin() + 2, v.end());
+      return v[2];
+    }
+    return _history[(_next + _window - 1) % _window];
+  }
+
+  size_t _window = 1;
+  size_t _next = 0;
+  bool _primed = false;
+  std::array<int32_t, max_window> _history{}; // last raw counts, ring of _window
+  int64_t _alpha_q16 = 65536;
+  int64_t _scale_q16 = 0;
+  int64_t _y_q8 = 0;
+};
+
+#endif // COUNT_FILTER_HPP
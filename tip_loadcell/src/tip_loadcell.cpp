@@ -22,7 +22,20 @@
 #include <pugg/Kernel.h>
 
 // other includes as needed here
+#include <atomic>
 #include <memory> // For std::unique_ptr
+#include <mutex>
+#include <thread>
+#include <command.hpp>
+#include <heartbeat.hpp>
+#include <idle_sleep.hpp>
+#include <message_template.hpp>
+#include <perf.hpp>
+#include <realtime_thread.hpp>
+#include <running_stats.hpp>
+#include <sample_frame.hpp>
+#include <spsc_ring.hpp>
+#include "count_filter.hpp"
 
 #ifdef RASPBERRYPI_PLATFORM
   // Include HX711 for Raspberry Pi
@@ -42,6 +55,8 @@
 // Load the namespaces
 using namespace std;
 using json = nlohmann::json;
+using message_template::assign;
+using message_template::field;
 
 // Plugin class. This shall be the only part that needs to be modified,
 // implementing the actual functionality
@@ -56,28 +71,42 @@ public:
   }
 #endif
 
+  // The acquisition thread must not outlive the sensor
+  ~Tip_loadcellPlugin() { stop_acquisition(); }
+
   // Typically, no need to change this
   string kind() override { return PLUGIN_NAME; }
 
   // Implement the actual functionality here
   return_type load_data(json const &input, string topic = "", vector<unsigned char> const *blob = nullptr) override {
     
-    // if topic contains the "command" field, process commands here
-    if (input.contains("command")) {
-
-      string action = input.value("command", ""); // Get the command, default to empty string if not found
-      if (action == "start") {
+    // if topic contains the "command" field, process commands here (dispatched on their code, see command.hpp)
+    const command::Code action = command::decode(input);
+    switch (action) {
 
+      case command::Code::start:
         _recording = true;
+        _calibration.restart(); // a pending calibration starts over after the acquisition
+        _sequence = 0;
+        _frame_samples = 0;
+        _frame_force.clear();
+        _frame_t_us.clear();
+        _filter.reset(); // the readings before the start are too old to filter with
+        if (_acquisition_thread) {
+          start_acquisition();
+        }
+        _ack.applied(input, action); // as soon as the acquisition is started, for the start skew of the crutches
         std::cout << std::endl << "Starting acquisition" << std::endl;
+        break;
 
-      } else if (action == "stop") {
-
-        _recording = false;
+      case command::Code::stop:
+        _recording = false; // a partial frame, if any, is sent by the next process()
+        stop_acquisition(); // samples left in the ring are sent by the next process() calls
+        _ack.applied(input, action);
         std::cout << std::endl << "Stopping acquisition" << std::endl;
+        break;
 
-      } else if (action == "set_offset") {
-        
+      case command::Code::set_offset:
         // Setting offset is only allowed when not recording, if we are recording return an error
         // This is to avoid changing the offset while we are acquiring data, which could lead to inconsistent data and make it difficult to understand the actual forces being applied on the crutches.
         if (_recording) {
@@ -86,14 +115,15 @@ public:
         }
 
         _setting_offset = true;
+        _calibration.start(_offset_samples, _offset_test_samples);
+        _filter.reset();
+        _ack.applied(input, action);
         std::cout << std::endl << "Setting offset" << std::endl;
+        break;
 
-      } else {
+      default:
+        // if the message doesn't contain a command, we don't know how to handle it, so we retry
         return return_type::retry;
-      }
-    } else {
-      // if the message doesn't contain a command, we don't know how to handle it, so we retry
-      return return_type::retry;
     }
     
 
@@ -103,15 +133,15 @@ public:
   // We calculate the average of the last N values for each key and store it
   // into the output json object
   return_type process(json &out, vector<unsigned char> *blob = nullptr) override {
-    out.clear();
+    perf::Timer process_timer(_perf_process);
+    _message.begin(out); // the fields of the previous message are updated in place
+    if (_binary_mode && blob != nullptr) {
+      blob->clear(); // only messages with a sample carry a frame
+    }
 
     // Not valid states or transitions are handled in load_data, here we just process data
     // Here we should have only valid states and errors related to reading the sensor
 
-    // Send periodic agent_status if 500ms have passed
-    auto now = std::chrono::steady_clock::now();
-    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(now - _last_health_status_time).count();
-    
     if (_process_cycles <= 1000000000) {
       ++_process_cycles;
     } else {
@@ -121,81 +151,99 @@ public:
     /*std::cout << "[tip_loadcell] process cycle=" << _process_cycles
           << " recording=" << (_recording ? "true" : "false")
           << " setting_offset=" << (_setting_offset ? "true" : "false")
-          << " elapsed_ms=" << elapsed
           << " _hx=" << (_hx ? "valid" : "null")
           << std::endl;*/
   
     // load the data as necessary and set the fields of the json out variable
-    if (_recording || _setting_offset || elapsed >= _health_status_period) {
+    const bool health_status_due = _heartbeat.due(_recording);
+    const bool must_send = health_status_due || _ack.pending(); // the ack of a command is not delayed to the next frame
+    if (_recording || _setting_offset || _frame_samples > 0 || !_samples.empty() || must_send) {
       
-      if (elapsed >= _health_status_period) {
-        out["agent_status"] = _recording ? "recording" : "idle";
-        _last_health_status_time = now;
+      if (health_status_due) {
+        assign(_message["agent_status"], _recording ? "recording" : "idle");
+        if (_acquisition_thread) {
+          json &acquisition = field(_message.object("info"), "acquisition");
+          assign(field(acquisition, "ring_size"), _samples.capacity());
+          assign(field(acquisition, "high_water"), _samples.high_water());
+          assign(field(acquisition, "overruns"), _overruns.load(std::memory_order_relaxed));
+        }
+        _heartbeat.sent(_recording);
       } 
 
-      if (_recording){
-        #ifdef RASPBERRYPI_PLATFORM
+      if (_acquisition_thread && (_recording || !_samples.empty())) {
 
-          // read the load cell value, subtract the offset and store it in the output json object
-          float loadCellValue = _hx->weight(1).getValue(Mass::Unit::N);
-          //float loadCellValue = 2400.0;
-          auto sample = loadCellValue - _offset;
-          out["force"] = sample;
+        {
+          std::lock_guard<std::mutex> lock(_acquisition_mutex);
+          if (!_acquisition_error.empty()) {
+            _error = "recording: " + _acquisition_error;
+            _acquisition_error.clear();
+            return return_type::error;
+          }
+        }
 
-        #else
+        // the samples are read by the acquisition thread, here we only drain the ring
+        if (!drain_samples(blob)) {
+          if (!_recording && _frame_samples > 0) {
+            // acquisition stopped and the ring is empty: send the partial frame
+            send_frame(blob);
+          } else if (!must_send) {
+            return return_type::retry;
+          }
+        }
 
-          // If we are not on a Raspberry Pi, we emulate the load cell readings by generating random values, which can be useful for development and testing on non-Raspberry Pi machines
-          out["force"] = static_cast<float>(rand()) / static_cast<float>(RAND_MAX) * 100.0; // Random value between 0 and 100 N
+      } else if (_recording){
 
-        #endif
-        
-      } else if (_setting_offset) {
-        #ifdef RASPBERRYPI_PLATFORM
-        
-          // Real hardware offset on Raspberry Pi
-          float loadCellValue = _hx->weight(40).getValue(Mass::Unit::N);
-          //float loadCellValue = 2400.0;
-          _offset = loadCellValue;
-          _setting_offset = false;
+        // read the load cell value, subtract the offset and store it in the output json object
+        const float sample = read_load_cell() - _offset;
 
-          // test read after setting offset
-          loadCellValue = _hx->weight(20).getValue(Mass::Unit::N);
-          auto offset_test = loadCellValue - _offset;
-          
-          // Store the offset and the test read in the output json for user feedback
-          // We only fill the field for the current side
-          out["info"]["offset"]["value"] = _offset;
-          out["info"]["offset"]["test"] = offset_test;
-          out["agent_status"] = "idle";
+        // until the frame is complete there is nothing to send, unless the health status is due
+        if (!add_sample(sample, steady_clock_us(), blob) && !must_send) {
+          return return_type::retry;
+        }
+        
+      } else if (_frame_samples > 0) {
 
-        #else
-          // If we are not on a Raspberry Pi, we emulate the offset setting by generating a random offset value, which can be useful for development and testing on non-Raspberry Pi machines
-          _offset = static_cast<float>(rand()) / static_cast<float>(RAND_MAX) * 10.0; // Random offset value between 0 and 10 N
-          _setting_offset = false;
+        // acquisition stopped with a partial frame: send it
+        send_frame(blob);
 
-          float offset_test = static_cast<float>(rand()) / static_cast<float>(RAND_MAX) * 5.0; // Random offset test value between 0 and 5 N
+      } else if (_setting_offset) {
 
-          // Store the offset and offset_test in the output json for user feedback
-          out["info"]["offset"]["value"] = _offset;
-          out["info"]["offset"]["test"] = offset_test;
-          out["agent_status"] = "idle";
+        // one reading per cycle, so that calibrating does not stall the agent loop
+        const double reading = read_load_cell();
+        if (_calibration.add(&reading)) {
+          _offset = static_cast<float>(_calibration.offset()[0]);
+          _setting_offset = false;
 
-        #endif
+          // Store the offset, the test read and the noise in the output json for user feedback
+          // We only fill the field for the current side
+          json &offset = field(_message.object("info"), "offset");
+          assign(field(offset, "value"), _offset);
+          assign(field(offset, "test"), _calibration.test(0));
+          assign(field(offset, "std"), _calibration.stddev()[0]);
+          assign(field(offset, "samples"), _calibration.samples());
+          assign(_message["agent_status"], "idle");
+        } else if (!must_send) {
+          return return_type::retry;
+        }
 
       }
 
     } else {
       // if there is no command to send and not enough time has passed, don't send anything
+      // (idle: sleep until the next agent_status, if enabled)
+      process_timer.discard();
+      _idle.until(_heartbeat.next_due(_recording));
       return return_type::retry;
     }
     
 
-    // If there is a message to send, we must send the crutch side
-    out["side"] = _side;
-    
-    // This sets the agent_id field in the output json object, only when it is
-    // not empty
-    if (!_agent_id.empty()) out["agent_id"] = _agent_id;
+    if (_ack.pending()) {
+      _ack.write(_message.object("ack"));
+    }
+
+    // If there is a message to send, we must send the crutch side and the agent_id (constants of _message)
+    _message.finish();
+    _perf.publish_if_due(out);
     return return_type::success;
   }
   
@@ -211,11 +259,28 @@ public:
     // params needs to be cast to json
     _params.merge_patch(params);
 
-    _health_status_period = _params.value("health_status_period", 500); // default to 500 ms
+    _heartbeat.configure(_params); // health_status_period, default to 500 ms, and health_status_mode
+    _perf.configure(_params); // perf_period, default to 5000 ms
+    _idle.configure(_params); // idle_sleep, default to false, and idle_max_sleep, default to 200 ms
+    _binary_mode = _params.value("binary_mode", false); // send samples as binary frames in the message blob
+    _samples_per_frame = max(1, _params.value("samples_per_frame", 1)); // readings sent in each message
+    _frame_force.reserve(_samples_per_frame);
+    _frame_t_us.reserve(_samples_per_frame);
+
+    _offset_samples = max(1, _params.value("offset_samples", 40)); // readings averaged for the offset
+    _offset_test_samples = max(0, _params.value("offset_test_samples", 20)); // readings of the test after the offset
+
+    // Acquisition thread: reads the HX711 at its own data rate, independently of the MADS loop
+    stop_acquisition();
+    _acquisition_thread = _params.value("acquisition_thread", false);
+    _thread_priority = _params.value("thread_priority", 0); // SCHED_FIFO priority (1-99), 0 keeps the default scheduling
+    _thread_cpu = _params.value("thread_cpu", -1); // core the thread is pinned to, -1 for no pinning
+    _samples.reset(max(1, _params.value("ring_size", 256))); // samples buffered between the thread and process()
 
     if (_params.contains("side") && (_params["side"] == "left" || _params["side"] == "right")) {
       _side = _params["side"].get<string>();
       _agent_id = "tip_loadcell_" + _side; // this is useful when the side field is not reachable
+      _frame_side = sample_frame::side_from_string(_side);
       std::cout << "Side set to " << _side << std::endl;
     } else {
       _error = "Side parameter not set or invalid (only 'left' or 'right' allowed).";
@@ -236,6 +301,12 @@ public:
       throw std::runtime_error(_error);
     }
 
+    // The readings are counts / scaling grams, as in the HX711 library, despiked, smoothed and
+    // converted to N in integers
+    const double newton_per_count = 9.80665e-3 / scaling;
+    _filter.configure(_params.value("median_window", 0), _params.value("iir_alpha", 1.0), newton_per_count);
+    _emulated_counts = max(1, static_cast<int>(100.0 / newton_per_count)); // 100 N
+
     #ifdef RASPBERRYPI_PLATFORM
 
       // Initialize the HX711 sensor
@@ -252,7 +323,19 @@ public:
 
     #endif
 
+    // Descriptor of the binary frames: a single unlabelled channel, stored in the "force" dataset
+    _frame_descriptor = {
+      {"kind", sample_frame::kind_name(sample_frame::Kind::force_f32)},
+      {"key", "force"},
+      {"channels", json::array()}
+    };
+
+    // Fields of every message
+    _message.set_constant("side", _side);
+    _message.set_constant("agent_id", _agent_id.empty() ? json() : json(_agent_id));
+
     _setting_offset = true; // Set offset at the beginning
+    _calibration.start(_offset_samples, _offset_test_samples);
   }
 
   // Implement this method if you want to provide additional information
@@ -260,13 +343,150 @@ public:
     // return a map of strings with additional information about the plugin
     // it is used to print the information about the plugin when it is loaded
     // by the agent
-    
-    return {};
+    map<string, string> info_map;
+    if (_acquisition_thread) {
+      info_map["Acquisition thread"] = "ring size " + to_string(_samples.capacity()) +
+        ", priority " + (_thread_priority > 0 ? "SCHED_FIFO " + to_string(_thread_priority) : string("default")) +
+        ", cpu " + (_thread_cpu >= 0 ? to_string(_thread_cpu) : string("any"));
+    } else {
+      info_map["Acquisition thread"] = "off";
+    }
+    info_map["Filter"] = (_filter.median_window() > 0 ? "median of " + to_string(_filter.median_window()) : string("no median")) +
+      (_filter.iir_alpha() < 1.0 ? ", IIR alpha " + to_string(_filter.iir_alpha()) : string(", no IIR"));
+    return info_map;
     
   };
 
 private:
 
+  // Monotonic timestamp of a sample, in microseconds
+  static uint64_t steady_clock_us() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+  }
+
+  // A reading of the acquisition thread
+  struct Sample {
+    uint64_t t_us;
+    float force; // offset not yet subtracted
+  };
+
+  // Move the samples read by the acquisition thread into the current frame, stopping as soon as a frame is
+  // sent (one message per process() call). Returns true if a frame has been sent.
+  bool drain_samples(vector<unsigned char> *blob) {
+    while (const Sample *sample = _samples.front()) {
+      const Sample s = *sample;
+      _samples.pop();
+      if (add_sample(s.force - _offset, s.t_us, blob)) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  void start_acquisition() {
+    stop_acquisition();
+    _samples.reset(_samples.capacity());
+    _overruns = 0;
+    _acquiring = true;
+    _acquisition = thread(&Tip_loadcellPlugin::acquisition_loop, this);
+    configure_realtime_thread(_acquisition, _thread_priority, _thread_cpu, "[tip_loadcell] ");
+  }
+
+  void stop_acquisition() {
+    if (!_acquisition.joinable()) {
+      return;
+    }
+    _acquiring = false;
+    _acquisition.join();
+  }
+
+  // One filtered reading of the load cell in N, without offset
+  float read_load_cell() {
+    perf::Timer timer(_perf_read);
+  #ifdef RASPBERRYPI_PLATFORM
+    // raw counts of the next conversion (80 Hz), read directly instead of
+    // through getValues(), which allocates a vector per reading
+    while (!_hx->isReady()) {
+      std::this_thread::sleep_for(std::chrono::microseconds(200));
+    }
+    const int32_t counts = _hx->readValue();
+  #else
+    // If we are not on a Raspberry Pi, we emulate the load cell readings by generating random counts, which can be useful for development and testing on non-Raspberry Pi machines
+    const int32_t counts = rand() % _emulated_counts; // Random value between 0 and 100 N
+  #endif
+    return static_cast<float>(_filter.add(counts)) * 1e-6f; // µN to N
+  }
+
+  // Body of the acquisition thread: a blocking read per HX711 conversion, stamped as soon as it is available
+  void acquisition_loop() {
+  #ifndef RASPBERRYPI_PLATFORM
+    auto next = std::chrono::steady_clock::now();
+  #endif
+    try {
+      while (_acquiring.load(std::memory_order_acquire)) {
+        #ifndef RASPBERRYPI_PLATFORM
+          // emulated converter at 80 Hz
+          next += std::chrono::microseconds(12500);
+          std::this_thread::sleep_until(next);
+        #endif
+        const float force = read_load_cell();
+        if (!_samples.push({steady_clock_us(), force})) {
+          _overruns.fetch_add(1, std::memory_order_relaxed); // process() is not keeping up, the sample is lost
+        }
+      }
+    } catch (const std::exception &e) {
+      std::lock_guard<std::mutex> lock(_acquisition_mutex);
+      _acquisition_error = string("reading HX711: ") + e.what();
+    }
+  }
+
+  // Add a reading to the current frame, returns true if the frame is complete and has been sent
+  // With one sample per frame the json carries a scalar "force", as before
+  bool add_sample(float sample, uint64_t t_us, vector<unsigned char> *blob) {
+    perf::Timer timer(_perf_json);
+    if (_binary_mode && blob != nullptr) {
+      // binary mode: the samples travel in the blob, the json only carries the frame descriptor
+      sample_frame::Writer frame(_frame_buffer);
+      if (_frame_samples == 0) {
+        frame.begin(_frame_side, sample_frame::Kind::force_f32, 1, _sequence);
+      }
+      frame.add_sample(t_us, &sample);
+    } else if (_samples_per_frame > 1) {
+      _frame_force.push_back(sample);
+      _frame_t_us.push_back(t_us);
+    } else {
+      assign(_message["force"], sample);
+      if (_acquisition_thread) {
+        assign(_message["t_us"], t_us); // the reading time is not the sending time
+      }
+      ++_sequence;
+      return true;
+    }
+    ++_sequence;
+    if (++_frame_samples < _samples_per_frame) {
+      return false;
+    }
+    send_frame(blob);
+    return true;
+  }
+
+  // Move the samples collected so far into the message: the frame goes in the blob (binary mode),
+  // or the "force" and "t_us" arrays go in the json together with the number of "samples"
+  void send_frame(vector<unsigned char> *blob) {
+    if (_binary_mode && blob != nullptr) {
+      blob->swap(_frame_buffer); // no copy, the old blob buffer is reused for the next frame
+      assign(_message["frame"], _frame_descriptor);
+    } else {
+      assign(_message["force"], _frame_force);
+      assign(_message["t_us"], _frame_t_us);
+      assign(_message["samples"], _frame_force.size());
+      _frame_force.clear();
+      _frame_t_us.clear();
+    }
+    _frame_samples = 0;
+  }
+
 #ifdef RASPBERRYPI_PLATFORM
   // Define the fields that are used to store internal resources
   unique_ptr<AdvancedHX711> _hx;  // Single HX711 sensor
@@ -277,13 +497,52 @@ private:
   bool _recording = false;
   bool _setting_offset = false;
 
-  int _health_status_period = 500; // in milliseconds, default to 500 ms
-  std::chrono::steady_clock::time_point _last_health_status_time = std::chrono::steady_clock::now();
+  Heartbeat _heartbeat; // schedules the agent_status messages
+  command::Ack _ack; // of the last command, sent in the next message
+  IdleSleep _idle; // sleep in process() while idle
+  MessageTemplate _message; // output messages, updated in place in out
   unsigned long long _process_cycles = 0; // I dont know why, but without this counter the agent blocks after one process cycle
 
   // Internal variables
   string _side = "unknown";
   float _offset = 0.0;
+  CountFilter _filter; // despike and low-pass of the raw counts, in the reading thread
+  int _emulated_counts = 1;
+
+  // Offset calibration, spread over several process() cycles
+  int _offset_samples = 40;
+  int _offset_test_samples = 20;
+  OffsetCalibration<1> _calibration;
+
+  // Binary mode
+  bool _binary_mode = false;
+  sample_frame::Side _frame_side = sample_frame::Side::unknown;
+  uint32_t _sequence = 0; // sequence number of the next sample, reset at every start
+  json _frame_descriptor;
+
+  // Multi-sample frames
+  int _samples_per_frame = 1;
+  int _frame_samples = 0; // readings in the current, not yet sent, frame
+  vector<unsigned char> _frame_buffer; // binary frame being filled
+  vector<float> _frame_force; // json frame being filled
+  vector<uint64_t> _frame_t_us;
+
+  // Acquisition thread
+  bool _acquisition_thread = false;
+  int _thread_priority = 0;
+  int _thread_cpu = -1;
+  SpscRing<Sample> _samples{256}; // producer: acquisition thread, consumer: process()
+  thread _acquisition;
+  std::atomic<bool> _acquiring{false};
+  std::atomic<uint64_t> _overruns{0}; // samples lost because the ring was full
+  std::mutex _acquisition_mutex;
+  string _acquisition_error; // guarded by _acquisition_mutex
+
+  // Latency histograms, compiled in with -DPERF_INSTRUMENTATION
+  perf::Histogram _perf_read;    // read_load_cell(), including the wait for the conversion
+  perf::Histogram _perf_json;    // add_sample(), frame and json building
+  perf::Histogram _perf_process; // process()
+  perf::Report _perf{{"sensor_read", &_perf_read}, {"json", &_perf_json}, {"process", &_perf_process}};
   
 };
 
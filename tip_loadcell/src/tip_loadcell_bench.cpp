@@ -0,0 +1,37 @@
+/*
+  ____                  _
+ | __ )  ___ _ __   ___| |__
+ |  _ \ / _ \ '_ \ / __| '_ \
+ | |_) |  __/ | | | (__| | | |
+ |____/ \___|_| |_|\___|_| |_|
+
+Per-message cost of tip_loadcell: process() at 200 Hz while recording, with
+the heartbeats of the coordinator, see common/bench.hpp
+*/
+#define main tip_loadcell_main
+#include "tip_loadcell.cpp"
+#undef main
+
+#include <bench.hpp>
+
+int main(int argc, char const *argv[]) {
+  bench::Bench bench("tip_loadcell", argc, argv, {
+    {"side", "left"},
+    {"health_status_period", 500},
+    {"samples_per_frame", 1},
+    {"scaling", {{"left", 5.5933}, {"right", 5.5891}}}
+  });
+
+  Tip_loadcellPlugin plugin;
+  plugin.set_params(bench.params());
+  bench.once("start", [&] { plugin.load_data({{"command", "start"}, {"id", 1}}, "coordinator"); });
+
+  bench.tick("process", 200.0);
+  bench.stream("coordinator", 2.0, [](uint64_t, bench::Message &m) {
+    bench::heartbeat(m, "coordinator", "recording");
+  });
+  bench.run(plugin);
+
+  bench.once("stop", [&] { plugin.load_data({{"command", "stop"}}, "coordinator"); });
+  return 0;
+}
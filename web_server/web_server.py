@@ -23,6 +23,7 @@ import numpy as np
 import uvicorn
 from dateutil import parser as date_parser
 import zipfile
+import shutil
 import tempfile
 
 # Initialize MADS agent
@@ -94,6 +95,62 @@ def init_mads_agent():
         return False
 
 
+def add_status_payload(payload):
+    """Add a single status entry to the message buffer and to the per-source state"""
+    global status_messages, status_state
+
+    # Ensure timestamp exists
+    if isinstance(payload, dict) and "timestamp" not in payload:
+        payload["timestamp"] = datetime.now().isoformat()
+
+    # Extract side from source if present (e.g., "tip_loadcell_left" -> side="left")
+    source = payload.get("source", "system")
+    side = extract_side_from_source(source)
+    if side and "side" not in payload:
+        payload["side"] = side
+    payload_side = str(payload.get("side", side) or "").lower()
+
+    status_messages.append(payload)
+    print(f"✓ Status message added to buffer. Total messages: {len(status_messages)}")
+    print(f"✓ Payload: {payload}")
+
+    # Update status state - track last status for each source
+    source_key = get_status_source_key(source)
+    current_message = payload.get("message", "")
+    is_offset_message = bool(current_message and "offset test:" in current_message.lower())
+
+    # Preserve last offset message across status updates
+    old_state = status_state.get(source_key, {})
+    old_offset_msg = old_state.get("last_offset_message", "")
+    old_offset_ts = old_state.get("last_offset_timestamp")
+
+    status_state[source_key] = {
+        "source": source,
+        "side": payload_side,
+        "level": payload.get("level", "info"),
+        "message": current_message,
+        "status": payload.get("status", ""),
+        "timestamp": payload.get("timestamp")
+    }
+
+    # Keep last_offset_message alive if current message is offset, or preserve old one
+    if is_offset_message:
+        status_state[source_key]["last_offset_message"] = current_message
+        status_state[source_key]["last_offset_timestamp"] = payload.get("timestamp")
+    elif old_offset_msg:
+        status_state[source_key]["last_offset_message"] = old_offset_msg
+        status_state[source_key]["last_offset_timestamp"] = old_offset_ts
+
+    battery_info = parse_battery_info(payload)
+    if battery_info:
+        status_state[source_key].update(battery_info)
+    print(f"✓ Status state updated: {source_key} = {status_state[source_key]}")
+
+    # Keep only last 100 messages
+    if len(status_messages) > 100:
+        status_messages.pop(0)
+
+
 def check_status_messages():
     """Check for incoming status messages from error_handler (non-blocking)"""
     global mads_agent, status_messages, status_state
@@ -108,6 +165,7 @@ def check_status_messages():
             #print(f"Received message on topic '{topic}': {message}")
             if topic == "status":
                 # Extract status payload from nested structure
+                # (status_handler with batch_status = true sends all the pending statuses as one array)
                 if isinstance(message, dict) and "status" in message:
                     payload = message["status"]
                 elif isinstance(message, dict):
@@ -118,57 +176,9 @@ def check_status_messages():
                         "level": "info",
                         "message": str(message)
                     }
-                
-                # Ensure timestamp exists
-                if isinstance(payload, dict) and "timestamp" not in payload:
-                    payload["timestamp"] = datetime.now().isoformat()
-                
-                # Extract side from source if present (e.g., "tip_loadcell_left" -> side="left")
-                source = payload.get("source", "system")
-                side = extract_side_from_source(source)
-                if side and "side" not in payload:
-                    payload["side"] = side
-                payload_side = str(payload.get("side", side) or "").lower()
-                    
-                status_messages.append(payload)
-                print(f"✓ Status message added to buffer. Total messages: {len(status_messages)}")
-                print(f"✓ Payload: {payload}")
-                
-                # Update status state - track last status for each source
-                source_key = get_status_source_key(source)
-                current_message = payload.get("message", "")
-                is_offset_message = bool(current_message and "offset test:" in current_message.lower())
-                
-                # Preserve last offset message across status updates
-                old_state = status_state.get(source_key, {})
-                old_offset_msg = old_state.get("last_offset_message", "")
-                old_offset_ts = old_state.get("last_offset_timestamp")
-                
-                status_state[source_key] = {
-                    "source": source,
-                    "side": payload_side,
-                    "level": payload.get("level", "info"),
-                    "message": current_message,
-                    "status": payload.get("status", ""),
-                    "timestamp": payload.get("timestamp")
-                }
-                
-                # Keep last_offset_message alive if current message is offset, or preserve old one
-                if is_offset_message:
-                    status_state[source_key]["last_offset_message"] = current_message
-                    status_state[source_key]["last_offset_timestamp"] = payload.get("timestamp")
-                elif old_offset_msg:
-                    status_state[source_key]["last_offset_message"] = old_offset_msg
-                    status_state[source_key]["last_offset_timestamp"] = old_offset_ts
-
-                battery_info = parse_battery_info(payload)
-                if battery_info:
-                    status_state[source_key].update(battery_info)
-                print(f"✓ Status state updated: {source_key} = {status_state[source_key]}")
-                
-                # Keep only last 100 messages
-                if len(status_messages) > 100:
-                    status_messages.pop(0)
+
+                for item in (payload if isinstance(payload, list) else [payload]):
+                    add_status_payload(item)
     except Exception as e:
         print(f"Error receiving status message: {e}", file=sys.stderr)
 
@@ -283,7 +293,10 @@ def load_index():
 
 def save_index(acq_dict):
     ensure_data_dir()
-    INDEX_FILE.write_text(json.dumps({"acquisitions": list(acq_dict.values())}))
+    # write a temporary file and rename it, so that a power loss never leaves a truncated index
+    tmp_file = INDEX_FILE.with_suffix(".json.tmp")
+    tmp_file.write_text(json.dumps({"acquisitions": list(acq_dict.values())}))
+    os.replace(tmp_file, INDEX_FILE)
 
 
 def compute_next_id(acq_dict):
@@ -303,6 +316,24 @@ def data_file_path(acq_id: str) -> Path:
     return DATA_DIR / f"{acq_id}.h5"
 
 
+def live_file_path(acq_id: str) -> Path:
+    """File of an acquisition being recorded: hdf5_writer renames it on stop."""
+    path = data_file_path(acq_id)
+    if not path.exists() and (DATA_DIR / f"_{acq_id}.h5").exists():
+        return DATA_DIR / f"_{acq_id}.h5"
+    return path
+
+
+def open_hdf5(path: Path):
+    """Open an HDF5 file for reading, in SWMR mode when hdf5_writer may still be writing it."""
+    if path.name.startswith("_"):
+        try:
+            return h5py.File(path, 'r', libver='latest', swmr=True)
+        except OSError:
+            pass  # not in SWMR mode (yet): the writer reopens it while creating a dataset
+    return h5py.File(path, 'r')
+
+
 def send_mads_command(command: str, acq_id: str = None, datetime_to_set: str = None):
     """Send command via MADS agent to ws_command topic"""
     global mads_agent
@@ -340,10 +371,14 @@ async def send_mads_command_async(command: str, acq_id: str = None, datetime_to_
     return await loop.run_in_executor(None, send_mads_command, command, acq_id, datetime_to_set)
 
 
+# values of the side enum written by hdf5_writer
+SIDE_CODES = {0: 'unknown', 1: 'left', 2: 'right'}
+
+
 def read_hdf5_data(file_path: Path):
     """Read HDF5 file with loadcell data and convert timestamps to relative seconds."""
     try:
-        with h5py.File(file_path, 'r') as f:
+        with open_hdf5(file_path) as f:
             result = {}
             
             # Check for new unified format: /tip_loadcell/{force, side, timestamp}
@@ -353,9 +388,11 @@ def read_hdf5_data(file_path: Path):
                 side_data = f['/tip_loadcell/side'][:]
                 timestamp_data = f['/tip_loadcell/timestamp'][:]
                 
-                # Decode side strings if they are bytes
+                # Decode side strings if they are bytes, or the side enum codes of hdf5_writer
                 if len(side_data) > 0 and isinstance(side_data[0], bytes):
                     side_data = [s.decode('utf-8') for s in side_data]
+                elif side_data.dtype.kind in 'iu':
+                    side_data = [SIDE_CODES.get(int(s), 'unknown') for s in side_data]
                 
                 # Decode timestamp strings if they are bytes
                 if len(timestamp_data) > 0 and isinstance(timestamp_data[0], bytes):
@@ -405,6 +442,49 @@ def read_hdf5_data(file_path: Path):
         raise HTTPException(status_code=500, detail=f"Error reading HDF5 file: {str(e)}")
 
 
+# points of a plot read from the /summary pyramid written by hdf5_writer
+SUMMARY_MAX_POINTS = 4000
+
+
+def read_hdf5_summary(file_path: Path, max_points: int = SUMMARY_MAX_POINTS):
+    """Read the tip force of each side from the /summary min/max pyramid written by hdf5_writer on stop.
+
+    Returns the same structure as read_hdf5_data, with a min and a max point per
+    window of the finest level that fits in max_points, or None if the file has no summary.
+    """
+    with open_hdf5(file_path) as f:
+        sides = {}
+        for side in ('left', 'right'):
+            path = f'/summary/tip_loadcell/{side}'
+            if path in f and 'force' in f[path] and 'duration' in f[path].attrs:
+                sides[side] = f[path]
+        if not sides:
+            return None
+
+        start_ms = min(int(g.attrs['first_timestamp_ms'][0]) for g in sides.values())
+        decimation = [int(d) for d in f['/summary'].attrs['decimation']]
+        result = {"samples": 0, "summary": True}
+        for side, group in sides.items():
+            force = group['force']
+            rows = int(force.attrs['rows'][0])
+            result["samples"] += rows
+            # finest level whose min and max points fit in the plot
+            level = next((d for d in decimation if 2 * force[f'min_{d}'].shape[0] <= max_points), decimation[-1])
+            mins = force[f'min_{level}'][:]
+            maxs = force[f'max_{level}'][:]
+            # windows are spread evenly over the duration of the side
+            offset_s = (int(group.attrs['first_timestamp_ms'][0]) - start_ms) / 1000.0
+            window_s = float(group.attrs['duration'][0]) * level / max(rows, 1)
+            values, ts = [], []
+            for k in range(len(mins)):
+                t = offset_s + k * window_s
+                values += [float(mins[k]), float(maxs[k])]
+                ts += [t, t + window_s / 2]
+            result[side] = values
+            result[f"ts_{side}"] = ts
+        return result
+
+
 def generate_mock_data(num_samples: int):
     """Generate mock data for testing when no HDF5 file exists."""
     timestamps = [i * 0.01 for i in range(num_samples)]  # 100 Hz sampling
@@ -921,7 +1001,7 @@ async def get_acquisition_file_info(acquisition_id: str):
         raise HTTPException(status_code=404, detail=f"Acquisition {acquisition_id} not found")
     
     acq = acquisitions[acquisition_id]
-    path = data_file_path(acquisition_id)
+    path = live_file_path(acquisition_id)
     
     if not path.exists():
         return {
@@ -950,8 +1030,11 @@ async def get_acquisition_file_info(acquisition_id: str):
 
 
 @app.get("/acquisitions/{acquisition_id}")
-async def get_acquisition_data(acquisition_id: str):
-    """Return numeric data for plotting and metadata including conditions."""
+async def get_acquisition_data(acquisition_id: str, full: bool = False):
+    """Return numeric data for plotting and metadata including conditions.
+
+    Completed acquisitions are read from their /summary pyramid, unless full is set.
+    """
     if acquisition_id not in acquisitions:
         raise HTTPException(status_code=404, detail=f"Acquisition {acquisition_id} not found")
     
@@ -966,10 +1049,17 @@ async def get_acquisition_data(acquisition_id: str):
     # Calculate body weight force in Newtons (weight_kg * 9.81 m/s²)
     body_weight_n = body_weight_kg * 9.81 if body_weight_kg else None
     
-    # If HDF5 data file exists, read it
-    path = data_file_path(acquisition_id)
+    # If HDF5 data file exists, read it, also while it is recorded
+    path = live_file_path(acquisition_id)
     if path.exists():
-        hdf5_data = read_hdf5_data(path)
+        hdf5_data = None
+        if not full and path == data_file_path(acquisition_id):
+            try:
+                hdf5_data = read_hdf5_summary(path)
+            except Exception as e:
+                print(f"Warning: Could not read HDF5 summary: {e}", file=sys.stderr)
+        if hdf5_data is None:
+            hdf5_data = read_hdf5_data(path)
         response_data = {
             "acquisition_id": acquisition_id,
             "status": acq.get("status", "completed"),
@@ -979,7 +1069,8 @@ async def get_acquisition_data(acquisition_id: str):
             "conditions": acq.get("conditions", []),
             "comments": acq.get("comments", []),
             "body_weight_kg": body_weight_kg,
-            "body_weight_n": body_weight_n
+            "body_weight_n": body_weight_n,
+            "summary": hdf5_data.get("summary", False)
         }
         
         # Convert data from Newton to % of body weight if body weight is available
@@ -1021,6 +1112,82 @@ async def get_acquisition_data(acquisition_id: str):
     }
 
 
+# Columns of the /aligned/matrix dataset written by the aligner agent: tip and
+# handle channels of each side, the handle channels at the position of their
+# label in the handle_labels setting of the aligner, the same on both sides
+# (0 for a channel not connected); keep the two lists identical
+HANDLE_LABELS = ["down_back", "down_front", "ext_back", "ext_front", "int_back", "int_front", "up_back", "up_front"]
+ALIGNED_LEFT_TIP = 0
+ALIGNED_RIGHT_TIP = 1 + len(HANDLE_LABELS)
+
+
+def read_aligned_matrix(f):
+    """Return (t_ns, matrix) from the /aligned group, or None if the file has no aligned data"""
+    if '/aligned/t_us' not in f or '/aligned/matrix' not in f:
+        return None
+    t_us = f['/aligned/t_us'][:]
+    matrix = f['/aligned/matrix'][:]
+    if len(t_us) == 0 or len(t_us) != len(matrix):
+        return None
+    return (t_us.astype('int64') * 1000), matrix
+
+
+# command-line exporter installed with hdf5_writer, see hdf5_writer/README.md
+H5EXPORT = os.environ.get("H5EXPORT") or shutil.which("h5export")
+
+
+async def h5export_csv_response(path: Path, group: str, dataset: str, filename: str, *options):
+    """Stream the CSV of a per-side dataset written by h5export, without blocking the worker.
+
+    Returns None if h5export is not installed or the file has no such data, so that the caller falls back to Python.
+    """
+    if not H5EXPORT:
+        return None
+    try:
+        proc = await asyncio.create_subprocess_exec(
+            H5EXPORT, str(path), group, dataset, *options,
+            stdout=asyncio.subprocess.PIPE, stderr=asyncio.subprocess.DEVNULL)
+    except OSError as e:
+        print(f"Warning: Could not run h5export: {e}", file=sys.stderr)
+        return None
+    first = await proc.stdout.read(65536)
+    if not first:
+        await proc.wait()
+        return None
+
+    async def stream():
+        try:
+            chunk = first
+            while chunk:
+                yield chunk
+                chunk = await proc.stdout.read(65536)
+        finally:
+            if proc.returncode is None:
+                proc.kill()
+            await proc.wait()
+
+    return StreamingResponse(
+        stream(),
+        media_type="text/csv",
+        headers={"Content-Disposition": f"attachment; filename={filename}"}
+    )
+
+
+def aligned_csv_response(header, t_ns, columns, filename):
+    """Stream a CSV with one row per aligned time"""
+    output = io.StringIO()
+    writer = csv.writer(output)
+    writer.writerow(header)
+    for i in range(len(t_ns)):
+        writer.writerow([int(t_ns[i])] + [f"{column[i]:.2f}" for column in columns])
+    output.seek(0)
+    return StreamingResponse(
+        iter([output.getvalue()]),
+        media_type="text/csv",
+        headers={"Content-Disposition": f"attachment; filename={filename}"}
+    )
+
+
 @app.get("/download/force/{acquisition_id}")
 async def download_force_csv(acquisition_id: str):
     """Download force data as CSV: timestamp (ns epoch), left (N), right (N)"""
@@ -1040,6 +1207,25 @@ async def download_force_csv(acquisition_id: str):
     if not path.exists():
         raise HTTPException(status_code=404, detail=f"Data file not found for {acquisition_id}")
     
+    filename = f"subject_{subject_id}_session_{session_id}_acq_{acq_num}_tip_force.csv"
+
+    # Aligned by the aligner agent at recording time: a straight dataset read
+    try:
+        with h5py.File(path, 'r') as f:
+            aligned = read_aligned_matrix(f)
+    except Exception as e:
+        raise HTTPException(status_code=500, detail=f"Failed to read HDF5 file: {str(e)}")
+    if aligned is not None:
+        t_ns, matrix = aligned
+        return aligned_csv_response(['timestamp_ns', 'left_crutch_N', 'right_crutch_N'], t_ns,
+                                    [matrix[:, ALIGNED_LEFT_TIP], matrix[:, ALIGNED_RIGHT_TIP]], filename)
+
+    # Layout of hdf5_writer (per side or with the side enum): merged by the native exporter
+    response = await h5export_csv_response(path, 'tip_loadcell', 'force', filename,
+                                           '--header', 'timestamp_ns,left_crutch_N,right_crutch_N')
+    if response is not None:
+        return response
+
     # Read raw data with absolute timestamps in milliseconds
     try:
         with h5py.File(path, 'r') as f:
@@ -1131,7 +1317,6 @@ async def download_force_csv(acquisition_id: str):
     
     output.seek(0)
     
-    filename = f"subject_{subject_id}_session_{session_id}_acq_{acq_num}_tip_force.csv"
     return StreamingResponse(
         iter([output.getvalue()]),
         media_type="text/csv",
@@ -1228,6 +1413,29 @@ async def download_handle_force_csv(acquisition_id: str):
     if not path.exists():
         raise HTTPException(status_code=404, detail=f"Data file not found for {acquisition_id}")
     
+    filename = f"subject_{subject_id}_session_{session_id}_acq_{acq_num}_handle_force.csv"
+
+    # Aligned by the aligner agent at recording time: one column per handle channel
+    try:
+        with h5py.File(path, 'r') as f:
+            aligned = read_aligned_matrix(f)
+    except Exception as e:
+        raise HTTPException(status_code=500, detail=f"Failed to read HDF5 file: {str(e)}")
+    if aligned is not None:
+        t_ns, matrix = aligned
+        header = ['timestamp_ns']
+        columns = []
+        for side, first in (('left', ALIGNED_LEFT_TIP + 1), ('right', ALIGNED_RIGHT_TIP + 1)):
+            for c, label in enumerate(HANDLE_LABELS):
+                header.append(f"{side}_{label}_N")
+                columns.append(matrix[:, first + c])
+        return aligned_csv_response(header, t_ns, columns, filename)
+
+    # Layout of hdf5_writer: one column per handle channel, merged by the native exporter
+    response = await h5export_csv_response(path, 'handle_loadcell', 'force', filename, '--suffix', '_N')
+    if response is not None:
+        return response
+
     try:
         with h5py.File(path, 'r') as f:
             has_left = '/handle_loadcell/force.left' in f
@@ -1307,7 +1515,6 @@ async def download_handle_force_csv(acquisition_id: str):
     
     output.seek(0)
     
-    filename = f"subject_{subject_id}_session_{session_id}_acq_{acq_num}_handle_force.csv"
     return StreamingResponse(
         iter([output.getvalue()]),
         media_type="text/csv",
@@ -1518,6 +1725,50 @@ async def download_eye_tracker_csv(acquisition_id: str):
     )
 
 
+def manifest_file_path(acq_id: str) -> Path:
+    """Manifest of the part files of an acquisition, written by hdf5_writer with rollover enabled."""
+    return DATA_DIR / f"{acq_id}.json"
+
+
+@app.get("/download/parts/{acquisition_id}")
+async def get_acquisition_parts(acquisition_id: str):
+    """List the part files of an acquisition: the hdf5_writer manifest, or the single file without rollover"""
+    acquisitions = load_index()
+
+    if acquisition_id not in acquisitions:
+        raise HTTPException(status_code=404, detail=f"Acquisition {acquisition_id} not found")
+
+    manifest_path = manifest_file_path(acquisition_id)
+    if manifest_path.exists():
+        try:
+            manifest = json.loads(manifest_path.read_text())
+        except Exception as e:
+            raise HTTPException(status_code=500, detail=f"Invalid manifest for {acquisition_id}: {e}")
+        return {"acquisition_id": acquisition_id, "complete": manifest.get("complete", False), "parts": manifest.get("parts", [])}
+
+    path = data_file_path(acquisition_id)
+    if not path.exists():
+        raise HTTPException(status_code=404, detail=f"Data file not found for {acquisition_id}")
+    return {"acquisition_id": acquisition_id, "complete": True, "parts": [{"file": path.name, "bytes": path.stat().st_size}]}
+
+
+@app.get("/download/part/{acquisition_id}/{part}")
+async def download_acquisition_part(acquisition_id: str, part: int):
+    """Download a closed part file of an acquisition, 0 being acq_<id>.h5"""
+    acquisitions = load_index()
+
+    if acquisition_id not in acquisitions:
+        raise HTTPException(status_code=404, detail=f"Acquisition {acquisition_id} not found")
+    if part < 0:
+        raise HTTPException(status_code=400, detail="Part must be 0 or more")
+
+    path = data_file_path(acquisition_id) if part == 0 else DATA_DIR / f"{acquisition_id}_part{part}.h5"
+    if not path.exists():
+        raise HTTPException(status_code=404, detail=f"Part {part} not found for {acquisition_id}")
+
+    return FileResponse(path, media_type="application/x-hdf5", filename=path.name)
+
+
 @app.get("/download/available-sensors/{acquisition_id}")
 async def get_available_sensors(acquisition_id: str):
     """Get list of available sensors for an acquisition from HDF5 file"""
@@ -1537,11 +1788,11 @@ async def get_available_sensors(acquisition_id: str):
     try:
         with h5py.File(path, 'r') as f:
             # Check for tip_loadcell
-            if '/tip_loadcell/force.left' in f or '/tip_loadcell/force.right' in f or '/loadcell/left' in f or '/loadcell/right' in f:
+            if '/tip_loadcell/force' in f or '/tip_loadcell/force.left' in f or '/tip_loadcell/force.right' in f or '/loadcell/left' in f or '/loadcell/right' in f or '/aligned/matrix' in f:
                 sensors["tip_force"] = True
             
             # Check for handle_loadcell
-            if '/handle_loadcell/force.left' in f or '/handle_loadcell/force.right' in f:
+            if '/handle_loadcell/force' in f or '/handle_loadcell/force.left' in f or '/handle_loadcell/force.right' in f or '/aligned/matrix' in f:
                 sensors["handle_force"] = True
             
             # Check for PPG (cardiac_frequency)
@@ -1579,9 +1830,9 @@ async def download_sensors_bundle(acquisition_id: str):
     sensors = {"info": True}
     try:
         with h5py.File(path, 'r') as f:
-            if '/tip_loadcell/force.left' in f or '/tip_loadcell/force.right' in f or '/loadcell/left' in f or '/loadcell/right' in f:
+            if '/tip_loadcell/force' in f or '/tip_loadcell/force.left' in f or '/tip_loadcell/force.right' in f or '/loadcell/left' in f or '/loadcell/right' in f or '/aligned/matrix' in f:
                 sensors["tip_force"] = True
-            if '/handle_loadcell/force.left' in f or '/handle_loadcell/force.right' in f:
+            if '/handle_loadcell/force' in f or '/handle_loadcell/force.left' in f or '/handle_loadcell/force.right' in f or '/aligned/matrix' in f:
                 sensors["handle_force"] = True
             if '/ppg' in f or '/cardiac' in f:
                 sensors["cardiac_frequency"] = True